@@ -0,0 +1,57 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * Timing helpers shared by the microbenchmarks in bench/. Each benchmark
+ * is a single source file, so these are defined here as static inline functions
+ * (inline so that a benchmark using only some of them builds cleanly).
+ */
+
+/* Shortest run a measurement is taken from, in seconds */
+#define BENCH_MIN_SECONDS 0.5
+
+/**
+ * @brief Work to be timed: runs the operation the given number of times
+ */
+typedef void (*bench_function)(void* context, size_t iterations);
+
+/* Results are added here so the compiler cannot drop the work being timed */
+static volatile size_t bench_sink;
+
+/**
+ * @brief Reads a monotonic clock
+ *
+ * @return Seconds since an arbitrary point
+ */
+static inline double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Times an operation
+ *
+ * Runs it once to warm up, then with doubling iteration counts until one
+ * run takes at least BENCH_MIN_SECONDS.
+ *
+ * @param function Runs the operation
+ * @param context Passed to the function
+ * @return Seconds per iteration
+ */
+static inline double bench_measure(bench_function function, void* context) {
+    function(context, 1);
+    for (size_t iterations = 1;; iterations *= 2) {
+        double start = bench_now();
+        function(context, iterations);
+        double elapsed = bench_now() - start;
+        if (elapsed >= BENCH_MIN_SECONDS) {
+            return elapsed / (double)iterations;
+        }
+    }
+}
+
+#endif /* BENCH_H */
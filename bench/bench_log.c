@@ -0,0 +1,144 @@
+#include "bench.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * This file contains the logger benchmark: a thread calling LOG_DEBUG() and
+ * LOG_INFO(), with the runtime level at debug, info and off. Each level is
+ * measured twice:
+ *
+ *   - in batches small enough for the caller's ring, waiting for the writer
+ *     thread between batches (untimed), which is what a call costs a worker
+ *     when nothing is dropped;
+ *   - flat out for a second, which shows how many records per second the
+ *     writer thread gets to the output and how many are dropped once the
+ *     caller outruns it.
+ *
+ * The records go to a scratch file (stdout is redirected to it) so the
+ * written ones can be counted; the results are printed on the original
+ * stdout.
+ */
+
+/* Iterations per batch; two records each must fit in LOG_RING_SIZE */
+#define BATCH 1024
+
+/* Timed batch time per level, in seconds */
+#define BATCH_SECONDS 0.2
+
+/* Length of the flat-out run, in seconds */
+#define FLOOD_SECONDS 1.0
+
+/**
+ * @brief A runtime level to measure
+ */
+typedef struct {
+    const char* name;
+    int level;
+    size_t records_per_call;  /**< Records each iteration produces at this level */
+} level_case;
+
+/**
+ * @brief Logs what a worker logs around a request, the given number of times
+ */
+static void log_requests(size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        LOG_DEBUG("Request complete, handling connection (fd=%d)...\n", (int)(i & 1023));
+        LOG_INFO("GET %s 200 %zu bytes\n", "/photos/2024/summer/IMG_4821.jpg", i);
+    }
+}
+
+/**
+ * @brief Counts the records in the output from an offset on
+ *
+ * The writer reports drops as "[WARNING] Log buffer full, N records
+ * dropped" lines, which are summed separately.
+ *
+ * @return The offset just past the last byte read
+ */
+static long count_records(const char* path, long offset, size_t* written, size_t* dropped) {
+    FILE* file = fopen(path, "r");
+    char line[LOG_MAX_RECORD + 2];
+    size_t count;
+
+    *written = 0;
+    *dropped = 0;
+    if (!file || fseek(file, offset, SEEK_SET) != 0) {
+        if (file) {
+            fclose(file);
+        }
+        return offset;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "[WARNING] Log buffer full, %zu records dropped", &count) == 1) {
+            *dropped += count;
+        } else {
+            (*written)++;
+        }
+    }
+    offset = ftell(file);
+    fclose(file);
+    return offset;
+}
+
+int main(void) {
+    char path[] = "/tmp/bench_log.XXXXXX";
+    int fd = mkstemp(path);
+    FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+    if (fd < 0 || !report || !freopen(path, "w", stdout)) {
+        perror("bench_log");
+        return 1;
+    }
+    close(fd);
+
+    if (log_init(LOG_LEVEL_DEBUG) != 0) {
+        fprintf(report, "log_init failed\n");
+        return 1;
+    }
+
+    static const level_case levels[] = {
+        { "debug", LOG_LEVEL_DEBUG, 2 },
+        { "info", LOG_LEVEL_INFO, 1 },
+        { "off", LOG_LEVEL_OFF, 0 },
+    };
+    fprintf(report, "One LOG_DEBUG() and one LOG_INFO() per iteration\n");
+    fprintf(report, "%-6s %18s %22s %26s\n", "level", "batched", "flat out, written", "flat out, dropped");
+    long offset = 0;
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        log_level_threshold = levels[i].level;
+        size_t written, dropped;
+
+        // Batches the ring can hold, drained before the next one
+        double batched = 0;
+        size_t batches = 0;
+        while (batched < BATCH_SECONDS) {
+            double start = bench_now();
+            log_requests(BATCH);
+            batched += bench_now() - start;
+            batches++;
+            log_flush();
+        }
+        fflush(stdout);
+        offset = count_records(path, offset, &written, &dropped);
+
+        double start = bench_now();
+        size_t iterations = 0;
+        do {
+            log_requests(BATCH);
+            iterations += BATCH;
+        } while (bench_now() - start < FLOOD_SECONDS);
+        double flood = bench_now() - start;
+        log_flush();
+        fflush(stdout);
+        offset = count_records(path, offset, &written, &dropped);
+
+        fprintf(report, "%-6s %7.1f ns/iteration %12.0f records/s %10zu of %10zu\n",
+                levels[i].name, batched / (double)(batches * BATCH) * 1e9, (double)written / flood,
+                dropped, iterations * levels[i].records_per_call);
+    }
+
+    unlink(path);
+    return 0;
+}
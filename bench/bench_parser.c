@@ -0,0 +1,126 @@
+#include "bench.h"
+#include "http_parser.h"
+#include "http_scan.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * This file contains the request parser microbenchmark: requests/s that
+ * http_parse_request() gets through for request heads like the ones
+ * browsers send, parsed in one call and incrementally, as if the head had
+ * arrived in small reads.
+ */
+
+/* Bytes per read in the incremental runs */
+#define READ_SIZE 100
+
+/**
+ * @brief A request head to parse
+ */
+typedef struct {
+    const char* name;  /**< Label for the output */
+    const char* head;  /**< The request head */
+    size_t length;     /**< Its length */
+    size_t read_size;  /**< Bytes made available per call (0 for the whole head at once) */
+} parser_case;
+
+static const char chrome_page[] =
+    "GET /docs/reference/index.html HTTP/1.1\r\n"
+    "Host: files.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,"
+    "*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Referer: http://files.example.com/docs/reference/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,pt-BR;q=0.8,pt;q=0.7\r\n"
+    "If-None-Match: \"a1b2c3-4d2-65f0e1a2\"\r\n"
+    "If-Modified-Since: Tue, 12 Mar 2024 18:21:04 GMT\r\n"
+    "\r\n";
+
+static const char firefox_image[] =
+    "GET /photos/2024/summer/IMG_4821.jpg HTTP/1.1\r\n"
+    "Host: files.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://files.example.com/photos/2024/summer/\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Range: bytes=0-\r\n"
+    "\r\n";
+
+static const char curl_file[] =
+    "GET /releases/httpfileserv-1.0.tar.gz HTTP/1.1\r\n"
+    "Host: files.example.com\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static const http_parser_limits limits = { 8192, 100, 8192 };
+
+/**
+ * @brief Parses a request head the given number of times
+ */
+static void parse_head(void* context, size_t iterations) {
+    const parser_case* test = context;
+    http_request request;
+
+    for (size_t i = 0; i < iterations; i++) {
+        http_request_init(&request);
+        http_parse_result result = HTTP_PARSE_INCOMPLETE;
+        if (test->read_size == 0) {
+            result = http_parse_request(&request, test->head, test->length, &limits);
+        } else {
+            // Each call sees READ_SIZE more bytes, like a request read in pieces
+            for (size_t available = 0; result == HTTP_PARSE_INCOMPLETE && available < test->length;) {
+                available += test->read_size;
+                if (available > test->length) {
+                    available = test->length;
+                }
+                result = http_parse_request(&request, test->head, available, &limits);
+            }
+        }
+        bench_sink += request.header_count + (size_t)result;
+    }
+}
+
+int main(void) {
+    parser_case cases[] = {
+        { "chrome page", chrome_page, sizeof(chrome_page) - 1, 0 },
+        { "chrome page, 100 B reads", chrome_page, sizeof(chrome_page) - 1, READ_SIZE },
+        { "firefox image", firefox_image, sizeof(firefox_image) - 1, 0 },
+        { "firefox image, 100 B reads", firefox_image, sizeof(firefox_image) - 1, READ_SIZE },
+        { "curl", curl_file, sizeof(curl_file) - 1, 0 },
+    };
+
+    http_scan_init();
+    printf("http_parse_request, %s kernels\n", http_scan_implementation());
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        // Make sure the case parses before timing it
+        http_request request;
+        http_request_init(&request);
+        if (http_parse_request(&request, cases[i].head, cases[i].length, &limits) != HTTP_PARSE_COMPLETE) {
+            fprintf(stderr, "%s: does not parse\n", cases[i].name);
+            return 1;
+        }
+
+        double seconds = bench_measure(parse_head, &cases[i]);
+        printf("%-28s %5zu B %3zu headers %12.0f requests/s %8.1f ns/request %8.1f MB/s\n",
+               cases[i].name, cases[i].length, request.header_count, 1.0 / seconds, seconds * 1e9,
+               (double)cases[i].length / seconds / (1024.0 * 1024.0));
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "bench.h"
+#include "http_parser.h"
+#include "http_scan.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * This file contains the scanning kernel benchmark: each http_scan_*
+ * function with every implementation the CPU can run, over 200-byte and
+ * 4 KB runs, followed by whole request heads of those sizes parsed with
+ * each implementation. The short runs show whether the SIMD kernels pay
+ * off on the typical small request; the long ones, a head with a large
+ * cookie, are where they are expected to.
+ */
+
+/* The two block sizes */
+static const size_t block_sizes[] = { 200, 4096 };
+
+/* Every implementation, slowest first */
+static const char* const implementations[] = { "scalar", "sse4.2", "avx2" };
+
+/**
+ * @brief A kernel applied to a buffer
+ */
+typedef struct {
+    size_t (*scan)(const char* data, size_t length);
+    const char* data;
+    size_t length;
+} scan_case;
+
+/**
+ * @brief A request head parsed whole
+ */
+typedef struct {
+    const char* head;
+    size_t length;
+} parse_case;
+
+static const http_parser_limits limits = { 8192, 100, 8192 };
+
+static void run_scan(void* context, size_t iterations) {
+    const scan_case* test = context;
+    for (size_t i = 0; i < iterations; i++) {
+        bench_sink += test->scan(test->data, test->length);
+    }
+}
+
+static void run_parse(void* context, size_t iterations) {
+    const parse_case* test = context;
+    http_request request;
+    for (size_t i = 0; i < iterations; i++) {
+        http_request_init(&request);
+        bench_sink += (size_t)http_parse_request(&request, test->head, test->length, &limits);
+    }
+}
+
+/**
+ * @brief Fills a buffer by repeating a pattern
+ */
+static void fill(char* buffer, size_t length, const char* pattern) {
+    size_t pattern_length = strlen(pattern);
+    for (size_t i = 0; i < length; i++) {
+        buffer[i] = pattern[i % pattern_length];
+    }
+}
+
+/**
+ * @brief Builds a request head of exactly the given length
+ *
+ * A browser-like head whose Cookie header is padded to the length.
+ *
+ * @return 0 on success, non-zero if the length is too short
+ */
+static int make_head(char* buffer, size_t length) {
+    static const char start[] =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: files.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+        "Accept: */*\r\n"
+        "Cookie: ";
+    static const char end[] = "\r\n\r\n";
+    size_t fixed = sizeof(start) - 1 + sizeof(end) - 1;
+    if (length <= fixed) {
+        return 1;
+    }
+    memcpy(buffer, start, sizeof(start) - 1);
+    fill(buffer + sizeof(start) - 1, length - fixed, "session=4f9c2a7e81d3b6; theme=dark; ");
+    memcpy(buffer + length - (sizeof(end) - 1), end, sizeof(end) - 1);
+    return 0;
+}
+
+/**
+ * @brief Prints one measurement
+ */
+static void report(const char* implementation, const char* what, size_t length, double seconds) {
+    printf("%-8s %-14s %5zu B %10.1f ns %8.2f GB/s\n",
+           implementation, what, length, seconds * 1e9, (double)length / seconds / 1e9);
+}
+
+int main(void) {
+    // Runs of each character class, ending just past the buffer
+    char token[4096], target[4096], value[4096], head[4096];
+    fill(token, sizeof(token), "Accept-Encoding");
+    fill(target, sizeof(target), "/photos/2024/summer/IMG_4821.jpg?size=large&v=2");
+    fill(value, sizeof(value), "Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 ");
+
+    printf("Scanning kernels: ns per call, bytes scanned per second\n");
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        if (http_scan_select(implementations[i]) != 0) {
+            printf("%-8s not supported on this CPU or compiler\n", implementations[i]);
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(block_sizes) / sizeof(block_sizes[0]); j++) {
+            size_t length = block_sizes[j];
+            scan_case cases[] = {
+                { http_scan_newline, value, length },
+                { http_scan_token, token, length },
+                { http_scan_target, target, length },
+                { http_scan_field_value, value, length },
+            };
+            static const char* const names[] = { "newline", "token", "target", "field_value" };
+            for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+                report(implementations[i], names[k], length, bench_measure(run_scan, &cases[k]));
+            }
+        }
+    }
+
+    printf("\nWhole request heads through http_parse_request\n");
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        if (http_scan_select(implementations[i]) != 0) {
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(block_sizes) / sizeof(block_sizes[0]); j++) {
+            parse_case test = { head, block_sizes[j] };
+            http_request request;
+            http_request_init(&request);
+            if (make_head(head, test.length) != 0 ||
+                http_parse_request(&request, head, test.length, &limits) != HTTP_PARSE_COMPLETE) {
+                fprintf(stderr, "The %zu byte head does not parse\n", test.length);
+                return 1;
+            }
+            report(implementations[i], "request head", test.length, bench_measure(run_parse, &test));
+        }
+    }
+    return 0;
+}
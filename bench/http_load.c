@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * This file contains the load driver the server benchmarks use
+ * (bench/server_bench.sh).
+ *
+ * Every connection gets a thread of its own that sends one GET at a time
+ * over a keep-alive connection, reads the whole response and sends the
+ * next request, reconnecting whenever the server closes the connection.
+ * After the run it prints the completed requests per second and the body
+ * bytes per second. Responses are expected to carry a Content-Length, which
+ * every file and non-streamed listing response does.
+ */
+
+/* Room for a response head; the server's are far smaller */
+#define HEAD_BUFFER_SIZE 8192
+
+/* Body bytes read per recv() */
+#define BODY_BUFFER_SIZE (256 * 1024)
+
+/* How long to wait for the server to start listening */
+#define CONNECT_ATTEMPTS 100
+#define CONNECT_RETRY_MS 50
+
+/**
+ * @brief Options of a run
+ */
+typedef struct {
+    int port;              /**< Server port on 127.0.0.1 */
+    int connections;       /**< Concurrent connections (one thread each) */
+    int seconds;           /**< Length of the measured run */
+    const char* path;      /**< Request target */
+    int wait_only;         /**< Only wait for the server to listen, then exit */
+} load_options;
+
+/**
+ * @brief Counters of one connection's thread
+ */
+typedef struct {
+    pthread_t thread;
+    unsigned long requests;    /**< Complete 2xx/3xx responses */
+    unsigned long long bytes;  /**< Body bytes of those */
+    unsigned long errors;      /**< Failed connections, error statuses, malformed responses */
+} load_worker;
+
+static load_options options = { 8080, 64, 5, "/", 0 };
+static volatile int stopping;
+static char request[1024];
+static size_t request_length;
+
+/**
+ * @brief Opens a connection to the server
+ *
+ * @return The socket, or -1 on failure
+ */
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)options.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * @brief Sends all of a buffer
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int send_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads one response and discards its body
+ *
+ * @param fd The connection
+ * @param body Scratch buffer of BODY_BUFFER_SIZE bytes
+ * @param status Receives the status code
+ * @param length Receives the body length
+ * @param keep_alive Receives whether the connection stays open
+ * @return 0 on success, -1 if the connection failed or the response is malformed
+ */
+static int read_response(int fd, char* body, int* status, unsigned long long* length, int* keep_alive) {
+    char head[HEAD_BUFFER_SIZE + 1];
+    size_t received = 0;
+    char* end = NULL;
+
+    // Read until the end of the head; the start of the body may come with it
+    while (!end) {
+        if (received == HEAD_BUFFER_SIZE) {
+            return -1;
+        }
+        ssize_t got = recv(fd, head + received, HEAD_BUFFER_SIZE - received, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -1;
+        }
+        received += (size_t)got;
+        head[received] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+
+    if (sscanf(head, "HTTP/1.%*d %d", status) != 1) {
+        return -1;
+    }
+    const char* content_length = strcasestr(head, "\r\nContent-Length:");
+    if (!content_length || content_length > end) {
+        return -1;
+    }
+    *length = strtoull(content_length + 17, NULL, 10);
+    const char* connection = strcasestr(head, "\r\nConnection: close");
+    *keep_alive = !connection || connection > end;
+
+    // Only GETs are sent, so everything after the head is body
+    size_t head_length = (size_t)(end + 4 - head);
+    unsigned long long remaining = *length;
+    unsigned long long already = received - head_length;
+    if (already > remaining) {
+        return -1;
+    }
+    remaining -= already;
+    while (remaining > 0) {
+        size_t want = remaining < BODY_BUFFER_SIZE ? (size_t)remaining : BODY_BUFFER_SIZE;
+        ssize_t got = recv(fd, body, want, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -1;
+        }
+        remaining -= (unsigned long long)got;
+    }
+    return 0;
+}
+
+/**
+ * @brief Connection thread: requests the path until the run stops
+ */
+static void* run_worker(void* arg) {
+    load_worker* worker = arg;
+    char* body = malloc(BODY_BUFFER_SIZE);
+    int fd = -1;
+
+    while (body && !stopping) {
+        if (fd < 0) {
+            fd = connect_server();
+            if (fd < 0) {
+                worker->errors++;
+                continue;
+            }
+        }
+
+        int status = 0;
+        int keep_alive = 0;
+        unsigned long long length = 0;
+        if (send_all(fd, request, request_length) != 0 ||
+            read_response(fd, body, &status, &length, &keep_alive) != 0) {
+            // Not counted as an error: a keep-alive connection the server
+            // closed between requests (--max-requests) ends up here too
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        if (status >= 200 && status < 400) {
+            worker->requests++;
+            worker->bytes += length;
+        } else {
+            worker->errors++;
+        }
+        if (!keep_alive) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(body);
+    return NULL;
+}
+
+/**
+ * @brief Waits until the server accepts connections
+ *
+ * @return 0 once it does, -1 if it never did
+ */
+static int wait_for_server(void) {
+    struct timespec delay = { 0, CONNECT_RETRY_MS * 1000000L };
+    for (int i = 0; i < CONNECT_ATTEMPTS; i++) {
+        int fd = connect_server();
+        if (fd >= 0) {
+            close(fd);
+            return 0;
+        }
+        nanosleep(&delay, NULL);
+    }
+    return -1;
+}
+
+/**
+ * @brief Prints the command line options
+ */
+static void print_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-p PORT] [-c CONNECTIONS] [-d SECONDS] PATH\n", program);
+    fprintf(stderr, "       %s [-p PORT] -w\n", program);
+    fprintf(stderr, "  -p PORT         Server port on 127.0.0.1 (default: 8080)\n");
+    fprintf(stderr, "  -c CONNECTIONS  Concurrent keep-alive connections (default: 64)\n");
+    fprintf(stderr, "  -d SECONDS      Length of the run (default: 5)\n");
+    fprintf(stderr, "  -w              Only wait until the server accepts connections\n");
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:d:w")) != -1) {
+        switch (opt) {
+        case 'p':
+            options.port = atoi(optarg);
+            break;
+        case 'c':
+            options.connections = atoi(optarg);
+            break;
+        case 'd':
+            options.seconds = atoi(optarg);
+            break;
+        case 'w':
+            options.wait_only = 1;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (options.wait_only) {
+        if (optind != argc || options.port <= 0) {
+            print_usage(argv[0]);
+            return 2;
+        }
+        if (wait_for_server() != 0) {
+            fprintf(stderr, "Cannot connect to 127.0.0.1:%d\n", options.port);
+            return 1;
+        }
+        return 0;
+    }
+    if (optind != argc - 1 || options.port <= 0 || options.connections <= 0 || options.seconds <= 0) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    options.path = argv[optind];
+
+    int written = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n"
+                           "User-Agent: http_load\r\nAccept: */*\r\n\r\n", options.path);
+    if (written < 0 || (size_t)written >= sizeof(request)) {
+        fprintf(stderr, "Path too long\n");
+        return 2;
+    }
+    request_length = (size_t)written;
+
+    if (wait_for_server() != 0) {
+        fprintf(stderr, "Cannot connect to 127.0.0.1:%d\n", options.port);
+        return 1;
+    }
+
+    load_worker* workers = calloc((size_t)options.connections, sizeof(load_worker));
+    if (!workers) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // Many connections mean many threads: keep their stacks small
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, 64 * 1024 + HEAD_BUFFER_SIZE);
+
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int started = 0;
+    for (; started < options.connections; started++) {
+        if (pthread_create(&workers[started].thread, &attributes, run_worker, &workers[started]) != 0) {
+            fprintf(stderr, "Started only %d connection threads\n", started);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attributes);
+
+    struct timespec run = { options.seconds, 0 };
+    nanosleep(&run, NULL);
+    stopping = 1;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+
+    unsigned long requests = 0, errors = 0;
+    unsigned long long bytes = 0;
+    for (int i = 0; i < started; i++) {
+        requests += workers[i].requests;
+        bytes += workers[i].bytes;
+        errors += workers[i].errors;
+    }
+    double elapsed = (double)(finish.tv_sec - start.tv_sec) + (double)(finish.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%10.0f req/s %10.1f MB/s %8lu errors\n",
+           (double)requests / elapsed, (double)bytes / elapsed / (1024.0 * 1024.0), errors);
+
+    free(workers);
+    return started == 0 ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+#!/bin/sh
+# Server benchmarks: each scenario starts bin/httpfileserv on a scratch
+# directory with different options and drives it with bin/bench/http_load
+# over loopback. Build both with "make bench" first (the make targets
+# bench-scaling etc. do that and then run this script).
+#
+# Usage: bench/server_bench.sh SCENARIO
+#   scaling   Requests/s for a small file with 1, 2, 4, ... workers up to
+#             the number of cores
+#   sendfile  Throughput for a 256 KB and a 64 MB file with the kernel
+#             sendfile (--sendfile on) and the read/write loop (off)
+#   backends  Requests/s for a small file, a 64 KB file and a directory
+#             listing with --io-backend epoll and --io-backend io_uring
+#
+# Environment:
+#   BENCH_PORT         Port to listen on (default: 8199)
+#   BENCH_SECONDS      Length of each run (default: 5)
+#   BENCH_CONNECTIONS  Concurrent connections (default: 64)
+#   BENCH_MAX_WORKERS  Most workers in the scaling run (default: number of cores)
+#
+# The load driver runs on the same machine and needs CPU time of its own,
+# so the numbers are for comparing configurations, not absolute capacity.
+
+set -e
+
+cd "$(dirname "$0")/.."
+SERVER=bin/httpfileserv
+LOAD=bin/bench/http_load
+PORT=${BENCH_PORT:-8199}
+SECONDS_PER_RUN=${BENCH_SECONDS:-5}
+CONNECTIONS=${BENCH_CONNECTIONS:-64}
+CORES=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+MAX_WORKERS=${BENCH_MAX_WORKERS:-$CORES}
+
+if [ ! -x "$SERVER" ] || [ ! -x "$LOAD" ]; then
+    echo "Build the server and the load driver first: make bench" >&2
+    exit 1
+fi
+
+ROOT=$(mktemp -d)
+SERVER_PID=
+
+cleanup() {
+    stop_server
+    rm -rf "$ROOT" "$ROOT.log"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Files every scenario can request
+make_fixtures() {
+    printf 'hello, world\n' > "$ROOT/small.txt"
+}
+
+# start_server OPTIONS...: serves the scratch directory with the options
+# and returns once the port accepts connections
+start_server() {
+    "$SERVER" "$ROOT" "$PORT" --log-level warning --max-requests 1000000 "$@" > "$ROOT.log" 2>&1 &
+    SERVER_PID=$!
+    if ! "$LOAD" -p "$PORT" -w; then
+        echo "The server did not start (server log: $ROOT.log)" >&2
+        cat "$ROOT.log" >&2
+        exit 1
+    fi
+}
+
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+
+# run_load LABEL PATH: one timed run against the running server
+run_load() {
+    printf '%-28s' "$1"
+    if ! "$LOAD" -p "$PORT" -c "$CONNECTIONS" -d "$SECONDS_PER_RUN" "$2"; then
+        echo "failed (server log: $ROOT.log)"
+        cat "$ROOT.log" >&2
+        exit 1
+    fi
+}
+
+scenario_scaling() {
+    echo "GET /small.txt, $CONNECTIONS connections, ${SECONDS_PER_RUN}s per run, $CORES cores"
+    workers=1
+    while :; do
+        start_server --workers "$workers"
+        run_load "workers $workers" /small.txt
+        stop_server
+        if [ "$workers" -ge "$MAX_WORKERS" ]; then
+            break
+        fi
+        # Powers of two, and the maximum itself
+        workers=$((workers * 2))
+        if [ "$workers" -gt "$MAX_WORKERS" ]; then
+            workers=$MAX_WORKERS
+        fi
+    done
+}
+
+scenario_sendfile() {
+    head -c 262144 /dev/zero > "$ROOT/medium.bin"
+    head -c 67108864 /dev/zero > "$ROOT/large.bin"
+    echo "$CONNECTIONS connections, ${SECONDS_PER_RUN}s per run"
+    for mode in on off; do
+        start_server --sendfile "$mode"
+        run_load "sendfile $mode, 256 KB" /medium.bin
+        run_load "sendfile $mode, 64 MB" /large.bin
+        stop_server
+    done
+}
+
+scenario_backends() {
+    head -c 65536 /dev/zero > "$ROOT/64k.bin"
+    mkdir "$ROOT/dir"
+    i=0
+    while [ "$i" -lt 100 ]; do
+        : > "$ROOT/dir/file-$i.txt"
+        i=$((i + 1))
+    done
+    echo "$CONNECTIONS connections, ${SECONDS_PER_RUN}s per run, 1 worker"
+    for backend in epoll io_uring; do
+        start_server --workers 1 --io-backend "$backend"
+        # The server says so when it has to fall back to epoll
+        if grep -q "not available" "$ROOT.log"; then
+            echo "$backend is not available on this kernel"
+            stop_server
+            continue
+        fi
+        run_load "$backend, small file" /small.txt
+        run_load "$backend, 64 KB file" /64k.bin
+        run_load "$backend, 100-entry listing" /dir/
+        stop_server
+    done
+}
+
+make_fixtures
+case "$1" in
+    scaling) scenario_scaling ;;
+    sendfile) scenario_sendfile ;;
+    backends) scenario_backends ;;
+    *)
+        echo "Usage: $0 scaling|sendfile|backends" >&2
+        exit 2
+        ;;
+esac
@@ -11,6 +11,14 @@ if not exist obj\platform\unix mkdir obj\platform\unix
 echo Setting up Visual Studio environment...
 call "D:\tools\BuildTools\Common7\Tools\VsDevCmd.bat" -no_logo
 
+echo Embedding the directory listing template...
+cl /nologo /W3 /O2 /D_CRT_SECURE_NO_WARNINGS /Foobj\bin2c.obj /Febin\bin2c.exe tools\bin2c.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+bin\bin2c.exe src\directory_template.html obj\directory_template.c directory_template_html
+if %ERRORLEVEL% NEQ 0 goto build_error
+cl /nologo /W3 /O2 /c /Foobj\directory_template.obj obj\directory_template.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
 echo Compiling platform-specific files...
 echo - Windows implementation
 cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\platform\windows\platform_windows.obj src\platform\windows\platform_windows.c
@@ -33,12 +41,72 @@ echo - http_response.c
 cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\http_response.obj src\http_response.c
 if %ERRORLEVEL% NEQ 0 goto build_error
 
+echo - connection.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\connection.obj src\connection.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - http_parser.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\http_parser.obj src\http_parser.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - http_scan.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\http_scan.obj src\http_scan.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - http_range.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\http_range.obj src\http_range.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - http_conditional.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\http_conditional.obj src\http_conditional.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - file_cache.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\file_cache.obj src\file_cache.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - stat_cache.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\stat_cache.obj src\stat_cache.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - listing_cache.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\listing_cache.obj src\listing_cache.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - dir_reader.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\dir_reader.obj src\dir_reader.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - event_loop.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\event_loop.obj src\event_loop.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - server_config.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\server_config.obj src\server_config.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
 echo - template.c
 cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\template.obj src\template.c
 if %ERRORLEVEL% NEQ 0 goto build_error
 
+echo - log.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\log.obj src\log.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - access_log.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\access_log.obj src\access_log.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - metrics.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\metrics.obj src\metrics.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
+echo - fs_pool.c
+cl /nologo /W3 /O2 /I"include" /D_CRT_SECURE_NO_WARNINGS /c /Foobj\fs_pool.obj src\fs_pool.c
+if %ERRORLEVEL% NEQ 0 goto build_error
+
 echo Linking...
-link /NOLOGO /OUT:bin\httpfileserv.exe obj\httpfileserv.obj obj\utils.obj obj\httpfileserv_lib.obj obj\http_response.obj obj\template.obj obj\platform\windows\platform_windows.obj ws2_32.lib
+link /NOLOGO /OUT:bin\httpfileserv.exe obj\httpfileserv.obj obj\utils.obj obj\httpfileserv_lib.obj obj\http_response.obj obj\connection.obj obj\http_parser.obj obj\http_scan.obj obj\http_range.obj obj\http_conditional.obj obj\file_cache.obj obj\stat_cache.obj obj\listing_cache.obj obj\dir_reader.obj obj\event_loop.obj obj\server_config.obj obj\template.obj obj\log.obj obj\access_log.obj obj\metrics.obj obj\fs_pool.obj obj\directory_template.obj obj\platform\windows\platform_windows.obj ws2_32.lib
 if %ERRORLEVEL% NEQ 0 goto build_error
 
 echo Build SUCCESSFUL!
@@ -0,0 +1,73 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "connection.h"
+
+/**
+ * Access log.
+ *
+ * Writes one record per request to a file, in Combined Log Format (with
+ * the response time in microseconds appended, like Apache's %D) or as JSON
+ * lines:
+ *
+ *     127.0.0.1 - - [16/Oct/2026:04:28:00 +0000] "GET /a.txt HTTP/1.1" 200 6 "-" "curl/8.5.0" 183
+ *     {"time":"2026-10-16T04:28:00Z","client":"127.0.0.1","method":"GET","path":"/a.txt",...}
+ *
+ * Like the debug log (log.h), a worker formats the record into a ring
+ * buffer of its own, without a lock or a syscall, and a writer thread
+ * appends what the rings hold to the file with one writev() per pass, so
+ * busy servers write in large chunks. If a ring is full the record is
+ * dropped and counted rather than stalling the worker. On SIGHUP the file
+ * is reopened, so it can be rotated by renaming it and signalling the server.
+ */
+
+/**
+ * Record formats.
+ */
+typedef enum {
+    ACCESS_LOG_COMBINED,  /**< Combined Log Format plus the response time in microseconds */
+    ACCESS_LOG_JSON       /**< One JSON object per line */
+} access_log_format;
+
+/* Bytes of records buffered per worker */
+#define ACCESS_LOG_RING_SIZE (256 * 1024)
+
+/* Longest record; request fields too long for their share of it are cut short */
+#define ACCESS_LOG_MAX_RECORD 4096
+
+/**
+ * Opens the log file and starts the writer thread. Call once at startup,
+ * before any worker threads are started. Without it nothing is logged.
+ *
+ * @param path The file to append to
+ * @param format The record format
+ * @return 0 on success, non-zero on failure
+ */
+int access_log_init(const char* path, access_log_format format);
+
+/**
+ * Checks whether the access log is on.
+ *
+ * @return Non-zero if access_log_init() succeeded
+ */
+int access_log_enabled(void);
+
+/**
+ * Queues the record of a finished (or failed) response: the connection's
+ * request, status, body bytes sent and time since the request was
+ * dispatched. Call before connection_finish_request() resets them.
+ *
+ * @param conn The connection
+ */
+void access_log_request(const http_connection* conn);
+
+/**
+ * Parses a record format name: "combined" or "json".
+ *
+ * @param name The name
+ * @param format Receives the format
+ * @return 0 on success, non-zero if the name is unknown
+ */
+int access_log_parse_format(const char* name, int* format);
+
+#endif /* ACCESS_LOG_H */
@@ -0,0 +1,312 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "platform.h"
+#include "http_parser.h"
+#include <time.h>
+
+/**
+ * Per-connection state for the HTTP file server.
+ *
+ * Each accepted client gets one http_connection. The event loop reads the
+ * request into the connection's input buffer, handle_connection() routes it
+ * and queues the response as a list of output segments, and the event loop
+ * then streams those segments out as the socket becomes writable.
+ */
+
+/* Seconds a stalled response may go without progress before it is dropped */
+#define CONNECTION_SEND_TIMEOUT 60
+
+/* Room for a client address in text form (an IPv6 address included) */
+#define CONNECTION_ADDRESS_SIZE 48
+
+/* Buffer a stream segment's producer fills at a time */
+#define CONNECTION_STREAM_BUFFER_SIZE 16384
+
+/**
+ * Connection states. A connection moves from reading the request, to sending
+ * the response headers, to streaming the body, and finally to closing.
+ */
+typedef enum {
+    CONN_READING_REQUEST,  /**< Waiting for a complete request head */
+    CONN_WAITING_FS,       /**< Being handled on the filesystem pool; the event loop leaves it alone */
+    CONN_SENDING_HEADERS,  /**< Writing the response status line and headers */
+    CONN_SENDING_BODY,     /**< Streaming the response body */
+    CONN_CLOSING           /**< Response done (or failed), connection can be closed */
+} connection_state;
+
+/**
+ * Result of an I/O step on a connection.
+ */
+typedef enum {
+    CONN_IO_DONE,        /**< The step completed */
+    CONN_IO_WOULD_BLOCK, /**< The socket is not ready, wait for the next event */
+    CONN_IO_ERROR        /**< The peer went away or a socket error occurred */
+} connection_io_result;
+
+/**
+ * How a request's filesystem work is done (see fs_pool.h).
+ */
+typedef enum {
+    CONN_FS_INLINE,     /**< On the calling thread, whatever it takes */
+    CONN_FS_ALLOWED,    /**< Work that may block should be handed to the filesystem pool */
+    CONN_FS_REQUESTED,  /**< handle_connection() stopped short of blocking work; hand the request over */
+    CONN_FS_ON_POOL     /**< handle_connection() is running again, on a pool thread */
+} connection_fs_mode;
+
+/**
+ * Output segment types.
+ */
+typedef enum {
+    SEGMENT_MEMORY,  /**< A heap buffer owned by the segment (or borrowed, see release) */
+    SEGMENT_FILE,    /**< A range of an open file, sent with platform_sendfile */
+    SEGMENT_STREAM   /**< Bytes generated on demand by a producer as the socket drains */
+} output_segment_type;
+
+/**
+ * Called when a segment that borrows its data is finished with it (sent,
+ * or dropped with the connection).
+ *
+ * @param context The context passed when the segment was queued
+ */
+typedef void (*segment_release_func)(void* context);
+
+/**
+ * Generates the next piece of a stream segment's data. Called whenever the
+ * previous piece has been sent.
+ *
+ * @param context The context passed when the segment was queued
+ * @param buffer Buffer to fill
+ * @param capacity Size of the buffer (CONNECTION_STREAM_BUFFER_SIZE)
+ * @return Number of bytes written (> 0), 0 when the stream is complete, or -1 on error
+ */
+typedef long (*segment_produce_func)(void* context, char* buffer, size_t capacity);
+
+/**
+ * @brief One piece of a queued response
+ *
+ * Responses are queued as a singly linked list of segments so that headers,
+ * generated HTML and file contents can be streamed without copying them into
+ * one big buffer first.
+ */
+typedef struct output_segment {
+    struct output_segment* next; /**< Next segment in the queue */
+    output_segment_type type;    /**< Segment type */
+    int is_header;               /**< 1 if this segment holds response headers */
+    char* data;                  /**< Memory/stream segment: buffer (owned unless release is set on a memory segment) */
+    size_t length;               /**< Memory/stream segment: buffer length */
+    size_t sent;                 /**< Memory/stream segment: bytes already sent */
+    int file_fd;                 /**< File segment: file descriptor (owned unless release is set) */
+    off_t offset;                /**< File segment: next offset to send */
+    size_t remaining;            /**< File segment: bytes left to send */
+    segment_produce_func produce; /**< Stream segment: fills data with the next piece */
+    segment_release_func release; /**< Called instead of free()/close() for borrowed data (or NULL); always set for streams */
+    void* release_context;       /**< Argument for produce and release */
+} output_segment;
+
+/**
+ * @brief State of a single client connection
+ */
+typedef struct http_connection {
+    int fd;                           /**< Client socket file descriptor */
+    connection_state state;           /**< Current state in the request lifecycle */
+    char* request;                    /**< Raw request bytes (may hold pipelined requests) */
+    size_t request_capacity;          /**< Size of the request buffer (the head size limit) */
+    size_t request_length;            /**< Number of bytes in the request buffer */
+    http_request parsed;              /**< Parser state and slices into the request buffer */
+    http_parse_result parse_result;   /**< Outcome of parsing the current request */
+    output_segment* out_head;         /**< First queued output segment */
+    output_segment* out_tail;         /**< Last queued output segment */
+    int keep_alive;                   /**< 1 if the connection stays open after this response */
+    int head_only;                    /**< 1 while answering HEAD: body segments are discarded */
+    int requests_served;              /**< Responses completed on this connection */
+    int max_requests;                 /**< Requests allowed on this connection (1 disables keep-alive) */
+    time_t last_active;               /**< Time of the last I/O event, for idle timeouts */
+    char client_address[CONNECTION_ADDRESS_SIZE]; /**< Peer address in text form ("-" if unknown) */
+    int status;                       /**< Status code of the current response (0 until its headers are queued) */
+    size_t bytes_sent;                /**< Body bytes of the current response sent so far */
+    long long request_start;          /**< When the current request was dispatched (platform_monotonic_us) */
+    long long first_byte_time;        /**< When the first byte of its response was sent (0 until then) */
+    connection_fs_mode fs_mode;       /**< Where the current request's filesystem work is done */
+    int external_input;               /**< 1 if request bytes arrive through connection_receive() instead of being read here */
+    unsigned ring_ops;                /**< Completion ring operations in flight (event loop flags) */
+    struct http_connection* prev;     /**< Previous connection in the event loop's list */
+    struct http_connection* next;     /**< Next connection in the event loop's list */
+} http_connection;
+
+/**
+ * Allocates and initializes a connection for an accepted socket.
+ *
+ * @param fd The client socket file descriptor
+ * @return The new connection, or NULL if out of memory
+ */
+http_connection* connection_create(int fd);
+
+/**
+ * Releases all queued output and frees the connection.
+ * The socket itself is closed by connection_close().
+ *
+ * @param conn The connection to free
+ */
+void connection_free(http_connection* conn);
+
+/**
+ * Shuts down and closes the connection's socket and frees the connection.
+ *
+ * @param conn The connection to close
+ */
+void connection_close(http_connection* conn);
+
+/**
+ * Queues a copy of a buffer for sending.
+ *
+ * This and the other body queueing functions below drop the data (and
+ * report success) while the connection is answering a HEAD request, so
+ * every response automatically goes out without its body.
+ *
+ * @param conn The connection
+ * @param data The bytes to send
+ * @param length Number of bytes
+ * @return 0 on success, non-zero if out of memory
+ */
+int connection_queue_copy(http_connection* conn, const char* data, size_t length);
+
+/**
+ * Queues a response header block. Identical to connection_queue_copy()
+ * except that the state machine reports CONN_SENDING_HEADERS while it drains,
+ * and the status code is taken from the status line for the access log.
+ *
+ * @param conn The connection
+ * @param data The header bytes
+ * @param length Number of bytes
+ * @return 0 on success, non-zero if out of memory
+ */
+int connection_queue_headers(http_connection* conn, const char* data, size_t length);
+
+/**
+ * Queues a heap buffer for sending. The connection takes ownership of the
+ * buffer and frees it once sent (or on failure).
+ *
+ * @param conn The connection
+ * @param data A malloc'ed buffer
+ * @param length Number of bytes to send
+ * @return 0 on success, non-zero on failure
+ */
+int connection_queue_owned(http_connection* conn, char* data, size_t length);
+
+/**
+ * Queues a buffer that is shared, e.g. with the listing cache. The buffer
+ * is neither copied nor freed; instead release(context) is called once the
+ * segment is done with it (immediately on failure).
+ *
+ * @param conn The connection
+ * @param data The bytes to send; must stay valid until release is called
+ * @param length Number of bytes to send
+ * @param release Called when the buffer is no longer needed
+ * @param context Argument for release
+ * @return 0 on success, non-zero on failure
+ */
+int connection_queue_shared(http_connection* conn, const char* data, size_t length,
+                            segment_release_func release, void* context);
+
+/**
+ * Queues a body that is generated piece by piece while it is sent, so its
+ * size does not have to be known (or held in memory) up front. produce is
+ * called each time the previous piece has gone out; release is called once
+ * the stream is complete or the connection is dropped (immediately on
+ * failure or for HEAD).
+ *
+ * @param conn The connection
+ * @param produce Generates the next piece
+ * @param release Frees the producer's state
+ * @param context Argument for produce and release
+ * @return 0 on success, non-zero on failure
+ */
+int connection_queue_stream(http_connection* conn, segment_produce_func produce,
+                            segment_release_func release, void* context);
+
+/**
+ * Queues a range of an open file for sending. The connection takes
+ * ownership of the file descriptor and closes it once sent (or on failure).
+ *
+ * @param conn The connection
+ * @param file_fd The open file descriptor
+ * @param offset The file offset to start at
+ * @param length Number of bytes to send
+ * @return 0 on success, non-zero on failure
+ */
+int connection_queue_file(http_connection* conn, int file_fd, off_t offset, size_t length);
+
+/**
+ * Queues a range of a file whose descriptor is shared, e.g. with the open
+ * file cache. The descriptor is not closed; instead release(context) is
+ * called once the segment is done with it (immediately on failure).
+ *
+ * @param conn The connection
+ * @param file_fd The open file descriptor
+ * @param offset The file offset to start at
+ * @param length Number of bytes to send
+ * @param release Called when the descriptor is no longer needed
+ * @param context Argument for release
+ * @return 0 on success, non-zero on failure
+ */
+int connection_queue_shared_file(http_connection* conn, int file_fd, off_t offset, size_t length,
+                                 segment_release_func release, void* context);
+
+/**
+ * Reads available request bytes from the socket into the request buffer and
+ * feeds them to the incremental parser. A pipelined request that is already
+ * complete in the buffer is returned without reading from the socket. With
+ * conn->external_input set nothing is read: only bytes already appended
+ * with connection_receive() are parsed.
+ *
+ * @param conn The connection
+ * @return CONN_IO_DONE once the parser reached a verdict (see
+ *         conn->parse_result: a complete head or a parse error),
+ *         CONN_IO_WOULD_BLOCK if more bytes are needed, or CONN_IO_ERROR if
+ *         the peer closed the connection or recv failed
+ */
+connection_io_result connection_read_request(http_connection* conn);
+
+/**
+ * Appends request bytes that were received on the connection's behalf (by
+ * a completion ring) to the request buffer. Only used with
+ * conn->external_input set, in which case connection_read_request() parses
+ * what has been appended instead of reading from the socket.
+ *
+ * @param conn The connection
+ * @param data The bytes received
+ * @param length Number of bytes; at most the free space in the buffer
+ * @return 0 on success, non-zero if the bytes do not fit
+ */
+int connection_receive(http_connection* conn, const char* data, size_t length);
+
+/**
+ * Sends as much queued output as the socket accepts.
+ *
+ * @param conn The connection
+ * @return CONN_IO_DONE when the queue is empty, CONN_IO_WOULD_BLOCK if the
+ *         socket buffer is full, or CONN_IO_ERROR on a send failure
+ */
+connection_io_result connection_flush(http_connection* conn);
+
+/**
+ * Finishes the current request on a keep-alive connection: drops its head
+ * from the request buffer, keeping any pipelined bytes that follow it, and
+ * returns the connection to CONN_READING_REQUEST. The request's slices and
+ * its response's status, byte count and first byte time are reset, so log
+ * it first.
+ *
+ * @param conn The connection
+ */
+void connection_finish_request(http_connection* conn);
+
+/**
+ * Returns the value for the response's Connection header.
+ *
+ * @param conn The connection
+ * @return "keep-alive" or "close"
+ */
+const char* connection_header_value(const http_connection* conn);
+
+#endif /* CONNECTION_H */
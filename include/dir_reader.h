@@ -0,0 +1,75 @@
+#ifndef DIR_READER_H
+#define DIR_READER_H
+
+#include "platform.h"
+
+/**
+ * Directory reader with optional parallel stat.
+ *
+ * Reading a directory means one metadata lookup per entry, and on cold
+ * network or spinning storage each of them waits for the device. With
+ * stat threads configured, the reader fetches the names of up to
+ * DIR_READER_BATCH_SIZE entries, has the entries of the batch examined by a
+ * shared pool of threads (and the calling thread), and hands them out in
+ * directory order once the whole batch is done. Without stat threads it
+ * reads the directory entry by entry like platform_read_directory().
+ *
+ * Memory per open reader is bounded by the batch size, whatever the size
+ * of the directory.
+ */
+
+/* Entries examined together in one batch */
+#define DIR_READER_BATCH_SIZE 256
+
+/**
+ * An open directory being read.
+ */
+typedef struct dir_reader dir_reader;
+
+/**
+ * Starts the stat threads. Call once at startup, before any worker threads
+ * are started. Without it (or with threads 0) entries are examined on the
+ * reading thread.
+ *
+ * @param threads Number of stat threads
+ * @return 0 on success, non-zero on failure
+ */
+int dir_reader_init(int threads);
+
+/**
+ * Opens a directory for reading.
+ *
+ * @param path The directory to read
+ * @return The reader, or NULL on failure
+ */
+dir_reader* dir_reader_open(const char* path);
+
+/**
+ * Reads the next entry, skipping "." and ".." and entries that cannot be
+ * examined.
+ *
+ * @param reader The reader
+ * @param entry Receives the entry; its name is valid until the next read or close
+ * @return 1 if an entry was read, 0 at the end of the directory, -1 on error
+ */
+int dir_reader_read(dir_reader* reader, platform_dir_entry* entry);
+
+/**
+ * Closes a reader.
+ *
+ * @param reader The reader (can be NULL)
+ */
+void dir_reader_close(dir_reader* reader);
+
+/**
+ * Lists a directory like platform_list_directory(), examining its entries
+ * on the stat threads.
+ *
+ * @param path The directory to list
+ * @param callback The callback to call for each entry, in directory order
+ * @param user_data User-defined data to pass to the callback
+ * @return 0 on success, non-zero on failure
+ */
+int dir_reader_list_directory(const char* path, dir_entry_callback callback, void* user_data);
+
+#endif /* DIR_READER_H */
@@ -0,0 +1,60 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+/**
+ * Event loop for the HTTP file server.
+ *
+ * On Linux the loop is a non-blocking, edge-triggered epoll reactor that
+ * drives every connection's state machine (read request -> send headers ->
+ * stream body) on a single thread, so one slow client no longer blocks the
+ * others. Other platforms fall back to a serial loop that runs the same
+ * state machine on blocking sockets, one connection at a time.
+ *
+ * With the io_uring backend the same state machine is driven by completions
+ * from a platform_ring instead: a multishot accept on the listening socket,
+ * and for each connection a receive into the ring's registered buffers while
+ * it waits for a request, or a writability poll while its response waits
+ * for room in the socket buffer. These are queued and reaped in one system
+ * call per batch, so a keep-alive request costs no system call to be read.
+ * Responses are still written straight from the loop with send() and
+ * sendfile(), which usually finish them in one call each. A kernel without
+ * io_uring (or one that forbids it) gets the epoll loop.
+ */
+
+/* Maximum number of events handled per epoll_wait() or ring wait */
+#define EVENT_LOOP_MAX_EVENTS 256
+
+/* Receive buffers registered with each io_uring ring */
+#define EVENT_LOOP_RING_BUFFERS 128
+
+/* Size of each receive buffer; longer request heads take several receives */
+#define EVENT_LOOP_RING_BUFFER_SIZE 4096
+
+/**
+ * I/O backends of the Linux event loop.
+ */
+typedef enum {
+    EVENT_LOOP_EPOLL,     /**< Readiness from epoll, a system call per socket operation */
+    EVENT_LOOP_IO_URING   /**< Completions from io_uring (Linux 6.1 and later), else epoll */
+} event_loop_backend;
+
+/**
+ * Looks up a backend by name ("epoll" or "io_uring").
+ *
+ * @param name The name
+ * @param backend Receives the event_loop_backend value
+ * @return 0 on success, non-zero if the name is unknown
+ */
+int event_loop_parse_backend(const char* name, int* backend);
+
+/**
+ * Runs the event loop on a listening socket. Does not return unless the
+ * loop fails to start.
+ *
+ * @param server_fd The bound and listening server socket
+ * @param base_path The base directory path to serve files from
+ * @return Non-zero on failure
+ */
+int event_loop_run(int server_fd, const char* base_path);
+
+#endif /* EVENT_LOOP_H */
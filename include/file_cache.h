@@ -0,0 +1,163 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include "platform.h"
+#include <sys/stat.h>
+#include <time.h>
+
+/**
+ * Open file descriptor cache.
+ *
+ * Keeps hot files open together with their metadata and MIME type, so a
+ * request for a cached file needs no stat(), open() or close(). Entries are
+ * keyed by the resolved filesystem path and reference counted: every request
+ * and every queued file segment using an entry holds a reference, and the
+ * descriptor is closed only after the last one is released, even if the
+ * entry has been evicted or invalidated in the meantime.
+ *
+ * Entries are revalidated once their TTL has expired and replaced if the
+ * file changed; the metadata cache (stat_cache.h) answers that check without
+ * a syscall and drops changed files right away. The cache is shared by all
+ * worker threads.
+ */
+
+/**
+ * @brief A cached open file
+ *
+ * All fields except the internal ones are read-only for users.
+ */
+typedef struct file_cache_entry {
+    char* path;                          /**< Resolved filesystem path (the key) */
+    int fd;                              /**< Open descriptor, shared by all users */
+    struct stat st;                      /**< Metadata of the open file */
+    const char* mime_type;               /**< MIME type from the file extension */
+    time_t validated;                    /**< Internal: last check against the filesystem */
+    int refcount;                        /**< Internal: references, including the cache's own */
+    int cached;                          /**< Internal: 1 while the entry is in the table */
+    struct file_cache_entry* hash_next;  /**< Internal: next entry in the hash bucket */
+    struct file_cache_entry* lru_prev;   /**< Internal: more recently used entry */
+    struct file_cache_entry* lru_next;   /**< Internal: less recently used entry */
+} file_cache_entry;
+
+/**
+ * @brief Cache counters
+ */
+typedef struct {
+    unsigned long hits;           /**< Lookups answered from the cache */
+    unsigned long misses;         /**< Lookups that had to open the file */
+    unsigned long revalidations;  /**< TTL expiries that found the file unchanged */
+    unsigned long invalidations;  /**< Entries dropped because the file changed */
+    unsigned long evictions;      /**< Entries dropped to stay within the size limit */
+    size_t entries;               /**< Entries currently cached */
+} file_cache_stats;
+
+/**
+ * Sets up the cache. Call once at startup, before any worker threads are
+ * started. Without it (or with max_entries 0) every lookup opens the file
+ * and the descriptor is closed on release.
+ *
+ * @param max_entries Maximum number of open files kept (0 disables caching)
+ * @param ttl Seconds an entry is trusted before it is revalidated
+ * @return 0 on success, non-zero on failure
+ */
+int file_cache_init(int max_entries, int ttl);
+
+/**
+ * Looks up a regular file, opening and caching it on a miss.
+ *
+ * @param path The resolved filesystem path
+ * @return A referenced entry, or NULL if the path is not a regular file that can be opened
+ */
+file_cache_entry* file_cache_acquire(const char* path);
+
+/**
+ * Looks up a regular file only if it is cached, never opening it. (An entry
+ * whose TTL expired is revalidated through the metadata cache, which only
+ * stats the file if it does not know it either.)
+ *
+ * @param path The resolved filesystem path
+ * @return A referenced entry, or NULL if the file is not cached
+ */
+file_cache_entry* file_cache_lookup(const char* path);
+
+/**
+ * Looks up the index file of a directory: the first of several names that
+ * is a regular file in it. It is opened relative to a descriptor of the
+ * directory. The entry is cached under the index file's
+ * own path, so a hot index page needs no syscall at all.
+ *
+ * @param dir_path The directory's resolved filesystem path
+ * @param names File names to try, in order
+ * @param count Number of names
+ * @return A referenced entry for the index file, or NULL if the directory has none
+ */
+file_cache_entry* file_cache_acquire_index(const char* dir_path, const char* const* names, int count);
+
+/**
+ * Looks up the index file of a directory like file_cache_acquire_index(),
+ * but only from the caches: it succeeds if an index file is cached, or if
+ * the metadata cache knows every name before it to be missing.
+ *
+ * @param dir_path The directory's resolved filesystem path
+ * @param names File names to try, in order
+ * @param count Number of names
+ * @param index Receives a referenced entry for the index file, or NULL if the directory has none
+ * @return 0 if the caches answered, non-zero if it takes the filesystem to find out
+ */
+int file_cache_lookup_index(const char* dir_path, const char* const* names, int count,
+                            file_cache_entry** index);
+
+/**
+ * Finds the index file of a directory like file_cache_acquire_index(), but
+ * never opens it. An index file that is cached is returned as an entry;
+ * otherwise its path and metadata come from the metadata cache.
+ *
+ * @param dir_path The directory's resolved filesystem path
+ * @param names File names to try, in order
+ * @param count Number of names
+ * @param index Receives a referenced entry if the index file is cached, or NULL
+ * @param path Receives the index file's path (MAX_PATH_SIZE bytes) when it is not cached
+ * @param st Receives the index file's metadata when it is not cached
+ * @return 0 if the directory has an index file, non-zero if it has none
+ */
+int file_cache_find_index(const char* dir_path, const char* const* names, int count,
+                          file_cache_entry** index, char* path, struct stat* st);
+
+/**
+ * Adds a reference to an entry the caller already holds.
+ *
+ * @param entry The entry
+ */
+void file_cache_retain(file_cache_entry* entry);
+
+/**
+ * Drops a reference. The descriptor is closed when the last reference to an
+ * entry that is no longer cached goes away.
+ *
+ * @param entry The entry
+ */
+void file_cache_release(file_cache_entry* entry);
+
+/**
+ * Drops the cached entry for a path, if any, so the next lookup reopens it.
+ *
+ * @param path The resolved filesystem path
+ */
+void file_cache_invalidate(const char* path);
+
+/**
+ * Drops the cached entries for every path starting with a prefix, e.g. all
+ * files below a directory that was renamed.
+ *
+ * @param prefix The path prefix ("" drops everything)
+ */
+void file_cache_invalidate_prefix(const char* prefix);
+
+/**
+ * Copies the current counters.
+ *
+ * @param stats Receives the counters
+ */
+void file_cache_get_stats(file_cache_stats* stats);
+
+#endif /* FILE_CACHE_H */
@@ -0,0 +1,91 @@
+#ifndef FS_POOL_H
+#define FS_POOL_H
+
+#include "platform.h"
+
+/**
+ * Thread pool for blocking filesystem work.
+ *
+ * stat(), open() and directory reads wait for the disk on a cold cache, and
+ * on an event loop thread that wait stalls every connection of the loop.
+ * The pool runs such work on threads of its own instead. Each pool thread
+ * has its own queue; submitted tasks are spread over the queues (going to a
+ * sleeping thread first), and a thread whose queue is empty steals from the
+ * others, so one slow task does not hold up the tasks queued behind it
+ * while another thread is idle. Once a task's work is done, the same pool
+ * thread calls its complete function, which hands the result back to
+ * whoever submitted it (the event loop posts it to its own thread).
+ *
+ * The number of tasks waiting is capped: past the cap fs_pool_submit()
+ * fails, and the caller answers right away (with a 503) rather than let the
+ * backlog of a slow disk grow without bound.
+ */
+
+typedef struct fs_pool_task fs_pool_task;
+
+/**
+ * Runs a step of a task. Called on a pool thread.
+ *
+ * @param task The task
+ */
+typedef void (*fs_pool_func)(fs_pool_task* task);
+
+/**
+ * @brief A unit of work for the pool
+ *
+ * Usually the first member of a larger structure with the task's state. It
+ * is owned by the submitter; the pool does not copy or free it.
+ */
+struct fs_pool_task {
+    fs_pool_func work;      /**< The blocking work */
+    fs_pool_func complete;  /**< Called right after work, to hand the result back */
+};
+
+/**
+ * @brief Pool counters
+ */
+typedef struct {
+    int threads;              /**< Pool threads (0 when disabled) */
+    size_t queued;            /**< Tasks waiting for a thread */
+    size_t max_queued;        /**< Most tasks allowed to wait */
+    unsigned long submitted;  /**< Tasks accepted */
+    unsigned long rejected;   /**< Tasks refused because the queues were full */
+    unsigned long completed;  /**< Tasks run */
+    unsigned long stolen;     /**< Tasks run by a thread other than the one they were queued for */
+} fs_pool_stats;
+
+/**
+ * Starts the pool threads. Call once at startup, before any worker threads
+ * are started. Without it (or with threads 0) there is no pool and callers
+ * do their filesystem work themselves.
+ *
+ * @param threads Number of pool threads
+ * @param max_queued Most tasks allowed to wait for a thread
+ * @return 0 on success, non-zero on failure
+ */
+int fs_pool_init(int threads, int max_queued);
+
+/**
+ * Checks whether the pool is running.
+ *
+ * @return Non-zero if fs_pool_init() started threads
+ */
+int fs_pool_enabled(void);
+
+/**
+ * Queues a task. The task must stay valid until its complete function has
+ * been called.
+ *
+ * @param task The task
+ * @return 0 if queued, non-zero if the queues are full (or there is no pool)
+ */
+int fs_pool_submit(fs_pool_task* task);
+
+/**
+ * Copies the current counters.
+ *
+ * @param stats Receives the counters
+ */
+void fs_pool_get_stats(fs_pool_stats* stats);
+
+#endif /* FS_POOL_H */
@@ -0,0 +1,57 @@
+#ifndef HTTP_CONDITIONAL_H
+#define HTTP_CONDITIONAL_H
+
+#include <time.h>
+#include <sys/stat.h>
+#include "http_parser.h"
+
+/**
+ * Validators and conditional requests (RFC 7232).
+ */
+
+/* Buffer size for an entity tag, quotes and weak prefix included */
+#define HTTP_ETAG_SIZE 128
+
+/**
+ * Builds an entity tag from a file's inode, size and modification time.
+ *
+ * @param st The file's metadata
+ * @param weak Non-zero for a weak tag (W/"..."), zero for a strong one
+ * @param buffer Output buffer of at least HTTP_ETAG_SIZE bytes
+ */
+void http_make_etag(const struct stat* st, int weak, char* buffer);
+
+/**
+ * Parses an HTTP date in any of the three formats of RFC 7231 7.1.1.1
+ * (IMF-fixdate, RFC 850 and asctime).
+ *
+ * @param value The header value
+ * @param t Receives the timestamp
+ * @return 0 on success, -1 if the value is not a valid date
+ */
+int http_parse_date(const http_slice* value, time_t* t);
+
+/**
+ * Evaluates If-None-Match and If-Modified-Since for a GET or HEAD request.
+ * If-None-Match takes precedence; If-Modified-Since is only consulted when
+ * it is absent.
+ *
+ * @param request The parsed request
+ * @param etag The representation's entity tag
+ * @param mtime The representation's modification time
+ * @return 1 if the client's copy is current (304), 0 otherwise
+ */
+int http_request_not_modified(const http_request* request, const char* etag, time_t mtime);
+
+/**
+ * Checks an If-Range validator. Entity tags must match strongly; dates
+ * must equal the Last-Modified value exactly.
+ *
+ * @param if_range The If-Range header value
+ * @param etag The representation's entity tag
+ * @param last_modified The representation's Last-Modified date
+ * @return 1 if the range may be served, 0 if the full representation must be sent
+ */
+int http_if_range_matches(const http_slice* if_range, const char* etag, const char* last_modified);
+
+#endif /* HTTP_CONDITIONAL_H */
@@ -0,0 +1,144 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+
+/**
+ * Incremental HTTP/1.x request parser.
+ *
+ * The parser works directly on the connection's request buffer and can be
+ * called again every time more bytes arrive: lines that were already parsed
+ * are not scanned twice. Results are returned as slices (pointer + length)
+ * into that buffer, so nothing is copied. The slices stay valid until the
+ * buffer is modified, i.e. until the request has been handled.
+ */
+
+/* Hard upper bound on the number of headers a request may carry */
+#define HTTP_PARSER_MAX_HEADERS 128
+
+/**
+ * @brief A read-only view of bytes inside the request buffer
+ */
+typedef struct {
+    const char* data;  /**< First byte (not NUL-terminated) */
+    size_t length;     /**< Number of bytes */
+} http_slice;
+
+/**
+ * @brief One request header
+ */
+typedef struct {
+    http_slice name;   /**< Header name as sent by the client */
+    http_slice value;  /**< Value with surrounding whitespace removed */
+} http_header;
+
+/**
+ * Parse results.
+ */
+typedef enum {
+    HTTP_PARSE_COMPLETE,      /**< The request head is complete */
+    HTTP_PARSE_INCOMPLETE,    /**< More bytes are needed */
+    HTTP_PARSE_ERROR,         /**< The request is malformed (400) */
+    HTTP_PARSE_URI_TOO_LONG,  /**< The request target exceeds the limit (414) */
+    HTTP_PARSE_TOO_LARGE      /**< The head or header count exceeds the limits (431) */
+} http_parse_result;
+
+/**
+ * @brief Limits enforced while parsing
+ */
+typedef struct {
+    size_t max_head_size;      /**< Maximum bytes in the request line plus headers */
+    size_t max_headers;        /**< Maximum number of headers (at most HTTP_PARSER_MAX_HEADERS) */
+    size_t max_target_length;  /**< Maximum length of the request target */
+} http_parser_limits;
+
+/**
+ * @brief A parsed (or partially parsed) request
+ */
+typedef struct {
+    http_slice method;        /**< Request method, e.g. "GET" */
+    http_slice target;        /**< Full request target, e.g. "/dir/?format=json" */
+    http_slice path;          /**< Target up to the '?' */
+    http_slice query;         /**< Target after the '?' (empty if none) */
+    http_slice version;       /**< Protocol version, "HTTP/1.0" or "HTTP/1.1" */
+    int version_minor;        /**< 1 for HTTP/1.1, 0 for HTTP/1.0 */
+    http_header headers[HTTP_PARSER_MAX_HEADERS]; /**< Parsed headers */
+    size_t header_count;      /**< Number of entries in headers */
+    size_t head_length;       /**< Bytes consumed by the head once complete */
+    size_t parse_offset;      /**< Internal: start of the next unparsed line */
+    int parse_state;          /**< Internal: request line or header section */
+} http_request;
+
+/**
+ * Resets a request so parsing starts over at the beginning of a buffer.
+ *
+ * @param request The request to reset
+ */
+void http_request_init(http_request* request);
+
+/**
+ * Parses as much of a request head as the buffer holds. Call again with the
+ * same (grown) buffer when more bytes arrive; parsing resumes where it
+ * stopped.
+ *
+ * @param request The request being parsed
+ * @param buffer The request buffer
+ * @param length Number of valid bytes in the buffer
+ * @param limits The limits to enforce
+ * @return The parse result
+ */
+http_parse_result http_parse_request(http_request* request, const char* buffer, size_t length,
+                                     const http_parser_limits* limits);
+
+/**
+ * Finds a header by name (case-insensitive).
+ *
+ * @param request A completely parsed request
+ * @param name The header name
+ * @return The header value, or NULL if the header is absent
+ */
+const http_slice* http_request_header(const http_request* request, const char* name);
+
+/**
+ * Compares a slice with a string (case-sensitive).
+ *
+ * @param slice The slice
+ * @param str A NUL-terminated string
+ * @return 1 if equal, 0 otherwise
+ */
+int http_slice_equals(const http_slice* slice, const char* str);
+
+/**
+ * Checks whether a comma-separated header value contains a token
+ * (case-insensitive), e.g. "keep-alive" in "keep-alive, Upgrade".
+ *
+ * @param slice The header value
+ * @param token The token to look for
+ * @return 1 if the token is present, 0 otherwise
+ */
+int http_slice_has_token(const http_slice* slice, const char* token);
+
+/**
+ * Checks whether an Accept header value lists a media type, ignoring
+ * parameters, e.g. "application/json" in "text/html, application/json;q=0.9".
+ * Wildcard media ranges do not count, and neither does a type listed with
+ * q=0, which marks it as not acceptable.
+ *
+ * @param slice The header value
+ * @param media_type The media type to look for (lower case)
+ * @return 1 if the media type is listed, 0 otherwise
+ */
+int http_slice_has_media_type(const http_slice* slice, const char* media_type);
+
+/**
+ * Finds a parameter in a query string ("name=value&name2=value2"). Values
+ * are returned as sent, without percent-decoding.
+ *
+ * @param query The query string
+ * @param name The parameter name
+ * @param value Receives the value (empty if the parameter has no '=')
+ * @return 1 if the parameter is present, 0 otherwise
+ */
+int http_query_param(const http_slice* query, const char* name, http_slice* value);
+
+#endif /* HTTP_PARSER_H */
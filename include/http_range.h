@@ -0,0 +1,60 @@
+#ifndef HTTP_RANGE_H
+#define HTTP_RANGE_H
+
+#include "platform.h"
+#include "http_parser.h"
+
+/**
+ * Range request support (RFC 7233).
+ */
+
+/**
+ * @brief One satisfiable byte range, clipped to the representation size
+ */
+typedef struct {
+    off_t first;   /**< Offset of the first byte */
+    off_t length;  /**< Number of bytes (always > 0) */
+} http_byte_range;
+
+/* Maximum number of ranges accepted in one Range header */
+#define HTTP_RANGE_MAX_RANGES 16
+
+/**
+ * @brief The ranges selected by a Range header
+ *
+ * After parsing, the ranges are sorted by offset and neither overlap nor
+ * touch each other.
+ */
+typedef struct {
+    http_byte_range ranges[HTTP_RANGE_MAX_RANGES];  /**< Selected ranges */
+    size_t count;                                   /**< Number of entries in ranges */
+} http_range_set;
+
+/**
+ * Range parse results.
+ */
+typedef enum {
+    HTTP_RANGE_NONE,           /**< No usable Range header: send the full representation (200) */
+    HTTP_RANGE_SATISFIABLE,    /**< Send the selected ranges (206) */
+    HTTP_RANGE_UNSATISFIABLE   /**< No range overlaps the representation (416) */
+} http_range_result;
+
+/**
+ * Parses a Range header value against a representation of a given size.
+ *
+ * Accepts a comma-separated list of "bytes=" ranges in any of the three
+ * forms: "first-last", "first-" (open-ended) and "-suffix" (the last suffix
+ * bytes). Ranges that start past the end are dropped; the rest are clipped,
+ * sorted and coalesced when they overlap or are adjacent. Headers that are
+ * malformed, use another unit or list more than HTTP_RANGE_MAX_RANGES ranges
+ * are ignored, as RFC 7233 allows, so the client gets a single full copy
+ * instead of many overlapping parts.
+ *
+ * @param header The Range header value
+ * @param size Size of the representation in bytes
+ * @param set Receives the selected ranges on HTTP_RANGE_SATISFIABLE
+ * @return The parse result
+ */
+http_range_result http_range_parse(const http_slice* header, off_t size, http_range_set* set);
+
+#endif /* HTTP_RANGE_H */
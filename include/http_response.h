@@ -1,45 +1,101 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
+#include "connection.h"
+#include <time.h>
+
 /**
  * HTTP status code constants
  */
 #define HTTP_STATUS_OK 200
+#define HTTP_STATUS_PARTIAL_CONTENT 206
+#define HTTP_STATUS_NOT_MODIFIED 304
 #define HTTP_STATUS_BAD_REQUEST 400
 #define HTTP_STATUS_NOT_FOUND 404
+#define HTTP_STATUS_METHOD_NOT_ALLOWED 405
+#define HTTP_STATUS_URI_TOO_LONG 414
+#define HTTP_STATUS_RANGE_NOT_SATISFIABLE 416
+#define HTTP_STATUS_HEADER_FIELDS_TOO_LARGE 431
 #define HTTP_STATUS_INTERNAL_SERVER_ERROR 500
+#define HTTP_STATUS_SERVICE_UNAVAILABLE 503
+
+/* Buffer size for an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define HTTP_DATE_SIZE 32
+
+/**
+ * Queues a 304 Not Modified response (headers only) for the client.
+ * 
+ * @param conn The client connection
+ * @param validators ETag and Last-Modified header lines, each ending in "\r\n"
+ */
+void send_304(http_connection* conn, const char* validators);
+
+/**
+ * Queues a 404 Not Found response for the client.
+ * 
+ * @param conn The client connection
+ */
+void send_404(http_connection* conn);
+
+/**
+ * Queues a 400 Bad Request response for the client.
+ * 
+ * @param conn The client connection
+ */
+void send_400(http_connection* conn);
 
 /**
- * Sends a 404 Not Found response to the client.
+ * Queues a 405 Method Not Allowed response (with an Allow header) for the client.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  */
-void send_404(int client_fd);
+void send_405(http_connection* conn);
 
 /**
- * Sends a 400 Bad Request response to the client.
+ * Queues a 500 Internal Server Error response for the client.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  */
-void send_400(int client_fd);
+void send_500(http_connection* conn);
 
 /**
- * Sends a 500 Internal Server Error response to the client.
+ * Queues a 503 Service Unavailable response (with a Retry-After header) for the client.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  */
-void send_500(int client_fd);
+void send_503(http_connection* conn);
 
 /**
- * Sends a generic HTTP response with the specified status code and message.
+ * Queues a generic HTTP response with the specified status code and message.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  * @param status_code The HTTP status code
  * @param status_text The status text (e.g., "Not Found")
  * @param content_type The content type (defaults to "text/html" if NULL)
  * @param body The response body (can be NULL for empty response)
  */
-void send_http_status(int client_fd, int status_code, const char* status_text, 
+void send_http_status(http_connection* conn, int status_code, const char* status_text, 
                      const char* content_type, const char* body);
 
+/**
+ * Queues a generic HTTP response with additional header lines.
+ * 
+ * @param conn The client connection
+ * @param status_code The HTTP status code
+ * @param status_text The status text (e.g., "Not Found")
+ * @param content_type The content type (defaults to "text/html" if NULL)
+ * @param extra_headers Header lines, each ending in "\r\n" (can be NULL)
+ * @param body The response body (can be NULL for empty response)
+ */
+void send_http_status_with_headers(http_connection* conn, int status_code, const char* status_text,
+                                   const char* content_type, const char* extra_headers, const char* body);
+
+/**
+ * Formats a timestamp as an HTTP date (IMF-fixdate, always GMT).
+ * 
+ * @param t The timestamp
+ * @param buffer Output buffer of at least HTTP_DATE_SIZE bytes
+ */
+void http_format_date(time_t t, char* buffer);
+
 #endif /* HTTP_RESPONSE_H */ 
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+/**
+ * Character scanning kernels for the HTTP request parser.
+ *
+ * Each function returns the length of the leading run of bytes that belong
+ * to a character class, i.e. the index of the first byte that does not (or
+ * the full length if every byte does). On x86 the kernels are implemented
+ * with AVX2 and SSE4.2, and http_scan_init() picks the best implementation
+ * the CPU supports. Everywhere else, and before http_scan_init() runs, the
+ * portable scalar versions are used. Line feeds are found with memchr()
+ * in every implementation.
+ */
+
+/**
+ * Selects the fastest kernels the CPU supports. Call once at startup,
+ * before any worker threads are started.
+ */
+void http_scan_init(void);
+
+/**
+ * Selects an implementation by name instead of the fastest one, e.g. to
+ * compare them (bench/bench_scan.c). Like http_scan_init(), call it before
+ * any worker threads are started.
+ *
+ * @param name "avx2", "sse4.2" or "scalar"
+ * @return 0 on success, non-zero if the implementation is not built in or
+ *         the CPU cannot run it
+ */
+int http_scan_select(const char* name);
+
+/**
+ * Returns the name of the selected kernels ("avx2", "sse4.2" or "scalar").
+ *
+ * @return The implementation name
+ */
+const char* http_scan_implementation(void);
+
+/**
+ * Finds the first line feed.
+ *
+ * @param data The bytes to scan
+ * @param length Number of bytes
+ * @return Index of the first '\n', or length if there is none
+ */
+size_t http_scan_newline(const char* data, size_t length);
+
+/**
+ * Measures a token (method or header name, RFC 7230 tchar).
+ *
+ * @param data The bytes to scan
+ * @param length Number of bytes
+ * @return Number of leading token characters
+ */
+size_t http_scan_token(const char* data, size_t length);
+
+/**
+ * Measures a request target: visible characters, no spaces or controls.
+ *
+ * @param data The bytes to scan
+ * @param length Number of bytes
+ * @return Number of leading request target characters
+ */
+size_t http_scan_target(const char* data, size_t length);
+
+/**
+ * Measures a header field value: visible characters, spaces and tabs.
+ *
+ * @param data The bytes to scan
+ * @param length Number of bytes
+ * @return Number of leading field value characters
+ */
+size_t http_scan_field_value(const char* data, size_t length);
+
+#endif /* HTTP_SCAN_H */
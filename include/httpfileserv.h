@@ -12,6 +12,8 @@
 #include "platform.h"
 #include "utils.h"
 #include "http_response.h"
+#include "connection.h"
+#include "file_cache.h"
 
 /* Include Windows socket headers for Windows platform */
 #ifdef _WIN32
@@ -33,32 +35,86 @@
 #define MAX_PATH_SIZE 1024
 
 /**
- * Handles an incoming client connection.
+ * Handles a complete request read into the connection's buffer: parses it,
+ * routes it and queues the response on the connection. With conn->fs_mode
+ * CONN_FS_ALLOWED it stops before work that may block on the disk, sets
+ * CONN_FS_REQUESTED and queues nothing; the caller then runs it again on
+ * the filesystem pool with CONN_FS_ON_POOL.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  * @param base_path The base directory path to serve files from
  */
-void handle_connection(int client_fd, const char* base_path);
+void handle_connection(http_connection* conn, const char* base_path);
 
 /**
- * Sends a directory listing as HTML to the client.
+ * Queues a directory listing as HTML for the client. With conn->fs_mode
+ * CONN_FS_ALLOWED a listing that is not cached is not rendered: it sets
+ * CONN_FS_REQUESTED and queues nothing, as handle_connection() does.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  * @param path The filesystem path to the directory
  * @param url_path The URL path for the directory
  */
-void send_directory_listing(int client_fd, const char* path, const char* url_path);
+void send_directory_listing(http_connection* conn, const char* path, const char* url_path);
 
 /**
- * Sends a file to the client with appropriate headers.
+ * Queues a file for the client with appropriate headers.
  * 
- * @param client_fd The client socket file descriptor
- * @param path The path to the file to send
+ * @param conn The client connection
+ * @param file The file, from the open file cache (the caller keeps its reference)
  */
-void send_file(int client_fd, const char* path);
+void send_file(http_connection* conn, file_cache_entry* file);
 
 // Template-related functions
+
+/**
+ * Placeholders in the directory listing template.
+ */
+typedef enum {
+    TEMPLATE_DIRECTORY_PATH,         /**< {{DIRECTORY_PATH}}: the directory's display path */
+    TEMPLATE_DIRECTORY_ENTRIES,      /**< {{DIRECTORY_ENTRIES}}: the table rows */
+    TEMPLATE_PARENT_DIRECTORY_LINK,  /**< {{PARENT_DIRECTORY_LINK}}: link to "..", if any */
+    TEMPLATE_SLOT_COUNT
+} template_slot;
+
 char* load_template(const char* template_path);
-char* process_template(const char* template_content, const char* url_path, const char* entries, int has_parent);
+
+/**
+ * Compiles the directory listing template into literal segments and
+ * placeholder slots. Call once at startup, before any worker threads are
+ * started.
+ * 
+ * @param template_path A template file to use instead of the one embedded
+ *                      at build time, or NULL
+ * @return 0 on success, non-zero if the file cannot be read
+ */
+int template_init(const char* template_path);
+
+/**
+ * Renders a directory listing page in one pass over the compiled template.
+ * 
+ * @param url_path The directory path to display
+ * @param entries The HTML table rows
+ * @param entries_length Length of entries in bytes
+ * @param has_parent Whether to include a parent directory link
+ * @param length Receives the length of the page
+ * @return A malloc'ed, NUL-terminated page, or NULL if out of memory
+ */
+char* render_template(const char* url_path, const char* entries, size_t entries_length,
+                      int has_parent, size_t* length);
+
+/**
+ * Renders a directory listing page without any entries, for listings whose
+ * rows are streamed: the rows go between the part before *entries_offset
+ * and the part after it.
+ * 
+ * @param url_path The directory path to display
+ * @param has_parent Whether to include a parent directory link
+ * @param length Receives the length of the page
+ * @param entries_offset Receives the offset at which the rows belong
+ * @return A malloc'ed, NUL-terminated page, or NULL if out of memory or the
+ *         template does not have exactly one {{DIRECTORY_ENTRIES}} placeholder
+ */
+char* render_template_frame(const char* url_path, int has_parent, size_t* length, size_t* entries_offset);
 
 #endif /* HTTPFILESERV_H */
\ No newline at end of file
@@ -26,6 +26,24 @@ void stop_server(void);
 typedef void (*request_callback)(const char* method, const char* path, int status_code);
 void set_request_callback(request_callback callback);
 
+/**
+ * Checks whether a request callback is set, so the server can skip
+ * preparing its arguments when there is none.
+ *
+ * @return Non-zero if a callback is set
+ */
+int has_request_callback(void);
+
+/**
+ * Calls the request callback, if any. Called by the server once the
+ * response to a request has been sent (or has failed).
+ *
+ * @param method The request method
+ * @param path The request target
+ * @param status_code The response status code
+ */
+void invoke_request_callback(const char* method, const char* path, int status_code);
+
 /**
  * Set custom MIME types for file extensions.
  * 
@@ -0,0 +1,138 @@
+#ifndef LISTING_CACHE_H
+#define LISTING_CACHE_H
+
+#include "platform.h"
+#include <sys/stat.h>
+#include <time.h>
+
+/**
+ * Rendered directory listing cache.
+ *
+ * Keeps the final HTML (or JSON) of directory listings, keyed by the
+ * directory's path and the URL it was requested under (including any query
+ * options that change the listing), and validated against the directory's
+ * device, inode and mtime. A hit is sent straight from the cached buffer.
+ * Entries are reference counted like file_cache entries: every queued
+ * segment holds a reference, so an entry evicted while it is being sent
+ * stays alive until the send is done.
+ *
+ * Adding or removing entries changes the directory's mtime, which makes a
+ * cached listing stale by itself. Changes to the entries themselves (sizes,
+ * mtimes) do not touch the directory's mtime; they are reported through
+ * listing_cache_invalidate() by the metadata cache (stat_cache.h) for as
+ * long as it watches the directory, so only listings of watched directories
+ * are cached (none where the metadata cache is disabled or has no inotify,
+ * or has no watch left to spare). A directory modified within the last
+ * second is not cached, since it could change again without its mtime
+ * changing. The total size is capped by a byte budget with LRU eviction.
+ * The cache is shared by all worker threads.
+ */
+
+/**
+ * @brief A cached rendered listing
+ *
+ * All fields except the internal ones are read-only for users.
+ */
+typedef struct listing_cache_entry {
+    char* path;                             /**< Directory path without trailing separators (the key, with url_path) */
+    char* url_path;                         /**< URL path and options the listing was rendered for */
+    dev_t dev;                              /**< Device of the directory when rendered */
+    ino_t ino;                              /**< Inode of the directory when rendered */
+    time_t mtime;                           /**< mtime of the directory when rendered */
+    char* html;                             /**< The rendered listing (HTML or JSON) */
+    size_t length;                          /**< Length of html in bytes */
+    size_t memory;                          /**< Internal: bytes accounted to the entry */
+    int refcount;                           /**< Internal: references, including the cache's own */
+    int cached;                             /**< Internal: 1 while the entry is in the table */
+    struct listing_cache_entry* hash_next;  /**< Internal: next entry in the hash bucket */
+    struct listing_cache_entry* lru_prev;   /**< Internal: more recently used entry */
+    struct listing_cache_entry* lru_next;   /**< Internal: less recently used entry */
+} listing_cache_entry;
+
+/**
+ * @brief Cache counters
+ */
+typedef struct {
+    unsigned long hits;           /**< Listings sent from the cache */
+    unsigned long misses;         /**< Listings that had to be rendered */
+    unsigned long invalidations;  /**< Entries dropped because the directory changed */
+    unsigned long evictions;      /**< Entries dropped to stay within the budget */
+    size_t entries;               /**< Entries currently cached */
+    size_t memory;                /**< Bytes used by cached entries */
+} listing_cache_stats;
+
+/**
+ * Sets up the cache. Call once at startup, before any worker threads are
+ * started. Without it (or with max_memory 0) every listing is rendered.
+ *
+ * @param max_memory Bytes the cached listings may use (0 disables caching)
+ * @return 0 on success, non-zero on failure
+ */
+int listing_cache_init(size_t max_memory);
+
+/**
+ * Looks up the listing of a directory as it is now.
+ *
+ * @param path The directory's filesystem path
+ * @param url_path The URL path the listing is for
+ * @param st The directory's current metadata
+ * @param generation Receives a value to pass to listing_cache_insert() on a miss
+ * @return A referenced entry, or NULL on a miss
+ */
+listing_cache_entry* listing_cache_acquire(const char* path, const char* url_path,
+                                           const struct stat* st, unsigned long* generation);
+
+/**
+ * Wraps a freshly rendered listing in an entry and caches it, unless the
+ * directory is not watched or was invalidated since the
+ * listing_cache_acquire() that missed.
+ *
+ * @param path The directory's filesystem path
+ * @param url_path The URL path the listing is for
+ * @param st The directory's metadata from before it was listed
+ * @param generation The value listing_cache_acquire() returned
+ * @param watched Whether changes to the directory's entries are reported
+ *                (stat_cache_is_watched() after listing it)
+ * @param html A malloc'ed buffer with the listing; the cache takes ownership
+ * @param length Length of html in bytes
+ * @return A referenced entry (cached or not), or NULL if out of memory (html is freed)
+ */
+listing_cache_entry* listing_cache_insert(const char* path, const char* url_path,
+                                          const struct stat* st, unsigned long generation,
+                                          int watched, char* html, size_t length);
+
+/**
+ * Adds a reference to an entry the caller already holds.
+ *
+ * @param entry The entry
+ */
+void listing_cache_retain(listing_cache_entry* entry);
+
+/**
+ * Drops a reference. The entry is freed when the last reference to an entry
+ * that is no longer cached goes away.
+ *
+ * @param entry The entry
+ */
+void listing_cache_release(listing_cache_entry* entry);
+
+/**
+ * Drops the cached listings of a directory (under every URL).
+ *
+ * @param path The directory's filesystem path
+ */
+void listing_cache_invalidate(const char* path);
+
+/**
+ * Drops every cached listing.
+ */
+void listing_cache_clear(void);
+
+/**
+ * Copies the current counters.
+ *
+ * @param stats Receives the counters
+ */
+void listing_cache_get_stats(listing_cache_stats* stats);
+
+#endif /* LISTING_CACHE_H */
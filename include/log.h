@@ -0,0 +1,100 @@
+#ifndef LOG_H
+#define LOG_H
+
+/**
+ * Leveled, asynchronous logging.
+ *
+ * LOG_DEBUG(), LOG_INFO(), LOG_WARNING() and LOG_ERROR() take printf-style
+ * arguments and print "[LEVEL] message" to stdout like the printf() calls
+ * they replace. Levels below LOG_COMPILE_LEVEL are compiled out entirely
+ * (build with e.g. -DLOG_COMPILE_LEVEL=LOG_LEVEL_INFO); levels below the
+ * runtime level cost one comparison and evaluate none of their arguments.
+ *
+ * Once log_init() has started the writer thread, a record is formatted
+ * straight into a ring buffer owned by the calling thread, with no lock and
+ * no syscall; the writer thread drains the rings and writes the records in
+ * batches. Records from one thread keep their order; records from different
+ * threads may interleave. If a thread's ring is full its records are dropped
+ * and counted rather than stalling the caller. Before log_init() records are
+ * written directly.
+ */
+
+/* Levels, in increasing severity (plain numbers so #if can compare them) */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF 4
+
+/* Lowest level compiled in */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/* Longest record; longer messages are truncated */
+#define LOG_MAX_RECORD 4096
+
+/* Bytes of records buffered per thread */
+#define LOG_RING_SIZE (256 * 1024)
+
+/**
+ * Lowest level logged at runtime. Set through log_init(); read without
+ * synchronization on every log call.
+ */
+extern int log_level_threshold;
+
+/**
+ * Checks whether a level is logged, at compile time and at runtime.
+ */
+#define LOG_ENABLED(level) ((level) >= LOG_COMPILE_LEVEL && (level) >= log_level_threshold)
+
+/* Arguments of a compiled-out level are still type checked (and count as
+   used), but never evaluated */
+#define LOG_AT(level, ...) \
+    do { \
+        if (LOG_ENABLED(level)) { \
+            log_write(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * Parses a level name: "debug", "info", "warning", "error" or "off".
+ *
+ * @param name The name
+ * @param level Receives the level
+ * @return 0 on success, non-zero if the name is unknown
+ */
+int log_parse_level(const char* name, int* level);
+
+/**
+ * Sets the runtime level and starts the writer thread. Call once at
+ * startup, before any worker threads are started.
+ *
+ * @param level Lowest level to log
+ * @return 0 on success, non-zero on failure
+ */
+int log_init(int level);
+
+/**
+ * Formats and queues a record. Use the LOG_* macros instead, which skip
+ * disabled levels without evaluating the arguments.
+ *
+ * @param level The record's level
+ * @param format printf-style format of the message
+ */
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void log_write(int level, const char* format, ...);
+
+/**
+ * Waits until every record queued so far has been written.
+ */
+void log_flush(void);
+
+#endif /* LOG_H */
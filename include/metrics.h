@@ -0,0 +1,83 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "http_parser.h"
+#include <stddef.h>
+
+/**
+ * Request metrics in Prometheus text format.
+ *
+ * Counts requests by method, responses by status code and by what was sent
+ * (file or listing), body bytes, connections, and keeps HDR-style latency
+ * histograms of the time to first byte and the total request time. Every
+ * thread that records gets a block of counters of its own, padded so no two
+ * threads write to the same cache line; recording is a plain increment with
+ * no lock or atomic. The blocks are only added up when metrics_render() is
+ * called for a scrape, together with the file, stat and listing cache
+ * counters. A scrape may see a block one update behind.
+ *
+ * Latencies are recorded in microseconds into log-linear buckets: four per
+ * power of two, so a bucket's bounds are within 25% of each other, from
+ * 1 microsecond up to 2^27 microseconds (about 134 seconds).
+ */
+
+/**
+ * What a response sent, for the httpfileserv_content_total counter.
+ */
+typedef enum {
+    METRICS_CONTENT_FILE,     /**< A file (or a range or 304 of one), index files included */
+    METRICS_CONTENT_LISTING,  /**< A directory listing */
+    METRICS_CONTENT_COUNT
+} metrics_content;
+
+/**
+ * Sets up the registry of per-thread counters. Call once at startup, before
+ * any worker threads are started. Without it nothing is recorded.
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int metrics_init(void);
+
+/**
+ * Counts a request by its method. Call once per parsed request.
+ *
+ * @param method The request method
+ */
+void metrics_count_method(const http_slice* method);
+
+/**
+ * Counts a response by what it sends.
+ *
+ * @param content What was sent
+ */
+void metrics_count_content(metrics_content content);
+
+/**
+ * Counts a connection being opened (delta 1) or closed (delta -1). Call
+ * both on the same thread.
+ *
+ * @param delta 1 or -1
+ */
+void metrics_count_connection(int delta);
+
+/**
+ * Records a finished (or failed) response.
+ *
+ * @param status Status code (0 if no status line was queued)
+ * @param bytes Body bytes sent
+ * @param first_byte_us Microseconds until its first byte was sent, or -1 if none was
+ * @param total_us Microseconds until it was complete
+ */
+void metrics_record_response(int status, size_t bytes, long long first_byte_us, long long total_us);
+
+/**
+ * Adds up every thread's counters and formats them, with the cache and
+ * filesystem pool counters, in the Prometheus text exposition format
+ * (version 0.0.4).
+ *
+ * @param length Receives the length of the text
+ * @return The text (free with free()), or NULL if out of memory
+ */
+char* metrics_render(size_t* length);
+
+#endif /* METRICS_H */
@@ -78,6 +78,11 @@ void platform_cleanup(void);
 /**
  * Send a file over a socket.
  * 
+ * Works with non-blocking sockets: if the socket buffer fills up, the
+ * function returns the number of bytes sent so far (or -1 with
+ * platform_socket_would_block() true if nothing could be sent) and
+ * *offset is advanced past exactly the bytes that were sent.
+ * 
  * @param out_fd The socket to send to
  * @param in_fd The file descriptor to read from
  * @param offset The offset to start from (can be NULL)
@@ -86,6 +91,16 @@ void platform_cleanup(void);
  */
 ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
 
+/**
+ * Chooses whether platform_sendfile() may use the kernel's zero-copy
+ * sendfile. With it off every transfer takes the read/write copy loop, so
+ * the two can be compared. On by default; where there is no kernel
+ * sendfile the copy loop is always used.
+ *
+ * @param enabled Non-zero to use the kernel sendfile where available
+ */
+void platform_set_zero_copy(int enabled);
+
 /**
  * Callback function for directory listing.
  * Called for each entry in a directory.
@@ -110,6 +125,72 @@ typedef int (*dir_entry_callback)(const char* name, int is_dir, size_t size,
  */
 int platform_list_directory(const char* path, dir_entry_callback callback, void* user_data);
 
+/**
+ * An open directory being read entry by entry.
+ */
+typedef struct platform_dir platform_dir;
+
+/**
+ * @brief One directory entry returned by platform_read_directory
+ */
+typedef struct {
+    const char* name;  /**< Entry name, valid until the next read or close */
+    int is_dir;        /**< 1 if the entry is a directory */
+    int is_link;       /**< 1 if the entry is a symbolic link (examined as its target) */
+    size_t size;       /**< Size in bytes */
+    time_t mtime;      /**< Last modification time */
+} platform_dir_entry;
+
+/**
+ * Open a directory for reading one entry at a time. Unlike
+ * platform_list_directory, the caller decides when to read the next entry,
+ * so a huge directory can be consumed in bounded memory and at its own pace.
+ * 
+ * @param path The directory to read
+ * @return The open directory, or NULL on failure
+ */
+platform_dir* platform_open_directory(const char* path);
+
+/**
+ * Read the next entry of a directory, skipping "." and "..".
+ * 
+ * @param dir The open directory
+ * @param entry Receives the entry
+ * @return 1 if an entry was read, 0 at the end of the directory, -1 on error
+ */
+int platform_read_directory(platform_dir* dir, platform_dir_entry* entry);
+
+/**
+ * Read the name of the next entry of a directory, skipping "." and "..",
+ * without examining the entry. Together with platform_stat_directory_entry
+ * this splits platform_read_directory in two, so the entries can be
+ * examined on several threads.
+ * 
+ * @param dir The open directory
+ * @param entry Receives the name, and is_dir and is_link if the directory
+ *              already tells (-1 otherwise); size and mtime are not set
+ * @return 1 if an entry was read, 0 at the end of the directory, -1 on error
+ */
+int platform_read_directory_name(platform_dir* dir, platform_dir_entry* entry);
+
+/**
+ * Fill in the metadata of an entry read with platform_read_directory_name.
+ * Safe to call from several threads at once for different entries of the
+ * same directory.
+ * 
+ * @param dir The open directory
+ * @param entry The entry; its name must stay valid during the call
+ * @return 0 on success, -1 if the entry cannot be examined (it may be gone)
+ */
+int platform_stat_directory_entry(platform_dir* dir, platform_dir_entry* entry);
+
+/**
+ * Close a directory opened with platform_open_directory.
+ * 
+ * @param dir The open directory (can be NULL)
+ */
+void platform_close_directory(platform_dir* dir);
+
 /**
  * Set a socket's blocking mode.
  * 
@@ -118,6 +199,21 @@ int platform_list_directory(const char* path, dir_entry_callback callback, void*
  */
 void platform_set_socket_blocking(int socket, int blocking);
 
+/**
+ * Check whether the last failed socket call only failed because a
+ * non-blocking socket was not ready (EAGAIN/EWOULDBLOCK).
+ *
+ * @return 1 if the operation would have blocked, 0 otherwise
+ */
+int platform_socket_would_block(void);
+
+/**
+ * Shut down and close a socket.
+ *
+ * @param socket The socket descriptor
+ */
+void platform_close_socket(int socket);
+
 /**
  * Set timeouts for socket operations.
  * 
@@ -126,6 +222,273 @@ void platform_set_socket_blocking(int socket, int blocking);
  */
 void platform_set_socket_timeouts(int socket, int seconds);
 
+/**
+ * Completion ring for asynchronous socket I/O (io_uring on Linux 6.1 and
+ * later). Operations are queued in user space and handed to the kernel
+ * together, in the same system call that waits for completions, so a busy
+ * loop makes one system call per batch instead of one per operation.
+ * Receives land in buffers registered with the ring rather than in memory
+ * passed with each operation. A ring must only be used by the thread that
+ * created it. Where no ring is available platform_ring_create() fails, and
+ * callers use readiness-based I/O instead.
+ */
+typedef struct platform_ring platform_ring;
+
+/**
+ * Operations a completion can be for.
+ */
+typedef enum {
+    PLATFORM_RING_ACCEPT,  /**< Multishot accept: one completion per accepted socket */
+    PLATFORM_RING_RECV,    /**< Receive into a registered buffer */
+    PLATFORM_RING_POLL,    /**< One-shot readiness poll */
+    PLATFORM_RING_CANCEL   /**< Cancellation (its completion carries no tag) */
+} platform_ring_op;
+
+/**
+ * @brief A completed ring operation
+ */
+typedef struct {
+    platform_ring_op op;  /**< The operation */
+    void* tag;            /**< Tag the operation was queued with */
+    int result;           /**< Accepted socket, bytes received (0 at end of stream) or ready events; -errno on failure */
+    int more;             /**< Non-zero if a multishot operation stays queued */
+    const char* data;     /**< Receive: the bytes, in a registered buffer */
+    int buffer;           /**< Receive: buffer to hand back with platform_ring_recycle() (-1 if none) */
+} platform_ring_event;
+
+/**
+ * Create a ring and register its receive buffers.
+ *
+ * @param entries Operations that can be queued between waits
+ * @param buffers Number of receive buffers (a power of two)
+ * @param buffer_size Size of each receive buffer
+ * @return The ring, or NULL if the kernel (or platform) has none to offer
+ */
+platform_ring* platform_ring_create(unsigned entries, unsigned buffers, size_t buffer_size);
+
+/**
+ * Destroy a ring, dropping queued operations and their buffers.
+ *
+ * @param ring The ring (can be NULL)
+ */
+void platform_ring_destroy(platform_ring* ring);
+
+/**
+ * Queue a multishot accept on a listening socket. Accepted sockets are
+ * non-blocking and close-on-exec.
+ *
+ * Tags are handed back in completions; they must be aligned to 8 bytes
+ * (any pointer returned by malloc is).
+ *
+ * @param ring The ring
+ * @param socket The listening socket
+ * @param tag Tag for its completions
+ * @return 0 on success, non-zero if the queue is full
+ */
+int platform_ring_accept(platform_ring* ring, int socket, void* tag);
+
+/**
+ * Queue a receive of at most max_length bytes into one of the registered
+ * buffers. It completes with -ENOBUFS if every buffer is in use.
+ *
+ * @param ring The ring
+ * @param socket The socket
+ * @param max_length Most bytes to receive
+ * @param tag Tag for its completion
+ * @return 0 on success, non-zero if the queue is full
+ */
+int platform_ring_recv(platform_ring* ring, int socket, size_t max_length, void* tag);
+
+/**
+ * Queue a one-shot poll for a descriptor to become readable or writable.
+ *
+ * @param ring The ring
+ * @param fd The descriptor
+ * @param writable 1 to wait for writability, 0 for readability
+ * @param tag Tag for its completion
+ * @return 0 on success, non-zero if the queue is full
+ */
+int platform_ring_poll(platform_ring* ring, int fd, int writable, void* tag);
+
+/**
+ * Queue the cancellation of every operation on a descriptor. Each one
+ * still completes (with -ECANCELED unless it had already finished).
+ *
+ * @param ring The ring
+ * @param fd The descriptor
+ * @return 0 on success, non-zero if the queue is full
+ */
+int platform_ring_cancel(platform_ring* ring, int fd);
+
+/**
+ * Hand the queued operations to the kernel and collect completions,
+ * waiting for at least one if none are ready.
+ *
+ * @param ring The ring
+ * @param events Receives the completions
+ * @param max_events Size of events
+ * @param timeout_ms Longest wait in milliseconds
+ * @return Number of completions (0 on timeout or interruption), or -1 on failure
+ */
+int platform_ring_wait(platform_ring* ring, platform_ring_event* events, int max_events, int timeout_ms);
+
+/**
+ * Hand a receive buffer back to the ring once its bytes have been used.
+ *
+ * @param ring The ring
+ * @param buffer The buffer from the receive's completion
+ */
+void platform_ring_recycle(platform_ring* ring, int buffer);
+
+/**
+ * Entry point for a thread started with platform_thread_create.
+ *
+ * @param arg The argument passed to platform_thread_create
+ */
+typedef void (*platform_thread_func)(void* arg);
+
+/**
+ * Start a detached thread.
+ *
+ * @param func The function to run on the new thread
+ * @param arg Argument passed to func
+ * @return 0 on success, non-zero on failure
+ */
+int platform_thread_create(platform_thread_func func, void* arg);
+
+/**
+ * Opaque mutex for data shared between worker threads.
+ */
+typedef struct platform_mutex platform_mutex;
+
+/**
+ * Create a mutex.
+ *
+ * @return The new mutex, or NULL on failure
+ */
+platform_mutex* platform_mutex_create(void);
+
+/**
+ * Lock a mutex, waiting until it is available.
+ *
+ * @param mutex The mutex
+ */
+void platform_mutex_lock(platform_mutex* mutex);
+
+/**
+ * Unlock a mutex held by the calling thread.
+ *
+ * @param mutex The mutex
+ */
+void platform_mutex_unlock(platform_mutex* mutex);
+
+/**
+ * Destroy a mutex that is no longer locked or used.
+ *
+ * @param mutex The mutex (can be NULL)
+ */
+void platform_mutex_destroy(platform_mutex* mutex);
+
+/**
+ * Opaque condition variable, used with a platform_mutex.
+ */
+typedef struct platform_cond platform_cond;
+
+/**
+ * Create a condition variable.
+ *
+ * @return The new condition variable, or NULL on failure
+ */
+platform_cond* platform_cond_create(void);
+
+/**
+ * Atomically unlock a mutex and wait until the condition variable is
+ * signalled, then lock the mutex again. Wakeups can be spurious, so the
+ * caller re-checks its condition in a loop.
+ *
+ * @param cond The condition variable
+ * @param mutex The mutex, locked by the calling thread
+ */
+void platform_cond_wait(platform_cond* cond, platform_mutex* mutex);
+
+/**
+ * Wake all threads waiting on a condition variable.
+ *
+ * @param cond The condition variable
+ */
+void platform_cond_broadcast(platform_cond* cond);
+
+/**
+ * Destroy a condition variable no thread waits on.
+ *
+ * @param cond The condition variable (can be NULL)
+ */
+void platform_cond_destroy(platform_cond* cond);
+
+/* Storage class of a variable with one instance per thread */
+#ifdef _MSC_VER
+#define PLATFORM_THREAD_LOCAL __declspec(thread)
+#else
+#define PLATFORM_THREAD_LOCAL __thread
+#endif
+
+/**
+ * Read a value another thread published with platform_atomic_store(). Writes
+ * that thread made before publishing the value are visible afterwards.
+ *
+ * @param value The shared value
+ * @return The value
+ */
+size_t platform_atomic_load(const volatile size_t* value);
+
+/**
+ * Publish a value to other threads. Writes made before it are visible to a
+ * thread that reads the value with platform_atomic_load().
+ *
+ * @param value The shared value
+ * @param new_value The value to store
+ */
+void platform_atomic_store(volatile size_t* value, size_t new_value);
+
+/**
+ * Add to a value shared by several threads, as one indivisible step that is
+ * ordered with every other atomic operation. Pass (size_t)-1 to subtract one.
+ *
+ * @param value The shared value
+ * @param delta The amount to add
+ * @return The value before the addition
+ */
+size_t platform_atomic_add(volatile size_t* value, size_t delta);
+
+/**
+ * Microseconds on a monotonic clock, for measuring durations. Cheap enough
+ * to call for every request (no syscall where the clock is read in user
+ * space, as with the vDSO on Linux).
+ *
+ * @return Microseconds since an arbitrary starting point
+ */
+long long platform_monotonic_us(void);
+
+/**
+ * Fill a buffer with random bytes from the operating system's
+ * cryptographically secure generator.
+ *
+ * @param buffer Receives the bytes
+ * @param length Number of bytes
+ * @return 0 on success, non-zero if no random source could be read
+ */
+int platform_random_bytes(void* buffer, size_t length);
+
+/**
+ * Format the IP address of a socket address filled in by accept() as text,
+ * without the port. IPv4-mapped IPv6 addresses are shown in IPv4 form.
+ *
+ * @param address The address (a struct sockaddr of any family)
+ * @param buffer Receives the text ("-" for an unknown family)
+ * @param size Size of buffer
+ */
+void platform_format_address(const void* address, char* buffer, size_t size);
+
 /**
  * Sleep for a specified number of milliseconds.
  * 
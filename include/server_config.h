@@ -0,0 +1,125 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+/**
+ * Runtime configuration for the HTTP file server.
+ *
+ * Options can be set from the command line (--name value or --name=value)
+ * or through set_server_option() when used as a library. All options have
+ * defaults, so the server runs without any of them.
+ */
+
+/* Default number of worker threads */
+#define DEFAULT_WORKERS 1
+
+/* Upper bound on worker threads */
+#define MAX_WORKERS 256
+
+/* Default seconds an idle keep-alive connection is kept open */
+#define DEFAULT_KEEPALIVE_TIMEOUT 15
+
+/* Default number of requests served on one connection before it is closed */
+#define DEFAULT_MAX_REQUESTS 100
+
+/* Default limit on the request line plus headers, in bytes */
+#define DEFAULT_MAX_HEADER_SIZE 8192
+
+/* Default limit on the number of request headers */
+#define DEFAULT_MAX_HEADERS 64
+
+/* Default number of open files kept by the file cache */
+#define DEFAULT_FILE_CACHE_SIZE 256
+
+/* Default seconds a cached file is trusted before it is checked again */
+#define DEFAULT_FILE_CACHE_TTL 5
+
+/* Default memory limit of the metadata (stat) cache, in megabytes */
+#define DEFAULT_STAT_CACHE_MEMORY 16
+
+/* Default memory limit of the rendered listing cache, in megabytes */
+#define DEFAULT_LISTING_CACHE_MEMORY 8
+
+/* Default number of threads examining directory entries in parallel (0: none) */
+#define DEFAULT_STAT_THREADS 0
+
+/* Upper bound on stat threads */
+#define MAX_STAT_THREADS 64
+
+/* Default number of threads doing blocking filesystem work (0: none) */
+#define DEFAULT_FS_THREADS 4
+
+/* Upper bound on filesystem threads */
+#define MAX_FS_THREADS 64
+
+/* Default number of requests allowed to wait for a filesystem thread */
+#define DEFAULT_FS_QUEUE_DEPTH 1024
+
+/* Default number of entries above which a directory listing is streamed */
+#define DEFAULT_LISTING_STREAM_THRESHOLD 1000
+
+/* Default (and largest) number of entries on a page of a sorted listing */
+#define DEFAULT_LISTING_PAGE_SIZE 1000
+
+/* Default index file names, tried in order before a directory is listed */
+#define DEFAULT_INDEX_FILES "index.html,index.htm"
+
+/* Default path of the metrics endpoint */
+#define DEFAULT_METRICS_PATH "/_metrics"
+
+/* Default lowest level logged (see log.h) */
+#define DEFAULT_LOG_LEVEL LOG_LEVEL_INFO
+
+/* Upper bound on index file names */
+#define MAX_INDEX_NAMES 8
+
+/**
+ * @brief Server configuration values
+ */
+typedef struct {
+    int workers;               /**< Number of worker threads, each with its own listener and event loop */
+    int io_backend;            /**< I/O backend of the event loops (an event_loop_backend value) */
+    int sendfile;              /**< Whether files are sent with the kernel sendfile where available */
+    int keepalive_timeout;     /**< Seconds an idle connection waits for its next request */
+    int max_requests;          /**< Requests per connection before it is closed (1 disables keep-alive) */
+    int max_header_size;       /**< Largest accepted request head in bytes (also the per-connection buffer size) */
+    int max_headers;           /**< Largest accepted number of request headers */
+    int file_cache_size;       /**< Open files kept by the file cache (0 disables it) */
+    int file_cache_ttl;        /**< Seconds before a cached file is revalidated */
+    int stat_cache_memory;     /**< Megabytes the metadata cache may use (0 disables it) */
+    int listing_cache_memory;  /**< Megabytes of rendered listings kept (0 disables the cache) */
+    int listing_stream_threshold; /**< Entries above which listings are streamed (0 disables streaming) */
+    int stat_threads;          /**< Threads examining directory entries in parallel (0 disables them) */
+    int fs_threads;            /**< Threads doing blocking filesystem work for the event loops (0 disables them) */
+    int fs_queue_depth;        /**< Requests allowed to wait for a filesystem thread before 503s are sent */
+    int listing_page_size;     /**< Default and largest number of entries on a page of a sorted listing */
+    const char* template_path; /**< Directory listing template file, or NULL for the embedded one */
+    const char* const* index_files; /**< File names served instead of a directory's listing, in order */
+    int index_file_count;      /**< Number of index_files (0 always lists directories) */
+    int log_level;             /**< Lowest level logged (a LOG_LEVEL_* value) */
+    const char* access_log_path; /**< Access log file, or NULL for no access log */
+    int access_log_format;     /**< Access log record format (an access_log_format value) */
+    const char* metrics_path;  /**< Path answered with the metrics, or NULL for no metrics */
+} server_config;
+
+/**
+ * Returns the current server configuration.
+ *
+ * @return Pointer to the configuration (never NULL)
+ */
+const server_config* server_config_get(void);
+
+/**
+ * Sets a configuration option by name.
+ *
+ * @param name The option name (e.g. "workers")
+ * @param value The option value as a string
+ * @return 0 on success, non-zero if the option is unknown or the value is invalid
+ */
+int server_config_set(const char* name, const char* value);
+
+/**
+ * Prints the supported options and their defaults.
+ */
+void server_config_print_usage(void);
+
+#endif /* SERVER_CONFIG_H */
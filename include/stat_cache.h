@@ -0,0 +1,133 @@
+#ifndef STAT_CACHE_H
+#define STAT_CACHE_H
+
+#include "platform.h"
+#include <sys/stat.h>
+
+/**
+ * Metadata (stat) cache.
+ *
+ * Remembers the result of stat() for paths the server has looked at,
+ * including paths that do not exist, and the entries of directories it has
+ * listed together with their type, size and mtime. Repeated requests and
+ * listings of unchanged content are then answered without touching the
+ * filesystem.
+ *
+ * The cache is kept coherent by inotify: every cached path holds a watch on
+ * its parent directory (and a directory's listing a watch on the directory
+ * itself), and any event under a watch drops what depends on it, including
+ * the matching file_cache entries. A symlink's target can change without
+ * an event under those watches, so a path that is a symlink, and the
+ * listing of a directory with symlinks in it, are never cached. Memory use
+ * is capped; the least recently used items are evicted first. Where inotify is not available (or a watch
+ * cannot be added) nothing is cached and every lookup goes to the
+ * filesystem.
+ *
+ * Paths are used as given, apart from repeated and trailing separators;
+ * callers should pass the paths they resolved with normalize_path().
+ */
+
+/**
+ * @brief Cache counters
+ */
+typedef struct {
+    unsigned long hits;           /**< Lookups answered from the cache */
+    unsigned long misses;         /**< Lookups that went to the filesystem */
+    unsigned long invalidations;  /**< Items dropped because of a change event */
+    unsigned long evictions;      /**< Items dropped to stay within the memory limit */
+    size_t entries;               /**< Items currently cached */
+    size_t memory;                /**< Bytes used by cached items */
+    size_t watches;               /**< Directories currently watched */
+} stat_cache_stats;
+
+/**
+ * Sets up the cache and starts the thread that reads change events. Call
+ * once at startup, before any worker threads are started. Without it (or
+ * with max_memory 0) every lookup goes to the filesystem.
+ *
+ * @param max_memory Bytes the cached items may use (0 disables caching)
+ * @return 0 on success, non-zero on failure
+ */
+int stat_cache_init(size_t max_memory);
+
+/**
+ * Looks up the metadata of a path, like stat().
+ *
+ * @param path The resolved filesystem path
+ * @param st Receives the metadata
+ * @return 0 on success, -1 if the path does not exist or cannot be examined
+ */
+int stat_cache_stat(const char* path, struct stat* st);
+
+/**
+ * Looks up the metadata of a path only if it is cached, never touching the
+ * filesystem. A miss is not counted: the caller is expected to ask
+ * stat_cache_stat() later.
+ *
+ * @param path The resolved filesystem path
+ * @param st Receives the metadata
+ * @return 0 on success, -1 if the path is cached as missing (errno is set
+ *         as stat_cache_stat() would), 1 if it is not cached
+ */
+int stat_cache_lookup(const char* path, struct stat* st);
+
+/**
+ * Tells whether changes to a directory's entries are being reported, which
+ * is the case while its snapshot is cached: the listing cache is told
+ * through listing_cache_invalidate() about every change until the snapshot
+ * is dropped. Never true where the cache is disabled.
+ *
+ * @param path The directory
+ * @return 1 if the directory's entries are watched, 0 otherwise
+ */
+int stat_cache_is_watched(const char* path);
+
+/**
+ * Lists a directory like platform_list_directory(), from a cached snapshot
+ * of its entries when the directory has not changed since it was last read.
+ * A directory whose snapshot would take more than an eighth of the cache is
+ * listed straight from the filesystem instead.
+ *
+ * @param path The directory to list
+ * @param callback The callback to call for each entry
+ * @param user_data User-defined data to pass to the callback
+ * @return 0 on success, non-zero on failure
+ */
+int stat_cache_list_directory(const char* path, dir_entry_callback callback, void* user_data);
+
+/**
+ * Keys a listing can be sorted by. Ties are broken by name.
+ */
+typedef enum {
+    STAT_CACHE_SORT_NAME,   /**< Byte order of the names */
+    STAT_CACHE_SORT_SIZE,   /**< Size in bytes */
+    STAT_CACHE_SORT_MTIME,  /**< Last modification time */
+    STAT_CACHE_SORT_COUNT
+} stat_cache_sort;
+
+/**
+ * Lists a page of a directory's entries in sorted order. The sorted order
+ * is kept with the cached snapshot, so further pages (and further requests
+ * for the unchanged directory) are served without sorting again.
+ *
+ * @param path The directory to list
+ * @param sort The key to sort by
+ * @param descending Non-zero to list in descending order
+ * @param offset Number of sorted entries to skip
+ * @param limit Largest number of entries to list (0 for no limit)
+ * @param callback The callback to call for each entry of the page
+ * @param user_data User-defined data to pass to the callback
+ * @param total Receives the number of entries in the directory
+ * @return 0 on success, non-zero on failure
+ */
+int stat_cache_list_sorted(const char* path, stat_cache_sort sort, int descending, size_t offset,
+                           size_t limit, dir_entry_callback callback, void* user_data, size_t* total);
+
+/**
+ * Copies the current counters.
+ *
+ * @param stats Receives the counters
+ */
+void stat_cache_get_stats(stat_cache_stats* stats);
+
+#endif /* STAT_CACHE_H */
@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+
 /**
  * Decodes a URL-encoded string.
  * 
@@ -17,4 +19,24 @@ char* url_decode(const char* str);
  */
 const char* get_mime_type(const char* path);
 
+/**
+ * Normalizes a filesystem path in place: repeated separators are collapsed
+ * and "." segments are removed, so each file has one spelling that can be
+ * used as a cache key. A trailing separator is kept.
+ * 
+ * @param path The path to normalize
+ */
+void normalize_path(char* path);
+
+/**
+ * Measures the well-formed UTF-8 sequence a byte string starts with.
+ * Overlong forms, surrogates and code points above U+10FFFF are not
+ * well-formed, and neither is a sequence cut off by the end of the string.
+ * 
+ * @param text The bytes
+ * @param length Number of bytes available at text
+ * @return 1 to 4, or 0 if the first byte does not start a well-formed sequence
+ */
+int utf8_sequence_length(const char* text, size_t length);
+
 #endif /* UTILS_H */ 
\ No newline at end of file
@@ -0,0 +1,489 @@
+#include "access_log.h"
+#include "platform.h"
+#include "log.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define close _close
+#define LOG_FILE_FLAGS (_O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY)
+#else
+#include <sys/uio.h>
+#define LOG_FILE_FLAGS (O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC)
+#endif
+
+/**
+ * This file contains the access log. See access_log.h.
+ *
+ * Each worker's ring is a single-producer, single-consumer byte queue of
+ * complete lines: the worker only advances head, the writer thread only
+ * advances tail, and both only grow, so head - tail bytes are queued. A line
+ * may wrap around the end of the ring; the writer then hands writev() the
+ * two pieces.
+ */
+
+/* Largest number of pieces handed to one writev() (two per ring) */
+#define MAX_IOVECS 64
+
+/* Longest pause of the writer thread while there is nothing to write */
+#define MAX_IDLE_MS 32
+
+/* Cache line size, to keep head and tail apart */
+#define CACHE_LINE 64
+
+/*
+ * Most bytes each request-supplied field may take in a record, escaped.
+ * Together with the room for the fixed parts (timestamp, address, numbers,
+ * punctuation and the newline, under 300 bytes in either format) they add
+ * up to ACCESS_LOG_MAX_RECORD, so a record always ends complete.
+ */
+#define FIXED_ROOM 512
+#define METHOD_BUDGET 64
+#define VERSION_BUDGET 32
+#define TARGET_BUDGET 2048
+#define HEADER_BUDGET 720
+
+/**
+ * @brief A worker's ring of records
+ */
+typedef struct access_ring {
+    volatile size_t head;                       /**< Bytes ever queued (advanced by the owning thread) */
+    char head_padding[CACHE_LINE - sizeof(size_t)];
+    volatile size_t tail;                       /**< Bytes ever written (advanced by the writer thread) */
+    char tail_padding[CACHE_LINE - sizeof(size_t)];
+    volatile size_t dropped;                    /**< Records dropped because the ring was full */
+    size_t dropped_reported;                    /**< Writer thread: dropped records already reported */
+    struct access_ring* next;                   /**< Next ring in the registry */
+    char data[ACCESS_LOG_RING_SIZE];            /**< The queued lines */
+} access_ring;
+
+/**
+ * @brief The log file, the rings and the writer thread's state
+ */
+static struct {
+    int enabled;                /**< Whether access_log_init() succeeded */
+    access_log_format format;   /**< Record format */
+    const char* path;           /**< The log file (kept for reopening) */
+    int fd;                     /**< The open log file (writer thread only, after init) */
+    platform_mutex* lock;       /**< Protects the registry */
+    access_ring* rings;         /**< Every worker's ring, newest first */
+} access_log;
+
+/* Set by SIGHUP, cleared by the writer thread when it reopens the file */
+static volatile sig_atomic_t reopen_requested;
+
+/* The calling thread's ring, created on its first record */
+static PLATFORM_THREAD_LOCAL access_ring* thread_ring;
+
+/* The calling thread's formatted timestamp and the second it is for */
+static PLATFORM_THREAD_LOCAL time_t cached_second = -1;
+static PLATFORM_THREAD_LOCAL char cached_time[48];
+
+static const char* const format_names[] = { "combined", "json" };
+
+int access_log_parse_format(const char* name, int* format) {
+    for (int i = ACCESS_LOG_COMBINED; i <= ACCESS_LOG_JSON; i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            *format = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int access_log_enabled(void) {
+    return access_log.enabled;
+}
+
+/**
+ * @brief Returns the timestamp for the current second, formatting it once per second and thread
+ */
+static const char* current_time(void) {
+    static const char* const months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    time_t now = time(NULL);
+    if (now != cached_second) {
+        struct tm tm_buf;
+#ifdef _WIN32
+        gmtime_s(&tm_buf, &now);
+#else
+        gmtime_r(&now, &tm_buf);
+#endif
+        if (access_log.format == ACCESS_LOG_JSON) {
+            snprintf(cached_time, sizeof(cached_time), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+                     tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
+                     tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec);
+        } else {
+            snprintf(cached_time, sizeof(cached_time), "%02d/%s/%04d:%02d:%02d:%02d +0000",
+                     tm_buf.tm_mday, months[tm_buf.tm_mon], tm_buf.tm_year + 1900,
+                     tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec);
+        }
+        cached_second = now;
+    }
+    return cached_time;
+}
+
+/**
+ * @brief A record being formatted
+ */
+typedef struct {
+    char* data;       /**< The buffer (ACCESS_LOG_MAX_RECORD bytes) */
+    size_t length;    /**< Bytes used */
+} record;
+
+/**
+ * @brief Appends text as is, truncating at the end of the record
+ *
+ * The field budgets keep records from ever reaching the end; this only
+ * guards the buffer.
+ */
+static void append_raw(record* out, const char* text, size_t length) {
+    // Keep room for the newline
+    size_t room = ACCESS_LOG_MAX_RECORD - 1 - out->length;
+    if (length > room) {
+        length = room;
+    }
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+}
+
+/**
+ * @brief Appends a request-supplied value, escaping quotes, backslashes and control bytes
+ *
+ * A missing or empty value is written as "-" (in both formats, so fields are never empty).
+ * JSON text has to be UTF-8, so in that format each byte that is not part of a
+ * well-formed sequence becomes U+FFFD. A value is cut at the last escape or
+ * character that fits its budget, never inside one.
+ *
+ * @param budget Most bytes the escaped value may take
+ */
+static void append_escaped(record* out, const char* text, size_t length, size_t budget) {
+    char escaped[8];
+    size_t consumed;
+
+    if (!text || length == 0) {
+        append_raw(out, "-", 1);
+        return;
+    }
+    for (size_t i = 0; i < length; i += consumed) {
+        unsigned char c = (unsigned char)text[i];
+        const char* unit = text + i;
+        size_t unit_length = 1;
+        consumed = 1;
+        if (c == '"' || c == '\\') {
+            escaped[0] = '\\';
+            escaped[1] = (char)c;
+            unit = escaped;
+            unit_length = 2;
+        } else if (c < 0x20 || c == 0x7f) {
+            int n = access_log.format == ACCESS_LOG_JSON ? snprintf(escaped, sizeof(escaped), "\\u%04x", c)
+                                                         : snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            unit = escaped;
+            unit_length = (size_t)n;
+        } else if (c >= 0x80 && access_log.format == ACCESS_LOG_JSON) {
+            int n = utf8_sequence_length(text + i, length - i);
+            if (n == 0) {
+                unit = "\\ufffd";
+                unit_length = 6;
+            } else {
+                unit_length = consumed = (size_t)n;
+            }
+        }
+        if (unit_length > budget) {
+            return;
+        }
+        append_raw(out, unit, unit_length);
+        budget -= unit_length;
+    }
+}
+
+/**
+ * @brief Appends a header's value, escaped
+ */
+static void append_header(record* out, const http_request* request, const char* name) {
+    const http_slice* value = request->method.length ? http_request_header(request, name) : NULL;
+    append_escaped(out, value ? value->data : NULL, value ? value->length : 0, HEADER_BUDGET);
+}
+
+/**
+ * @brief Formats a connection's current request as one line
+ */
+static void format_request(record* out, const http_connection* conn) {
+    const http_request* request = &conn->parsed;
+    long long duration = conn->request_start ? platform_monotonic_us() - conn->request_start : 0;
+    const char* time_text = current_time();
+    char number[128];
+    int n;
+
+    if (access_log.format == ACCESS_LOG_JSON) {
+        append_raw(out, "{\"time\":\"", 9);
+        append_raw(out, time_text, strlen(time_text));
+        append_raw(out, "\",\"client\":\"", 12);
+        append_raw(out, conn->client_address, strlen(conn->client_address));
+        append_raw(out, "\",\"method\":\"", 12);
+        append_escaped(out, request->method.data, request->method.length, METHOD_BUDGET);
+        append_raw(out, "\",\"path\":\"", 10);
+        append_escaped(out, request->target.data, request->target.length, TARGET_BUDGET);
+        append_raw(out, "\",\"protocol\":\"", 14);
+        append_escaped(out, request->version.data, request->version.length, VERSION_BUDGET);
+        n = snprintf(number, sizeof(number), "\",\"status\":%d,\"bytes\":%zu,\"duration_us\":%lld,\"referer\":\"",
+                     conn->status, conn->bytes_sent, duration);
+        append_raw(out, number, (size_t)n);
+        append_header(out, request, "Referer");
+        append_raw(out, "\",\"user_agent\":\"", 16);
+        append_header(out, request, "User-Agent");
+        append_raw(out, "\"}", 2);
+    } else {
+        append_raw(out, conn->client_address, strlen(conn->client_address));
+        append_raw(out, " - - [", 6);
+        append_raw(out, time_text, strlen(time_text));
+        append_raw(out, "] \"", 3);
+        if (request->method.length) {
+            append_escaped(out, request->method.data, request->method.length, METHOD_BUDGET);
+            append_raw(out, " ", 1);
+            append_escaped(out, request->target.data, request->target.length, TARGET_BUDGET);
+            append_raw(out, " ", 1);
+            append_escaped(out, request->version.data, request->version.length, VERSION_BUDGET);
+        } else {
+            append_raw(out, "-", 1);
+        }
+        // Like %b, "-" for no body
+        if (conn->bytes_sent) {
+            n = snprintf(number, sizeof(number), "\" %d %zu \"", conn->status, conn->bytes_sent);
+        } else {
+            n = snprintf(number, sizeof(number), "\" %d - \"", conn->status);
+        }
+        append_raw(out, number, (size_t)n);
+        append_header(out, request, "Referer");
+        append_raw(out, "\" \"", 3);
+        append_header(out, request, "User-Agent");
+        n = snprintf(number, sizeof(number), "\" %lld", duration);
+        append_raw(out, number, (size_t)n);
+    }
+    out->data[out->length++] = '\n';
+}
+
+/**
+ * @brief Creates and registers the calling thread's ring
+ */
+static access_ring* register_ring(void) {
+    access_ring* ring = calloc(1, sizeof(access_ring));
+    if (!ring) {
+        return NULL;
+    }
+    platform_mutex_lock(access_log.lock);
+    ring->next = access_log.rings;
+    access_log.rings = ring;
+    platform_mutex_unlock(access_log.lock);
+    thread_ring = ring;
+    return ring;
+}
+
+void access_log_request(const http_connection* conn) {
+    if (!access_log.enabled) {
+        return;
+    }
+    access_ring* ring = thread_ring ? thread_ring : register_ring();
+    if (!ring) {
+        return;
+    }
+
+    char buffer[ACCESS_LOG_MAX_RECORD];
+    record line = { buffer, 0 };
+    format_request(&line, conn);
+
+    size_t head = ring->head;
+    if (head + line.length - platform_atomic_load(&ring->tail) > ACCESS_LOG_RING_SIZE) {
+        platform_atomic_store(&ring->dropped, ring->dropped + 1);
+        return;
+    }
+
+    // The line may wrap around the end of the ring
+    size_t offset = head % ACCESS_LOG_RING_SIZE;
+    size_t first = ACCESS_LOG_RING_SIZE - offset;
+    if (first > line.length) {
+        first = line.length;
+    }
+    memcpy(ring->data + offset, line.data, first);
+    memcpy(ring->data, line.data + first, line.length - first);
+    platform_atomic_store(&ring->head, head + line.length);
+}
+
+#ifdef SIGHUP
+/**
+ * @brief SIGHUP handler: asks the writer thread to reopen the file
+ */
+static void handle_sighup(int signal_number) {
+    (void)signal_number;
+    reopen_requested = 1;
+}
+#endif
+
+/**
+ * @brief Reopens the log file at its path, e.g. after it was rotated (writer thread)
+ */
+static void reopen_file(void) {
+    int fd = open(access_log.path, LOG_FILE_FLAGS, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to reopen access log '%s': %s\n", access_log.path, platform_get_error_string());
+        return;
+    }
+    close(access_log.fd);
+    access_log.fd = fd;
+    LOG_INFO("Reopened access log '%s'\n", access_log.path);
+}
+
+/**
+ * @brief Writes queued pieces to the file
+ *
+ * @return Bytes written, or -1 on error
+ */
+static long write_pieces(const char* const* bases, const size_t* lengths, int count) {
+#ifdef _WIN32
+    long total = 0;
+    for (int i = 0; i < count; i++) {
+        int written = _write(access_log.fd, bases[i], (unsigned int)lengths[i]);
+        if (written < 0) {
+            return total ? total : -1;
+        }
+        total += written;
+        if ((size_t)written < lengths[i]) {
+            break;
+        }
+    }
+    return total;
+#else
+    struct iovec iov[MAX_IOVECS];
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = (void*)bases[i];
+        iov[i].iov_len = lengths[i];
+    }
+    return (long)writev(access_log.fd, iov, count);
+#endif
+}
+
+/**
+ * @brief Writes what every ring holds with as few writes as possible
+ *
+ * @return Non-zero if anything was written
+ */
+static int drain_rings(void) {
+    const char* bases[MAX_IOVECS];
+    size_t lengths[MAX_IOVECS];
+    access_ring* owners[MAX_IOVECS];
+    int count = 0;
+
+    platform_mutex_lock(access_log.lock);
+    access_ring* ring = access_log.rings;
+    platform_mutex_unlock(access_log.lock);
+
+    // Rings are only ever added at the front, so the list can be walked
+    // without the lock. Gather up to two pieces per ring
+    for (; ring && count + 2 <= MAX_IOVECS; ring = ring->next) {
+        size_t head = platform_atomic_load(&ring->head);
+        size_t tail = ring->tail;
+        while (tail != head && count < MAX_IOVECS) {
+            size_t offset = tail % ACCESS_LOG_RING_SIZE;
+            size_t length = head - tail;
+            if (length > ACCESS_LOG_RING_SIZE - offset) {
+                length = ACCESS_LOG_RING_SIZE - offset;
+            }
+            bases[count] = ring->data + offset;
+            lengths[count] = length;
+            owners[count] = ring;
+            count++;
+            tail += length;
+        }
+
+        size_t dropped = platform_atomic_load(&ring->dropped);
+        if (dropped != ring->dropped_reported) {
+            LOG_WARNING("Access log buffer full, %zu records dropped\n", dropped - ring->dropped_reported);
+            ring->dropped_reported = dropped;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    long written = write_pieces(bases, lengths, count);
+    if (written < 0) {
+        // Drop the records rather than retry forever
+        LOG_ERROR("Failed to write access log: %s\n", platform_get_error_string());
+        written = 0;
+        for (int i = 0; i < count; i++) {
+            written += (long)lengths[i];
+        }
+    }
+
+    // Hand the written bytes back to their rings; a short write leaves the
+    // rest queued for the next pass
+    for (int i = 0; i < count && written > 0; i++) {
+        size_t done = (size_t)written < lengths[i] ? (size_t)written : lengths[i];
+        platform_atomic_store(&owners[i]->tail, owners[i]->tail + done);
+        written -= (long)done;
+        if (done < lengths[i]) {
+            break;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Writer thread: drains the rings, pausing longer the longer they stay empty
+ */
+static void writer_thread(void* arg) {
+    int idle_ms = 1;
+    (void)arg;
+
+    for (;;) {
+        if (reopen_requested) {
+            reopen_requested = 0;
+            reopen_file();
+        }
+        if (drain_rings()) {
+            idle_ms = 1;
+        } else {
+            platform_sleep_ms(idle_ms);
+            if (idle_ms < MAX_IDLE_MS) {
+                idle_ms *= 2;
+            }
+        }
+    }
+}
+
+int access_log_init(const char* path, access_log_format format) {
+    access_log.format = format;
+    access_log.path = path;
+    access_log.fd = open(path, LOG_FILE_FLAGS, 0644);
+    if (access_log.fd < 0) {
+        LOG_ERROR("Failed to open access log '%s': %s\n", path, platform_get_error_string());
+        return 1;
+    }
+
+    access_log.lock = platform_mutex_create();
+    if (!access_log.lock || platform_thread_create(writer_thread, NULL) != 0) {
+        platform_mutex_destroy(access_log.lock);
+        access_log.lock = NULL;
+        close(access_log.fd);
+        return 1;
+    }
+
+#ifdef SIGHUP
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_sighup;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+#endif
+
+    access_log.enabled = 1;
+    LOG_INFO("Access log: %s (%s)\n", path, format_names[format]);
+    return 0;
+}
@@ -0,0 +1,455 @@
+#include "connection.h"
+#include "platform.h"
+#include "server_config.h"
+#include "log.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Platform-specific includes for sockets and file operations
+#ifdef _WIN32
+#include <winsock2.h>
+#include <io.h>
+#define close _close
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/**
+ * This file contains the per-connection state machine helpers: reading the
+ * request into the connection buffer and streaming queued output segments.
+ */
+
+http_connection* connection_create(int fd) {
+    http_connection* conn = malloc(sizeof(http_connection));
+    if (!conn) {
+        return NULL;
+    }
+
+    // The request buffer is exactly as large as the largest head we accept
+    conn->request_capacity = server_config_get()->max_header_size;
+    conn->request = malloc(conn->request_capacity);
+    if (!conn->request) {
+        free(conn);
+        return NULL;
+    }
+
+    conn->fd = fd;
+    conn->state = CONN_READING_REQUEST;
+    conn->request_length = 0;
+    http_request_init(&conn->parsed);
+    conn->parse_result = HTTP_PARSE_INCOMPLETE;
+    conn->out_head = NULL;
+    conn->out_tail = NULL;
+    conn->keep_alive = 0;
+    conn->head_only = 0;
+    conn->requests_served = 0;
+    conn->max_requests = 1;
+    conn->last_active = time(NULL);
+    strcpy(conn->client_address, "-");
+    conn->status = 0;
+    conn->bytes_sent = 0;
+    conn->request_start = 0;
+    conn->first_byte_time = 0;
+    conn->fs_mode = CONN_FS_INLINE;
+    conn->external_input = 0;
+    conn->ring_ops = 0;
+    conn->prev = NULL;
+    conn->next = NULL;
+    metrics_count_connection(1);
+    return conn;
+}
+
+static void free_segment(output_segment* segment) {
+    if (segment->type == SEGMENT_FILE) {
+        if (segment->release) {
+            segment->release(segment->release_context);
+        } else if (close(segment->file_fd) < 0) {
+            LOG_ERROR("Failed to close file (fd=%d) - %s\n", segment->file_fd, platform_get_error_string());
+        }
+    } else if (segment->type == SEGMENT_STREAM) {
+        free(segment->data);
+        segment->release(segment->release_context);
+    } else if (segment->release) {
+        segment->release(segment->release_context);
+    } else {
+        free(segment->data);
+    }
+    free(segment);
+}
+
+void connection_free(http_connection* conn) {
+    output_segment* segment = conn->out_head;
+    while (segment) {
+        output_segment* next = segment->next;
+        free_segment(segment);
+        segment = next;
+    }
+    free(conn->request);
+    free(conn);
+    metrics_count_connection(-1);
+}
+
+void connection_close(http_connection* conn) {
+    LOG_DEBUG("Closing connection (fd=%d)...\n", conn->fd);
+    platform_close_socket(conn->fd);
+    connection_free(conn);
+}
+
+static void append_segment(http_connection* conn, output_segment* segment) {
+    segment->next = NULL;
+    if (conn->out_tail) {
+        conn->out_tail->next = segment;
+    } else {
+        conn->out_head = segment;
+    }
+    conn->out_tail = segment;
+}
+
+static int queue_memory(http_connection* conn, char* data, size_t length, int is_header) {
+    output_segment* segment = malloc(sizeof(output_segment));
+    if (!segment) {
+        free(data);
+        return 1;
+    }
+
+    segment->type = SEGMENT_MEMORY;
+    segment->is_header = is_header;
+    segment->data = data;
+    segment->length = length;
+    segment->sent = 0;
+    segment->produce = NULL;
+    segment->release = NULL;
+    segment->release_context = NULL;
+    append_segment(conn, segment);
+    return 0;
+}
+
+static char* copy_bytes(const char* data, size_t length) {
+    char* copy = malloc(length > 0 ? length : 1);
+    if (copy && length > 0) {
+        memcpy(copy, data, length);
+    }
+    return copy;
+}
+
+int connection_queue_copy(http_connection* conn, const char* data, size_t length) {
+    if (conn->head_only) {
+        return 0;
+    }
+    char* copy = copy_bytes(data, length);
+    if (!copy) {
+        return 1;
+    }
+    return queue_memory(conn, copy, length, 0);
+}
+
+int connection_queue_headers(http_connection* conn, const char* data, size_t length) {
+    // "HTTP/1.1 200 OK"
+    if (length > 12 && memcmp(data, "HTTP/1.", 7) == 0) {
+        conn->status = (data[9] - '0') * 100 + (data[10] - '0') * 10 + (data[11] - '0');
+    }
+
+    char* copy = copy_bytes(data, length);
+    if (!copy) {
+        return 1;
+    }
+    return queue_memory(conn, copy, length, 1);
+}
+
+int connection_queue_owned(http_connection* conn, char* data, size_t length) {
+    if (conn->head_only) {
+        free(data);
+        return 0;
+    }
+    return queue_memory(conn, data, length, 0);
+}
+
+int connection_queue_shared(http_connection* conn, const char* data, size_t length,
+                            segment_release_func release, void* context) {
+    output_segment* segment = NULL;
+    if (!conn->head_only) {
+        segment = malloc(sizeof(output_segment));
+    }
+    if (!segment) {
+        release(context);
+        return conn->head_only ? 0 : 1;
+    }
+
+    segment->type = SEGMENT_MEMORY;
+    segment->is_header = 0;
+    segment->data = (char*)data;
+    segment->length = length;
+    segment->sent = 0;
+    segment->produce = NULL;
+    segment->release = release;
+    segment->release_context = context;
+    append_segment(conn, segment);
+    return 0;
+}
+
+int connection_queue_stream(http_connection* conn, segment_produce_func produce,
+                            segment_release_func release, void* context) {
+    output_segment* segment = NULL;
+    char* buffer = NULL;
+    if (!conn->head_only) {
+        segment = malloc(sizeof(output_segment));
+        buffer = malloc(CONNECTION_STREAM_BUFFER_SIZE);
+    }
+    if (!segment || !buffer) {
+        free(segment);
+        free(buffer);
+        release(context);
+        return conn->head_only ? 0 : 1;
+    }
+
+    segment->type = SEGMENT_STREAM;
+    segment->is_header = 0;
+    segment->data = buffer;
+    segment->length = 0;
+    segment->sent = 0;
+    segment->produce = produce;
+    segment->release = release;
+    segment->release_context = context;
+    append_segment(conn, segment);
+    return 0;
+}
+
+/**
+ * @brief Appends a file segment; the descriptor is owned unless release is set
+ */
+static int queue_file(http_connection* conn, int file_fd, off_t offset, size_t length,
+                      segment_release_func release, void* context) {
+    output_segment* segment = NULL;
+    if (!conn->head_only) {
+        segment = malloc(sizeof(output_segment));
+    }
+    if (!segment) {
+        if (release) {
+            release(context);
+        } else {
+            close(file_fd);
+        }
+        return conn->head_only ? 0 : 1;
+    }
+
+    segment->type = SEGMENT_FILE;
+    segment->is_header = 0;
+    segment->data = NULL;
+    segment->file_fd = file_fd;
+    segment->offset = offset;
+    segment->remaining = length;
+    segment->produce = NULL;
+    segment->release = release;
+    segment->release_context = context;
+    append_segment(conn, segment);
+    return 0;
+}
+
+int connection_queue_file(http_connection* conn, int file_fd, off_t offset, size_t length) {
+    return queue_file(conn, file_fd, offset, length, NULL, NULL);
+}
+
+int connection_queue_shared_file(http_connection* conn, int file_fd, off_t offset, size_t length,
+                                 segment_release_func release, void* context) {
+    return queue_file(conn, file_fd, offset, length, release, context);
+}
+
+/**
+ * @brief Runs the parser over the bytes received so far
+ *
+ * @param conn The connection
+ * @return 1 if the parser reached a verdict (complete head or error), 0 if it needs more bytes
+ */
+static int parse_request(http_connection* conn) {
+    const server_config* config = server_config_get();
+    http_parser_limits limits;
+    limits.max_head_size = conn->request_capacity;
+    limits.max_headers = config->max_headers;
+    limits.max_target_length = MAX_PATH_SIZE - 1;
+
+    conn->parse_result = http_parse_request(&conn->parsed, conn->request, conn->request_length, &limits);
+    return conn->parse_result != HTTP_PARSE_INCOMPLETE;
+}
+
+connection_io_result connection_read_request(http_connection* conn) {
+    // A pipelined request may already be waiting in the buffer
+    if (conn->request_length > 0 && parse_request(conn)) {
+        return CONN_IO_DONE;
+    }
+
+    while (conn->request_length < conn->request_capacity) {
+        if (conn->external_input) {
+            // The event loop appends bytes as they arrive
+            return CONN_IO_WOULD_BLOCK;
+        }
+        char* dest = conn->request + conn->request_length;
+        size_t space = conn->request_capacity - conn->request_length;
+
+        #ifdef _WIN32
+        int bytes_read = recv(conn->fd, dest, (int)space, 0);
+        #else
+        ssize_t bytes_read = recv(conn->fd, dest, space, 0);
+        #endif
+
+        if (bytes_read == 0) {
+            LOG_DEBUG("Client closed connection (fd=%d)\n", conn->fd);
+            return CONN_IO_ERROR;
+        }
+        if (bytes_read < 0) {
+            if (platform_socket_would_block()) {
+                return CONN_IO_WOULD_BLOCK;
+            }
+            LOG_ERROR("recv error: %s\n", platform_get_error_string());
+            return CONN_IO_ERROR;
+        }
+
+        conn->request_length += bytes_read;
+        if (parse_request(conn)) {
+            return CONN_IO_DONE;
+        }
+    }
+
+    // The parser reports an over-long head before the buffer fills up, so
+    // this is only reached if the limits and buffer size disagree
+    conn->parse_result = HTTP_PARSE_TOO_LARGE;
+    return CONN_IO_DONE;
+}
+
+int connection_receive(http_connection* conn, const char* data, size_t length) {
+    if (length > conn->request_capacity - conn->request_length) {
+        return 1;
+    }
+    memcpy(conn->request + conn->request_length, data, length);
+    conn->request_length += length;
+    return 0;
+}
+
+static connection_io_result flush_memory(http_connection* conn, output_segment* segment) {
+    while (segment->sent < segment->length) {
+        const char* data = segment->data + segment->sent;
+        size_t length = segment->length - segment->sent;
+
+        #ifdef _WIN32
+        int bytes_sent = send(conn->fd, data, (int)length, 0);
+        #else
+        ssize_t bytes_sent = send(conn->fd, data, length, 0);
+        #endif
+
+        if (bytes_sent < 0) {
+            if (platform_socket_would_block()) {
+                return CONN_IO_WOULD_BLOCK;
+            }
+            LOG_ERROR("Failed to send data: %s\n", platform_get_error_string());
+            return CONN_IO_ERROR;
+        }
+        if (conn->first_byte_time == 0) {
+            conn->first_byte_time = platform_monotonic_us();
+        }
+        segment->sent += bytes_sent;
+        if (!segment->is_header) {
+            conn->bytes_sent += (size_t)bytes_sent;
+        }
+    }
+    return CONN_IO_DONE;
+}
+
+static connection_io_result flush_file(http_connection* conn, output_segment* segment) {
+    while (segment->remaining > 0) {
+        ssize_t bytes_sent = platform_sendfile(conn->fd, segment->file_fd, &segment->offset, segment->remaining);
+        if (bytes_sent < 0) {
+            if (platform_socket_would_block()) {
+                return CONN_IO_WOULD_BLOCK;
+            }
+            LOG_ERROR("Failed to send file content: %s\n", platform_get_error_string());
+            return CONN_IO_ERROR;
+        }
+        if (bytes_sent == 0) {
+            // The file shrank underneath us, nothing more to send
+            LOG_ERROR("Unexpected end of file (fd=%d)\n", segment->file_fd);
+            return CONN_IO_ERROR;
+        }
+        segment->remaining -= bytes_sent;
+        conn->bytes_sent += (size_t)bytes_sent;
+    }
+    return CONN_IO_DONE;
+}
+
+/**
+ * @brief Sends a stream segment, asking its producer for more whenever a piece is out
+ */
+static connection_io_result flush_stream(http_connection* conn, output_segment* segment) {
+    for (;;) {
+        if (segment->sent == segment->length) {
+            long produced = segment->produce(segment->release_context, segment->data,
+                                             CONNECTION_STREAM_BUFFER_SIZE);
+            if (produced < 0) {
+                LOG_ERROR("Failed to generate streamed content\n");
+                return CONN_IO_ERROR;
+            }
+            if (produced == 0) {
+                return CONN_IO_DONE;
+            }
+            segment->length = (size_t)produced;
+            segment->sent = 0;
+        }
+
+        connection_io_result result = flush_memory(conn, segment);
+        if (result != CONN_IO_DONE) {
+            return result;
+        }
+    }
+}
+
+connection_io_result connection_flush(http_connection* conn) {
+    while (conn->out_head) {
+        output_segment* segment = conn->out_head;
+        conn->state = segment->is_header ? CONN_SENDING_HEADERS : CONN_SENDING_BODY;
+
+        connection_io_result result;
+        if (segment->type == SEGMENT_FILE) {
+            result = flush_file(conn, segment);
+        } else if (segment->type == SEGMENT_STREAM) {
+            result = flush_stream(conn, segment);
+        } else {
+            result = flush_memory(conn, segment);
+        }
+        if (result != CONN_IO_DONE) {
+            return result;
+        }
+
+        conn->out_head = segment->next;
+        if (!conn->out_head) {
+            conn->out_tail = NULL;
+        }
+        free_segment(segment);
+    }
+    return CONN_IO_DONE;
+}
+
+void connection_finish_request(http_connection* conn) {
+    size_t consumed = conn->parsed.head_length;
+    if (consumed == 0 || consumed > conn->request_length) {
+        consumed = conn->request_length;
+    }
+
+    // Keep any pipelined bytes that arrived after this request
+    memmove(conn->request, conn->request + consumed, conn->request_length - consumed);
+    conn->request_length -= consumed;
+    http_request_init(&conn->parsed);
+    conn->parse_result = HTTP_PARSE_INCOMPLETE;
+
+    conn->requests_served++;
+    conn->status = 0;
+    conn->bytes_sent = 0;
+    conn->first_byte_time = 0;
+    conn->keep_alive = 0;
+    conn->head_only = 0;
+    conn->state = CONN_READING_REQUEST;
+}
+
+const char* connection_header_value(const http_connection* conn) {
+    return conn->keep_alive ? "keep-alive" : "close";
+}
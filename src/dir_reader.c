@@ -0,0 +1,280 @@
+#include "dir_reader.h"
+#include "log.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This file contains the directory reader and its stat threads. See dir_reader.h.
+ *
+ * A reader that needs a batch examined queues itself; the stat threads and
+ * the reader's own thread claim a few entries at a time from the queued
+ * batches until every entry is claimed, and the reader waits until all of
+ * its entries are done before handing them out.
+ */
+
+/* Bytes of names kept per batch */
+#define NAMES_SIZE 32768
+
+/* Room kept for one more name (longer than NAME_MAX and MAX_PATH) */
+#define MAX_NAME_SIZE 512
+
+/* Entries claimed at a time */
+#define CLAIM_SIZE 8
+
+struct dir_reader {
+    platform_dir* dir;                    /**< The directory being read */
+    size_t count;                         /**< Entries in the current batch */
+    size_t position;                      /**< Next entry to hand out */
+    int status;                           /**< Last platform_read_directory_name result */
+    size_t claimed;                       /**< Entries of the batch claimed for examining */
+    size_t done;                          /**< Entries of the batch examined */
+    struct dir_reader* queue_next;        /**< Next batch waiting to be claimed */
+    /* The batch itself, last so it can be left out without stat threads */
+    platform_dir_entry entries[DIR_READER_BATCH_SIZE]; /**< The current batch */
+    int examined[DIR_READER_BATCH_SIZE];  /**< Whether each entry could be examined */
+    char names[NAMES_SIZE];               /**< Names of the current batch */
+};
+
+/**
+ * @brief The stat threads' shared state, protected by lock
+ */
+static struct {
+    int threads;               /**< Number of stat threads (0 when disabled) */
+    platform_mutex* lock;      /**< Protects the queue and the batches' claimed/done counts */
+    platform_cond* work;       /**< Signalled when a batch is queued */
+    platform_cond* finished;   /**< Signalled when a batch is done */
+    dir_reader* queue_head;    /**< Oldest batch with unclaimed entries */
+    dir_reader* queue_tail;    /**< Newest batch with unclaimed entries */
+} pool;
+
+/**
+ * @brief Claims up to CLAIM_SIZE entries of a batch (lock held)
+ *
+ * The batch leaves the queue once all of its entries are claimed.
+ *
+ * @param start Receives the index of the first claimed entry
+ * @return Number of entries claimed
+ */
+static size_t claim_entries(dir_reader* reader, size_t* start) {
+    size_t count = reader->count - reader->claimed;
+    if (count > CLAIM_SIZE) {
+        count = CLAIM_SIZE;
+    }
+    *start = reader->claimed;
+    reader->claimed += count;
+
+    if (reader->claimed == reader->count) {
+        dir_reader** link = &pool.queue_head;
+        dir_reader* previous = NULL;
+        while (*link && *link != reader) {
+            previous = *link;
+            link = &(*link)->queue_next;
+        }
+        if (*link) {
+            *link = reader->queue_next;
+            if (pool.queue_tail == reader) {
+                pool.queue_tail = previous;
+            }
+            reader->queue_next = NULL;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Examines claimed entries (without the lock) and marks them done (lock held on return)
+ */
+static void examine_entries(dir_reader* reader, size_t start, size_t count) {
+    platform_mutex_unlock(pool.lock);
+    for (size_t i = start; i < start + count; i++) {
+        reader->examined[i] = platform_stat_directory_entry(reader->dir, &reader->entries[i]) == 0;
+    }
+    platform_mutex_lock(pool.lock);
+
+    reader->done += count;
+    if (reader->done == reader->count) {
+        platform_cond_broadcast(pool.finished);
+    }
+}
+
+/**
+ * @brief Stat thread: examines entries of queued batches
+ */
+static void stat_thread(void* arg) {
+    (void)arg;
+
+    platform_mutex_lock(pool.lock);
+    for (;;) {
+        while (!pool.queue_head) {
+            platform_cond_wait(pool.work, pool.lock);
+        }
+        dir_reader* reader = pool.queue_head;
+        size_t start;
+        size_t count = claim_entries(reader, &start);
+        examine_entries(reader, start, count);
+    }
+}
+
+int dir_reader_init(int threads) {
+    pool.threads = 0;
+    if (threads <= 0) {
+        return 0;
+    }
+
+    pool.lock = platform_mutex_create();
+    pool.work = platform_cond_create();
+    pool.finished = platform_cond_create();
+    if (!pool.lock || !pool.work || !pool.finished) {
+        platform_mutex_destroy(pool.lock);
+        platform_cond_destroy(pool.work);
+        platform_cond_destroy(pool.finished);
+        return 1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (platform_thread_create(stat_thread, NULL) != 0) {
+            // The threads already started keep serving
+            if (i == 0) {
+                return 1;
+            }
+            break;
+        }
+        pool.threads++;
+    }
+    LOG_DEBUG("Started %d stat threads\n", pool.threads);
+    return 0;
+}
+
+dir_reader* dir_reader_open(const char* path) {
+    // The batch buffers are only needed with stat threads
+    size_t size = pool.threads > 0 ? sizeof(dir_reader) : offsetof(dir_reader, entries);
+    dir_reader* reader = malloc(size);
+    if (!reader) {
+        return NULL;
+    }
+
+    reader->dir = platform_open_directory(path);
+    if (!reader->dir) {
+        free(reader);
+        return NULL;
+    }
+    reader->count = 0;
+    reader->position = 0;
+    reader->status = 1;
+    reader->claimed = 0;
+    reader->done = 0;
+    reader->queue_next = NULL;
+    return reader;
+}
+
+/**
+ * @brief Reads the names of the next batch and has the batch examined
+ *
+ * @return 1 if the batch has entries, 0 at the end of the directory, -1 on error
+ */
+static int read_batch(dir_reader* reader) {
+    size_t names_used = 0;
+
+    reader->count = 0;
+    reader->position = 0;
+    while (reader->status > 0 && reader->count < DIR_READER_BATCH_SIZE &&
+           names_used + MAX_NAME_SIZE <= NAMES_SIZE) {
+        platform_dir_entry* entry = &reader->entries[reader->count];
+        reader->status = platform_read_directory_name(reader->dir, entry);
+        if (reader->status <= 0) {
+            break;
+        }
+
+        // The name is only valid until the next read
+        size_t name_size = strlen(entry->name) + 1;
+        if (name_size > MAX_NAME_SIZE) {
+            continue;
+        }
+        memcpy(reader->names + names_used, entry->name, name_size);
+        entry->name = reader->names + names_used;
+        names_used += name_size;
+        reader->count++;
+    }
+    if (reader->count == 0) {
+        return reader->status;
+    }
+
+    platform_mutex_lock(pool.lock);
+    reader->claimed = 0;
+    reader->done = 0;
+    reader->queue_next = NULL;
+    if (pool.queue_tail) {
+        pool.queue_tail->queue_next = reader;
+    } else {
+        pool.queue_head = reader;
+    }
+    pool.queue_tail = reader;
+    platform_cond_broadcast(pool.work);
+
+    // Help with our own batch rather than sit idle
+    while (reader->claimed < reader->count) {
+        size_t start;
+        size_t count = claim_entries(reader, &start);
+        examine_entries(reader, start, count);
+    }
+    while (reader->done < reader->count) {
+        platform_cond_wait(pool.finished, pool.lock);
+    }
+    platform_mutex_unlock(pool.lock);
+    return 1;
+}
+
+int dir_reader_read(dir_reader* reader, platform_dir_entry* entry) {
+    if (pool.threads == 0) {
+        return platform_read_directory(reader->dir, entry);
+    }
+
+    for (;;) {
+        if (reader->position == reader->count) {
+            int result = read_batch(reader);
+            if (result <= 0) {
+                return result;
+            }
+        }
+
+        size_t i = reader->position++;
+        if (reader->examined[i]) {
+            *entry = reader->entries[i];
+            return 1;
+        }
+        LOG_WARNING("stat failed for '%s'\n", reader->entries[i].name);
+    }
+}
+
+void dir_reader_close(dir_reader* reader) {
+    if (reader) {
+        platform_close_directory(reader->dir);
+        free(reader);
+    }
+}
+
+int dir_reader_list_directory(const char* path, dir_entry_callback callback, void* user_data) {
+    platform_dir_entry entry;
+    int result;
+
+    if (pool.threads == 0) {
+        return platform_list_directory(path, callback, user_data);
+    }
+
+    LOG_DEBUG("Listing directory with %d stat threads: %s\n", pool.threads, path);
+    dir_reader* reader = dir_reader_open(path);
+    if (!reader) {
+        return 1;
+    }
+
+    while ((result = dir_reader_read(reader, &entry)) > 0) {
+        if (callback(entry.name, entry.is_dir, entry.size, entry.mtime, user_data) != 0) {
+            break;
+        }
+    }
+
+    dir_reader_close(reader);
+    return 0;
+}
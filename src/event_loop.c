@@ -0,0 +1,763 @@
+#include "event_loop.h"
+#include "httpfileserv.h"
+#include "connection.h"
+#include "platform.h"
+#include "server_config.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "fs_pool.h"
+#include "http_response.h"
+#include "httpfileserv_lib.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+/**
+ * This file contains the server's accept/dispatch loop. See event_loop.h.
+ */
+
+static const char* const backend_names[] = { "epoll", "io_uring" };
+
+int event_loop_parse_backend(const char* name, int* backend) {
+    for (int i = EVENT_LOOP_EPOLL; i <= EVENT_LOOP_IO_URING; i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            *backend = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Applies the per-client socket options
+ *
+ * @param client_fd The accepted client socket
+ */
+static void configure_client_socket(int client_fd) {
+    // Disable Nagle's algorithm to improve responsiveness
+    int nodelay = 1;
+    if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay)) < 0) {
+        perror("setsockopt:TCP_NODELAY");
+    }
+
+    // Keep-alive settings
+    int keepalive = 1;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, (const char*)&keepalive, sizeof(keepalive)) < 0) {
+        perror("setsockopt:SO_KEEPALIVE");
+    }
+}
+
+/**
+ * @brief Records a finished (or failed) response in the access log and the
+ * metrics and reports it to the request callback
+ *
+ * @param conn The connection, before connection_finish_request()
+ */
+static void complete_request(http_connection* conn) {
+    access_log_request(conn);
+
+    long long now = platform_monotonic_us();
+    long long first_byte = conn->first_byte_time ? conn->first_byte_time - conn->request_start : -1;
+    metrics_record_response(conn->status, conn->bytes_sent, first_byte, now - conn->request_start);
+
+    if (has_request_callback()) {
+        char method[32];
+        char target[MAX_PATH_SIZE];
+        snprintf(method, sizeof(method), "%.*s", (int)conn->parsed.method.length, conn->parsed.method.data);
+        snprintf(target, sizeof(target), "%.*s", (int)conn->parsed.target.length, conn->parsed.target.data);
+        invoke_request_callback(method, target, conn->status);
+    }
+}
+
+/**
+ * @brief Remembers a client's address for the access log
+ *
+ * @param conn The connection
+ * @param address The address accept() filled in
+ */
+static void set_client_address(http_connection* conn, const struct sockaddr_storage* address) {
+    platform_format_address(address, conn->client_address, sizeof(conn->client_address));
+}
+
+/**
+ * @brief Advances a connection's state machine as far as the socket allows
+ *
+ * Reads the request until it is complete, dispatches it through
+ * handle_connection() and then streams the queued response. On keep-alive
+ * connections the cycle repeats, which also serves pipelined requests that
+ * are already sitting in the request buffer. Returns as soon as the socket
+ * would block, so it can be called again on the next event.
+ *
+ * With use_pool, a request that needs blocking filesystem work is left in
+ * CONN_WAITING_FS with fs_mode CONN_FS_REQUESTED for the caller to hand to
+ * the filesystem pool; until the pool is done with it, calls return at once.
+ *
+ * @param conn The connection
+ * @param base_path The base directory path to serve files from
+ * @param use_pool Non-zero to leave blocking filesystem work to the pool
+ * @return 1 if the connection is finished and should be closed, 0 otherwise
+ */
+static int process_connection(http_connection* conn, const char* base_path, int use_pool) {
+    connection_io_result result;
+
+    while (1) {
+        if (conn->state == CONN_WAITING_FS) {
+            return 0;
+        }
+        if (conn->state == CONN_READING_REQUEST) {
+            result = connection_read_request(conn);
+            if (result == CONN_IO_WOULD_BLOCK) {
+                return 0;
+            }
+            if (result == CONN_IO_ERROR) {
+                conn->state = CONN_CLOSING;
+                return 1;
+            }
+
+            LOG_DEBUG("Request complete, handling connection (fd=%d)...\n", conn->fd);
+            conn->request_start = platform_monotonic_us();
+            conn->fs_mode = use_pool ? CONN_FS_ALLOWED : CONN_FS_INLINE;
+            handle_connection(conn, base_path);
+            if (conn->fs_mode == CONN_FS_REQUESTED) {
+                conn->state = CONN_WAITING_FS;
+                return 0;
+            }
+            conn->state = CONN_SENDING_HEADERS;
+        }
+
+        result = connection_flush(conn);
+        if (result == CONN_IO_WOULD_BLOCK) {
+            return 0;
+        }
+        complete_request(conn);
+        if (result == CONN_IO_ERROR || !conn->keep_alive) {
+            conn->state = CONN_CLOSING;
+            return 1;
+        }
+
+        // Response complete, wait for (or serve) the next request
+        connection_finish_request(conn);
+    }
+}
+
+#ifdef __linux__
+
+typedef struct fs_offload fs_offload;
+
+/* Flags of http_connection.ring_ops */
+#define RING_OP_RECV 1  /* A receive is queued */
+#define RING_OP_POLL 2  /* A writability poll is queued */
+
+/**
+ * @brief State of one event loop
+ */
+typedef struct event_loop {
+    int epoll_fd;                  /**< The epoll instance (-1 with a ring) */
+    platform_ring* ring;           /**< The io_uring ring, or NULL when the loop uses epoll */
+    int server_fd;                 /**< Listening socket */
+    const char* base_path;         /**< Directory being served */
+    http_connection* connections;  /**< Open connections, for idle sweeps */
+    time_t last_sweep;             /**< Last time idle connections were checked */
+    int completion_fd;             /**< eventfd the filesystem pool signals (-1 without the pool) */
+    platform_mutex* completion_lock; /**< Protects completed */
+    fs_offload* completed;         /**< Requests the pool is done with, newest first */
+} event_loop;
+
+/**
+ * @brief A request handed to the filesystem pool
+ */
+struct fs_offload {
+    fs_pool_task task;             /**< The pool's part (first, so a task is its offload) */
+    event_loop* loop;              /**< The loop the connection belongs to */
+    http_connection* conn;         /**< The connection */
+    fs_offload* next;              /**< Next request in the loop's completed list */
+};
+
+/**
+ * @brief Removes a connection from the loop's list and closes it
+ *
+ * Closing the socket also removes it from the epoll set. Ring operations
+ * still queued for it are cancelled instead, and the connection is closed
+ * once the last of them has completed (see finish_ring_op()).
+ *
+ * @param loop The event loop
+ * @param conn The connection to close
+ */
+static void close_loop_connection(event_loop* loop, http_connection* conn) {
+    if (conn->state == CONN_WAITING_FS) {
+        // A pool thread is still using it. A failed socket fails again when
+        // the response is flushed, and the idle clock restarts then
+        return;
+    }
+    if (conn->state == CONN_SENDING_HEADERS || conn->state == CONN_SENDING_BODY) {
+        // A response cut short (stalled or failed) still gets its record
+        complete_request(conn);
+    }
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        loop->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    if (conn->ring_ops) {
+        conn->state = CONN_CLOSING;
+        if (platform_ring_cancel(loop->ring, conn->fd) != 0) {
+            // A shut down socket completes them just the same
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+        return;
+    }
+    connection_close(conn);
+}
+
+/**
+ * @brief Queues the ring operation a connection now waits for
+ *
+ * A connection reading a request gets a receive of at most the free space
+ * in its request buffer, so it is never handed more than it can hold; one
+ * whose response filled the socket buffer gets a writability poll. While a
+ * response is sent nothing is received, just as epoll leaves the bytes in
+ * the socket until the connection reads again.
+ *
+ * @param loop The event loop
+ * @param conn The connection
+ * @return 0 on success, 1 if the ring could not take the operation
+ */
+static int arm_connection(event_loop* loop, http_connection* conn) {
+    if (conn->state == CONN_READING_REQUEST && !(conn->ring_ops & RING_OP_RECV)) {
+        size_t space = conn->request_capacity - conn->request_length;
+        if (platform_ring_recv(loop->ring, conn->fd, space, conn) != 0) {
+            return 1;
+        }
+        conn->ring_ops |= RING_OP_RECV;
+    } else if ((conn->state == CONN_SENDING_HEADERS || conn->state == CONN_SENDING_BODY) &&
+               !(conn->ring_ops & RING_OP_POLL)) {
+        if (platform_ring_poll(loop->ring, conn->fd, 1, conn) != 0) {
+            return 1;
+        }
+        conn->ring_ops |= RING_OP_POLL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Notes the completion of a connection's ring operation
+ *
+ * @param conn The connection
+ * @param op The RING_OP_* flag of the operation
+ * @return 1 if the connection had been closed (it is freed once nothing is left in flight), 0 otherwise
+ */
+static int finish_ring_op(http_connection* conn, unsigned op) {
+    conn->ring_ops &= ~op;
+    if (conn->state != CONN_CLOSING) {
+        return 0;
+    }
+    if (conn->ring_ops == 0) {
+        connection_close(conn);
+    }
+    return 1;
+}
+
+/**
+ * @brief Pool thread: handles the request, blocking filesystem work included
+ */
+static void run_offload(fs_pool_task* task) {
+    fs_offload* offload = (fs_offload*)task;
+    handle_connection(offload->conn, offload->loop->base_path);
+}
+
+/**
+ * @brief Pool thread: posts the handled request back to its loop
+ *
+ * The eventfd is only written when the list was empty; the loop reads the
+ * eventfd before taking the list, so no completion goes unnoticed.
+ */
+static void post_offload(fs_pool_task* task) {
+    fs_offload* offload = (fs_offload*)task;
+    event_loop* loop = offload->loop;
+
+    platform_mutex_lock(loop->completion_lock);
+    int was_empty = loop->completed == NULL;
+    offload->next = loop->completed;
+    loop->completed = offload;
+    platform_mutex_unlock(loop->completion_lock);
+
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(loop->completion_fd, &one, sizeof(one)) < 0) {
+            perror("write:eventfd");
+        }
+    }
+}
+
+/**
+ * @brief Advances a connection, handing requests that need the disk to the filesystem pool
+ *
+ * When the pool has as much work queued as it may, the request is answered
+ * with a 503 instead, so a slow disk cannot pile up work without bound.
+ *
+ * @param loop The event loop
+ * @param conn The connection
+ * @return 1 if the connection is finished and should be closed, 0 otherwise
+ */
+static int run_connection(event_loop* loop, http_connection* conn) {
+    for (;;) {
+        if (process_connection(conn, loop->base_path, loop->completion_fd >= 0)) {
+            return 1;
+        }
+        if (conn->state != CONN_WAITING_FS || conn->fs_mode != CONN_FS_REQUESTED) {
+            // Waiting for the socket: epoll reports it anyway, a ring is asked to
+            return loop->ring ? arm_connection(loop, conn) : 0;
+        }
+
+        fs_offload* offload = malloc(sizeof(fs_offload));
+        if (offload) {
+            offload->task.work = run_offload;
+            offload->task.complete = post_offload;
+            offload->loop = loop;
+            offload->conn = conn;
+            conn->fs_mode = CONN_FS_ON_POOL;
+            if (fs_pool_submit(&offload->task) == 0) {
+                return 0;
+            }
+            free(offload);
+        }
+
+        LOG_DEBUG("Filesystem queue full, refusing request (fd=%d)\n", conn->fd);
+        conn->fs_mode = CONN_FS_INLINE;
+        send_503(conn);
+        conn->state = CONN_SENDING_HEADERS;
+    }
+}
+
+/**
+ * @brief Resumes the connections whose requests the filesystem pool has handled
+ *
+ * @param loop The event loop
+ * @param now The current time
+ */
+static void finish_offloads(event_loop* loop, time_t now) {
+    uint64_t count;
+    if (read(loop->completion_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("read:eventfd");
+    }
+
+    platform_mutex_lock(loop->completion_lock);
+    fs_offload* offload = loop->completed;
+    loop->completed = NULL;
+    platform_mutex_unlock(loop->completion_lock);
+
+    while (offload) {
+        fs_offload* next = offload->next;
+        http_connection* conn = offload->conn;
+        free(offload);
+
+        // The response is queued: send it like any other
+        conn->state = CONN_SENDING_HEADERS;
+        conn->last_active = now;
+        if (run_connection(loop, conn)) {
+            close_loop_connection(loop, conn);
+        }
+        offload = next;
+    }
+}
+
+/**
+ * @brief Closes connections that have made no progress for too long
+ *
+ * Connections waiting for a request get the keep-alive timeout; connections
+ * stuck sending a response get CONNECTION_SEND_TIMEOUT.
+ *
+ * @param loop The event loop
+ * @param now The current time
+ */
+static void sweep_idle_connections(event_loop* loop, time_t now) {
+    int keepalive_timeout = server_config_get()->keepalive_timeout;
+    http_connection* conn = loop->connections;
+
+    while (conn) {
+        http_connection* next = conn->next;
+        int timeout = conn->state == CONN_READING_REQUEST ? keepalive_timeout : CONNECTION_SEND_TIMEOUT;
+        if (conn->state != CONN_WAITING_FS && now - conn->last_active >= timeout) {
+            LOG_DEBUG("Closing idle connection (fd=%d)\n", conn->fd);
+            close_loop_connection(loop, conn);
+        }
+        conn = next;
+    }
+    loop->last_sweep = now;
+}
+
+/**
+ * @brief Sets up a connection for an accepted socket and adds it to the loop's list
+ *
+ * @param loop The event loop
+ * @param client_fd The accepted socket
+ * @param address The peer's address
+ * @return The connection, or NULL on failure (the socket is closed then)
+ */
+static http_connection* open_connection(event_loop* loop, int client_fd, const struct sockaddr_storage* address) {
+    LOG_DEBUG("Connection accepted (fd=%d)\n", client_fd);
+
+    configure_client_socket(client_fd);
+
+    http_connection* conn = connection_create(client_fd);
+    if (!conn) {
+        LOG_ERROR("Failed to allocate connection for fd=%d\n", client_fd);
+        platform_close_socket(client_fd);
+        return NULL;
+    }
+    conn->max_requests = server_config_get()->max_requests;
+    set_client_address(conn, address);
+
+    conn->next = loop->connections;
+    if (loop->connections) {
+        loop->connections->prev = conn;
+    }
+    loop->connections = conn;
+    return conn;
+}
+
+/**
+ * @brief Accepts every pending connection on the listening socket
+ *
+ * The listening socket is edge-triggered, so we must keep accepting until
+ * accept() reports that the backlog is empty.
+ *
+ * @param loop The event loop
+ */
+static void accept_connections(event_loop* loop) {
+    while (1) {
+        struct sockaddr_storage address;
+        socklen_t address_length = sizeof(address);
+        int client_fd = accept(loop->server_fd, (struct sockaddr*)&address, &address_length);
+        if (client_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!platform_socket_would_block()) {
+                perror("accept");
+            }
+            return;
+        }
+
+        platform_set_socket_blocking(client_fd, 0);
+        http_connection* conn = open_connection(loop, client_fd, &address);
+        if (!conn) {
+            continue;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) < 0) {
+            perror("epoll_ctl:EPOLL_CTL_ADD");
+            close_loop_connection(loop, conn);
+        }
+    }
+}
+
+/**
+ * @brief Runs the loop on epoll. Returns only on failure
+ *
+ * @param loop The event loop
+ * @return Non-zero
+ */
+static int run_epoll(event_loop* loop) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    struct epoll_event event;
+
+    loop->epoll_fd = epoll_create1(0);
+    if (loop->epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    platform_set_socket_blocking(loop->server_fd, 0);
+
+    // The filesystem pool's eventfd is identified by a pointer to the loop
+    if (loop->completion_fd >= 0) {
+        event.events = EPOLLIN;
+        event.data.ptr = loop;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->completion_fd, &event) < 0) {
+            perror("epoll_ctl:eventfd");
+            close(loop->epoll_fd);
+            return 1;
+        }
+    }
+
+    // The listening socket is identified by a NULL data pointer
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = NULL;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->server_fd, &event) < 0) {
+        perror("epoll_ctl:listen socket");
+        close(loop->epoll_fd);
+        return 1;
+    }
+
+    LOG_INFO("Waiting for connections (epoll)...\n");
+
+    while (1) {
+        // Wake up at least once a second to expire idle connections
+        int count = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, 1000);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            close(loop->epoll_fd);
+            return 1;
+        }
+
+        time_t now = time(NULL);
+        int completions = 0;
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == loop) {
+                completions = 1;
+                continue;
+            }
+            http_connection* conn = events[i].data.ptr;
+            if (!conn) {
+                accept_connections(loop);
+                continue;
+            }
+
+            conn->last_active = now;
+            if ((events[i].events & EPOLLERR) || run_connection(loop, conn)) {
+                close_loop_connection(loop, conn);
+            }
+        }
+
+        // Only after the batch: resuming a connection can close it, and a
+        // later event of the batch could still refer to it
+        if (completions) {
+            finish_offloads(loop, now);
+        }
+
+        if (now != loop->last_sweep) {
+            sweep_idle_connections(loop, now);
+        }
+    }
+}
+
+/**
+ * @brief Handles a completion of the ring's multishot accept
+ *
+ * @param loop The event loop
+ * @param event The completion
+ */
+static void accept_ring_connection(event_loop* loop, const platform_ring_event* event) {
+    if (!event->more && platform_ring_accept(loop->ring, loop->server_fd, NULL) != 0) {
+        // The kernel ends a multishot accept after an error; it is queued
+        // again unless the ring is full, when the next completion retries
+        LOG_ERROR("Failed to queue accept\n");
+    }
+    if (event->result < 0) {
+        LOG_ERROR("accept failed: %s\n", strerror(-event->result));
+        return;
+    }
+
+    // A multishot accept reports no address, so ask for it
+    int client_fd = event->result;
+    struct sockaddr_storage address;
+    socklen_t address_length = sizeof(address);
+    if (getpeername(client_fd, (struct sockaddr*)&address, &address_length) < 0) {
+        address.ss_family = AF_UNSPEC;
+    }
+
+    http_connection* conn = open_connection(loop, client_fd, &address);
+    if (!conn) {
+        return;
+    }
+    conn->external_input = 1;
+    if (arm_connection(loop, conn) != 0) {
+        close_loop_connection(loop, conn);
+    }
+}
+
+/**
+ * @brief Handles the completion of a connection's receive or poll
+ *
+ * @param loop The event loop
+ * @param event The completion
+ * @param now The current time
+ */
+static void handle_ring_completion(event_loop* loop, const platform_ring_event* event, time_t now) {
+    http_connection* conn = event->tag;
+
+    if (event->op == PLATFORM_RING_RECV) {
+        int accepted = 1;
+        if (event->buffer >= 0) {
+            if (conn->state != CONN_CLOSING && event->result > 0) {
+                accepted = connection_receive(conn, event->data, (size_t)event->result) == 0;
+            }
+            platform_ring_recycle(loop->ring, event->buffer);
+        }
+        if (finish_ring_op(conn, RING_OP_RECV)) {
+            return;
+        }
+        if (event->result == 0) {
+            LOG_DEBUG("Client closed connection (fd=%d)\n", conn->fd);
+            close_loop_connection(loop, conn);
+            return;
+        }
+        // -ENOBUFS only means every buffer was in use: receive again below
+        if (event->result < 0 && event->result != -ENOBUFS) {
+            LOG_ERROR("recv error: %s\n", strerror(-event->result));
+            close_loop_connection(loop, conn);
+            return;
+        }
+        if (!accepted) {
+            LOG_ERROR("Received more than the request buffer holds (fd=%d)\n", conn->fd);
+            close_loop_connection(loop, conn);
+            return;
+        }
+    } else if (finish_ring_op(conn, RING_OP_POLL)) {
+        return;
+    }
+
+    conn->last_active = now;
+    if (run_connection(loop, conn)) {
+        close_loop_connection(loop, conn);
+    }
+}
+
+/**
+ * @brief Runs the loop on an io_uring ring. Returns only on failure
+ *
+ * @param loop The event loop
+ * @return Non-zero
+ */
+static int run_ring(event_loop* loop) {
+    platform_ring_event events[EVENT_LOOP_MAX_EVENTS];
+
+    // The filesystem pool's eventfd is polled with the loop as its tag
+    if (platform_ring_accept(loop->ring, loop->server_fd, NULL) != 0 ||
+        (loop->completion_fd >= 0 && platform_ring_poll(loop->ring, loop->completion_fd, 0, loop) != 0)) {
+        LOG_ERROR("Failed to queue the listening socket\n");
+        return 1;
+    }
+
+    LOG_INFO("Waiting for connections (io_uring)...\n");
+
+    while (1) {
+        // Wake up at least once a second to expire idle connections
+        int count = platform_ring_wait(loop->ring, events, EVENT_LOOP_MAX_EVENTS, 1000);
+        if (count < 0) {
+            return 1;
+        }
+
+        time_t now = time(NULL);
+        int completions = 0;
+        for (int i = 0; i < count; i++) {
+            if (events[i].op == PLATFORM_RING_ACCEPT) {
+                accept_ring_connection(loop, &events[i]);
+            } else if (events[i].op == PLATFORM_RING_POLL && events[i].tag == loop) {
+                completions = 1;
+            } else if (events[i].op != PLATFORM_RING_CANCEL) {
+                handle_ring_completion(loop, &events[i], now);
+            }
+        }
+
+        if (completions) {
+            finish_offloads(loop, now);
+            if (platform_ring_poll(loop->ring, loop->completion_fd, 0, loop) != 0) {
+                LOG_ERROR("Failed to queue the filesystem pool's eventfd\n");
+                return 1;
+            }
+        }
+
+        if (now != loop->last_sweep) {
+            sweep_idle_connections(loop, now);
+        }
+    }
+}
+
+int event_loop_run(int server_fd, const char* base_path) {
+    event_loop loop;
+    loop.epoll_fd = -1;
+    loop.ring = NULL;
+    loop.server_fd = server_fd;
+    loop.base_path = base_path;
+    loop.connections = NULL;
+    loop.last_sweep = time(NULL);
+    loop.completion_fd = -1;
+    loop.completion_lock = NULL;
+    loop.completed = NULL;
+
+    // The ring belongs to the thread that uses it, so each loop sets up its own
+    if (server_config_get()->io_backend == EVENT_LOOP_IO_URING) {
+        loop.ring = platform_ring_create(EVENT_LOOP_MAX_EVENTS, EVENT_LOOP_RING_BUFFERS,
+                                         EVENT_LOOP_RING_BUFFER_SIZE);
+        if (!loop.ring) {
+            LOG_WARNING("io_uring is not available, using epoll\n");
+        }
+    }
+
+    // The filesystem pool reports finished requests through an eventfd
+    if (fs_pool_enabled()) {
+        loop.completion_lock = platform_mutex_create();
+        loop.completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!loop.completion_lock || loop.completion_fd < 0) {
+            perror("eventfd");
+            platform_ring_destroy(loop.ring);
+            return 1;
+        }
+    }
+
+    int result = loop.ring ? run_ring(&loop) : run_epoll(&loop);
+    platform_ring_destroy(loop.ring);
+    return result;
+}
+
+#else
+
+int event_loop_run(int server_fd, const char* base_path) {
+    LOG_INFO("Waiting for connections...\n");
+
+    while (1) {
+        struct sockaddr_storage address;
+        socklen_t address_length = sizeof(address);
+        int client_fd = (int)accept(server_fd, (struct sockaddr*)&address, &address_length);
+        if (client_fd < 0) {
+            LOG_ERROR("accept failed: %s\n", platform_get_error_string());
+            continue;
+        }
+
+        LOG_DEBUG("Connection accepted (fd=%d)\n", client_fd);
+
+        configure_client_socket(client_fd);
+
+        // Without epoll we serve one connection at a time on a blocking socket
+        platform_set_socket_blocking(client_fd, 1);
+
+        // Set socket timeout to prevent stalled connections
+        platform_set_socket_timeouts(client_fd, 60);  // 60 seconds timeout
+
+        http_connection* conn = connection_create(client_fd);
+        if (!conn) {
+            LOG_ERROR("Failed to allocate connection for fd=%d\n", client_fd);
+            platform_close_socket(client_fd);
+            continue;
+        }
+
+        // Keep-alive would let one idle client hold up everyone else here
+        conn->max_requests = 1;
+        set_client_address(conn, &address);
+        process_connection(conn, base_path, 0);
+        connection_close(conn);
+        LOG_DEBUG("Connection closed.\n");
+    }
+}
+
+#endif
@@ -0,0 +1,551 @@
+#include "file_cache.h"
+#include "stat_cache.h"
+#include "utils.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define close _close
+#define FILE_OPEN_FLAGS (O_RDONLY | O_BINARY)
+#else
+// O_NONBLOCK keeps open() from hanging on a FIFO; it has no effect on regular files
+#define FILE_OPEN_FLAGS (O_RDONLY | O_NONBLOCK | O_CLOEXEC)
+// The directory is only used to open index files relative to it
+#ifdef O_PATH
+#define DIRECTORY_OPEN_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIRECTORY_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+#endif
+
+/**
+ * This file contains the open file descriptor cache. See file_cache.h.
+ */
+
+/**
+ * @brief Global cache state, protected by lock
+ */
+static struct {
+    platform_mutex* lock;          /**< Protects everything below and all entry internals */
+    file_cache_entry** buckets;    /**< Hash table of cached entries */
+    size_t bucket_count;           /**< Number of buckets (a power of two) */
+    size_t max_entries;            /**< Size limit (0 when caching is disabled) */
+    int ttl;                       /**< Seconds before an entry is revalidated */
+    file_cache_entry* lru_head;    /**< Most recently used entry */
+    file_cache_entry* lru_tail;    /**< Least recently used entry */
+    file_cache_stats stats;        /**< Counters */
+} cache;
+
+/**
+ * @brief FNV-1a hash of a path
+ */
+static size_t hash_path(const char* path) {
+    size_t hash = (size_t)2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int file_cache_init(int max_entries, int ttl) {
+    cache.ttl = ttl;
+    cache.max_entries = 0;
+    if (max_entries <= 0) {
+        return 0;
+    }
+
+    cache.lock = platform_mutex_create();
+    if (!cache.lock) {
+        return 1;
+    }
+
+    // Keep the load factor at or below one half
+    cache.bucket_count = 16;
+    while (cache.bucket_count < (size_t)max_entries * 2) {
+        cache.bucket_count *= 2;
+    }
+    cache.buckets = calloc(cache.bucket_count, sizeof(file_cache_entry*));
+    if (!cache.buckets) {
+        platform_mutex_destroy(cache.lock);
+        cache.lock = NULL;
+        return 1;
+    }
+
+    cache.max_entries = (size_t)max_entries;
+    return 0;
+}
+
+/**
+ * @brief Closes and frees an entry that has no references left
+ */
+static void free_entry(file_cache_entry* entry) {
+    close(entry->fd);
+    free(entry->path);
+    free(entry);
+}
+
+/**
+ * @brief Finds the cached entry for a path (lock held)
+ */
+static file_cache_entry* find_entry(const char* path) {
+    file_cache_entry* entry = cache.buckets[hash_path(path) & (cache.bucket_count - 1)];
+    while (entry && strcmp(entry->path, path) != 0) {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+/**
+ * @brief Unlinks an entry from the LRU list (lock held)
+ */
+static void lru_unlink(file_cache_entry* entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache.lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache.lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+/**
+ * @brief Puts an entry at the front of the LRU list (lock held)
+ */
+static void lru_push_front(file_cache_entry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache.lru_head;
+    if (cache.lru_head) {
+        cache.lru_head->lru_prev = entry;
+    } else {
+        cache.lru_tail = entry;
+    }
+    cache.lru_head = entry;
+}
+
+/**
+ * @brief Removes an entry from the table and drops the cache's reference (lock held)
+ *
+ * @return 1 if that was the last reference and the caller must free the entry
+ */
+static int remove_entry(file_cache_entry* entry) {
+    file_cache_entry** link = &cache.buckets[hash_path(entry->path) & (cache.bucket_count - 1)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    entry->hash_next = NULL;
+
+    lru_unlink(entry);
+    entry->cached = 0;
+    cache.stats.entries--;
+    return --entry->refcount == 0;
+}
+
+/**
+ * @brief Wraps an open descriptor in an unreferenced-by-cache entry
+ *
+ * @param path The resolved filesystem path the descriptor was opened for
+ * @param fd The descriptor; closed if it is not a regular file or on failure
+ * @return An entry holding one reference (the caller's), or NULL
+ */
+static file_cache_entry* wrap_descriptor(const char* path, int fd) {
+    file_cache_entry* entry = calloc(1, sizeof(file_cache_entry));
+    if (!entry || fstat(fd, &entry->st) != 0 || (entry->st.st_mode & S_IFMT) != S_IFREG) {
+        // Directories and special files are not served from the cache
+        free(entry);
+        close(fd);
+        return NULL;
+    }
+
+    entry->path = malloc(strlen(path) + 1);
+    if (!entry->path) {
+        free(entry);
+        close(fd);
+        return NULL;
+    }
+    strcpy(entry->path, path);
+
+    entry->fd = fd;
+    entry->mime_type = get_mime_type(path);
+    entry->validated = time(NULL);
+    entry->refcount = 1;
+    return entry;
+}
+
+/**
+ * @brief Opens a regular file and wraps it in an unreferenced-by-cache entry
+ *
+ * @return An entry holding one reference (the caller's), or NULL
+ */
+static file_cache_entry* open_entry(const char* path) {
+    // The metadata cache usually knows without a syscall that a path is a
+    // directory or missing
+    struct stat st;
+    if (stat_cache_stat(path, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG) {
+        return NULL;
+    }
+
+    int fd = open(path, FILE_OPEN_FLAGS);
+    if (fd < 0) {
+        return NULL;
+    }
+    return wrap_descriptor(path, fd);
+}
+
+/**
+ * @brief Checks whether a file at a path is still the one an entry has open
+ */
+static int entry_matches_file(const file_cache_entry* entry, const struct stat* st) {
+    return entry->st.st_dev == st->st_dev && entry->st.st_ino == st->st_ino &&
+           entry->st.st_size == st->st_size && entry->st.st_mtime == st->st_mtime;
+}
+
+/**
+ * @brief Looks up a cached entry that is still valid, revalidating it once its TTL has expired
+ *
+ * @return A referenced entry, or NULL if the path is not cached or changed
+ */
+static file_cache_entry* acquire_cached(const char* path) {
+    time_t now = time(NULL);
+
+    platform_mutex_lock(cache.lock);
+    file_cache_entry* entry = find_entry(path);
+    if (entry) {
+        entry->refcount++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+
+        if (now - entry->validated < cache.ttl) {
+            cache.stats.hits++;
+            platform_mutex_unlock(cache.lock);
+            LOG_DEBUG("File cache hit for '%s'\n", path);
+            return entry;
+        }
+    }
+    platform_mutex_unlock(cache.lock);
+
+    // The TTL expired: check the file without holding the lock (the
+    // metadata cache answers this without a syscall if nothing changed)
+    if (entry) {
+        struct stat st;
+        int unchanged = stat_cache_stat(path, &st) == 0 && entry_matches_file(entry, &st);
+        int free_it = 0;
+
+        platform_mutex_lock(cache.lock);
+        if (unchanged) {
+            entry->validated = now;
+            cache.stats.revalidations++;
+            cache.stats.hits++;
+        } else {
+            if (entry->cached) {
+                cache.stats.invalidations++;
+                remove_entry(entry);
+            }
+            free_it = --entry->refcount == 0;
+        }
+        platform_mutex_unlock(cache.lock);
+
+        if (unchanged) {
+            LOG_DEBUG("File cache revalidated '%s'\n", path);
+            return entry;
+        }
+        LOG_DEBUG("File cache entry for '%s' is stale\n", path);
+        if (free_it) {
+            free_entry(entry);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Caches a freshly opened file after a miss
+ *
+ * @param path The resolved filesystem path
+ * @param opened The opened entry (can be NULL if the open failed)
+ * @return A referenced entry for the path (opened, or the one another worker cached meanwhile), or NULL
+ */
+static file_cache_entry* insert_entry(const char* path, file_cache_entry* opened) {
+    file_cache_entry* entry = NULL;
+    file_cache_entry* evicted = NULL;
+
+    platform_mutex_lock(cache.lock);
+    cache.stats.misses++;
+    if (opened) {
+        entry = find_entry(path);
+        if (entry && entry_matches_file(entry, &opened->st)) {
+            // Another worker cached the same file in the meantime: use theirs
+            entry->refcount++;
+        } else {
+            if (entry && remove_entry(entry)) {
+                evicted = entry;
+            }
+            entry = NULL;
+
+            // Make room by dropping the least recently used entry; files still
+            // being sent stay open until their last reference goes away
+            if (cache.stats.entries >= cache.max_entries && cache.lru_tail) {
+                file_cache_entry* victim = cache.lru_tail;
+                cache.stats.evictions++;
+                if (remove_entry(victim)) {
+                    victim->hash_next = evicted;
+                    evicted = victim;
+                }
+            }
+
+            size_t bucket = hash_path(path) & (cache.bucket_count - 1);
+            opened->hash_next = cache.buckets[bucket];
+            cache.buckets[bucket] = opened;
+            lru_push_front(opened);
+            opened->cached = 1;
+            opened->refcount++;
+            cache.stats.entries++;
+        }
+    }
+    unsigned long misses = cache.stats.misses;
+    unsigned long hits = cache.stats.hits;
+    platform_mutex_unlock(cache.lock);
+
+    // Close what no one uses any more, without holding the lock
+    while (evicted) {
+        file_cache_entry* next = evicted->hash_next;
+        free_entry(evicted);
+        evicted = next;
+    }
+
+    LOG_DEBUG("File cache miss for '%s' (hits=%lu, misses=%lu)\n", path, hits, misses);
+    if (entry) {
+        file_cache_release(opened);
+        return entry;
+    }
+    return opened;
+}
+
+file_cache_entry* file_cache_acquire(const char* path) {
+    if (cache.max_entries == 0) {
+        return open_entry(path);
+    }
+
+    file_cache_entry* entry = acquire_cached(path);
+    if (entry) {
+        return entry;
+    }
+
+    // Miss: open the file outside the lock, then publish it
+    return insert_entry(path, open_entry(path));
+}
+
+file_cache_entry* file_cache_lookup(const char* path) {
+    if (cache.max_entries == 0) {
+        return NULL;
+    }
+    return acquire_cached(path);
+}
+
+/**
+ * @brief Length of a directory's path without its trailing separators
+ *
+ * Index paths are spelled like any other file's ("/srv/www/sub/" lists as
+ * "/srv/www/sub"), so invalidation by path finds them.
+ */
+static int index_dir_length(const char* dir_path) {
+    int dir_length = (int)strlen(dir_path);
+    while (dir_length > 1 && (dir_path[dir_length - 1] == '/' || dir_path[dir_length - 1] == PATH_SEPARATOR)) {
+        dir_length--;
+    }
+    return dir_length;
+}
+
+file_cache_entry* file_cache_acquire_index(const char* dir_path, const char* const* names, int count) {
+    char path[MAX_PATH_SIZE];
+    int first = 0;
+    int dir_length = index_dir_length(dir_path);
+
+    // The first name that exists wins. A hot index page is served without
+    // any syscall, and names the metadata cache knows to be missing cost
+    // none either, so a plain directory is listed as cheaply as before
+    for (; first < count; first++) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%.*s%c%s", dir_length, dir_path, PATH_SEPARATOR, names[first]);
+        if (cache.max_entries != 0) {
+            file_cache_entry* entry = acquire_cached(path);
+            if (entry) {
+                return entry;
+            }
+        }
+        if (stat_cache_stat(path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG) {
+            break;
+        }
+    }
+    if (first == count) {
+        return NULL;
+    }
+
+    // Open it relative to the directory, so the kernel resolves the
+    // directory's path once, and fall back to the later names if it is gone
+    file_cache_entry* opened = NULL;
+#ifdef _WIN32
+    for (int i = first; i < count && !opened; i++) {
+        snprintf(path, sizeof(path), "%.*s%c%s", dir_length, dir_path, PATH_SEPARATOR, names[i]);
+        int fd = open(path, FILE_OPEN_FLAGS);
+        if (fd >= 0) {
+            opened = wrap_descriptor(path, fd);
+        }
+    }
+#else
+    int dir_fd = open(dir_path, DIRECTORY_OPEN_FLAGS);
+    if (dir_fd < 0) {
+        return NULL;
+    }
+    for (int i = first; i < count && !opened; i++) {
+        int fd = openat(dir_fd, names[i], FILE_OPEN_FLAGS);
+        if (fd >= 0) {
+            snprintf(path, sizeof(path), "%.*s%c%s", dir_length, dir_path, PATH_SEPARATOR, names[i]);
+            opened = wrap_descriptor(path, fd);
+        }
+    }
+    close(dir_fd);
+#endif
+    if (!opened || cache.max_entries == 0) {
+        return opened;
+    }
+    return insert_entry(path, opened);
+}
+
+int file_cache_lookup_index(const char* dir_path, const char* const* names, int count,
+                            file_cache_entry** index) {
+    char path[MAX_PATH_SIZE];
+    int dir_length = index_dir_length(dir_path);
+
+    *index = NULL;
+    for (int i = 0; i < count; i++) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%.*s%c%s", dir_length, dir_path, PATH_SEPARATOR, names[i]);
+        if (cache.max_entries != 0) {
+            *index = acquire_cached(path);
+            if (*index) {
+                return 0;
+            }
+        }
+        // Only a name known to be missing can be passed over without
+        // looking: anything else would have to be opened
+        if (stat_cache_lookup(path, &st) != -1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int file_cache_find_index(const char* dir_path, const char* const* names, int count,
+                          file_cache_entry** index, char* path, struct stat* st) {
+    int dir_length = index_dir_length(dir_path);
+
+    *index = NULL;
+    for (int i = 0; i < count; i++) {
+        snprintf(path, MAX_PATH_SIZE, "%.*s%c%s", dir_length, dir_path, PATH_SEPARATOR, names[i]);
+        if (cache.max_entries != 0) {
+            *index = acquire_cached(path);
+            if (*index) {
+                return 0;
+            }
+        }
+        if (stat_cache_stat(path, st) == 0 && (st->st_mode & S_IFMT) == S_IFREG) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void file_cache_retain(file_cache_entry* entry) {
+    if (cache.max_entries == 0) {
+        entry->refcount++;
+        return;
+    }
+    platform_mutex_lock(cache.lock);
+    entry->refcount++;
+    platform_mutex_unlock(cache.lock);
+}
+
+void file_cache_release(file_cache_entry* entry) {
+    int free_it;
+
+    if (cache.max_entries == 0) {
+        free_it = --entry->refcount == 0;
+    } else {
+        platform_mutex_lock(cache.lock);
+        free_it = --entry->refcount == 0;
+        platform_mutex_unlock(cache.lock);
+    }
+
+    if (free_it) {
+        free_entry(entry);
+    }
+}
+
+void file_cache_invalidate(const char* path) {
+    if (cache.max_entries == 0) {
+        return;
+    }
+
+    int free_it = 0;
+    platform_mutex_lock(cache.lock);
+    file_cache_entry* entry = find_entry(path);
+    if (entry) {
+        cache.stats.invalidations++;
+        free_it = remove_entry(entry);
+    }
+    platform_mutex_unlock(cache.lock);
+
+    if (free_it) {
+        free_entry(entry);
+    }
+}
+
+void file_cache_invalidate_prefix(const char* prefix) {
+    if (cache.max_entries == 0) {
+        return;
+    }
+
+    size_t length = strlen(prefix);
+    file_cache_entry* unused = NULL;
+    platform_mutex_lock(cache.lock);
+    file_cache_entry* entry = cache.lru_head;
+    while (entry) {
+        file_cache_entry* next = entry->lru_next;
+        if (strncmp(entry->path, prefix, length) == 0) {
+            cache.stats.invalidations++;
+            if (remove_entry(entry)) {
+                entry->hash_next = unused;
+                unused = entry;
+            }
+        }
+        entry = next;
+    }
+    platform_mutex_unlock(cache.lock);
+
+    while (unused) {
+        file_cache_entry* next = unused->hash_next;
+        free_entry(unused);
+        unused = next;
+    }
+}
+
+void file_cache_get_stats(file_cache_stats* stats) {
+    if (cache.max_entries == 0) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    platform_mutex_lock(cache.lock);
+    *stats = cache.stats;
+    platform_mutex_unlock(cache.lock);
+}
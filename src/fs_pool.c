@@ -0,0 +1,236 @@
+#include "fs_pool.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This file contains the filesystem thread pool. See fs_pool.h.
+ *
+ * Every pool thread owns a ring of task pointers protected by its own lock.
+ * Tasks come from the event loops rather than from the pool threads, so
+ * there is no locality to gain from running the newest task first: the
+ * owner and thieves alike take the oldest task, which is the client that
+ * has waited longest.
+ *
+ * A thread with nothing to run or steal goes to sleep on its own condition
+ * variable. It remembers the submitted count before looking for work and
+ * only sleeps if it has not changed; a submitter counts the task after
+ * queueing it and then wakes a sleeping thread, checking each thread's
+ * sleeping flag under that thread's lock. So a task queued while a thread
+ * was looking elsewhere is either seen by that thread's final check or
+ * finds it asleep and wakes it.
+ */
+
+/* Cache line size, to keep the threads' queues apart */
+#define CACHE_LINE 64
+
+/**
+ * @brief A pool thread and its queue
+ */
+typedef struct {
+    platform_mutex* lock;         /**< Protects the queue and sleeping */
+    platform_cond* wake;          /**< Signalled when the thread is woken */
+    fs_pool_task** tasks;         /**< Ring of queued tasks (max_queued slots) */
+    size_t head;                  /**< Slot of the oldest task */
+    size_t count;                 /**< Tasks in the ring */
+    int sleeping;                 /**< Set while the thread waits for work */
+    volatile size_t completed;    /**< Tasks run (written by the thread itself) */
+    volatile size_t stolen;       /**< Of those, tasks taken from another queue */
+    char padding[CACHE_LINE];
+} pool_thread;
+
+/**
+ * @brief The pool's shared state
+ */
+static struct {
+    int threads;                /**< Number of pool threads (0 when disabled) */
+    size_t max_queued;          /**< Most tasks allowed to wait */
+    pool_thread* workers;       /**< The threads */
+    volatile size_t queued;     /**< Tasks waiting */
+    volatile size_t submitted;  /**< Tasks ever accepted */
+    volatile size_t rejected;   /**< Tasks ever refused */
+} pool;
+
+/* Queue the calling thread submits to next, to spread its tasks */
+static PLATFORM_THREAD_LOCAL size_t next_queue;
+
+/**
+ * @brief Takes the oldest task of a thread's queue
+ *
+ * @return The task, or NULL if the queue is empty
+ */
+static fs_pool_task* take_task(pool_thread* worker) {
+    fs_pool_task* task = NULL;
+    platform_mutex_lock(worker->lock);
+    if (worker->count > 0) {
+        task = worker->tasks[worker->head];
+        worker->head = (worker->head + 1) % pool.max_queued;
+        worker->count--;
+    }
+    platform_mutex_unlock(worker->lock);
+    return task;
+}
+
+/**
+ * @brief Takes the oldest task of any other thread's queue
+ *
+ * @return The task, or NULL if every queue is empty
+ */
+static fs_pool_task* steal_task(pool_thread* self) {
+    int index = (int)(self - pool.workers);
+    for (int i = 1; i < pool.threads; i++) {
+        fs_pool_task* task = take_task(&pool.workers[(index + i) % pool.threads]);
+        if (task) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Wakes a thread if it is sleeping
+ *
+ * @return Non-zero if it was woken
+ */
+static int wake_thread(pool_thread* worker) {
+    platform_mutex_lock(worker->lock);
+    int sleeping = worker->sleeping;
+    if (sleeping) {
+        worker->sleeping = 0;
+        platform_cond_broadcast(worker->wake);
+    }
+    platform_mutex_unlock(worker->lock);
+    return sleeping;
+}
+
+/**
+ * @brief Pool thread: runs its own tasks, steals when it has none, sleeps when there are none
+ */
+static void worker_thread(void* arg) {
+    pool_thread* self = arg;
+
+    for (;;) {
+        size_t seen = platform_atomic_load(&pool.submitted);
+
+        int stolen = 0;
+        fs_pool_task* task = take_task(self);
+        if (!task) {
+            task = steal_task(self);
+            stolen = task != NULL;
+        }
+        if (task) {
+            platform_atomic_add(&pool.queued, (size_t)-1);
+            task->work(task);
+            task->complete(task);
+            platform_atomic_store(&self->completed, self->completed + 1);
+            if (stolen) {
+                platform_atomic_store(&self->stolen, self->stolen + 1);
+            }
+            continue;
+        }
+
+        platform_mutex_lock(self->lock);
+        if (self->count == 0 && platform_atomic_load(&pool.submitted) == seen) {
+            self->sleeping = 1;
+            while (self->sleeping) {
+                platform_cond_wait(self->wake, self->lock);
+            }
+        }
+        platform_mutex_unlock(self->lock);
+    }
+}
+
+int fs_pool_init(int threads, int max_queued) {
+    pool.threads = 0;
+    if (threads <= 0) {
+        return 0;
+    }
+
+    pool.max_queued = (size_t)max_queued;
+    pool.workers = calloc((size_t)threads, sizeof(pool_thread));
+    if (!pool.workers) {
+        return 1;
+    }
+    for (int i = 0; i < threads; i++) {
+        pool_thread* worker = &pool.workers[i];
+        // The total is capped, so no single queue can hold more than that
+        worker->tasks = malloc(pool.max_queued * sizeof(fs_pool_task*));
+        worker->lock = platform_mutex_create();
+        worker->wake = platform_cond_create();
+        if (!worker->tasks || !worker->lock || !worker->wake) {
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (platform_thread_create(worker_thread, &pool.workers[i]) != 0) {
+            // The threads already started keep serving; tasks only go to those
+            if (i == 0) {
+                return 1;
+            }
+            break;
+        }
+        pool.threads++;
+    }
+    LOG_DEBUG("Started %d filesystem threads\n", pool.threads);
+    return 0;
+}
+
+int fs_pool_enabled(void) {
+    return pool.threads > 0;
+}
+
+int fs_pool_submit(fs_pool_task* task) {
+    if (pool.threads == 0) {
+        return 1;
+    }
+    if (platform_atomic_add(&pool.queued, 1) >= pool.max_queued) {
+        platform_atomic_add(&pool.queued, (size_t)-1);
+        platform_atomic_add(&pool.rejected, 1);
+        return 1;
+    }
+
+    // Prefer a thread that is asleep (the flag is only a hint here), so the
+    // task starts right away
+    size_t start = next_queue++;
+    pool_thread* target = &pool.workers[start % pool.threads];
+    for (int i = 0; i < pool.threads; i++) {
+        pool_thread* worker = &pool.workers[(start + i) % pool.threads];
+        if (worker->sleeping) {
+            target = worker;
+            break;
+        }
+    }
+
+    platform_mutex_lock(target->lock);
+    target->tasks[(target->head + target->count) % pool.max_queued] = task;
+    target->count++;
+    platform_mutex_unlock(target->lock);
+    platform_atomic_add(&pool.submitted, 1);
+
+    // If its thread is busy, another one can steal the task
+    if (!wake_thread(target)) {
+        for (int i = 0; i < pool.threads; i++) {
+            if (wake_thread(&pool.workers[(start + i) % pool.threads])) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+void fs_pool_get_stats(fs_pool_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->threads = pool.threads;
+    if (pool.threads == 0) {
+        return;
+    }
+    stats->queued = platform_atomic_load(&pool.queued);
+    stats->max_queued = pool.max_queued;
+    stats->submitted = (unsigned long)platform_atomic_load(&pool.submitted);
+    stats->rejected = (unsigned long)platform_atomic_load(&pool.rejected);
+    for (int i = 0; i < pool.threads; i++) {
+        stats->completed += (unsigned long)platform_atomic_load(&pool.workers[i].completed);
+        stats->stolen += (unsigned long)platform_atomic_load(&pool.workers[i].stolen);
+    }
+}
@@ -0,0 +1,163 @@
+#include "http_conditional.h"
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * This file contains validator generation and conditional request
+ * evaluation. See http_conditional.h.
+ */
+
+static const char* month_names[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+void http_make_etag(const struct stat* st, int weak, char* buffer) {
+    snprintf(buffer, HTTP_ETAG_SIZE, "%s\"%llx-%llx-%llx\"", weak ? "W/" : "",
+             (unsigned long long)st->st_ino, (unsigned long long)st->st_size,
+             (unsigned long long)st->st_mtime);
+}
+
+/**
+ * @brief Converts a month abbreviation to 0-11
+ *
+ * @return The month index, or -1 if the name is not a month
+ */
+static int month_index(const char* name) {
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(name, month_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Converts a UTC calendar date to a timestamp
+ *
+ * Equivalent to timegm(), which is not available everywhere. Uses the
+ * days-from-civil algorithm, counting years from March so leap days fall at
+ * the end of the year.
+ */
+static time_t make_utc_time(int year, int month, int day, int hour, int minute, int second) {
+    int y = year - (month < 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    unsigned year_of_era = (unsigned)(y - era * 400);
+    unsigned day_of_year = (153 * (unsigned)((month + 10) % 12) + 2) / 5 + (unsigned)day - 1;
+    unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    long long days = (long long)era * 146097 + (long long)day_of_era - 719468;
+
+    return (time_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+}
+
+int http_parse_date(const http_slice* value, time_t* t) {
+    char buffer[64];
+    char day_name[16];
+    char month_name[4];
+    int day, year, hour, minute, second;
+    int consumed = 0;
+
+    if (value->length == 0 || value->length >= sizeof(buffer)) {
+        return -1;
+    }
+    memcpy(buffer, value->data, value->length);
+    buffer[value->length] = '\0';
+
+    // IMF-fixdate: "Sun, 06 Nov 1994 08:49:37 GMT"
+    if (sscanf(buffer, "%15[A-Za-z], %2d %3s %4d %2d:%2d:%2d GMT%n",
+               day_name, &day, month_name, &year, &hour, &minute, &second, &consumed) == 7 &&
+        (size_t)consumed == value->length) {
+        // Parsed
+    }
+    // RFC 850: "Sunday, 06-Nov-94 08:49:37 GMT"
+    else if (sscanf(buffer, "%15[A-Za-z], %2d-%3[A-Za-z]-%2d %2d:%2d:%2d GMT%n",
+                    day_name, &day, month_name, &year, &hour, &minute, &second, &consumed) == 7 &&
+             (size_t)consumed == value->length) {
+        year += year < 70 ? 2000 : 1900;
+    }
+    // asctime: "Sun Nov  6 08:49:37 1994"
+    else if (sscanf(buffer, "%15s %3s %2d %2d:%2d:%2d %4d%n",
+                    day_name, month_name, &day, &hour, &minute, &second, &year, &consumed) == 7 &&
+             (size_t)consumed == value->length) {
+        // Parsed
+    } else {
+        return -1;
+    }
+
+    int month = month_index(month_name);
+    if (month < 0 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60 ||
+        hour < 0 || minute < 0 || second < 0) {
+        return -1;
+    }
+
+    *t = make_utc_time(year, month, day, hour, minute, second);
+    return 0;
+}
+
+/**
+ * @brief Checks an If-None-Match list against an entity tag (weak comparison)
+ *
+ * @param list The header value: "*" or a comma-separated list of entity tags
+ * @param etag Our entity tag
+ * @return 1 if any listed tag matches, 0 otherwise
+ */
+static int etag_list_matches(const http_slice* list, const char* etag) {
+    const char* p = list->data;
+    const char* end = list->data + list->length;
+
+    // Weak comparison ignores the W/ prefix on both sides
+    const char* opaque = strncmp(etag, "W/", 2) == 0 ? etag + 2 : etag;
+    size_t opaque_length = strlen(opaque);
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        if (p == end) {
+            break;
+        }
+        if (*p == '*') {
+            return 1;
+        }
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/') {
+            p += 2;
+        }
+        if (p == end || *p != '"') {
+            return 0;
+        }
+
+        // Tags may contain commas, so find the closing quote rather than splitting
+        const char* close = memchr(p + 1, '"', end - p - 1);
+        if (!close) {
+            return 0;
+        }
+        if ((size_t)(close + 1 - p) == opaque_length && memcmp(p, opaque, opaque_length) == 0) {
+            return 1;
+        }
+        p = close + 1;
+    }
+    return 0;
+}
+
+int http_request_not_modified(const http_request* request, const char* etag, time_t mtime) {
+    const http_slice* if_none_match = http_request_header(request, "If-None-Match");
+    if (if_none_match) {
+        return etag_list_matches(if_none_match, etag);
+    }
+
+    // Dates in the future are invalid and the header is ignored
+    const http_slice* if_modified_since = http_request_header(request, "If-Modified-Since");
+    time_t since;
+    if (if_modified_since && http_parse_date(if_modified_since, &since) == 0 && since <= time(NULL)) {
+        return mtime <= since;
+    }
+    return 0;
+}
+
+int http_if_range_matches(const http_slice* if_range, const char* etag, const char* last_modified) {
+    // Entity tags need a strong comparison, which weak tags never pass
+    if (if_range->length >= 2 && if_range->data[0] == 'W' && if_range->data[1] == '/') {
+        return 0;
+    }
+    if (if_range->length > 0 && if_range->data[0] == '"') {
+        return etag[0] == '"' && http_slice_equals(if_range, etag);
+    }
+    return http_slice_equals(if_range, last_modified);
+}
@@ -0,0 +1,266 @@
+#include "http_parser.h"
+#include "http_scan.h"
+#include "platform.h"
+#include <string.h>
+
+/**
+ * This file contains the incremental HTTP/1.x request parser. See http_parser.h.
+ */
+
+/* Parser states */
+#define PARSE_REQUEST_LINE 0
+#define PARSE_HEADERS      1
+#define PARSE_DONE         2
+
+void http_request_init(http_request* request) {
+    memset(request, 0, sizeof(*request));
+    request->parse_state = PARSE_REQUEST_LINE;
+}
+
+/**
+ * @brief Parses "METHOD SP request-target SP HTTP-version"
+ */
+static http_parse_result parse_request_line(http_request* request, const char* line, size_t length,
+                                            const http_parser_limits* limits) {
+    const char* end = line + length;
+
+    // Method
+    size_t method_length = http_scan_token(line, length);
+    if (method_length == 0 || method_length == length || line[method_length] != ' ') {
+        return HTTP_PARSE_ERROR;
+    }
+    request->method.data = line;
+    request->method.length = method_length;
+
+    // Request target: visible characters up to the next space
+    const char* target = line + method_length + 1;
+    const char* target_end = target + http_scan_target(target, end - target);
+    if (target_end == target || target_end == end || *target_end != ' ') {
+        return HTTP_PARSE_ERROR;
+    }
+    if ((size_t)(target_end - target) > limits->max_target_length) {
+        return HTTP_PARSE_URI_TOO_LONG;
+    }
+    request->target.data = target;
+    request->target.length = target_end - target;
+
+    // Split the target into path and query
+    const char* question = memchr(target, '?', target_end - target);
+    request->path.data = target;
+    request->path.length = (question ? question : target_end) - target;
+    request->query.data = question ? question + 1 : target_end;
+    request->query.length = question ? (size_t)(target_end - question - 1) : 0;
+
+    // Version: HTTP/1.0 or HTTP/1.1
+    const char* version = target_end + 1;
+    if (end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0 ||
+        (version[7] != '0' && version[7] != '1')) {
+        return HTTP_PARSE_ERROR;
+    }
+    request->version.data = version;
+    request->version.length = 8;
+    request->version_minor = version[7] - '0';
+
+    return HTTP_PARSE_COMPLETE;
+}
+
+/**
+ * @brief Parses "field-name ":" OWS field-value OWS"
+ */
+static http_parse_result parse_header_line(http_request* request, const char* line, size_t length,
+                                           const http_parser_limits* limits) {
+    // Field names are tokens directly followed by a colon (no obsolete line folding)
+    size_t name_length = http_scan_token(line, length);
+    if (name_length == 0 || name_length == length || line[name_length] != ':') {
+        return HTTP_PARSE_ERROR;
+    }
+
+    if (request->header_count >= limits->max_headers ||
+        request->header_count >= HTTP_PARSER_MAX_HEADERS) {
+        return HTTP_PARSE_TOO_LARGE;
+    }
+
+    const char* value = line + name_length + 1;
+    const char* value_end = line + length;
+    while (value < value_end && (*value == ' ' || *value == '\t')) value++;
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+    if (http_scan_field_value(value, value_end - value) != (size_t)(value_end - value)) {
+        return HTTP_PARSE_ERROR;
+    }
+
+    http_header* header = &request->headers[request->header_count++];
+    header->name.data = line;
+    header->name.length = name_length;
+    header->value.data = value;
+    header->value.length = value_end - value;
+    return HTTP_PARSE_COMPLETE;
+}
+
+http_parse_result http_parse_request(http_request* request, const char* buffer, size_t length,
+                                     const http_parser_limits* limits) {
+    if (request->parse_state == PARSE_DONE) {
+        return HTTP_PARSE_COMPLETE;
+    }
+
+    while (request->parse_offset < length) {
+        const char* line = buffer + request->parse_offset;
+        size_t line_end = http_scan_newline(line, length - request->parse_offset);
+
+        if (line_end == length - request->parse_offset) {
+            // Wait for the rest of the line, unless it can no longer fit
+            if (length >= limits->max_head_size) {
+                return request->parse_state == PARSE_REQUEST_LINE ? HTTP_PARSE_URI_TOO_LONG : HTTP_PARSE_TOO_LARGE;
+            }
+            return HTTP_PARSE_INCOMPLETE;
+        }
+
+        size_t next_offset = request->parse_offset + line_end + 1;
+        if (next_offset > limits->max_head_size) {
+            return HTTP_PARSE_TOO_LARGE;
+        }
+
+        // Lines end with CRLF, but a bare LF is accepted too
+        size_t line_length = line_end;
+        if (line_length > 0 && line[line_length - 1] == '\r') {
+            line_length--;
+        }
+
+        http_parse_result result;
+        if (request->parse_state == PARSE_REQUEST_LINE) {
+            if (line_length == 0) {
+                // Ignore empty lines before the request line (RFC 7230 3.5)
+                request->parse_offset = next_offset;
+                continue;
+            }
+            result = parse_request_line(request, line, line_length, limits);
+            request->parse_state = PARSE_HEADERS;
+        } else if (line_length == 0) {
+            // Blank line: end of the head
+            request->parse_offset = next_offset;
+            request->head_length = next_offset;
+            request->parse_state = PARSE_DONE;
+            return HTTP_PARSE_COMPLETE;
+        } else {
+            result = parse_header_line(request, line, line_length, limits);
+        }
+
+        if (result != HTTP_PARSE_COMPLETE) {
+            return result;
+        }
+        request->parse_offset = next_offset;
+    }
+
+    if (length >= limits->max_head_size) {
+        return HTTP_PARSE_TOO_LARGE;
+    }
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+const http_slice* http_request_header(const http_request* request, const char* name) {
+    size_t name_length = strlen(name);
+    for (size_t i = 0; i < request->header_count; i++) {
+        const http_header* header = &request->headers[i];
+        if (header->name.length == name_length &&
+            strncasecmp(header->name.data, name, name_length) == 0) {
+            return &header->value;
+        }
+    }
+    return NULL;
+}
+
+int http_slice_equals(const http_slice* slice, const char* str) {
+    size_t length = strlen(str);
+    return slice->length == length && memcmp(slice->data, str, length) == 0;
+}
+
+int http_slice_has_token(const http_slice* slice, const char* token) {
+    size_t token_length = strlen(token);
+    const char* p = slice->data;
+    const char* end = slice->data + slice->length;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char* start = p;
+        while (p < end && *p != ',') p++;
+        const char* stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+        if ((size_t)(stop - start) == token_length && strncasecmp(start, token, token_length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks whether a qvalue is zero ("0", "0.", "0.0" up to "0.000")
+ *
+ * @param p Start of the value
+ * @param end End of the value (trailing whitespace allowed)
+ * @return 1 if the value is zero, 0 otherwise (malformed values included)
+ */
+static int qvalue_is_zero(const char* p, const char* end) {
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    if (p == end || *p++ != '0') {
+        return 0;
+    }
+    if (p < end && *p == '.') {
+        p++;
+    }
+    for (int digits = 0; p < end; p++, digits++) {
+        if (*p != '0' || digits == 3) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int http_slice_has_media_type(const http_slice* slice, const char* media_type) {
+    size_t type_length = strlen(media_type);
+    const char* p = slice->data;
+    const char* end = slice->data + slice->length;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char* start = p;
+        while (p < end && *p != ',' && *p != ';') p++;
+        const char* stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+        int listed = (size_t)(stop - start) == type_length && strncasecmp(start, media_type, type_length) == 0;
+
+        // Of the parameters only the weight matters: q=0 means "not acceptable"
+        int rejected = 0;
+        while (p < end && *p == ';') {
+            p++;
+            while (p < end && (*p == ' ' || *p == '\t')) p++;
+            const char* parameter = p;
+            while (p < end && *p != ',' && *p != ';') p++;
+            if (p - parameter >= 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+                rejected = qvalue_is_zero(parameter + 2, p);
+            }
+        }
+        if (listed && !rejected) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int http_query_param(const http_slice* query, const char* name, http_slice* value) {
+    size_t name_length = strlen(name);
+    const char* p = query->data;
+    const char* end = query->data + query->length;
+
+    while (p < end) {
+        const char* start = p;
+        while (p < end && *p != '&') p++;
+        const char* equals = memchr(start, '=', (size_t)(p - start));
+        const char* name_end = equals ? equals : p;
+        if ((size_t)(name_end - start) == name_length && strncmp(start, name, name_length) == 0) {
+            value->data = equals ? equals + 1 : p;
+            value->length = equals ? (size_t)(p - equals - 1) : 0;
+            return 1;
+        }
+        if (p < end) p++;
+    }
+    return 0;
+}
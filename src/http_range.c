@@ -0,0 +1,186 @@
+#include "http_range.h"
+#include "platform.h"
+#include <string.h>
+
+/**
+ * This file contains the Range header parser. See http_range.h.
+ */
+
+/**
+ * @brief Parses a run of decimal digits
+ *
+ * Values too large to represent saturate at the maximum, which is always
+ * beyond the end of any file and therefore handled like any other position
+ * past the end.
+ *
+ * @param p In: first character; out: first character after the digits
+ * @param end End of the input
+ * @param value Receives the parsed value
+ * @return 0 on success, -1 if there are no digits
+ */
+static int parse_position(const char** p, const char* end, unsigned long long* value) {
+    const char* start = *p;
+    unsigned long long result = 0;
+
+    while (*p < end && **p >= '0' && **p <= '9') {
+        unsigned digit = (unsigned)(**p - '0');
+        if (result > (~0ULL - digit) / 10) {
+            result = ~0ULL;
+        } else {
+            result = result * 10 + digit;
+        }
+        (*p)++;
+    }
+
+    *value = result;
+    return *p == start ? -1 : 0;
+}
+
+/**
+ * @brief Skips optional whitespace
+ */
+static const char* skip_whitespace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+/**
+ * @brief Parses one byte-range-spec and clips it to the representation
+ *
+ * @param p First character of the spec (whitespace already skipped)
+ * @param end End of the spec (trailing whitespace already removed)
+ * @param size Size of the representation
+ * @param range Receives the clipped range if it is satisfiable
+ * @return 1 if satisfiable, 0 if unsatisfiable, -1 if malformed
+ */
+static int parse_range_spec(const char* p, const char* end, off_t size, http_byte_range* range) {
+    unsigned long long first, last;
+
+    if (p < end && *p == '-') {
+        // Suffix range: the last N bytes
+        unsigned long long suffix;
+        p++;
+        if (parse_position(&p, end, &suffix) != 0 || p != end) {
+            return -1;
+        }
+        if (suffix == 0 || size == 0) {
+            return 0;
+        }
+        first = suffix >= (unsigned long long)size ? 0 : (unsigned long long)size - suffix;
+        last = (unsigned long long)size - 1;
+    } else {
+        // "first-last" or open-ended "first-"
+        if (parse_position(&p, end, &first) != 0 || p == end || *p != '-') {
+            return -1;
+        }
+        p++;
+        if (parse_position(&p, end, &last) != 0) {
+            last = ~0ULL;
+        } else if (last < first) {
+            return -1;
+        }
+        if (p != end) {
+            return -1;
+        }
+        if (first >= (unsigned long long)size) {
+            return 0;
+        }
+        if (last >= (unsigned long long)size) {
+            last = (unsigned long long)size - 1;
+        }
+    }
+
+    range->first = (off_t)first;
+    range->length = (off_t)(last - first + 1);
+    return 1;
+}
+
+/**
+ * @brief Sorts ranges by offset and merges overlapping or adjacent ones
+ *
+ * @param set The range set
+ */
+static void coalesce_ranges(http_range_set* set) {
+    // Insertion sort: the set holds at most HTTP_RANGE_MAX_RANGES entries
+    for (size_t i = 1; i < set->count; i++) {
+        http_byte_range current = set->ranges[i];
+        size_t j = i;
+        while (j > 0 && set->ranges[j - 1].first > current.first) {
+            set->ranges[j] = set->ranges[j - 1];
+            j--;
+        }
+        set->ranges[j] = current;
+    }
+
+    size_t merged = 0;
+    for (size_t i = 1; i < set->count; i++) {
+        http_byte_range* last = &set->ranges[merged];
+        const http_byte_range* next = &set->ranges[i];
+        off_t last_end = last->first + last->length;
+
+        if (next->first <= last_end) {
+            off_t next_end = next->first + next->length;
+            if (next_end > last_end) {
+                last->length = next_end - last->first;
+            }
+        } else {
+            set->ranges[++merged] = *next;
+        }
+    }
+    set->count = merged + 1;
+}
+
+http_range_result http_range_parse(const http_slice* header, off_t size, http_range_set* set) {
+    const char* p = header->data;
+    const char* end = header->data + header->length;
+    size_t specs = 0;
+
+    // Only the bytes unit is supported
+    if (header->length < 6 || strncasecmp(p, "bytes=", 6) != 0) {
+        return HTTP_RANGE_NONE;
+    }
+    p += 6;
+    set->count = 0;
+
+    // byte-range-set = 1#( byte-range-spec / suffix-byte-range-spec )
+    while (p < end) {
+        const char* element_end = memchr(p, ',', end - p);
+        const char* next = element_end ? element_end + 1 : end;
+        if (!element_end) {
+            element_end = end;
+        }
+
+        const char* spec = skip_whitespace(p, element_end);
+        const char* spec_end = element_end;
+        while (spec_end > spec && (spec_end[-1] == ' ' || spec_end[-1] == '\t')) spec_end--;
+        p = next;
+
+        // Empty list elements are allowed and ignored
+        if (spec == spec_end) {
+            continue;
+        }
+
+        // Asking for more ranges than we serve is treated as abuse: send it all once
+        if (++specs > HTTP_RANGE_MAX_RANGES) {
+            return HTTP_RANGE_NONE;
+        }
+
+        int result = parse_range_spec(spec, spec_end, size, &set->ranges[set->count]);
+        if (result < 0) {
+            return HTTP_RANGE_NONE;
+        }
+        if (result > 0) {
+            set->count++;
+        }
+    }
+
+    if (specs == 0) {
+        return HTTP_RANGE_NONE;
+    }
+    if (set->count == 0) {
+        return HTTP_RANGE_UNSATISFIABLE;
+    }
+
+    coalesce_ranges(set);
+    return HTTP_RANGE_SATISFIABLE;
+}
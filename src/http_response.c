@@ -1,65 +1,69 @@
 /**
  * http_response.c - HTTP response handling module
  * 
- * This file contains functions for generating and sending HTTP responses to clients.
+ * This file contains functions for generating HTTP responses and queueing them on
+ * client connections. The event loop sends the queued bytes once the socket is
+ * writable (see connection.c).
  * It abstracts the details of HTTP protocol formatting and provides a simple interface
  * for sending common HTTP status responses like 404 Not Found or 500 Internal Server Error.
  * 
  * Key concepts covered in this file:
  * - HTTP response format (status line, headers, body)
- * - Cross-platform socket handling (Windows vs Unix)
  * - Error handling and reporting
  * - Memory management for variable-length responses
  */
 
 #include "http_response.h"
 #include "platform.h"
+#include "log.h"
 #include <stdio.h>
 #include <string.h>
 
-/* Include Windows socket headers for Windows platform */
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
-/* Unix socket headers */
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netinet/tcp.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#endif
-
 /**
- * Send an HTTP response with the specified status code and message
+ * Queue an HTTP response with the specified status code and message
  * 
  * This function forms the core of our HTTP response system. It constructs a properly
- * formatted HTTP response with status line, headers, and optional body, then sends it
- * to the client.
+ * formatted HTTP response with status line, headers, and optional body, then queues it
+ * on the client connection.
  * 
  * HTTP Response Format:
  * HTTP/1.1 [STATUS_CODE] [STATUS_TEXT]    <- Status line
  * Content-Type: [MIME_TYPE]               <- Headers
  * Content-Length: [LENGTH]
- * Connection: close
+ * Connection: [keep-alive|close]
  * 
  * [BODY]                                  <- Response body (optional)
  * 
- * The function handles large responses by sending the header and body separately
- * if they won't fit in our buffer together.
+ * The header and body are queued as separate segments, so there is no limit on
+ * the body size and no need to copy the body into the header buffer.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  * @param status_code The HTTP status code (e.g., 200, 404, 500)
  * @param status_text The status text (e.g., "OK", "Not Found")
  * @param content_type The MIME type of the response (e.g., "text/html")
  * @param body The response body (can be NULL for empty response)
  */
-void send_http_status(int client_fd, int status_code, const char* status_text, 
+void send_http_status(http_connection* conn, int status_code, const char* status_text, 
                      const char* content_type, const char* body) {
-    char response[BUFFER_SIZE];  /* Buffer to hold the HTTP response */
-    int bytes_sent;              /* Number of bytes sent to the client */
-    size_t response_len;         /* Length of the response string */
+    send_http_status_with_headers(conn, status_code, status_text, content_type, NULL, body);
+}
+
+/**
+ * Queue an HTTP response with additional header lines
+ * 
+ * Works like send_http_status, but inserts extra_headers (for example
+ * "Accept-Ranges: bytes\r\n") after the standard headers.
+ * 
+ * @param conn The client connection
+ * @param status_code The HTTP status code (e.g., 200, 404, 500)
+ * @param status_text The status text (e.g., "OK", "Not Found")
+ * @param content_type The MIME type of the response (e.g., "text/html")
+ * @param extra_headers Header lines, each ending in "\r\n" (can be NULL)
+ * @param body The response body (can be NULL for empty response)
+ */
+void send_http_status_with_headers(http_connection* conn, int status_code, const char* status_text,
+                                   const char* content_type, const char* extra_headers, const char* body) {
+    char response[BUFFER_SIZE];  /* Buffer to hold the HTTP response header */
     
     /* Use default content type if none provided */
     if (content_type == NULL) {
@@ -75,66 +79,54 @@ void send_http_status(int client_fd, int status_code, const char* status_text,
              "HTTP/1.1 %d %s\r\n"           /* Status line: HTTP/1.1 200 OK */
              "Content-Type: %s\r\n"         /* Content-Type header: text/html */
              "Content-Length: %zu\r\n"      /* Content-Length header: size of body */
-             "Connection: close\r\n\r\n",   /* Connection header + empty line to separate headers from body */
-             status_code, status_text, content_type, content_length);
+             "%s"                           /* Caller-supplied headers, if any */
+             "Connection: %s\r\n\r\n",      /* Connection header + empty line to separate headers from body */
+             status_code, status_text, content_type, content_length,
+             extra_headers ? extra_headers : "", connection_header_value(conn));
     
-    /* Add body if provided */
+    /* Queue the header; the event loop sends it when the socket is writable */
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
+        return;
+    }
+    
+    /* Queue the body separately if provided */
     if (body != NULL && content_length > 0) {
-        response_len = strlen(response);
-        
-        /* Check if the complete response (header + body) fits in our buffer */
-        if (response_len + content_length < BUFFER_SIZE) {
-            /* If it fits, append the body to the header in the buffer */
-            strcat(response, body);
-        } else {
-            /* If it doesn't fit, send header and body separately
-             * This handles large responses that exceed our buffer size */
-            
-            /* Send header first */
-            #ifdef _WIN32
-            /* Windows requires casting the length to int for the send function */
-            bytes_sent = send(client_fd, response, (int)strlen(response), 0);
-            #else
-            /* Unix systems use size_t for the length parameter */
-            bytes_sent = send(client_fd, response, strlen(response), 0);
-            #endif
-            
-            /* Check for errors when sending the header */
-            if (bytes_sent < 0) {
-                printf("[ERROR] Failed to send HTTP header: %d - %s\n", bytes_sent, platform_get_error_string());
-                return;
-            }
-            
-            /* Send body separately */
-            #ifdef _WIN32
-            bytes_sent = send(client_fd, body, (int)content_length, 0);
-            #else
-            bytes_sent = send(client_fd, body, content_length, 0);
-            #endif
-            
-            /* Check for errors when sending the body */
-            if (bytes_sent < 0) {
-                printf("[ERROR] Failed to send HTTP body: %d - %s\n", bytes_sent, platform_get_error_string());
-            }
-            return;  /* We're done - sent header and body separately */
+        if (connection_queue_copy(conn, body, content_length) != 0) {
+            LOG_ERROR("Failed to queue HTTP body\n");
         }
     }
+}
+
+/**
+ * Queue a 304 Not Modified response for the client
+ * 
+ * Sent when a conditional GET finds that the client's cached copy is still
+ * current. A 304 never has a body, so there is no Content-Type or
+ * Content-Length; the validators are repeated so the client can refresh its
+ * cache entry.
+ * 
+ * @param conn The client connection
+ * @param validators ETag and Last-Modified header lines, each ending in "\r\n"
+ */
+void send_304(http_connection* conn, const char* validators) {
+    char response[BUFFER_SIZE];
+    
+    LOG_DEBUG("Sending 304 Not Modified response\n");
     
-    /* Send the complete response (header + body if it fits) */
-    #ifdef _WIN32
-    bytes_sent = send(client_fd, response, (int)strlen(response), 0);
-    #else
-    bytes_sent = send(client_fd, response, strlen(response), 0);
-    #endif
+    snprintf(response, BUFFER_SIZE,
+             "HTTP/1.1 304 Not Modified\r\n"
+             "%s"
+             "Connection: %s\r\n\r\n",
+             validators, connection_header_value(conn));
     
-    /* Check for errors when sending the complete response */
-    if (bytes_sent < 0) {
-        printf("[ERROR] Failed to send HTTP response: %d - %s\n", bytes_sent, platform_get_error_string());
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
     }
 }
 
 /**
- * Send a 404 Not Found response to the client
+ * Queue a 404 Not Found response for the client
  * 
  * This is a convenience function that wraps send_http_status with pre-defined
  * parameters for a 404 Not Found response. It's used when a requested resource
@@ -142,22 +134,22 @@ void send_http_status(int client_fd, int status_code, const char* status_text,
  * 
  * The response includes a simple HTML page explaining the error to the user.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  */
-void send_404(int client_fd) {
+void send_404(http_connection* conn) {
     /* Define the HTML body for the 404 response */
     const char* body = 
         "<html><body><h1>404 Not Found</h1>"
         "<p>The requested resource could not be found.</p></body></html>";
     
-    printf("[DEBUG] Sending 404 Not Found response\n");
+    LOG_DEBUG("Sending 404 Not Found response\n");
     
     /* Call the generic function with 404-specific parameters */
-    send_http_status(client_fd, HTTP_STATUS_NOT_FOUND, "Not Found", "text/html", body);
+    send_http_status(conn, HTTP_STATUS_NOT_FOUND, "Not Found", "text/html", body);
 }
 
 /**
- * Send a 400 Bad Request response to the client
+ * Queue a 400 Bad Request response for the client
  * 
  * This is a convenience function that wraps send_http_status with pre-defined
  * parameters for a 400 Bad Request response. It's used when the client sends
@@ -165,22 +157,43 @@ void send_404(int client_fd) {
  * 
  * The response includes a simple HTML page explaining the error to the user.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  */
-void send_400(int client_fd) {
+void send_400(http_connection* conn) {
     /* Define the HTML body for the 400 response */
     const char* body = 
         "<html><body><h1>400 Bad Request</h1>"
         "<p>Your browser sent a request that this server could not understand.</p></body></html>";
     
-    printf("[DEBUG] Sending 400 Bad Request response\n");
+    LOG_DEBUG("Sending 400 Bad Request response\n");
     
     /* Call the generic function with 400-specific parameters */
-    send_http_status(client_fd, HTTP_STATUS_BAD_REQUEST, "Bad Request", "text/html", body);
+    send_http_status(conn, HTTP_STATUS_BAD_REQUEST, "Bad Request", "text/html", body);
 }
 
 /**
- * Send a 500 Internal Server Error response to the client
+ * Queue a 405 Method Not Allowed response for the client
+ * 
+ * Used for any method other than GET and HEAD. The Allow header, which a
+ * 405 response must carry, tells the client which methods we do support.
+ * 
+ * @param conn The client connection
+ */
+void send_405(http_connection* conn) {
+    /* Define the HTML body for the 405 response */
+    const char* body = 
+        "<html><body><h1>405 Method Not Allowed</h1>"
+        "<p>Only GET and HEAD requests are supported.</p></body></html>";
+    
+    LOG_DEBUG("Sending 405 Method Not Allowed response\n");
+    
+    /* Call the generic function with 405-specific parameters */
+    send_http_status_with_headers(conn, HTTP_STATUS_METHOD_NOT_ALLOWED, "Method Not Allowed", "text/html",
+                                  "Allow: GET, HEAD\r\n", body);
+}
+
+/**
+ * Queue a 500 Internal Server Error response for the client
  * 
  * This is a convenience function that wraps send_http_status with pre-defined
  * parameters for a 500 Internal Server Error response. It's used when the server
@@ -188,16 +201,65 @@ void send_400(int client_fd) {
  * 
  * The response includes a simple HTML page explaining the error to the user.
  * 
- * @param client_fd The client socket file descriptor
+ * @param conn The client connection
  */
-void send_500(int client_fd) {
+void send_500(http_connection* conn) {
     /* Define the HTML body for the 500 response */
     const char* body = 
         "<html><body><h1>500 Internal Server Error</h1>"
         "<p>The server encountered an unexpected condition.</p></body></html>";
     
-    printf("[DEBUG] Sending 500 Internal Server Error response\n");
+    LOG_DEBUG("Sending 500 Internal Server Error response\n");
     
     /* Call the generic function with 500-specific parameters */
-    send_http_status(client_fd, HTTP_STATUS_INTERNAL_SERVER_ERROR, "Internal Server Error", "text/html", body);
+    send_http_status(conn, HTTP_STATUS_INTERNAL_SERVER_ERROR, "Internal Server Error", "text/html", body);
+}
+
+/**
+ * Queue a 503 Service Unavailable response for the client
+ * 
+ * Sent when the server is too busy to take the request on right now, for
+ * example when the filesystem threads already have as much work queued as
+ * they are allowed. Retry-After asks the client to try again shortly.
+ * 
+ * @param conn The client connection
+ */
+void send_503(http_connection* conn) {
+    const char* body = 
+        "<html><body><h1>503 Service Unavailable</h1>"
+        "<p>The server is busy, please try again shortly.</p></body></html>";
+    
+    LOG_DEBUG("Sending 503 Service Unavailable response\n");
+    
+    send_http_status_with_headers(conn, HTTP_STATUS_SERVICE_UNAVAILABLE, "Service Unavailable", "text/html",
+                                  "Retry-After: 1\r\n", body);
+}
+
+/**
+ * Format a timestamp as an HTTP date
+ * 
+ * HTTP dates are always expressed in GMT using the fixed-length format from
+ * RFC 7231 section 7.1.1.1, e.g. "Sun, 06 Nov 1994 08:49:37 GMT". Day and
+ * month names are spelled out here rather than taken from strftime, which
+ * would follow the current locale.
+ * 
+ * @param t The timestamp
+ * @param buffer Output buffer of at least HTTP_DATE_SIZE bytes
+ */
+void http_format_date(time_t t, char* buffer) {
+    static const char* days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm tm_buf;
+    
+    /* gmtime_r/gmtime_s are safe with several workers */
+#ifdef _WIN32
+    gmtime_s(&tm_buf, &t);
+#else
+    gmtime_r(&t, &tm_buf);
+#endif
+    
+    snprintf(buffer, HTTP_DATE_SIZE, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             days[tm_buf.tm_wday], tm_buf.tm_mday, months[tm_buf.tm_mon], tm_buf.tm_year + 1900,
+             tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec);
 } 
\ No newline at end of file
@@ -1,6 +1,20 @@
 #include "httpfileserv.h"
 #include "platform.h"
 #include "http_response.h"
+#include "event_loop.h"
+#include "server_config.h"
+#include "http_scan.h"
+#include "http_range.h"
+#include "http_conditional.h"
+#include "file_cache.h"
+#include "stat_cache.h"
+#include "listing_cache.h"
+#include "dir_reader.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "fs_pool.h"
+#include "utils.h"
+#include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +30,48 @@
 #include <fcntl.h>
 #endif
 
+// Room for the "ETag: ...\r\nLast-Modified: ...\r\n" header lines (and
+// "Vary: Accept\r\n" for listings)
+#define VALIDATORS_SIZE (HTTP_ETAG_SIZE + HTTP_DATE_SIZE + 48)
+
+// Room for one listing row; JSON escaping can grow a 255-byte name sixfold
+#define LISTING_ROW_SIZE 2048
+
+// Random bytes in a multipart/byteranges boundary (two hex digits each)
+#define BOUNDARY_RANDOM_BYTES 12
+
+/**
+ * @brief Representations of a directory listing
+ */
+typedef enum {
+    LISTING_HTML,  /**< The page rendered from the template */
+    LISTING_JSON   /**< A JSON array of {name, type, size, mtime} objects */
+} listing_format;
+
+/* Content-Type of each listing_format */
+static const char* const listing_content_types[] = { "text/html", "application/json" };
+
+/* Query values of each stat_cache_sort */
+static const char* const listing_sort_names[] = { "name", "size", "mtime" };
+
+/**
+ * @brief What a listing request asks for
+ */
+typedef struct {
+    listing_format format;  /**< Representation */
+    int paged;              /**< Whether the entries are sorted and paginated */
+    stat_cache_sort sort;   /**< Paged: key to sort by */
+    int descending;         /**< Paged: whether to sort in descending order */
+    size_t offset;          /**< Paged: sorted entries to skip */
+    size_t limit;           /**< Paged: entries per page */
+    char variant[96];       /**< Canonical form of the above ("" for the plain HTML listing) */
+} listing_options;
+
+// Streamed listing chunks: a fixed-width "XXXX\r\n" size line before the
+// data and "\r\n" after it (chunks never exceed CONNECTION_STREAM_BUFFER_SIZE)
+#define CHUNK_HEADER_SIZE 6
+#define CHUNK_FRAMING_SIZE (CHUNK_HEADER_SIZE + 2)
+
 // Structure to hold directory listing data for callback
 /**
  * @brief Structure to hold directory listing data during generation
@@ -25,39 +81,44 @@
  * information like the client file descriptor and URL path.
  */
 typedef struct {
-    int client_fd;           /**< Client socket file descriptor */
+    http_connection* conn;   /**< Connection the listing is sent on */
     char* entries;           /**< Buffer containing the HTML entries */
     const char* url_path;    /**< URL path being listed */
     size_t entries_size;     /**< Current size of the entries content */
     size_t entries_capacity; /**< Total capacity of the entries buffer */
+    size_t entry_count;      /**< Entries added so far */
+    size_t entry_limit;      /**< Entries to add before giving up (0 for no limit) */
+    int truncated;           /**< Set when the directory has more than entry_limit entries */
+    listing_format format;   /**< Representation being built */
 } dir_listing_data;
 
 /**
- * @brief Callback function for processing directory entries during directory listing
+ * @brief Formats a directory entry as an HTML table row
  *
- * This function is called by platform_list_directory for each entry in a directory.
- * It formats the entry as an HTML table row and appends it to the entries buffer.
- * The function handles both files and directories with appropriate styling and icons.
+ * Files and directories get their own styling and icons.
  *
  * @param name The name of the directory entry (file or subdirectory)
  * @param is_dir Flag indicating if the entry is a directory (1) or a file (0)
  * @param size Size of the file in bytes (ignored for directories)
  * @param mtime Last modification time of the entry
- * @param user_data Pointer to a dir_listing_data structure containing the entries buffer
- *
- * @return 0 on success to continue listing, 1 on error to stop listing
+ * @param entry_html Receives the row (LISTING_ROW_SIZE bytes)
+ * @return Length of the row
  */
-int dir_listing_callback(const char* name, int is_dir, size_t size, time_t mtime, void* user_data) {
-    dir_listing_data* data = (dir_listing_data*)user_data;
-    char entry_html[BUFFER_SIZE];
+static size_t format_html_row(const char* name, int is_dir, size_t size, time_t mtime, char* entry_html) {
     char timestr[80];
     
-    // Format last modified time
-    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&mtime));
+    // Format last modified time (localtime_r/localtime_s are safe with several workers)
+    struct tm tm_buf;
+#ifdef _WIN32
+    localtime_s(&tm_buf, &mtime);
+#else
+    localtime_r(&mtime, &tm_buf);
+#endif
+    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm_buf);
     
     // Format the HTML for this entry with improved styling
     if (is_dir) {
-        snprintf(entry_html, BUFFER_SIZE, 
+        snprintf(entry_html, LISTING_ROW_SIZE, 
                  "<tr><td><a href=\"%s/\"><span class=\"icon\">📁</span> %s/</a></td>"
                  "<td class=\"size\">-</td><td class=\"date\">%s</td></tr>", 
                  name, name, timestr);
@@ -74,233 +135,555 @@ int dir_listing_callback(const char* name, int is_dir, size_t size, time_t mtime
             snprintf(size_str, sizeof(size_str), "%.1f GB", size / (1024.0 * 1024.0 * 1024.0));
         }
         
-        snprintf(entry_html, BUFFER_SIZE, 
+        snprintf(entry_html, LISTING_ROW_SIZE, 
                  "<tr><td><a href=\"%s\"><span class=\"icon\">📄</span> %s</a></td>"
                  "<td class=\"size\">%s</td><td class=\"date\">%s</td></tr>", 
                  name, name, size_str, timestr);
     }
     
+    return strlen(entry_html);
+}
+
+/**
+ * @brief Formats a directory entry as a JSON object
+ *
+ * Directories have a size of 0. Objects after the first one start with
+ * the separating comma. Names are bytes, and JSON text has to be UTF-8: each
+ * byte that is not part of a well-formed sequence becomes U+FFFD.
+ *
+ * @param name The name of the directory entry
+ * @param is_dir Flag indicating if the entry is a directory (1) or a file (0)
+ * @param size Size of the file in bytes
+ * @param mtime Last modification time of the entry
+ * @param first Whether this is the first entry of the array
+ * @param row Receives the object (LISTING_ROW_SIZE bytes)
+ * @return Length of the object
+ */
+static size_t format_json_row(const char* name, int is_dir, size_t size, time_t mtime, int first, char* row) {
+    static const char hex[] = "0123456789abcdef";
+    char* p = row;
+    
+    if (!first) {
+        *p++ = ',';
+    }
+    memcpy(p, "{\"name\":\"", 9);
+    p += 9;
+    const unsigned char* end = (const unsigned char*)name + strlen(name);
+    for (const unsigned char* c = (const unsigned char*)name; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)*c;
+        } else if (*c < 0x20) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[*c >> 4];
+            p[5] = hex[*c & 0xf];
+            p += 6;
+        } else if (*c < 0x80) {
+            *p++ = (char)*c;
+        } else {
+            int length = utf8_sequence_length((const char*)c, (size_t)(end - c));
+            if (length == 0) {
+                memcpy(p, "\\ufffd", 6);
+                p += 6;
+            } else {
+                memcpy(p, c, (size_t)length);
+                p += length;
+                c += length - 1;
+            }
+        }
+    }
+    p += snprintf(p, LISTING_ROW_SIZE - (size_t)(p - row),
+                  "\",\"type\":\"%s\",\"size\":%llu,\"mtime\":%lld}",
+                  is_dir ? "directory" : "file", is_dir ? 0ULL : (unsigned long long)size,
+                  (long long)mtime);
+    return (size_t)(p - row);
+}
+
+/**
+ * @brief Formats a directory entry in the listing's representation
+ */
+static size_t format_listing_row(listing_format format, int first, const char* name, int is_dir,
+                                 size_t size, time_t mtime, char* row) {
+    if (format == LISTING_JSON) {
+        return format_json_row(name, is_dir, size, mtime, first, row);
+    }
+    return format_html_row(name, is_dir, size, mtime, row);
+}
+
+/**
+ * @brief Appends text to the entries buffer, growing it as needed
+ *
+ * @return 0 on success, 1 if out of memory
+ */
+static int append_entries(dir_listing_data* data, const char* text, size_t length) {
     // Check if we need to resize the buffer
-    size_t entry_len = strlen(entry_html);
-    if (data->entries_size + entry_len + 1 > data->entries_capacity) {
-        data->entries_capacity = data->entries_capacity * 2 + entry_len;
+    if (data->entries_size + length + 1 > data->entries_capacity) {
+        data->entries_capacity = data->entries_capacity * 2 + length;
         char* new_entries = realloc(data->entries, data->entries_capacity);
         if (!new_entries) {
-            return 1; // Error, stop listing
+            return 1;
         }
         data->entries = new_entries;
     }
     
-    // Append to the entries
-    strcat(data->entries, entry_html);
-    data->entries_size += entry_len;
+    // Append to the entries (at the known end, not with strcat)
+    memcpy(data->entries + data->entries_size, text, length);
+    data->entries_size += length;
+    data->entries[data->entries_size] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Callback function for processing directory entries during directory listing
+ *
+ * This function is called by platform_list_directory for each entry in a directory.
+ * It formats the entry as an HTML table row (or JSON object) and appends it to the
+ * entries buffer.
+ * Once the entry limit is reached it stops and marks the listing as truncated,
+ * so a huge directory is streamed instead of being built in memory.
+ *
+ * @param name The name of the directory entry (file or subdirectory)
+ * @param is_dir Flag indicating if the entry is a directory (1) or a file (0)
+ * @param size Size of the file in bytes (ignored for directories)
+ * @param mtime Last modification time of the entry
+ * @param user_data Pointer to a dir_listing_data structure containing the entries buffer
+ *
+ * @return 0 on success to continue listing, 1 on error or at the limit to stop listing
+ */
+int dir_listing_callback(const char* name, int is_dir, size_t size, time_t mtime, void* user_data) {
+    dir_listing_data* data = (dir_listing_data*)user_data;
+    char entry_html[LISTING_ROW_SIZE];
+    
+    if (data->entry_limit && data->entry_count == data->entry_limit) {
+        data->truncated = 1;
+        return 1;
+    }
+    size_t entry_len = format_listing_row(data->format, data->entry_count == 0, name, is_dir, size, mtime,
+                                          entry_html);
+    data->entry_count++;
+    
+    return append_entries(data, entry_html, entry_len); // 0 to continue listing, 1 on error
+}
+
+/**
+ * @brief Creates, binds and starts listening on a server socket
+ *
+ * @param port The port to listen on
+ * @param reuse_port 1 to set SO_REUSEPORT so several sockets can bind the same
+ *                   port and the kernel spreads incoming connections across them
+ * @return The listening socket, or -1 on failure
+ */
+static int create_server_socket(int port, int reuse_port) {
+    int server_fd;
+    struct sockaddr_in address;
+    
+    // Create server socket
+    if ((server_fd = (int)socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket failed");
+        return -1;
+    }
+    
+    // Set socket options to reuse address
+    int opt = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt))) {
+        perror("setsockopt");
+        platform_close_socket(server_fd);
+        return -1;
+    }
+    
+#ifdef SO_REUSEPORT
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&opt, sizeof(opt))) {
+        perror("setsockopt:SO_REUSEPORT");
+        platform_close_socket(server_fd);
+        return -1;
+    }
+#else
+    (void)reuse_port;
+#endif
+    
+    // Configure address
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    
+    // Bind socket to port
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("bind failed");
+        platform_close_socket(server_fd);
+        return -1;
+    }
+    
+    // Listen for connections, with room for bursts of concurrent clients
+    if (listen(server_fd, SOMAXCONN) < 0) {
+        perror("listen");
+        platform_close_socket(server_fd);
+        return -1;
+    }
     
-    return 0; // Continue listing
+    return server_fd;
+}
+
+/**
+ * @brief Arguments for a worker thread
+ */
+typedef struct {
+    int id;                /**< Worker number, for log messages */
+    int server_fd;         /**< Listening socket owned by this worker */
+    const char* base_path; /**< Directory being served */
+} worker_args;
+
+/**
+ * @brief Worker thread entry point: runs one event loop on the worker's listener
+ *
+ * @param arg Pointer to the worker's worker_args
+ */
+static void worker_main(void* arg) {
+    worker_args* worker = (worker_args*)arg;
+    LOG_DEBUG("Worker %d running event loop on fd=%d\n", worker->id, worker->server_fd);
+    if (event_loop_run(worker->server_fd, worker->base_path) != 0) {
+        LOG_ERROR("Worker %d event loop failed\n", worker->id);
+    }
 }
 
 // Main function
 int main(int argc, char* argv[]) {
-    int server_fd, client_fd;
-    struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    char* base_path;
+    char* base_path = NULL;
     int port = DEFAULT_PORT;
+    int positional = 0;
     
     // Check command-line arguments
     if (argc < 2) {
-        printf("Usage: %s <directory_path> [port]\n", argv[0]);
+        printf("Usage: %s <directory_path> [port] [options]\n", argv[0]);
         printf("  directory_path: Directory to serve files from\n");
         printf("  port: Optional port number (default: %d)\n", DEFAULT_PORT);
+        server_config_print_usage();
         return 1;
     }
     
-    base_path = argv[1];
-    
-    // Check if port is provided as an argument
-    if (argc >= 3) {
-        int custom_port = atoi(argv[2]);
-        if (custom_port > 0 && custom_port < 65536) {
-            port = custom_port;
+    // Options are "--name value" or "--name=value", everything else is positional
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            char name[64];
+            const char* value;
+            const char* equals = strchr(argv[i] + 2, '=');
+            if (equals) {
+                snprintf(name, sizeof(name), "%.*s", (int)(equals - argv[i] - 2), argv[i] + 2);
+                value = equals + 1;
+            } else if (i + 1 < argc) {
+                snprintf(name, sizeof(name), "%s", argv[i] + 2);
+                value = argv[++i];
+            } else {
+                printf("Missing value for option '%s'\n", argv[i]);
+                return 1;
+            }
+            if (server_config_set(name, value) != 0) {
+                return 1;
+            }
+        } else if (positional == 0) {
+            base_path = argv[i];
+            positional++;
+        } else if (positional == 1) {
+            // Port number
+            int custom_port = atoi(argv[i]);
+            if (custom_port > 0 && custom_port < 65536) {
+                port = custom_port;
+            } else {
+                printf("Warning: Invalid port number '%s', using default port %d\n", 
+                      argv[i], DEFAULT_PORT);
+            }
+            positional++;
         } else {
-            printf("Warning: Invalid port number '%s', using default port %d\n", 
-                  argv[2], DEFAULT_PORT);
+            printf("Warning: Ignoring extra argument '%s'\n", argv[i]);
         }
     }
     
+    if (base_path == NULL) {
+        printf("Missing directory_path argument\n");
+        return 1;
+    }
+    
     // Initialize platform-specific functionality
     if (platform_init() != 0) {
         perror("Platform initialization failed");
         exit(EXIT_FAILURE);
     }
+    platform_set_zero_copy(server_config_get()->sendfile);
     
-    // Create server socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket failed");
+    // From here on records are queued and written by the logger's own thread
+    if (log_init(server_config_get()->log_level) != 0) {
+        perror("Logger initialization failed");
         platform_cleanup();
         exit(EXIT_FAILURE);
     }
-    
-    // Set socket options to reuse address
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt))) {
-        perror("setsockopt");
+    if (server_config_get()->access_log_path &&
+        access_log_init(server_config_get()->access_log_path,
+                        (access_log_format)server_config_get()->access_log_format) != 0) {
+        LOG_ERROR("Failed to set up the access log\n");
         platform_cleanup();
         exit(EXIT_FAILURE);
     }
     
-    // Configure address
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
+    // Pick the request parser's scanning kernels before any worker runs
+    http_scan_init();
     
-    // Bind socket to port
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("bind failed");
+    // The stat threads, metadata and open file caches are shared by all workers
+    if (dir_reader_init(server_config_get()->stat_threads) != 0) {
+        LOG_ERROR("Failed to start the stat threads\n");
         platform_cleanup();
         exit(EXIT_FAILURE);
     }
-    
-    // Listen for connections
-    if (listen(server_fd, 10) < 0) {
-        perror("listen");
+    if (stat_cache_init((size_t)server_config_get()->stat_cache_memory * 1024 * 1024) != 0) {
+        LOG_ERROR("Failed to set up the metadata cache\n");
+        platform_cleanup();
+        exit(EXIT_FAILURE);
+    }
+    if (template_init(server_config_get()->template_path) != 0) {
+        LOG_ERROR("Failed to load the directory listing template\n");
+        platform_cleanup();
+        exit(EXIT_FAILURE);
+    }
+    if (listing_cache_init((size_t)server_config_get()->listing_cache_memory * 1024 * 1024) != 0) {
+        LOG_ERROR("Failed to set up the listing cache\n");
+        platform_cleanup();
+        exit(EXIT_FAILURE);
+    }
+    if (file_cache_init(server_config_get()->file_cache_size, server_config_get()->file_cache_ttl) != 0) {
+        LOG_ERROR("Failed to set up the file cache\n");
+        platform_cleanup();
+        exit(EXIT_FAILURE);
+    }
+    if (fs_pool_init(server_config_get()->fs_threads, server_config_get()->fs_queue_depth) != 0) {
+        LOG_ERROR("Failed to start the filesystem threads\n");
+        platform_cleanup();
+        exit(EXIT_FAILURE);
+    }
+    if (server_config_get()->metrics_path && metrics_init() != 0) {
+        LOG_ERROR("Failed to set up the metrics\n");
         platform_cleanup();
         exit(EXIT_FAILURE);
     }
     
-    printf("Server started at http://localhost:%d\n", port);
-    printf("Serving directory: %s\n", base_path);
+    int workers = server_config_get()->workers;
+    worker_args* worker_list = calloc(workers, sizeof(worker_args));
+    if (!worker_list) {
+        LOG_ERROR("Failed to allocate worker state\n");
+        platform_cleanup();
+        exit(EXIT_FAILURE);
+    }
     
-    // Accept and handle connections
-    while (1) {
-        printf("Waiting for connections...\n");
-        
-        if ((client_fd = accept(server_fd, (struct sockaddr *)&address, 
-                                (socklen_t*)&addrlen)) < 0) {
-            perror("accept");
-            continue;
-        }
-        
-        printf("Connection accepted (fd=%d)\n", client_fd);
-        
-        // Set socket options to reuse address and prevent "Address already in use" errors
-        int reuse = 1;
-        if (setsockopt(client_fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0) {
-            perror("setsockopt:SO_REUSEADDR on client socket");
-        }
-        
-        // Disable Nagle's algorithm to improve responsiveness
-        int nodelay = 1;
-        if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay)) < 0) {
-            perror("setsockopt:TCP_NODELAY");
+    // Bind every listener up front so a busy port fails before any thread starts.
+    // With SO_REUSEPORT each worker gets its own socket and the kernel balances
+    // accepts between them; without it the workers share a single socket.
+    for (int i = 0; i < workers; i++) {
+        worker_list[i].id = i;
+        worker_list[i].base_path = base_path;
+#ifdef SO_REUSEPORT
+        worker_list[i].server_fd = create_server_socket(port, workers > 1);
+#else
+        worker_list[i].server_fd = i == 0 ? create_server_socket(port, 0) : worker_list[0].server_fd;
+#endif
+        if (worker_list[i].server_fd < 0) {
+            platform_cleanup();
+            exit(EXIT_FAILURE);
         }
-
-        // Set socket to blocking mode explicitly
-        platform_set_socket_blocking(client_fd, 1);
-        
-        // Set socket timeout to prevent stalled connections
-        platform_set_socket_timeouts(client_fd, 60);  // 60 seconds timeout
-        
-        // Keep-alive settings
-        int keepalive = 1;
-        if (setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, (const char*)&keepalive, sizeof(keepalive)) < 0) {
-            perror("setsockopt:SO_KEEPALIVE");
+    }
+    
+    LOG_INFO("Server started at http://localhost:%d\n", port);
+    LOG_INFO("Serving directory: %s\n", base_path);
+    LOG_INFO("Workers: %d\n", workers);
+    LOG_INFO("SIMD scanning: %s\n", http_scan_implementation());
+    
+    // Worker 0 runs on the main thread, the rest get their own threads
+    for (int i = 1; i < workers; i++) {
+        if (platform_thread_create(worker_main, &worker_list[i]) != 0) {
+            LOG_ERROR("Failed to start worker %d\n", i);
         }
-        
-        printf("[DEBUG] Socket options set, handling connection...\n");
-        
-        // We wrap handle_connection in a simple error handler
-        // to prevent a bad request from crashing the server
-        handle_connection(client_fd, base_path);
-        
-        // Add delay before closing to ensure all data is sent
-        platform_sleep_ms(500); // 500ms
+    }
+    
+    // Accept and handle connections until the loop fails
+    int result = event_loop_run(worker_list[0].server_fd, base_path);
+    
+    // Cleanup (only reached if the event loop could not run)
+    platform_close_socket(worker_list[0].server_fd);
+    platform_cleanup();
+    
+    return result == 0 ? 0 : 1;
+}
 
-        printf("[DEBUG] Closing connection (fd=%d)...\n", client_fd);
-        
-        #ifdef _WIN32
-        if (closesocket(client_fd) != 0) {
-            printf("[ERROR] Failed to close client socket: %d\n", WSAGetLastError());
-        }
-        #else
-        // On Unix, we need to use shutdown() before close() to ensure all data is sent
-        shutdown(client_fd, SHUT_RDWR);  // Shutdown both reading and writing
-        if (close(client_fd) < 0) {
-            perror("Failed to close client socket");
+/**
+ * @brief Decides whether the connection stays open after this request
+ *
+ * HTTP/1.1 connections are persistent unless the client sends
+ * "Connection: close"; HTTP/1.0 connections close unless the client sends
+ * "Connection: keep-alive". Requests with a body are not kept alive because
+ * the body is never read, and the per-connection request cap always applies.
+ *
+ * @param conn The connection with a completely parsed request
+ * @return 1 to keep the connection open, 0 to close it
+ */
+static int request_keep_alive(const http_connection* conn) {
+    const http_request* request = &conn->parsed;
+    int keep_alive = request->version_minor >= 1;
+    
+    if (conn->requests_served + 1 >= conn->max_requests) {
+        return 0;
+    }
+    
+    const http_slice* connection = http_request_header(request, "Connection");
+    if (connection) {
+        if (http_slice_has_token(connection, "close")) {
+            keep_alive = 0;
+        } else if (http_slice_has_token(connection, "keep-alive")) {
+            keep_alive = 1;
         }
-        #endif
-        
-        printf("Connection closed.\n");
-        
-        // Small delay between connections
-        platform_sleep_ms(100); // 100ms
     }
     
-    // Cleanup (this code is never reached in this simple version)
-    #ifdef _WIN32
-    closesocket(server_fd);
-    #else
-    shutdown(server_fd, SHUT_RDWR);
-    close(server_fd);
-    #endif
-    platform_cleanup();
+    const http_slice* content_length = http_request_header(request, "Content-Length");
+    if (http_request_header(request, "Transfer-Encoding") ||
+        (content_length && !http_slice_equals(content_length, "0"))) {
+        keep_alive = 0;
+    }
     
-    return 0;
+    return keep_alive;
 }
 
-void handle_connection(int client_fd, const char* base_path) {
-    char buffer[BUFFER_SIZE] = {0};
-    char method[32] = {0};
+/**
+ * @brief Queues the current metrics in the Prometheus text format
+ *
+ * @param conn The connection
+ */
+static void send_metrics(http_connection* conn) {
+    char response[BUFFER_SIZE];
+    size_t length;
+    char* body = metrics_render(&length);
+    if (!body) {
+        send_500(conn);
+        return;
+    }
+    
+    snprintf(response, BUFFER_SIZE,
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+             "Content-Length: %zu\r\n"
+             "Cache-Control: no-store\r\n"
+             "Connection: %s\r\n\r\n",
+             length, connection_header_value(conn));
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
+        free(body);
+        return;
+    }
+    if (connection_queue_owned(conn, body, length) != 0) {
+        LOG_ERROR("Failed to queue metrics\n");
+    }
+}
+
+/**
+ * @brief Hands the rest of a request to the filesystem pool
+ *
+ * Called in a cache-only pass (fs_mode CONN_FS_ALLOWED) at the first point
+ * where answering needs the filesystem; nothing has been sent by then.
+ *
+ * @param conn The client connection
+ * @param path The path the filesystem is needed for
+ */
+static void request_filesystem(http_connection* conn, const char* path) {
+    LOG_DEBUG("Handing '%s' to the filesystem pool\n", path);
+    conn->fs_mode = CONN_FS_REQUESTED;
+}
+
+/**
+ * @brief Answers HEAD for a regular file that is not open in the file cache
+ *
+ * For HEAD, send_file() only reads an entry's path, metadata and MIME type,
+ * so an entry built from the metadata on the stack will do and the file is
+ * never opened.
+ *
+ * @param conn The client connection, answering HEAD
+ * @param path The file's resolved path
+ * @param st The file's metadata
+ */
+static void send_file_head(http_connection* conn, const char* path, const struct stat* st) {
+    file_cache_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = (char*)path;
+    entry.fd = -1;
+    entry.st = *st;
+    entry.mime_type = get_mime_type(path);
+    send_file(conn, &entry);
+}
+
+void handle_connection(http_connection* conn, const char* base_path) {
+    const http_request* request = &conn->parsed;
     char url[MAX_PATH_SIZE] = {0};
     char path[MAX_PATH_SIZE] = {0};
     
-    printf("[DEBUG] Reading request from client_fd=%d...\n", client_fd);
-    
-    // Set a receive timeout to prevent hanging
-    struct timeval tv;
-    tv.tv_sec = 10;  // 10 second timeout
-    tv.tv_usec = 0;
-    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
-
-    // Read request
-    int bytes_read = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-    if (bytes_read <= 0) {
-        // Connection closed or error
-        printf("[ERROR] Failed to read from socket or connection closed: %d\n", bytes_read);
-        if (bytes_read < 0) {
-            printf("[ERROR] recv error: %s\n", platform_get_error_string());
-        }
+    // Error responses close the connection unless we decide otherwise below
+    conn->keep_alive = 0;
+    
+    // Reject requests the parser could not accept
+    switch (conn->parse_result) {
+    case HTTP_PARSE_COMPLETE:
+        break;
+    case HTTP_PARSE_URI_TOO_LONG:
+        LOG_ERROR("Request target too long\n");
+        send_http_status(conn, HTTP_STATUS_URI_TOO_LONG, "URI Too Long", "text/html",
+                         "<html><body><h1>414 URI Too Long</h1></body></html>");
+        return;
+    case HTTP_PARSE_TOO_LARGE:
+        LOG_ERROR("Request header fields too large\n");
+        send_http_status(conn, HTTP_STATUS_HEADER_FIELDS_TOO_LARGE, "Request Header Fields Too Large", "text/html",
+                         "<html><body><h1>431 Request Header Fields Too Large</h1></body></html>");
+        return;
+    default:
+        LOG_ERROR("Failed to parse request: '%.*s'\n", (int)conn->request_length, conn->request);
+        send_400(conn);
         return;
     }
-    buffer[bytes_read] = '\0';
     
-    printf("[DEBUG] Read %d bytes from client\n", bytes_read);
-    printf("Request:\n%s\n", buffer);
+    LOG_DEBUG("Read %zu bytes from client_fd=%d\n", request->head_length, conn->fd);
+    LOG_DEBUG("Request:\n%.*s\n", (int)request->head_length, conn->request);
+    LOG_DEBUG("Parsed request: method='%.*s', target='%.*s', version='%.*s', %zu headers\n",
+           (int)request->method.length, request->method.data,
+           (int)request->target.length, request->target.data,
+           (int)request->version.length, request->version.data,
+           request->header_count);
+    
+    conn->keep_alive = request_keep_alive(conn);
+    if (conn->fs_mode != CONN_FS_ON_POOL) {
+        // Counted when the request first arrives, not again on the pool
+        metrics_count_method(&request->method);
+    }
     
-    // Parse request line
-    if (sscanf(buffer, "%31s %1023s", method, url) != 2) {
-        printf("[ERROR] Failed to parse request: '%s'\n", buffer);
-        send_400(client_fd);
+    // Handle only GET and HEAD requests. HEAD gets exactly the headers GET
+    // would; the connection drops any body queued for it
+    conn->head_only = http_slice_equals(&request->method, "HEAD");
+    if (!conn->head_only && !http_slice_equals(&request->method, "GET")) {
+        LOG_ERROR("Unsupported method: '%.*s'\n", (int)request->method.length, request->method.data);
+        send_405(conn);
         return;
     }
     
-    printf("[DEBUG] Parsed request: method='%s', url='%s'\n", method, url);
-    
-    // Handle only GET requests
-    if (strcmp(method, "GET") != 0) {
-        printf("[ERROR] Unsupported method: '%s'\n", method);
-        send_404(client_fd);
+    // The metrics endpoint takes precedence over a file of the same name
+    const char* metrics_path = server_config_get()->metrics_path;
+    if (metrics_path && http_slice_equals(&request->path, metrics_path)) {
+        send_metrics(conn);
         return;
     }
     
+    // The query string is not part of the filesystem path
+    snprintf(url, sizeof(url), "%.*s", (int)request->path.length, request->path.data);
+    
     // URL decode the path
     char* decoded_url = url_decode(url);
     if (!decoded_url) {
-        printf("[ERROR] Failed to decode URL: '%s'\n", url);
-        send_500(client_fd);
+        LOG_ERROR("Failed to decode URL: '%s'\n", url);
+        send_500(conn);
         return;
     }
     
-    printf("[DEBUG] Decoded URL: '%s'\n", decoded_url);
+    LOG_DEBUG("Decoded URL: '%s'\n", decoded_url);
     
     // Construct file path (skipping the leading '/')
     const char* request_path = strcmp(decoded_url, "/") == 0 ? "" : decoded_url + 1;
@@ -308,106 +691,663 @@ void handle_connection(int client_fd, const char* base_path) {
     // Use correct path separator for the platform
     snprintf(path, MAX_PATH_SIZE, "%s%c%s", base_path, PATH_SEPARATOR, request_path);
     
-    printf("[DEBUG] Raw path: '%s'\n", path);
+    LOG_DEBUG("Raw path: '%s'\n", path);
     
     // Remove any potential path traversal vulnerabilities
     char* p;
     while ((p = strstr(path, "..")) != NULL) {
-        printf("[WARNING] Path traversal attempt detected and blocked\n");
+        LOG_WARNING("Path traversal attempt detected and blocked\n");
         memmove(p, p + 2, strlen(p + 2) + 1);
     }
     
-    printf("[DEBUG] Accessing path: '%s'\n", path);
+    // One spelling per file, so the caches and their invalidation agree
+    normalize_path(path);
+    
+    LOG_DEBUG("Accessing path: '%s'\n", path);
+    
+    // Regular files come from the open file cache, which answers requests for
+    // hot files without any stat() or open(). Anything else may wait for the
+    // disk: with the filesystem pool the event loop answers what the caches
+    // can (missing paths, cached listings) and hands the rest to a pool
+    // thread, which runs handle_connection() again from the start. HEAD only
+    // uses files that are already open and never opens one itself
+    int cache_only = conn->fs_mode == CONN_FS_ALLOWED;
+    file_cache_entry* file = cache_only || conn->head_only ? file_cache_lookup(path) : file_cache_acquire(path);
+    if (file) {
+        LOG_DEBUG("Sending file: '%s' (size: %lld bytes)\n", path, (long long)file->st.st_size);
+        send_file(conn, file);
+        file_cache_release(file);
+        LOG_DEBUG("File sent\n");
+    } else {
+        // Not a regular file: list it if it is a directory
+        struct stat path_stat;
+        int found = cache_only ? stat_cache_lookup(path, &path_stat) : stat_cache_stat(path, &path_stat);
+        if (found == 0 && conn->head_only && (path_stat.st_mode & S_IFMT) == S_IFREG) {
+            LOG_DEBUG("Sending file headers: '%s'\n", path);
+            send_file_head(conn, path, &path_stat);
+            free(decoded_url);
+            return;
+        }
+        if (found > 0 || (found == 0 && cache_only && (path_stat.st_mode & S_IFDIR) == 0)) {
+            // Not cached, or a file that has to be opened
+            request_filesystem(conn, path);
+            free(decoded_url);
+            return;
+        }
+        if (found != 0 || (path_stat.st_mode & S_IFDIR) == 0) {
+            LOG_ERROR("File not found: '%s' - %s\n", path, platform_get_error_string());
+            send_404(conn);
+            free(decoded_url);
+            return;
+        }
+        
+        // A directory with an index file is served that file instead of a listing
+        const server_config* config = server_config_get();
+        file_cache_entry* index;
+        if (cache_only) {
+            if (file_cache_lookup_index(path, config->index_files, config->index_file_count, &index) != 0) {
+                request_filesystem(conn, path);
+                free(decoded_url);
+                return;
+            }
+        } else if (conn->head_only) {
+            // HEAD does not open the index file either
+            char index_path[MAX_PATH_SIZE];
+            struct stat index_stat;
+            if (file_cache_find_index(path, config->index_files, config->index_file_count, &index,
+                                      index_path, &index_stat) == 0 && !index) {
+                LOG_DEBUG("Sending index file headers: '%s'\n", index_path);
+                send_file_head(conn, index_path, &index_stat);
+                free(decoded_url);
+                return;
+            }
+        } else {
+            index = file_cache_acquire_index(path, config->index_files, config->index_file_count);
+        }
+        if (index) {
+            LOG_DEBUG("Sending index file: '%s'\n", index->path);
+            send_file(conn, index);
+            file_cache_release(index);
+        } else {
+            LOG_DEBUG("Sending directory listing for: '%s'\n", path);
+            send_directory_listing(conn, path, decoded_url);
+            if (conn->fs_mode != CONN_FS_REQUESTED) {
+                // Counted here, so a listing handed to the pool counts once
+                metrics_count_content(METRICS_CONTENT_LISTING);
+                LOG_DEBUG("Directory listing sent\n");
+            }
+        }
+    }
+    
+    LOG_DEBUG("Freeing decoded URL\n");
+    free(decoded_url);
+    LOG_DEBUG("Connection handling complete\n");
+}
+
+/**
+ * @brief Segment release hook for descriptors borrowed from the file cache
+ *
+ * @param context The file_cache_entry the segment holds a reference to
+ */
+static void release_cached_file(void* context) {
+    file_cache_release((file_cache_entry*)context);
+}
+
+/**
+ * @brief Formats the ETag and Last-Modified header lines for a file or directory
+ *
+ * Directory listings get a weak tag: they are generated, and the directory's
+ * mtime only changes when entries are added, removed or renamed. A file
+ * modified within the last second gets a weak tag too, because it could
+ * change again within the same second without its tag changing.
+ *
+ * @param st The file's or directory's metadata
+ * @param is_directory Non-zero for a directory listing
+ * @param etag Receives the entity tag (HTTP_ETAG_SIZE bytes)
+ * @param last_modified Receives the Last-Modified date (HTTP_DATE_SIZE bytes)
+ * @param validators Receives both header lines (VALIDATORS_SIZE bytes)
+ */
+static void format_validators(const struct stat* st, int is_directory, char* etag,
+                              char* last_modified, char* validators) {
+    http_make_etag(st, is_directory || st->st_mtime >= time(NULL) - 1, etag);
+    http_format_date(st->st_mtime, last_modified);
+    snprintf(validators, VALIDATORS_SIZE, "ETag: %s\r\nLast-Modified: %s\r\n", etag, last_modified);
+}
+
+/**
+ * @brief Formats the validator header lines of a directory listing
+ *
+ * Like format_validators(), but each representation (and page) gets its
+ * own entity tag, and caches are told the representation depends on Accept.
+ *
+ * @param st The directory's metadata
+ * @param options The representation and page
+ * @param etag Receives the entity tag (HTTP_ETAG_SIZE bytes)
+ * @param last_modified Receives the Last-Modified date (HTTP_DATE_SIZE bytes)
+ * @param validators Receives the header lines (VALIDATORS_SIZE bytes)
+ */
+static void format_listing_validators(const struct stat* st, const listing_options* options, char* etag,
+                                      char* last_modified, char* validators) {
+    http_make_etag(st, 1, etag);
+    if (options->variant[0]) {
+        // W/"..." becomes W/"...-json" and the like
+        size_t length = strlen(etag);
+        snprintf(etag + length - 1, HTTP_ETAG_SIZE - (length - 1), "-%s\"", options->variant);
+    }
+    http_format_date(st->st_mtime, last_modified);
+    snprintf(validators, VALIDATORS_SIZE, "ETag: %s\r\nLast-Modified: %s\r\nVary: Accept\r\n",
+             etag, last_modified);
+}
+
+/**
+ * @brief Segment release hook for listings shared with the listing cache
+ *
+ * @param context The listing_cache_entry the segment holds a reference to
+ */
+static void release_cached_listing(void* context) {
+    listing_cache_release((listing_cache_entry*)context);
+}
+
+/**
+ * @brief Queues a rendered listing straight from its (cached) buffer
+ *
+ * @param conn The client connection
+ * @param listing The listing (the caller keeps its reference)
+ * @param format The listing's representation
+ * @param validators The listing's validator header lines
+ */
+static void send_listing(http_connection* conn, listing_cache_entry* listing, listing_format format,
+                         const char* validators) {
+    char response[BUFFER_SIZE];
+    
+    snprintf(response, BUFFER_SIZE, 
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: %s\r\n"
+             "Content-Length: %ld\r\n"
+             "%s"
+             "Connection: %s\r\n\r\n", 
+             listing_content_types[format], (long)listing->length, validators, connection_header_value(conn));
     
-    // Check if path exists
-    struct stat path_stat;
-    if (stat(path, &path_stat) != 0) {
-        printf("[ERROR] File not found: '%s' - %s\n", path, platform_get_error_string());
-        send_404(client_fd);
-        free(decoded_url);
+    LOG_DEBUG("Queueing HTTP header (%zu bytes)\n", strlen(response));
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
         return;
     }
     
-    // Check if it's a directory (portable way for Windows and Unix)
-    int is_directory = (path_stat.st_mode & S_IFDIR) != 0;
-    printf("[DEBUG] Path exists. Is directory: %s\n", is_directory ? "Yes" : "No");
+    // The segment shares the buffer and holds its own reference. For HEAD
+    // it is dropped right away
+    LOG_DEBUG("Queueing directory listing (%zu bytes)\n", listing->length);
+    listing_cache_retain(listing);
+    if (connection_queue_shared(conn, listing->html, listing->length, release_cached_listing, listing) != 0) {
+        LOG_ERROR("Failed to queue listing content\n");
+    }
+}
+
+/**
+ * @brief Queues the headers of a listing that is not cached, for HEAD
+ *
+ * The listing is not rendered. Content-Length is left out, as it is for a
+ * streamed listing: a HEAD response has no body to delimit, and the length
+ * would take rendering the whole page.
+ *
+ * @param conn The client connection, answering HEAD
+ * @param format The representation
+ * @param validators The listing's validator header lines
+ */
+static void send_listing_headers(http_connection* conn, listing_format format, const char* validators) {
+    char response[BUFFER_SIZE];
+    
+    snprintf(response, BUFFER_SIZE,
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: %s\r\n"
+             "%s"
+             "Connection: %s\r\n\r\n",
+             listing_content_types[format], validators, connection_header_value(conn));
+    
+    LOG_DEBUG("Queueing HTTP header (%zu bytes)\n", strlen(response));
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
+    }
+}
+
+/**
+ * @brief State of a directory listing that is streamed while it is read
+ *
+ * Only the page frame and one row are held, however large the directory.
+ */
+typedef struct {
+    dir_reader* dir;               /**< The directory being read */
+    listing_format format;         /**< Representation being streamed */
+    char* frame;                   /**< The page without rows (from render_template_frame, or "[]") */
+    size_t frame_length;           /**< Length of frame */
+    size_t entries_offset;         /**< Where the rows go in frame */
+    size_t frame_sent;             /**< Bytes of frame produced so far */
+    char row[LISTING_ROW_SIZE];    /**< The next row, if row_length is non-zero */
+    size_t row_length;             /**< Length of the pending row */
+    size_t rows;                   /**< Rows formatted so far */
+    int rows_done;                 /**< Set once the directory has been read to the end */
+    int chunked;                   /**< Whether to use chunked transfer encoding */
+    int finished;                  /**< Set once the last chunk has been produced */
+} listing_stream;
+
+/**
+ * @brief Segment release hook for streamed listings
+ *
+ * @param context The listing_stream
+ */
+static void release_listing_stream(void* context) {
+    listing_stream* stream = (listing_stream*)context;
+    dir_reader_close(stream->dir);
+    free(stream->frame);
+    free(stream);
+}
+
+/**
+ * @brief Copies as much of the frame as is due and fits
+ *
+ * @return Bytes copied
+ */
+static size_t produce_frame(listing_stream* stream, size_t end, char* dest, size_t room) {
+    if (stream->frame_sent >= end) {
+        return 0;
+    }
+    size_t length = end - stream->frame_sent;
+    if (length > room) {
+        length = room;
+    }
+    memcpy(dest, stream->frame + stream->frame_sent, length);
+    stream->frame_sent += length;
+    return length;
+}
+
+/**
+ * @brief Stream segment producer for listings: the frame head, the rows and
+ *        the frame tail, one buffer (one chunk) at a time
+ */
+static long produce_listing_stream(void* context, char* buffer, size_t capacity) {
+    listing_stream* stream = (listing_stream*)context;
+    char* data = stream->chunked ? buffer + CHUNK_HEADER_SIZE : buffer;
+    size_t room = stream->chunked ? capacity - CHUNK_FRAMING_SIZE : capacity;
+    size_t used = 0;
+    
+    if (stream->finished) {
+        return 0;
+    }
+    
+    // Head of the page, up to the rows
+    used += produce_frame(stream, stream->entries_offset, data, room);
+    
+    // As many rows as fit
+    while (used < room && !stream->rows_done) {
+        if (stream->row_length == 0) {
+            platform_dir_entry entry;
+            int result = dir_reader_read(stream->dir, &entry);
+            if (result <= 0) {
+                if (result < 0) {
+                    // The status line is out, so the page just ends early
+                    LOG_ERROR("Failed to read directory while streaming its listing\n");
+                }
+                stream->rows_done = 1;
+                break;
+            }
+            stream->row_length = format_listing_row(stream->format, stream->rows == 0, entry.name,
+                                                    entry.is_dir, entry.size, entry.mtime, stream->row);
+            stream->rows++;
+        }
+        if (stream->row_length > room - used) {
+            break;
+        }
+        memcpy(data + used, stream->row, stream->row_length);
+        used += stream->row_length;
+        stream->row_length = 0;
+    }
+    
+    // Tail of the page
+    if (stream->rows_done) {
+        used += produce_frame(stream, stream->frame_length, data + used, room - used);
+    }
+    
+    if (used == 0) {
+        // Everything is out; a chunked body ends with an empty chunk
+        stream->finished = 1;
+        if (!stream->chunked) {
+            return 0;
+        }
+        memcpy(buffer, "0\r\n\r\n", 5);
+        return 5;
+    }
+    
+    if (!stream->chunked) {
+        return (long)used;
+    }
+    char size_line[32];
+    snprintf(size_line, sizeof(size_line), "%04zx\r\n", used);
+    memcpy(buffer, size_line, CHUNK_HEADER_SIZE);
+    memcpy(data + used, "\r\n", 2);
+    return (long)(used + CHUNK_FRAMING_SIZE);
+}
+
+/**
+ * @brief Streams a directory listing as the directory is read
+ *
+ * The response starts right away with the head of the page; the rows
+ * follow in chunks of up to CONNECTION_STREAM_BUFFER_SIZE bytes, each
+ * produced only once the previous one has been sent. HTTP/1.0 clients,
+ * which do not understand chunked encoding, get the same body delimited by
+ * closing the connection. Streamed listings are not cached.
+ *
+ * @param conn The client connection
+ * @param path Filesystem path to the directory
+ * @param format The representation
+ * @param display_path Directory path to show on the page
+ * @param has_parent Whether to include a parent directory link
+ * @param validators The listing's validator header lines
+ * @return 0 if the response was queued, non-zero if the template cannot be
+ *         streamed (nothing has been queued then)
+ */
+static int send_streamed_listing(http_connection* conn, const char* path, listing_format format,
+                                 const char* display_path, int has_parent, const char* validators) {
+    char response[BUFFER_SIZE];
     
-    // If directory, send listing
-    if (is_directory) {
-        printf("[DEBUG] Sending directory listing for: '%s'\n", path);
-        send_directory_listing(client_fd, path, decoded_url);
-        printf("[DEBUG] Directory listing sent\n");
+    listing_stream* stream = calloc(1, sizeof(listing_stream));
+    if (!stream) {
+        LOG_ERROR("Failed to allocate memory for directory listing\n");
+        send_500(conn);
+        return 0;
+    }
+    stream->format = format;
+    if (format == LISTING_JSON) {
+        stream->frame = malloc(3);
+        if (stream->frame) {
+            memcpy(stream->frame, "[]", 3);
+        }
+        stream->frame_length = 2;
+        stream->entries_offset = 1;
     } else {
-        // If file, send the file
-        printf("[DEBUG] Sending file: '%s' (size: %ld bytes)\n", path, (long)path_stat.st_size);
-        send_file(client_fd, path);
-        printf("[DEBUG] File sent\n");
+        stream->frame = render_template_frame(display_path, has_parent, &stream->frame_length,
+                                              &stream->entries_offset);
+    }
+    if (!stream->frame) {
+        LOG_WARNING("Template cannot be streamed, rendering the listing in memory\n");
+        free(stream);
+        return 1;
+    }
+    stream->dir = dir_reader_open(path);
+    if (!stream->dir) {
+        LOG_ERROR("Failed to list directory: '%s'\n", path);
+        free(stream->frame);
+        free(stream);
+        send_500(conn);
+        return 0;
     }
     
-    printf("[DEBUG] Freeing decoded URL\n");
-    free(decoded_url);
-    printf("[DEBUG] Connection handling complete\n");
+    stream->chunked = conn->parsed.version_minor >= 1;
+    if (!stream->chunked) {
+        conn->keep_alive = 0;
+    }
+    
+    snprintf(response, BUFFER_SIZE,
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: %s\r\n"
+             "%s"
+             "%s"
+             "Connection: %s\r\n\r\n",
+             listing_content_types[format], stream->chunked ? "Transfer-Encoding: chunked\r\n" : "",
+             validators, connection_header_value(conn));
+    
+    LOG_DEBUG("Queueing HTTP header (%zu bytes)\n", strlen(response));
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
+        release_listing_stream(stream);
+        return 0;
+    }
+    
+    // The stream owns the open directory from here on
+    LOG_DEBUG("Streaming directory listing for '%s'\n", path);
+    if (connection_queue_stream(conn, produce_listing_stream, release_listing_stream, stream) != 0) {
+        LOG_ERROR("Failed to queue listing content\n");
+    }
+    return 0;
 }
 
 /**
- * @brief Generates and sends an HTML directory listing to the client
+ * @brief Picks the listing representation a request asks for
+ *
+ * "?format=json" or "?format=html" decides; otherwise JSON is sent to
+ * clients that list application/json in their Accept header.
+ */
+static listing_format request_listing_format(const http_request* request) {
+    http_slice format;
+    if (http_query_param(&request->query, "format", &format)) {
+        return http_slice_equals(&format, "json") ? LISTING_JSON : LISTING_HTML;
+    }
+    const http_slice* accept = http_request_header(request, "Accept");
+    if (accept && http_slice_has_media_type(accept, "application/json")) {
+        return LISTING_JSON;
+    }
+    return LISTING_HTML;
+}
+
+/**
+ * @brief Reads a non-negative decimal query parameter
+ *
+ * @return 1 if the parameter is present and valid, 0 otherwise
+ */
+static int query_size_param(const http_request* request, const char* name, size_t* out) {
+    http_slice value;
+    if (!http_query_param(&request->query, name, &value) || value.length == 0 || value.length > 9) {
+        return 0;
+    }
+    size_t parsed = 0;
+    for (size_t i = 0; i < value.length; i++) {
+        if (value.data[i] < '0' || value.data[i] > '9') {
+            return 0;
+        }
+        parsed = parsed * 10 + (size_t)(value.data[i] - '0');
+    }
+    *out = parsed;
+    return 1;
+}
+
+/**
+ * @brief Works out the representation, sort order and page a listing request asks for
+ *
+ * Any of sort=name|size|mtime, order=asc|desc, offset=N and limit=N makes
+ * the listing sorted (by name unless given) and paged. The page size
+ * defaults to, and is capped at, the configured listing page size. Invalid
+ * values are ignored. Without any of them the entries come in directory
+ * order, unpaged.
+ */
+static void request_listing_options(const http_request* request, listing_options* options) {
+    http_slice value;
+    size_t page_size = (size_t)server_config_get()->listing_page_size;
+    
+    options->format = request_listing_format(request);
+    options->paged = 0;
+    options->sort = STAT_CACHE_SORT_NAME;
+    options->descending = 0;
+    options->offset = 0;
+    options->limit = page_size;
+    
+    if (http_query_param(&request->query, "sort", &value)) {
+        options->paged = 1;
+        for (int sort = 0; sort < STAT_CACHE_SORT_COUNT; sort++) {
+            if (http_slice_equals(&value, listing_sort_names[sort])) {
+                options->sort = (stat_cache_sort)sort;
+            }
+        }
+    }
+    if (http_query_param(&request->query, "order", &value)) {
+        options->paged = 1;
+        options->descending = http_slice_equals(&value, "desc");
+    }
+    if (http_query_param(&request->query, "offset", &value)) {
+        options->paged = 1;
+        query_size_param(request, "offset", &options->offset);
+    }
+    if (http_query_param(&request->query, "limit", &value)) {
+        size_t limit;
+        options->paged = 1;
+        if (query_size_param(request, "limit", &limit) && limit > 0 && limit < page_size) {
+            options->limit = limit;
+        }
+    }
+    
+    const char* format_name = options->format == LISTING_JSON ? "json" : "html";
+    if (options->paged) {
+        snprintf(options->variant, sizeof(options->variant), "%s-%s-%s-%zu-%zu", format_name,
+                 listing_sort_names[options->sort], options->descending ? "desc" : "asc",
+                 options->offset, options->limit);
+    } else {
+        snprintf(options->variant, sizeof(options->variant), "%s",
+                 options->format == LISTING_JSON ? format_name : "");
+    }
+}
+
+/**
+ * @brief Appends links to the neighbouring pages to a paged HTML listing
+ *
+ * @return 0 on success, 1 if out of memory
+ */
+static int append_page_links(dir_listing_data* data, const listing_options* options, size_t total) {
+    char row[LISTING_ROW_SIZE];
+    char previous[BUFFER_SIZE] = "";
+    char next[BUFFER_SIZE] = "";
+    const char* sort = listing_sort_names[options->sort];
+    const char* order = options->descending ? "desc" : "asc";
+    size_t shown = total > options->offset ? total - options->offset : 0;
+    if (shown > options->limit) {
+        shown = options->limit;
+    }
+    
+    if (options->offset > 0) {
+        size_t offset = options->offset > options->limit ? options->offset - options->limit : 0;
+        snprintf(previous, sizeof(previous), "<a href=\"?sort=%s&amp;order=%s&amp;offset=%zu&amp;limit=%zu\">"
+                 "&larr; Previous</a> ", sort, order, offset, options->limit);
+    }
+    if (options->offset + options->limit < total) {
+        snprintf(next, sizeof(next), " <a href=\"?sort=%s&amp;order=%s&amp;offset=%zu&amp;limit=%zu\">"
+                 "Next &rarr;</a>", sort, order, options->offset + options->limit, options->limit);
+    }
+    int length = snprintf(row, sizeof(row), "<tr><td colspan=\"3\" class=\"pages\">%sEntries %zu-%zu of %zu%s</td></tr>",
+                          previous, shown ? options->offset + 1 : 0, options->offset + shown, total, next);
+    return append_entries(data, row, (size_t)length);
+}
+
+/**
+ * @brief Generates and sends a directory listing to the client
  *
  * This function creates a modern, responsive HTML page that displays the contents
- * of a directory with file/folder icons, sizes, and modification times. It handles
- * dynamic memory allocation for the listing and sends the complete HTML response
- * to the client.
+ * of a directory with file/folder icons, sizes, and modification times, or for
+ * programmatic clients a JSON array of the entries, built straight from the
+ * listing without a template pass. It handles dynamic memory allocation for the
+ * listing and queues the complete response on the connection. Rendered listings
+ * are kept in the listing cache, so a busy index page costs one (cached) stat
+ * and one send. A directory with more entries than the listing stream threshold
+ * is streamed instead, so its memory use and time to first byte do not grow
+ * with its size. Sorted and paged listings (?sort=, ?order=, ?offset=, ?limit=)
+ * are cut from a sort order kept with the cached metadata and never streamed.
+ * In a cache-only pass (fs_mode CONN_FS_ALLOWED) a cache miss is handed to the
+ * filesystem pool instead of being rendered on the event loop.
+ * HEAD gets the length of a cached listing, and otherwise headers without
+ * Content-Length: the listing is never rendered for it.
  *
- * @param client_fd Socket file descriptor for the client connection
+ * @param conn The client connection
  * @param path Filesystem path to the directory being listed
  * @param url_path URL path corresponding to the directory (for display purposes)
  */
-void send_directory_listing(int client_fd, const char* path, const char* url_path) {
-    char response[BUFFER_SIZE];
+void send_directory_listing(http_connection* conn, const char* path, const char* url_path) {
+    char etag[HTTP_ETAG_SIZE];
+    char last_modified[HTTP_DATE_SIZE];
+    char validators[VALIDATORS_SIZE];
+    char cache_key[MAX_PATH_SIZE + 128];
+    struct stat dir_stat;
+    listing_options options;
+    request_listing_options(&conn->parsed, &options);
+    listing_format format = options.format;
+    
+    LOG_DEBUG("Preparing %s directory listing for '%s'\n", format == LISTING_JSON ? "JSON" : "HTML", path);
+    
+    // Validators come from the directory's own mtime, so an unchanged
+    // directory is answered with a 304 without listing it
+    if (stat_cache_stat(path, &dir_stat) != 0) {
+        LOG_ERROR("Failed to stat directory: '%s' - %s\n", path, platform_get_error_string());
+        send_404(conn);
+        return;
+    }
+    format_listing_validators(&dir_stat, &options, etag, last_modified, validators);
+    if (http_request_not_modified(&conn->parsed, etag, dir_stat.st_mtime)) {
+        send_304(conn, validators);
+        return;
+    }
     
-    printf("[DEBUG] Preparing directory listing for '%s'\n", path);
+    // A listing rendered from the directory as it is now is sent as is. Each
+    // representation and page is cached under its own key
+    snprintf(cache_key, sizeof(cache_key), "%s%s%s", url_path, options.variant[0] ? "?" : "", options.variant);
+    unsigned long generation;
+    listing_cache_entry* listing = listing_cache_acquire(path, cache_key, &dir_stat, &generation);
+    if (listing) {
+        LOG_DEBUG("Listing cache hit for '%s'\n", path);
+        send_listing(conn, listing, format, validators);
+        listing_cache_release(listing);
+        return;
+    }
+    if (conn->head_only) {
+        // Rendering the page only to discard it would just measure it
+        send_listing_headers(conn, format, validators);
+        return;
+    }
+    if (conn->fs_mode == CONN_FS_ALLOWED) {
+        request_filesystem(conn, path);
+        return;
+    }
     
     // Initialize the entries buffer
     dir_listing_data data;
-    data.client_fd = client_fd;
+    data.conn = conn;
     data.url_path = url_path;
     data.entries_capacity = BUFFER_SIZE * 16;
     data.entries = malloc(data.entries_capacity);
     data.entries_size = 0;
+    data.entry_count = 0;
+    data.entry_limit = options.paged ? 0 : (size_t)server_config_get()->listing_stream_threshold;
+    data.truncated = 0;
+    data.format = format;
     
     if (!data.entries) {
-        printf("[ERROR] Failed to allocate memory for directory listing\n");
-        send_500(client_fd);
+        LOG_ERROR("Failed to allocate memory for directory listing\n");
+        send_500(conn);
         return;
     }
     
     // Initialize with empty string
     strcpy(data.entries, "");
     
-    printf("[DEBUG] Calling platform_list_directory for '%s'\n", path);
-    
-    // List directory contents
-    if (platform_list_directory(path, dir_listing_callback, &data) != 0) {
-        printf("[ERROR] Failed to list directory: '%s'\n", path);
-        free(data.entries);
-        send_500(client_fd);
-        return;
+    // List directory contents (from the metadata cache if it is unchanged)
+    int list_result;
+    if (options.paged) {
+        size_t total;
+        LOG_DEBUG("Listing '%s' by %s (%s), entries %zu+%zu\n", path, listing_sort_names[options.sort],
+               options.descending ? "desc" : "asc", options.offset, options.limit);
+        list_result = stat_cache_list_sorted(path, options.sort, options.descending, options.offset,
+                                             options.limit, dir_listing_callback, &data, &total);
+        if (list_result == 0 && format == LISTING_HTML) {
+            list_result = append_page_links(&data, &options, total);
+        }
+    } else {
+        LOG_DEBUG("Calling stat_cache_list_directory for '%s'\n", path);
+        list_result = stat_cache_list_directory(path, dir_listing_callback, &data);
     }
-    
-    printf("[DEBUG] Directory listing retrieved successfully\n");
-    
-    // Load the template file
-    char template_path[MAX_PATH_SIZE];
-    snprintf(template_path, MAX_PATH_SIZE, "src/directory_template.html");
-    
-    char* template_content = load_template(template_path);
-    if (!template_content) {
-        printf("[ERROR] Failed to load template file: %s\n", template_path);
+    if (list_result != 0) {
+        LOG_ERROR("Failed to list directory: '%s'\n", path);
         free(data.entries);
-        send_500(client_fd);
+        send_500(conn);
         return;
     }
     
-    // Process the template
+    LOG_DEBUG("Directory listing retrieved successfully\n");
+    
+    // Fill in the template compiled at startup
     int has_parent = strcmp(url_path, "/") != 0;
     
     // Make sure we display the directory path correctly
@@ -423,115 +1363,271 @@ void send_directory_listing(int client_fd, const char* path, const char* url_pat
         snprintf(display_path, MAX_PATH_SIZE, "%s", display_url);
     }
     
-    printf("[DEBUG] Using display path: '%s'\n", display_path);
+    LOG_DEBUG("Using display path: '%s'\n", display_path);
+    
+    // Too many entries to build the page in memory: start over, streaming
+    if (data.truncated) {
+        if (send_streamed_listing(conn, path, format, display_path, has_parent, validators) == 0) {
+            free(data.entries);
+            return;
+        }
+        data.entries_size = 0;
+        data.entry_count = 0;
+        data.entry_limit = 0;
+        data.truncated = 0;
+        if (stat_cache_list_directory(path, dir_listing_callback, &data) != 0) {
+            LOG_ERROR("Failed to list directory: '%s'\n", path);
+            free(data.entries);
+            send_500(conn);
+            return;
+        }
+    }
     
-    char* html_content = process_template(template_content, display_path, data.entries, has_parent);
-    free(template_content);
+    size_t content_length;
+    char* content;
+    if (format == LISTING_JSON) {
+        // The objects only need the surrounding brackets
+        content_length = data.entries_size + 2;
+        content = malloc(content_length + 1);
+        if (content) {
+            content[0] = '[';
+            memcpy(content + 1, data.entries, data.entries_size);
+            memcpy(content + 1 + data.entries_size, "]", 2);
+        }
+    } else {
+        content = render_template(display_path, data.entries, data.entries_size, has_parent,
+                                  &content_length);
+    }
     free(data.entries);
     
-    if (!html_content) {
-        printf("[ERROR] Failed to process template\n");
-        send_500(client_fd);
+    if (!content) {
+        LOG_ERROR("Failed to process template\n");
+        send_500(conn);
         return;
     }
     
-    size_t content_length = strlen(html_content);
-    printf("[DEBUG] Generated %zu bytes of HTML\n", content_length);
+    LOG_DEBUG("Generated %zu bytes of %s\n", content_length, format == LISTING_JSON ? "JSON" : "HTML");
     
-    // Send HTTP response header
-    snprintf(response, BUFFER_SIZE, 
-             "HTTP/1.1 200 OK\r\n"
-             "Content-Type: text/html\r\n"
-             "Content-Length: %ld\r\n"
-             "Connection: close\r\n\r\n", 
-             (long)content_length);
-    
-    printf("[DEBUG] Sending HTTP header (%zu bytes)\n", strlen(response));
-    int bytes_sent = send(client_fd, response, strlen(response), 0);
-    if (bytes_sent < 0) {
-        printf("[ERROR] Failed to send HTTP header: %d - %s\n", bytes_sent, platform_get_error_string());
-        free(html_content);
+    // The listing cache takes ownership of the buffer
+    listing = listing_cache_insert(path, cache_key, &dir_stat, generation, stat_cache_is_watched(path),
+                                   content, content_length);
+    if (!listing) {
+        LOG_ERROR("Failed to allocate memory for directory listing\n");
+        send_500(conn);
         return;
     }
+    send_listing(conn, listing, format, validators);
+    listing_cache_release(listing);
     
-    printf("[DEBUG] Sending directory listing HTML (%zu bytes)\n", content_length);
-    bytes_sent = send(client_fd, html_content, content_length, 0);
-    if (bytes_sent < 0) {
-        printf("[ERROR] Failed to send HTML content: %d - %s\n", bytes_sent, platform_get_error_string());
-    } else {
-        printf("[DEBUG] Successfully sent %d bytes of HTML\n", bytes_sent);
+    LOG_DEBUG("Directory listing complete\n");
+}
+
+/**
+ * @brief Decides whether a file request asks for a byte range
+ *
+ * A Range header is only honoured while the If-Range validator, if any,
+ * still matches the file; a stale validator means the client's partial copy
+ * is out of date, so it gets the whole file instead.
+ *
+ * @param request The parsed request
+ * @param size Size of the file
+ * @param etag The file's entity tag
+ * @param last_modified The file's Last-Modified date
+ * @param ranges Receives the selected ranges on HTTP_RANGE_SATISFIABLE
+ * @return The range result
+ */
+static http_range_result select_file_range(const http_request* request, off_t size, const char* etag,
+                                           const char* last_modified, http_range_set* ranges) {
+    const http_slice* range_header = http_request_header(request, "Range");
+    if (!range_header) {
+        return HTTP_RANGE_NONE;
     }
     
-    free(html_content);
-    printf("[DEBUG] Directory listing complete\n");
+    const http_slice* if_range = http_request_header(request, "If-Range");
+    if (if_range && !http_if_range_matches(if_range, etag, last_modified)) {
+        LOG_DEBUG("If-Range validator does not match, ignoring Range\n");
+        return HTTP_RANGE_NONE;
+    }
+    
+    return http_range_parse(range_header, size, ranges);
 }
 
-// Sends a file to the client with appropriate headers.
-void send_file(int client_fd, const char* path) {
-    int fd;
-    struct stat file_stat;
-    off_t offset = 0;
+/**
+ * @brief Queues a multipart/byteranges response for several ranges of a file
+ *
+ * Each part is a small header block (boundary, Content-Type, Content-Range)
+ * queued as a memory segment, followed by a file segment for the range, so
+ * the range data itself still goes out with platform_sendfile. Every file
+ * segment holds its own reference to the cached descriptor.
+ *
+ * @param conn The client connection
+ * @param file The cached file
+ * @param mime_type The file's MIME type
+ * @param validators The file's ETag and Last-Modified header lines
+ * @param ranges The ranges to send (sorted and coalesced)
+ */
+static void send_file_ranges(http_connection* conn, file_cache_entry* file, const char* mime_type,
+                             const char* validators, const http_range_set* ranges) {
+    off_t size = file->st.st_size;
     char response[BUFFER_SIZE];
-    ssize_t bytes_sent;
+    char part_headers[HTTP_RANGE_MAX_RANGES][BUFFER_SIZE];
+    char boundary[40];
+    char closing[64];
+    long long content_length = 0;
+    
+    // The boundary only has to be absent from the parts' bytes, which 96
+    // random bits practically guarantee. It goes to the client, so it is
+    // made of nothing the process knows (such as addresses)
+    unsigned char entropy[BOUNDARY_RANDOM_BYTES];
+    if (platform_random_bytes(entropy, sizeof(entropy)) == 0) {
+        for (size_t i = 0; i < sizeof(entropy); i++) {
+            snprintf(boundary + i * 2, sizeof(boundary) - i * 2, "%02x", entropy[i]);
+        }
+    } else {
+        // No random source: a per-process counter mixed with the clock
+        static volatile size_t boundary_counter;
+        snprintf(boundary, sizeof(boundary), "%016llx%08lx",
+                 (unsigned long long)platform_monotonic_us() ^ ((unsigned long long)time(NULL) << 32),
+                 (unsigned long)platform_atomic_add(&boundary_counter, 1));
+    }
     
-    printf("[DEBUG] Preparing to send file: '%s'\n", path);
+    for (size_t i = 0; i < ranges->count; i++) {
+        const http_byte_range* range = &ranges->ranges[i];
+        snprintf(part_headers[i], BUFFER_SIZE,
+                 "%s--%s\r\n"
+                 "Content-Type: %s\r\n"
+                 "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                 i == 0 ? "" : "\r\n", boundary, mime_type,
+                 (long long)range->first, (long long)(range->first + range->length - 1), (long long)size);
+        content_length += (long long)strlen(part_headers[i]) + range->length;
+    }
+    snprintf(closing, sizeof(closing), "\r\n--%s--\r\n", boundary);
+    content_length += (long long)strlen(closing);
     
-    // Get file info
-    if (stat(path, &file_stat) != 0) {
-        printf("[ERROR] File does not exist: '%s' - %s\n", path, platform_get_error_string());
-        send_404(client_fd);
+    LOG_DEBUG("Sending %zu ranges as multipart/byteranges (%lld bytes)\n", ranges->count, content_length);
+    snprintf(response, BUFFER_SIZE, 
+             "HTTP/1.1 206 Partial Content\r\n"
+             "Content-Type: multipart/byteranges; boundary=%s\r\n"
+             "Content-Length: %lld\r\n"
+             "Accept-Ranges: bytes\r\n"
+             "%s"
+             "Connection: %s\r\n\r\n", 
+             boundary, content_length, validators, connection_header_value(conn));
+    
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
         return;
     }
     
-    printf("[DEBUG] File size: %ld bytes\n", (long)file_stat.st_size);
+    for (size_t i = 0; i < ranges->count; i++) {
+        const http_byte_range* range = &ranges->ranges[i];
+        
+        int failed = connection_queue_copy(conn, part_headers[i], strlen(part_headers[i])) != 0;
+        if (!failed) {
+            // The segment releases this reference, even if queueing fails
+            file_cache_retain(file);
+            failed = connection_queue_shared_file(conn, file->fd, range->first, (size_t)range->length,
+                                                  release_cached_file, file) != 0;
+        }
+        if (failed) {
+            // The response is incomplete: close the connection so the client notices
+            LOG_ERROR("Failed to queue range %zu\n", i);
+            conn->keep_alive = 0;
+            return;
+        }
+    }
+    
+    if (connection_queue_copy(conn, closing, strlen(closing)) != 0) {
+        LOG_ERROR("Failed to queue closing boundary\n");
+        conn->keep_alive = 0;
+    }
+}
+
+// Queues a file for the client with appropriate headers.
+void send_file(http_connection* conn, file_cache_entry* file) {
+    const struct stat* file_stat = &file->st;
+    char response[BUFFER_SIZE];
+    char etag[HTTP_ETAG_SIZE];
+    char last_modified[HTTP_DATE_SIZE];
+    char validators[VALIDATORS_SIZE];
+    
+    LOG_DEBUG("Preparing to send file: '%s' (fd=%d, %lld bytes)\n",
+           file->path, file->fd, (long long)file_stat->st_size);
+    metrics_count_content(METRICS_CONTENT_FILE);
+    
+    // A client with a current copy gets a 304 without touching the file
+    format_validators(file_stat, 0, etag, last_modified, validators);
+    if (http_request_not_modified(&conn->parsed, etag, file_stat->st_mtime)) {
+        send_304(conn, validators);
+        return;
+    }
     
-    // Open the file
-    fd = open(path, O_RDONLY | O_BINARY);
-    if (fd < 0) {
-        printf("[ERROR] Failed to open file: '%s' - %s\n", path, platform_get_error_string());
-        send_404(client_fd);
+    const char* mime_type = file->mime_type;
+    LOG_DEBUG("MIME type: %s\n", mime_type);
+    
+    // Work out which part of the file was asked for (Range only applies to GET)
+    http_range_set ranges;
+    http_range_result range_result = conn->head_only ? HTTP_RANGE_NONE :
+        select_file_range(&conn->parsed, file_stat->st_size, etag, last_modified, &ranges);
+    if (range_result == HTTP_RANGE_UNSATISFIABLE) {
+        LOG_DEBUG("Range not satisfiable for %lld byte file\n", (long long)file_stat->st_size);
+        snprintf(response, BUFFER_SIZE, "Content-Range: bytes */%lld\r\n", (long long)file_stat->st_size);
+        send_http_status_with_headers(conn, HTTP_STATUS_RANGE_NOT_SATISFIABLE, "Range Not Satisfiable", "text/html",
+                                      response, "<html><body><h1>416 Range Not Satisfiable</h1></body></html>");
         return;
     }
     
-    printf("[DEBUG] File opened successfully (fd=%d)\n", fd);
+    // Several disjoint ranges are sent as one multipart/byteranges body
+    if (range_result == HTTP_RANGE_SATISFIABLE && ranges.count > 1) {
+        send_file_ranges(conn, file, mime_type, validators, &ranges);
+        return;
+    }
     
-    // Get MIME type
-    const char* mime_type = get_mime_type(path);
-    printf("[DEBUG] MIME type: %s\n", mime_type);
+    off_t offset = 0;
+    off_t length = file_stat->st_size;
     
     // Send HTTP response header
-    snprintf(response, BUFFER_SIZE, 
-             "HTTP/1.1 200 OK\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %ld\r\n"
-             "Connection: close\r\n\r\n", 
-             mime_type, (long)file_stat.st_size);
-    
-    printf("[DEBUG] Sending HTTP header (%zu bytes)\n", strlen(response));
-    bytes_sent = send(client_fd, response, strlen(response), 0);
-    if (bytes_sent < 0) {
-        printf("[ERROR] Failed to send HTTP header: %d - %s\n", bytes_sent, platform_get_error_string());
-        close(fd);
+    if (range_result == HTTP_RANGE_SATISFIABLE) {
+        offset = ranges.ranges[0].first;
+        length = ranges.ranges[0].length;
+        LOG_DEBUG("Sending range %lld-%lld\n", (long long)offset, (long long)(offset + length - 1));
+        snprintf(response, BUFFER_SIZE, 
+                 "HTTP/1.1 206 Partial Content\r\n"
+                 "Content-Type: %s\r\n"
+                 "Content-Length: %lld\r\n"
+                 "Content-Range: bytes %lld-%lld/%lld\r\n"
+                 "Accept-Ranges: bytes\r\n"
+                 "%s"
+                 "Connection: %s\r\n\r\n", 
+                 mime_type, (long long)length, (long long)offset, (long long)(offset + length - 1),
+                 (long long)file_stat->st_size, validators, connection_header_value(conn));
+    } else {
+        snprintf(response, BUFFER_SIZE, 
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: %s\r\n"
+                 "Content-Length: %lld\r\n"
+                 "Accept-Ranges: bytes\r\n"
+                 "%s"
+                 "Connection: %s\r\n\r\n", 
+                 mime_type, (long long)length, validators, connection_header_value(conn));
+    }
+    
+    LOG_DEBUG("Queueing HTTP header (%zu bytes)\n", strlen(response));
+    if (connection_queue_headers(conn, response, strlen(response)) != 0) {
+        LOG_ERROR("Failed to queue HTTP header\n");
         return;
     }
     
-    // Send file content using platform_sendfile
-    printf("[DEBUG] Sending file content (%ld bytes)\n", (long)file_stat.st_size);
-    bytes_sent = platform_sendfile(client_fd, fd, &offset, file_stat.st_size);
-    if (bytes_sent < 0) {
-        printf("[ERROR] Failed to send file content: %d - %s\n", bytes_sent, platform_get_error_string());
-    } else {
-        printf("[DEBUG] Successfully sent %ld bytes of file content\n", (long)bytes_sent);
+    if (conn->head_only) {
+        return;
     }
     
-    if (close(fd) < 0) {
-        printf("[ERROR] Failed to close file (fd=%d) - %s\n", fd, platform_get_error_string());
-    } else {
-        printf("[DEBUG] File closed successfully\n");
+    // The file content is streamed by the event loop with platform_sendfile,
+    // starting at the range offset so nothing before the range is read. The
+    // segment holds its own reference to the cached descriptor
+    LOG_DEBUG("Queueing file content (%lld bytes)\n", (long long)length);
+    file_cache_retain(file);
+    if (connection_queue_shared_file(conn, file->fd, offset, (size_t)length, release_cached_file, file) != 0) {
+        LOG_ERROR("Failed to queue file content\n");
     }
 }
-
-
-
-
-
@@ -1,6 +1,7 @@
 #include "httpfileserv_lib.h"
 #include "httpfileserv.h"
 #include "platform.h"
+#include "server_config.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -114,13 +115,14 @@ void set_mime_type(const char* extension, const char* mime_type) {
 }
 
 int set_server_option(const char* option_name, const char* option_value) {
-    // TODO: Implement server options
     printf("Setting server option: %s = %s\n", option_name, option_value);
-    return 0;
+    return server_config_set(option_name, option_value);
+}
+
+int has_request_callback(void) {
+    return user_callback != NULL;
 }
 
-// Function to be called when a request is processed
-// This would be called from handle_connection() in the actual implementation
 void invoke_request_callback(const char* method, const char* path, int status_code) {
     if (user_callback != NULL) {
         user_callback(method, path, status_code);
@@ -0,0 +1,371 @@
+#include "listing_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This file contains the rendered directory listing cache. See listing_cache.h.
+ */
+
+/**
+ * @brief Global cache state, protected by lock
+ */
+static struct {
+    platform_mutex* lock;            /**< Protects everything below and all entry internals */
+    listing_cache_entry** buckets;   /**< Hash table of cached entries (hashed by path only) */
+    size_t bucket_count;             /**< Number of buckets (a power of two) */
+    size_t max_memory;               /**< Byte budget (0 when caching is disabled) */
+    unsigned long* generations;      /**< Per bucket, bumped by invalidations of its paths */
+    listing_cache_entry* lru_head;   /**< Most recently used entry */
+    listing_cache_entry* lru_tail;   /**< Least recently used entry */
+    listing_cache_stats stats;       /**< Counters */
+} cache;
+
+/**
+ * @brief Length of a directory path without trailing separators
+ *
+ * "/srv/www/sub/" and "/srv/www/sub" name the same directory and get the
+ * same key.
+ */
+static size_t key_length(const char* path) {
+    size_t length = strlen(path);
+    while (length > 1 && (path[length - 1] == '/' || path[length - 1] == PATH_SEPARATOR)) {
+        length--;
+    }
+    return length;
+}
+
+/**
+ * @brief FNV-1a hash of a directory path key
+ *
+ * Only the directory path is hashed, so all URL variants of a directory
+ * share a bucket and can be invalidated together.
+ */
+static size_t hash_path(const char* path, size_t length) {
+    size_t hash = (size_t)2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Checks whether an entry belongs to a directory path key
+ */
+static int entry_has_path(const listing_cache_entry* entry, const char* path, size_t length) {
+    return strncmp(entry->path, path, length) == 0 && entry->path[length] == '\0';
+}
+
+int listing_cache_init(size_t max_memory) {
+    cache.max_memory = 0;
+    if (max_memory == 0) {
+        return 0;
+    }
+
+    cache.lock = platform_mutex_create();
+    if (!cache.lock) {
+        return 1;
+    }
+
+    // Listings are a few kilobytes and up
+    cache.bucket_count = 64;
+    while (cache.bucket_count < max_memory / 4096 && cache.bucket_count < ((size_t)1 << 16)) {
+        cache.bucket_count *= 2;
+    }
+    cache.buckets = calloc(cache.bucket_count, sizeof(listing_cache_entry*));
+    cache.generations = calloc(cache.bucket_count, sizeof(unsigned long));
+    if (!cache.buckets || !cache.generations) {
+        free(cache.buckets);
+        free(cache.generations);
+        platform_mutex_destroy(cache.lock);
+        cache.lock = NULL;
+        return 1;
+    }
+
+    cache.max_memory = max_memory;
+    return 0;
+}
+
+/**
+ * @brief Frees an entry that has no references left
+ */
+static void free_entry(listing_cache_entry* entry) {
+    free(entry->html);
+    free(entry->path);
+    free(entry);
+}
+
+/**
+ * @brief Unlinks an entry from the LRU list (lock held)
+ */
+static void lru_unlink(listing_cache_entry* entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache.lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache.lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+/**
+ * @brief Puts an entry at the front of the LRU list (lock held)
+ */
+static void lru_push_front(listing_cache_entry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache.lru_head;
+    if (cache.lru_head) {
+        cache.lru_head->lru_prev = entry;
+    } else {
+        cache.lru_tail = entry;
+    }
+    cache.lru_head = entry;
+}
+
+/**
+ * @brief Removes an entry from the table and drops the cache's reference (lock held)
+ *
+ * @return 1 if that was the last reference and the caller must free the entry
+ */
+static int remove_entry(listing_cache_entry* entry) {
+    size_t length = strlen(entry->path);
+    listing_cache_entry** link = &cache.buckets[hash_path(entry->path, length) & (cache.bucket_count - 1)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    entry->hash_next = NULL;
+
+    lru_unlink(entry);
+    entry->cached = 0;
+    cache.stats.entries--;
+    cache.stats.memory -= entry->memory;
+    return --entry->refcount == 0;
+}
+
+/**
+ * @brief Finds the cached entry for a directory and URL (lock held)
+ */
+static listing_cache_entry* find_entry(const char* path, size_t length, const char* url_path) {
+    listing_cache_entry* entry = cache.buckets[hash_path(path, length) & (cache.bucket_count - 1)];
+    while (entry && (!entry_has_path(entry, path, length) || strcmp(entry->url_path, url_path) != 0)) {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+/**
+ * @brief Checks whether an entry was rendered from the directory as it is now
+ */
+static int entry_matches_directory(const listing_cache_entry* entry, const struct stat* st) {
+    return entry->dev == st->st_dev && entry->ino == st->st_ino && entry->mtime == st->st_mtime;
+}
+
+listing_cache_entry* listing_cache_acquire(const char* path, const char* url_path,
+                                           const struct stat* st, unsigned long* generation) {
+    *generation = 0;
+    if (cache.max_memory == 0) {
+        return NULL;
+    }
+
+    size_t length = key_length(path);
+    listing_cache_entry* stale = NULL;
+    platform_mutex_lock(cache.lock);
+    listing_cache_entry* entry = find_entry(path, length, url_path);
+    if (entry && entry_matches_directory(entry, st)) {
+        entry->refcount++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+        cache.stats.hits++;
+    } else {
+        if (entry) {
+            cache.stats.invalidations++;
+            if (remove_entry(entry)) {
+                stale = entry;
+            }
+            entry = NULL;
+        }
+        cache.stats.misses++;
+        *generation = cache.generations[hash_path(path, length) & (cache.bucket_count - 1)];
+    }
+    platform_mutex_unlock(cache.lock);
+
+    if (stale) {
+        free_entry(stale);
+    }
+    return entry;
+}
+
+listing_cache_entry* listing_cache_insert(const char* path, const char* url_path,
+                                          const struct stat* st, unsigned long generation,
+                                          int watched, char* html, size_t length) {
+    size_t path_length = key_length(path);
+    size_t path_size = path_length + 1;
+    size_t url_size = strlen(url_path) + 1;
+
+    listing_cache_entry* entry = calloc(1, sizeof(listing_cache_entry));
+    if (entry) {
+        entry->path = malloc(path_size + url_size);
+    }
+    if (!entry || !entry->path) {
+        free(entry);
+        free(html);
+        return NULL;
+    }
+    memcpy(entry->path, path, path_length);
+    entry->path[path_length] = '\0';
+    entry->url_path = entry->path + path_size;
+    memcpy(entry->url_path, url_path, url_size);
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtime;
+    entry->html = html;
+    entry->length = length;
+    entry->memory = sizeof(listing_cache_entry) + path_size + url_size + length;
+    entry->refcount = 1;
+
+    // Nothing would report changes to the entries of a directory that is not
+    // watched. A directory modified in the current second could change again
+    // without its mtime changing, so it is not cached either
+    if (cache.max_memory == 0 || !watched || entry->memory > cache.max_memory ||
+        st->st_mtime >= time(NULL) - 1) {
+        return entry;
+    }
+
+    listing_cache_entry* unused = NULL;
+    platform_mutex_lock(cache.lock);
+    size_t bucket = hash_path(path, path_length) & (cache.bucket_count - 1);
+    if (generation == cache.generations[bucket]) {
+        listing_cache_entry* existing = find_entry(path, path_length, url_path);
+        if (existing && remove_entry(existing)) {
+            existing->hash_next = unused;
+            unused = existing;
+        }
+
+        while (cache.stats.memory + entry->memory > cache.max_memory && cache.lru_tail) {
+            listing_cache_entry* victim = cache.lru_tail;
+            cache.stats.evictions++;
+            if (remove_entry(victim)) {
+                victim->hash_next = unused;
+                unused = victim;
+            }
+        }
+
+        entry->hash_next = cache.buckets[bucket];
+        cache.buckets[bucket] = entry;
+        lru_push_front(entry);
+        entry->cached = 1;
+        entry->refcount++;
+        cache.stats.entries++;
+        cache.stats.memory += entry->memory;
+    }
+    platform_mutex_unlock(cache.lock);
+
+    // Free what no one uses any more, without holding the lock
+    while (unused) {
+        listing_cache_entry* next = unused->hash_next;
+        free_entry(unused);
+        unused = next;
+    }
+    return entry;
+}
+
+void listing_cache_retain(listing_cache_entry* entry) {
+    if (cache.max_memory == 0) {
+        entry->refcount++;
+        return;
+    }
+    platform_mutex_lock(cache.lock);
+    entry->refcount++;
+    platform_mutex_unlock(cache.lock);
+}
+
+void listing_cache_release(listing_cache_entry* entry) {
+    int free_it;
+
+    if (cache.max_memory == 0) {
+        free_it = --entry->refcount == 0;
+    } else {
+        platform_mutex_lock(cache.lock);
+        free_it = --entry->refcount == 0;
+        platform_mutex_unlock(cache.lock);
+    }
+
+    if (free_it) {
+        free_entry(entry);
+    }
+}
+
+void listing_cache_invalidate(const char* path) {
+    if (cache.max_memory == 0) {
+        return;
+    }
+
+    size_t length = key_length(path);
+    listing_cache_entry* unused = NULL;
+    platform_mutex_lock(cache.lock);
+    size_t bucket = hash_path(path, length) & (cache.bucket_count - 1);
+    cache.generations[bucket]++;
+    listing_cache_entry* entry = cache.buckets[bucket];
+    while (entry) {
+        listing_cache_entry* next = entry->hash_next;
+        if (entry_has_path(entry, path, length)) {
+            cache.stats.invalidations++;
+            if (remove_entry(entry)) {
+                entry->hash_next = unused;
+                unused = entry;
+            }
+        }
+        entry = next;
+    }
+    platform_mutex_unlock(cache.lock);
+
+    while (unused) {
+        listing_cache_entry* next = unused->hash_next;
+        free_entry(unused);
+        unused = next;
+    }
+}
+
+void listing_cache_clear(void) {
+    if (cache.max_memory == 0) {
+        return;
+    }
+
+    listing_cache_entry* unused = NULL;
+    platform_mutex_lock(cache.lock);
+    for (size_t i = 0; i < cache.bucket_count; i++) {
+        cache.generations[i]++;
+    }
+    while (cache.lru_head) {
+        listing_cache_entry* entry = cache.lru_head;
+        cache.stats.invalidations++;
+        if (remove_entry(entry)) {
+            entry->hash_next = unused;
+            unused = entry;
+        }
+    }
+    platform_mutex_unlock(cache.lock);
+
+    while (unused) {
+        listing_cache_entry* next = unused->hash_next;
+        free_entry(unused);
+        unused = next;
+    }
+}
+
+void listing_cache_get_stats(listing_cache_stats* stats) {
+    if (cache.max_memory == 0) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    platform_mutex_lock(cache.lock);
+    *stats = cache.stats;
+    platform_mutex_unlock(cache.lock);
+}
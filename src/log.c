@@ -0,0 +1,290 @@
+#include "log.h"
+#include "platform.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This file contains the asynchronous logger. See log.h.
+ *
+ * Each thread that logs gets a single-producer, single-consumer ring: the
+ * thread only advances head, the writer thread only advances tail, and both
+ * are byte counts that only grow, so head - tail is the number of bytes in
+ * use. A record is a record_header followed by its text, padded to a
+ * multiple of 8 bytes; a header with size 0 means the rest of the ring up to
+ * its end is unused and the next record starts at the beginning.
+ */
+
+/* Bytes written by the writer thread at a time */
+#define OUTPUT_SIZE 65536
+
+/* Longest pause of the writer thread while there is nothing to write */
+#define MAX_IDLE_MS 32
+
+/* Longest wait of log_flush() */
+#define FLUSH_TIMEOUT_MS 1000
+
+/* Cache line size, to keep head and tail apart */
+#define CACHE_LINE 64
+
+/**
+ * @brief Start of a record in a ring
+ */
+typedef struct {
+    uint32_t size;    /**< Bytes taken by the record, header and padding included (0: wrap) */
+    uint32_t length;  /**< Length of the text */
+} record_header;
+
+/**
+ * @brief A thread's ring of records
+ */
+typedef struct log_ring {
+    volatile size_t head;                       /**< Bytes ever written (advanced by the owning thread) */
+    char head_padding[CACHE_LINE - sizeof(size_t)];
+    volatile size_t tail;                       /**< Bytes ever consumed (advanced by the writer thread) */
+    char tail_padding[CACHE_LINE - sizeof(size_t)];
+    volatile size_t dropped;                    /**< Records dropped because the ring was full */
+    size_t dropped_reported;                    /**< Writer thread: dropped records already reported */
+    struct log_ring* next;                      /**< Next ring in the registry */
+    char data[LOG_RING_SIZE];                   /**< The records */
+} log_ring;
+
+int log_level_threshold = LOG_LEVEL_DEBUG;
+
+static const char* const level_names[] = { "debug", "info", "warning", "error", "off" };
+static const char* const level_prefixes[] = { "[DEBUG] ", "[INFO] ", "[WARNING] ", "[ERROR] " };
+
+/**
+ * @brief The rings and the writer thread's state
+ */
+static struct {
+    int running;               /**< Whether the writer thread has been started */
+    platform_mutex* lock;      /**< Protects the registry */
+    log_ring* rings;           /**< Every thread's ring, newest first */
+} logger;
+
+/* The calling thread's ring, created on its first record */
+static PLATFORM_THREAD_LOCAL log_ring* thread_ring;
+
+int log_parse_level(const char* name, int* level) {
+    for (int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_OFF; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            *level = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Formats a record's text (prefix and message) into a buffer
+ *
+ * @return Length of the text, at most capacity - 1
+ */
+static size_t format_record(char* buffer, size_t capacity, int level, const char* format, va_list args) {
+    size_t length = strlen(level_prefixes[level]);
+    memcpy(buffer, level_prefixes[level], length);
+
+    int written = vsnprintf(buffer + length, capacity - length, format, args);
+    if (written > 0) {
+        length += (size_t)written < capacity - length ? (size_t)written : capacity - length - 1;
+    }
+    return length;
+}
+
+/**
+ * @brief Creates and registers the calling thread's ring
+ */
+static log_ring* register_ring(void) {
+    log_ring* ring = calloc(1, sizeof(log_ring));
+    if (!ring) {
+        return NULL;
+    }
+    platform_mutex_lock(logger.lock);
+    ring->next = logger.rings;
+    logger.rings = ring;
+    platform_mutex_unlock(logger.lock);
+    thread_ring = ring;
+    return ring;
+}
+
+void log_write(int level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    log_ring* ring = logger.running ? thread_ring : NULL;
+    if (logger.running && !ring) {
+        ring = register_ring();
+    }
+    if (!ring) {
+        // Before the writer thread runs (or out of memory): write directly
+        char text[LOG_MAX_RECORD];
+        size_t length = format_record(text, sizeof(text), level, format, args);
+        fwrite(text, 1, length, stdout);
+        fflush(stdout);
+        va_end(args);
+        return;
+    }
+
+    // Reserve room for the longest record, wrapping first if the end of the
+    // ring cannot hold it
+    size_t head = ring->head;
+    size_t tail = platform_atomic_load(&ring->tail);
+    size_t offset = head % LOG_RING_SIZE;
+    size_t contiguous = LOG_RING_SIZE - offset;
+    size_t needed = sizeof(record_header) + LOG_MAX_RECORD;
+    size_t skipped = contiguous < needed ? contiguous : 0;
+    if (head + skipped + needed - tail > LOG_RING_SIZE) {
+        platform_atomic_store(&ring->dropped, ring->dropped + 1);
+        va_end(args);
+        return;
+    }
+    if (skipped) {
+        ((record_header*)(ring->data + offset))->size = 0;
+        head += skipped;
+        offset = 0;
+    }
+
+    record_header* header = (record_header*)(ring->data + offset);
+    header->length = (uint32_t)format_record((char*)(header + 1), LOG_MAX_RECORD, level, format, args);
+    header->size = (uint32_t)((sizeof(record_header) + header->length + 7) & ~(size_t)7);
+    platform_atomic_store(&ring->head, head + header->size);
+    va_end(args);
+}
+
+/**
+ * @brief Adds text to the output buffer, writing the buffer out when full
+ */
+static void output_append(char* output, size_t* used, const char* text, size_t length) {
+    if (*used + length > OUTPUT_SIZE) {
+        fwrite(output, 1, *used, stdout);
+        *used = 0;
+    }
+    memcpy(output + *used, text, length);
+    *used += length;
+}
+
+/**
+ * @brief Moves the records of every ring to stdout
+ *
+ * @return Non-zero if anything was written
+ */
+static int drain_rings(char* output) {
+    size_t used = 0;
+    int wrote = 0;
+
+    platform_mutex_lock(logger.lock);
+    log_ring* ring = logger.rings;
+    platform_mutex_unlock(logger.lock);
+
+    // Rings are only ever added at the front, so the list can be walked
+    // without the lock
+    for (; ring; ring = ring->next) {
+        size_t head = platform_atomic_load(&ring->head);
+        size_t tail = ring->tail;
+        while (tail != head) {
+            size_t offset = tail % LOG_RING_SIZE;
+            const record_header* header = (const record_header*)(ring->data + offset);
+            if (header->size == 0) {
+                tail += LOG_RING_SIZE - offset;
+                continue;
+            }
+            output_append(output, &used, (const char*)(header + 1), header->length);
+            tail += header->size;
+        }
+        if (tail != ring->tail) {
+            // The records are copied out, so the thread can reuse the space
+            platform_atomic_store(&ring->tail, tail);
+            wrote = 1;
+        }
+
+        size_t dropped = platform_atomic_load(&ring->dropped);
+        if (dropped != ring->dropped_reported) {
+            char text[128];
+            int length = snprintf(text, sizeof(text), "[WARNING] Log buffer full, %zu records dropped\n",
+                                  dropped - ring->dropped_reported);
+            output_append(output, &used, text, (size_t)length);
+            ring->dropped_reported = dropped;
+            wrote = 1;
+        }
+    }
+
+    if (used) {
+        fwrite(output, 1, used, stdout);
+    }
+    if (wrote) {
+        fflush(stdout);
+    }
+    return wrote;
+}
+
+/**
+ * @brief Writer thread: drains the rings, pausing longer the longer they stay empty
+ */
+static void writer_thread(void* arg) {
+    char* output = arg;
+    int idle_ms = 1;
+
+    for (;;) {
+        if (drain_rings(output)) {
+            idle_ms = 1;
+        } else {
+            platform_sleep_ms(idle_ms);
+            if (idle_ms < MAX_IDLE_MS) {
+                idle_ms *= 2;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Checks whether every ring has been drained
+ */
+static int rings_empty(void) {
+    platform_mutex_lock(logger.lock);
+    log_ring* ring = logger.rings;
+    platform_mutex_unlock(logger.lock);
+
+    for (; ring; ring = ring->next) {
+        if (platform_atomic_load(&ring->tail) != platform_atomic_load(&ring->head)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void log_flush(void) {
+    if (!logger.running) {
+        fflush(stdout);
+        return;
+    }
+    for (int waited = 0; waited < FLUSH_TIMEOUT_MS && !rings_empty(); waited++) {
+        platform_sleep_ms(1);
+    }
+}
+
+int log_init(int level) {
+    log_level_threshold = level;
+
+    char* output = malloc(OUTPUT_SIZE);
+    logger.lock = platform_mutex_create();
+    if (!output || !logger.lock) {
+        free(output);
+        platform_mutex_destroy(logger.lock);
+        logger.lock = NULL;
+        return 1;
+    }
+    if (platform_thread_create(writer_thread, output) != 0) {
+        free(output);
+        platform_mutex_destroy(logger.lock);
+        logger.lock = NULL;
+        return 1;
+    }
+
+    // Whatever is queued when the process exits still gets written
+    atexit(log_flush);
+    logger.running = 1;
+    return 0;
+}
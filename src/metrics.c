@@ -0,0 +1,435 @@
+#include "metrics.h"
+#include "platform.h"
+#include "file_cache.h"
+#include "stat_cache.h"
+#include "listing_cache.h"
+#include "fs_pool.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This file contains the request metrics. See metrics.h.
+ */
+
+/* Cache line size, to keep the threads' counters apart */
+#define CACHE_LINE 64
+
+/* Buckets per power of two, and the powers covered by the histograms */
+#define SUB_BUCKET_BITS 2
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_MAGNITUDE 27
+
+/* Buckets of a histogram; longer times only count towards +Inf */
+#define HISTOGRAM_BUCKETS (SUB_BUCKETS + (MAX_MAGNITUDE - SUB_BUCKET_BITS) * SUB_BUCKETS)
+
+/* Status codes counted one by one (100-599); others share code "0" */
+#define STATUS_CODES 600
+
+/* Request methods counted one by one; others count as "other" */
+static const char* const method_names[] = { "GET", "HEAD", "other" };
+#define METHOD_COUNT 3
+
+static const char* const content_names[] = { "file", "listing" };
+
+/* Initial size of the scrape output */
+#define RENDER_INITIAL_SIZE 16384
+
+/**
+ * @brief A latency histogram, in microseconds
+ */
+typedef struct {
+    unsigned long long buckets[HISTOGRAM_BUCKETS]; /**< Times by bucket (not cumulative) */
+    unsigned long long count;                      /**< Times recorded, longer ones included */
+    unsigned long long sum_us;                     /**< Sum of the times */
+} latency_histogram;
+
+/**
+ * @brief One thread's counters
+ *
+ * Written only by the owning thread; the padding keeps them off any cache
+ * line another allocation (another thread's block included) could share.
+ */
+typedef struct metrics_block {
+    char head_padding[CACHE_LINE];
+    unsigned long long methods[METHOD_COUNT];              /**< Requests by method */
+    unsigned long long statuses[STATUS_CODES];             /**< Responses by status code */
+    unsigned long long content[METRICS_CONTENT_COUNT];     /**< Responses by content */
+    unsigned long long bytes_sent;                         /**< Body bytes sent */
+    unsigned long long connections_opened;                 /**< Connections accepted */
+    unsigned long long connections_closed;                 /**< Connections closed */
+    latency_histogram first_byte;                          /**< Time to first byte */
+    latency_histogram total;                               /**< Time to the end of the response */
+    struct metrics_block* next;                            /**< Next block in the registry */
+    char tail_padding[CACHE_LINE];
+} metrics_block;
+
+/**
+ * @brief Every thread's block
+ */
+static struct {
+    platform_mutex* lock;      /**< Protects the registry */
+    metrics_block* blocks;     /**< Every thread's block, newest first */
+} registry;
+
+/* The calling thread's block, created on its first update */
+static PLATFORM_THREAD_LOCAL metrics_block* thread_block;
+
+/**
+ * @brief Returns the calling thread's block, creating and registering it first if needed
+ *
+ * @return The block, or NULL if metrics_init() has not run or out of memory
+ */
+static metrics_block* current_block(void) {
+    metrics_block* block = thread_block;
+    if (block || !registry.lock) {
+        return block;
+    }
+
+    block = calloc(1, sizeof(metrics_block));
+    if (!block) {
+        return NULL;
+    }
+    platform_mutex_lock(registry.lock);
+    block->next = registry.blocks;
+    registry.blocks = block;
+    platform_mutex_unlock(registry.lock);
+    thread_block = block;
+    return block;
+}
+
+/**
+ * @brief Finds the bucket of a time
+ *
+ * Bucket i covers (upper(i - 1), upper(i)]. The first SUB_BUCKETS buckets
+ * hold 1, 2, 3 and 4 microseconds; after that each power of two is split
+ * into SUB_BUCKETS equal parts.
+ *
+ * @return The bucket, or HISTOGRAM_BUCKETS if the time is longer than the last one
+ */
+static int bucket_index(long long us) {
+    if (us <= 1) {
+        return 0;
+    }
+    unsigned long long value = (unsigned long long)(us - 1);
+    if (value < SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    int magnitude = 0;
+    while ((value >> magnitude) > 1) {
+        magnitude++;
+    }
+    if (magnitude >= MAX_MAGNITUDE) {
+        return HISTOGRAM_BUCKETS;
+    }
+    int sub = (int)((value >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return SUB_BUCKETS + (magnitude - SUB_BUCKET_BITS) * SUB_BUCKETS + sub;
+}
+
+/**
+ * @brief Returns the inclusive upper bound of a bucket, in microseconds
+ */
+static long long bucket_upper(int index) {
+    if (index < SUB_BUCKETS) {
+        return index + 1;
+    }
+    int magnitude = (index - SUB_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS;
+    int sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+    return (long long)(SUB_BUCKETS + sub + 1) << (magnitude - SUB_BUCKET_BITS);
+}
+
+static void histogram_record(latency_histogram* histogram, long long us) {
+    if (us < 0) {
+        us = 0;
+    }
+    int index = bucket_index(us);
+    if (index < HISTOGRAM_BUCKETS) {
+        histogram->buckets[index]++;
+    }
+    histogram->count++;
+    histogram->sum_us += (unsigned long long)us;
+}
+
+int metrics_init(void) {
+    registry.lock = platform_mutex_create();
+    return registry.lock ? 0 : 1;
+}
+
+void metrics_count_method(const http_slice* method) {
+    metrics_block* block = current_block();
+    if (!block) {
+        return;
+    }
+    int index = METHOD_COUNT - 1;
+    for (int i = 0; i < METHOD_COUNT - 1; i++) {
+        if (http_slice_equals(method, method_names[i])) {
+            index = i;
+            break;
+        }
+    }
+    block->methods[index]++;
+}
+
+void metrics_count_content(metrics_content content) {
+    metrics_block* block = current_block();
+    if (block) {
+        block->content[content]++;
+    }
+}
+
+void metrics_count_connection(int delta) {
+    metrics_block* block = current_block();
+    if (!block) {
+        return;
+    }
+    if (delta > 0) {
+        block->connections_opened++;
+    } else {
+        block->connections_closed++;
+    }
+}
+
+void metrics_record_response(int status, size_t bytes, long long first_byte_us, long long total_us) {
+    metrics_block* block = current_block();
+    if (!block) {
+        return;
+    }
+    block->statuses[status >= 100 && status < STATUS_CODES ? status : 0]++;
+    block->bytes_sent += bytes;
+    if (first_byte_us >= 0) {
+        histogram_record(&block->first_byte, first_byte_us);
+    }
+    histogram_record(&block->total, total_us);
+}
+
+/**
+ * @brief Growing output buffer of a scrape
+ */
+typedef struct {
+    char* data;       /**< The text */
+    size_t length;    /**< Bytes used */
+    size_t capacity;  /**< Bytes allocated */
+    int failed;       /**< Set once an allocation failed */
+} render_buffer;
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+static void render_printf(render_buffer* out, const char* format, ...) {
+    if (out->failed) {
+        return;
+    }
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(out->data + out->length, out->capacity - out->length, format, args);
+        va_end(args);
+        if (written < 0) {
+            out->failed = 1;
+            return;
+        }
+        if ((size_t)written < out->capacity - out->length) {
+            out->length += (size_t)written;
+            return;
+        }
+
+        char* grown = realloc(out->data, out->capacity * 2);
+        if (!grown) {
+            out->failed = 1;
+            return;
+        }
+        out->data = grown;
+        out->capacity *= 2;
+    }
+}
+
+static void add_histogram(latency_histogram* sum, const latency_histogram* add) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        sum->buckets[i] += add->buckets[i];
+    }
+    sum->count += add->count;
+    sum->sum_us += add->sum_us;
+}
+
+/**
+ * @brief Formats a histogram with cumulative buckets in seconds
+ */
+static void render_histogram(render_buffer* out, const char* name, const char* help,
+                             const latency_histogram* histogram) {
+    render_printf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        long long upper = bucket_upper(i);
+        cumulative += histogram->buckets[i];
+        render_printf(out, "%s_bucket{le=\"%lld.%06lld\"} %llu\n",
+                      name, upper / 1000000, upper % 1000000, cumulative);
+    }
+    render_printf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, histogram->count);
+    render_printf(out, "%s_sum %llu.%06llu\n", name, histogram->sum_us / 1000000, histogram->sum_us % 1000000);
+    render_printf(out, "%s_count %llu\n", name, histogram->count);
+}
+
+/**
+ * @brief One cache's counters, whichever cache they come from
+ */
+typedef struct {
+    const char* name;           /**< Value of the cache label */
+    unsigned long values[5];    /**< Hits, misses, invalidations, evictions and entries */
+} cache_counters;
+
+static const char* const cache_families[][3] = {
+    { "httpfileserv_cache_hits_total", "counter", "Lookups answered from a cache." },
+    { "httpfileserv_cache_misses_total", "counter", "Lookups a cache could not answer." },
+    { "httpfileserv_cache_invalidations_total", "counter", "Cache entries dropped because their content changed." },
+    { "httpfileserv_cache_evictions_total", "counter", "Cache entries dropped to stay within the cache's limit." },
+    { "httpfileserv_cache_entries", "gauge", "Entries currently cached." }
+};
+
+/**
+ * @brief Formats the caches' counters, one metric family at a time
+ */
+static void render_caches(render_buffer* out, const cache_counters* caches, int count) {
+    for (int family = 0; family < 5; family++) {
+        const char* name = cache_families[family][0];
+        render_printf(out, "# HELP %s %s\n# TYPE %s %s\n",
+                      name, cache_families[family][2], name, cache_families[family][1]);
+        for (int i = 0; i < count; i++) {
+            render_printf(out, "%s{cache=\"%s\"} %lu\n", name, caches[i].name, caches[i].values[family]);
+        }
+    }
+}
+
+char* metrics_render(size_t* length) {
+    // Large (two histograms and every status code), so not on the stack
+    metrics_block* sum = calloc(1, sizeof(metrics_block));
+    render_buffer out = { malloc(RENDER_INITIAL_SIZE), 0, RENDER_INITIAL_SIZE, 0 };
+    if (!sum || !out.data) {
+        free(sum);
+        free(out.data);
+        return NULL;
+    }
+
+    // Blocks are only ever added at the front, so the list can be walked
+    // without the lock once its head has been read
+    metrics_block* block = NULL;
+    if (registry.lock) {
+        platform_mutex_lock(registry.lock);
+        block = registry.blocks;
+        platform_mutex_unlock(registry.lock);
+    }
+    for (; block; block = block->next) {
+        for (int i = 0; i < METHOD_COUNT; i++) {
+            sum->methods[i] += block->methods[i];
+        }
+        for (int i = 0; i < STATUS_CODES; i++) {
+            sum->statuses[i] += block->statuses[i];
+        }
+        for (int i = 0; i < METRICS_CONTENT_COUNT; i++) {
+            sum->content[i] += block->content[i];
+        }
+        sum->bytes_sent += block->bytes_sent;
+        sum->connections_opened += block->connections_opened;
+        sum->connections_closed += block->connections_closed;
+        add_histogram(&sum->first_byte, &block->first_byte);
+        add_histogram(&sum->total, &block->total);
+    }
+
+    render_printf(&out, "# HELP httpfileserv_requests_total Requests received, by method.\n"
+                        "# TYPE httpfileserv_requests_total counter\n");
+    for (int i = 0; i < METHOD_COUNT; i++) {
+        render_printf(&out, "httpfileserv_requests_total{method=\"%s\"} %llu\n", method_names[i], sum->methods[i]);
+    }
+
+    render_printf(&out, "# HELP httpfileserv_responses_total Responses sent, by status code.\n"
+                        "# TYPE httpfileserv_responses_total counter\n");
+    for (int i = 0; i < STATUS_CODES; i++) {
+        if (sum->statuses[i]) {
+            render_printf(&out, "httpfileserv_responses_total{code=\"%d\"} %llu\n", i, sum->statuses[i]);
+        }
+    }
+
+    render_printf(&out, "# HELP httpfileserv_content_total Responses by what they sent.\n"
+                        "# TYPE httpfileserv_content_total counter\n");
+    for (int i = 0; i < METRICS_CONTENT_COUNT; i++) {
+        render_printf(&out, "httpfileserv_content_total{content=\"%s\"} %llu\n", content_names[i], sum->content[i]);
+    }
+
+    render_printf(&out, "# HELP httpfileserv_response_bytes_total Response body bytes sent.\n"
+                        "# TYPE httpfileserv_response_bytes_total counter\n"
+                        "httpfileserv_response_bytes_total %llu\n", sum->bytes_sent);
+
+    // Opened and closed are counted by the same thread, so the difference
+    // is never negative once every block is added up
+    render_printf(&out, "# HELP httpfileserv_connections_total Connections accepted.\n"
+                        "# TYPE httpfileserv_connections_total counter\n"
+                        "httpfileserv_connections_total %llu\n"
+                        "# HELP httpfileserv_connections_active Connections currently open.\n"
+                        "# TYPE httpfileserv_connections_active gauge\n"
+                        "httpfileserv_connections_active %llu\n",
+                  sum->connections_opened, sum->connections_opened - sum->connections_closed);
+
+    render_histogram(&out, "httpfileserv_time_to_first_byte_seconds",
+                     "Time from dispatching a request to sending the first byte of its response.", &sum->first_byte);
+    render_histogram(&out, "httpfileserv_request_duration_seconds",
+                     "Time from dispatching a request to sending the last byte of its response.", &sum->total);
+
+    file_cache_stats file_stats;
+    stat_cache_stats stat_stats;
+    listing_cache_stats listing_stats;
+    file_cache_get_stats(&file_stats);
+    stat_cache_get_stats(&stat_stats);
+    listing_cache_get_stats(&listing_stats);
+
+    cache_counters caches[3] = {
+        { "file", { file_stats.hits, file_stats.misses, file_stats.invalidations,
+                    file_stats.evictions, (unsigned long)file_stats.entries } },
+        { "stat", { stat_stats.hits, stat_stats.misses, stat_stats.invalidations,
+                    stat_stats.evictions, (unsigned long)stat_stats.entries } },
+        { "listing", { listing_stats.hits, listing_stats.misses, listing_stats.invalidations,
+                       listing_stats.evictions, (unsigned long)listing_stats.entries } }
+    };
+    render_caches(&out, caches, 3);
+
+    render_printf(&out, "# HELP httpfileserv_cache_memory_bytes Memory used by a cache.\n"
+                        "# TYPE httpfileserv_cache_memory_bytes gauge\n"
+                        "httpfileserv_cache_memory_bytes{cache=\"stat\"} %zu\n"
+                        "httpfileserv_cache_memory_bytes{cache=\"listing\"} %zu\n",
+                  stat_stats.memory, listing_stats.memory);
+
+    fs_pool_stats pool_stats;
+    fs_pool_get_stats(&pool_stats);
+    render_printf(&out, "# HELP httpfileserv_fs_pool_threads Threads doing blocking filesystem work.\n"
+                        "# TYPE httpfileserv_fs_pool_threads gauge\n"
+                        "httpfileserv_fs_pool_threads %d\n"
+                        "# HELP httpfileserv_fs_pool_queued Requests waiting for a filesystem thread.\n"
+                        "# TYPE httpfileserv_fs_pool_queued gauge\n"
+                        "httpfileserv_fs_pool_queued %zu\n"
+                        "# HELP httpfileserv_fs_pool_queue_limit Requests allowed to wait for a filesystem thread.\n"
+                        "# TYPE httpfileserv_fs_pool_queue_limit gauge\n"
+                        "httpfileserv_fs_pool_queue_limit %zu\n"
+                        "# HELP httpfileserv_fs_pool_submitted_total Requests handed to the filesystem threads.\n"
+                        "# TYPE httpfileserv_fs_pool_submitted_total counter\n"
+                        "httpfileserv_fs_pool_submitted_total %lu\n"
+                        "# HELP httpfileserv_fs_pool_rejected_total Requests refused with a 503 because the queue was full.\n"
+                        "# TYPE httpfileserv_fs_pool_rejected_total counter\n"
+                        "httpfileserv_fs_pool_rejected_total %lu\n"
+                        "# HELP httpfileserv_fs_pool_completed_total Requests the filesystem threads have handled.\n"
+                        "# TYPE httpfileserv_fs_pool_completed_total counter\n"
+                        "httpfileserv_fs_pool_completed_total %lu\n"
+                        "# HELP httpfileserv_fs_pool_stolen_total Requests handled by a thread other than the one they were queued for.\n"
+                        "# TYPE httpfileserv_fs_pool_stolen_total counter\n"
+                        "httpfileserv_fs_pool_stolen_total %lu\n",
+                  pool_stats.threads, pool_stats.queued, pool_stats.max_queued, pool_stats.submitted,
+                  pool_stats.rejected, pool_stats.completed, pool_stats.stolen);
+
+    free(sum);
+    if (out.failed) {
+        free(out.data);
+        return NULL;
+    }
+    *length = out.length;
+    return out.data;
+}
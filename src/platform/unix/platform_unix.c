@@ -1,14 +1,38 @@
 #include "platform.h"
+#include "log.h"
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/stat.h>  /* For S_ISDIR */
 #include <limits.h>    /* For PATH_MAX */
 #include <signal.h>    /* For signal handling */
 #include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/random.h>
+#include <sys/sendfile.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
+
+/* The completion ring needs io_uring headers from Linux 6.1 or later */
+#ifdef IORING_SETUP_DEFER_TASKRUN
+#define HAVE_IO_URING 1
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 /**
  * Unix-specific implementation of platform functions
@@ -25,104 +49,384 @@ void platform_cleanup(void) {
     // No cleanup needed on Unix-like systems
 }
 
-// On Unix, we need to implement the platform sendfile function
-// We need a custom implementation to avoid conflicts with the system sendfile
-ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
-    // For WSL and other Unix systems, we'll use a simple read/write implementation
-    // to avoid issues with the system sendfile function
+// Portable read/write copy loop, used where the kernel sendfile is not
+// available or refuses the descriptors (e.g. some WSL and FUSE filesystems)
+static ssize_t sendfile_copy(int out_fd, int in_fd, off_t *offset, size_t count) {
     char buffer[8192];
     ssize_t total_sent = 0;
     size_t remaining = count;
     ssize_t bytes_read, bytes_sent;
-
-    if (offset && *offset) {
-        if (lseek(in_fd, *offset, SEEK_SET) == -1) {
-            return -1;
-        }
-    }
+    off_t position = offset ? *offset : 0;
 
     while (remaining > 0) {
-        bytes_read = read(in_fd, buffer, sizeof(buffer) < remaining ? sizeof(buffer) : remaining);
+        size_t to_read = sizeof(buffer) < remaining ? sizeof(buffer) : remaining;
+
+        // Read at the exact offset so a short write on a non-blocking socket
+        // never loses the bytes that were read but not sent
+        if (offset) {
+            bytes_read = pread(in_fd, buffer, to_read, position);
+        } else {
+            bytes_read = read(in_fd, buffer, to_read);
+        }
         if (bytes_read <= 0) {
-            if (bytes_read < 0) printf("[ERROR] Read error: %s\n", strerror(errno));
+            if (bytes_read < 0) LOG_ERROR("Read error: %s\n", strerror(errno));
             break;
         }
 
         bytes_sent = write(out_fd, buffer, bytes_read);
-        if (bytes_sent <= 0) {
-            if (bytes_sent < 0) printf("[ERROR] Write error: %s\n", strerror(errno));
+        if (bytes_sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Socket buffer full: report progress, or EAGAIN if there was none
+                return total_sent > 0 ? total_sent : -1;
+            }
+            LOG_ERROR("Write error: %s\n", strerror(errno));
             return -1;
         }
 
         total_sent += bytes_sent;
         remaining -= bytes_sent;
+        position += bytes_sent;
 
         if (offset) {
-            *offset += bytes_sent;
+            *offset = position;
+        }
+
+        if (bytes_sent < bytes_read) {
+            // Partial write, the socket buffer is full
+            break;
         }
     }
 
     return total_sent;
 }
 
-int platform_list_directory(const char* path, dir_entry_callback callback, void* user_data) {
-    DIR* dir;
-    struct dirent* entry;
-    struct stat stat_buf;
-    char full_path[PATH_MAX];
-    
-    printf("[DEBUG] Unix listing directory: %s\n", path);
-    
-    // Open directory
-    if ((dir = opendir(path)) == NULL) {
-        printf("[ERROR] opendir failed: %s\n", strerror(errno));
-        return 1;  // Error
+// Cleared with --sendfile off; set once at startup, before any worker runs
+static int zero_copy = 1;
+
+void platform_set_zero_copy(int enabled) {
+    zero_copy = enabled;
+}
+
+#ifdef __linux__
+
+// Largest count a single sendfile() call transfers on Linux
+#define SENDFILE_MAX_CHUNK 0x7ffff000
+
+// Linux: zero-copy transfer with the kernel sendfile, falling back to the
+// copy loop only when sendfile cannot handle this pair of descriptors
+ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    ssize_t total_sent = 0;
+    size_t remaining = count;
+
+    if (!zero_copy) {
+        return sendfile_copy(out_fd, in_fd, offset, count);
+    }
+
+    while (remaining > 0) {
+        size_t chunk = remaining < SENDFILE_MAX_CHUNK ? remaining : SENDFILE_MAX_CHUNK;
+        ssize_t bytes_sent = sendfile(out_fd, in_fd, offset, chunk);
+
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Socket buffer full: report progress, or EAGAIN if there was none
+                return total_sent > 0 ? total_sent : -1;
+            }
+            if ((errno == EINVAL || errno == ENOSYS) && total_sent == 0) {
+                return sendfile_copy(out_fd, in_fd, offset, count);
+            }
+            LOG_ERROR("sendfile error: %s\n", strerror(errno));
+            return total_sent > 0 ? total_sent : -1;
+        }
+        if (bytes_sent == 0) {
+            break;  // End of file
+        }
+
+        // sendfile advances *offset itself (or the file position when offset is NULL)
+        total_sent += bytes_sent;
+        remaining -= bytes_sent;
+    }
+
+    return total_sent;
+}
+
+#else
+
+ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return sendfile_copy(out_fd, in_fd, offset, count);
+}
+
+#endif
+
+#ifdef __linux__
+
+/*
+ * Linux reads directories with getdents64 into a large buffer, many entries
+ * per system call, and examines each entry relative to the directory's
+ * descriptor with statx (or fstatat), so the kernel never walks the
+ * directory's path again. statx is asked for only the fields a listing
+ * uses, and the type only when d_type does not already give it.
+ */
+
+#include <sys/syscall.h>
+
+/* Bytes of entries fetched per getdents64 call */
+#define DIRENT_BUFFER_SIZE 32768
+
+/* Layout of the records getdents64 returns */
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct platform_dir {
+    int fd;                              /* Directory descriptor */
+    size_t position;                     /* Offset of the next record in buffer */
+    size_t length;                       /* Bytes of records in buffer */
+    char buffer[DIRENT_BUFFER_SIZE];     /* Records from the last getdents64 call */
+};
+
+platform_dir* platform_open_directory(const char* path) {
+    platform_dir* dir = malloc(sizeof(platform_dir));
+    if (!dir) {
+        return NULL;
     }
     
-    // Read directory entries
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip "." and ".." entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    if ((dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        LOG_ERROR("open of directory failed: %s\n", strerror(errno));
+        free(dir);
+        return NULL;
+    }
+    dir->position = 0;
+    dir->length = 0;
+    return dir;
+}
+
+/**
+ * Examines one name relative to the directory, following it if it is a
+ * symlink unless flags has AT_SYMLINK_NOFOLLOW.
+ */
+static int stat_entry_at(platform_dir* dir, const char* name, int flags, int need_type,
+                         mode_t* mode, size_t* size, time_t* mtime) {
+#ifdef STATX_MTIME
+    static volatile int statx_unsupported = 0;
+    if (!statx_unsupported) {
+        struct statx stx;
+        unsigned int mask = STATX_SIZE | STATX_MTIME | (need_type ? STATX_TYPE : 0);
+        if (statx(dir->fd, name, AT_STATX_SYNC_AS_STAT | flags, mask, &stx) == 0) {
+            *mode = stx.stx_mode;
+            *size = (size_t)stx.stx_size;
+            *mtime = (time_t)stx.stx_mtime.tv_sec;
+            return 0;
+        }
+        if (errno != ENOSYS) {
+            return -1;
+        }
+        // Kernels before 4.11: use fstatat from now on
+        statx_unsupported = 1;
+    }
+#else
+    (void)need_type;
+#endif
+    struct stat stat_buf;
+    if (fstatat(dir->fd, name, &stat_buf, flags) != 0) {
+        return -1;
+    }
+    *mode = stat_buf.st_mode;
+    *size = stat_buf.st_size;
+    *mtime = stat_buf.st_mtime;
+    return 0;
+}
+
+int platform_stat_directory_entry(platform_dir* dir, platform_dir_entry* entry) {
+    // The type is only asked for when d_type did not give it (DT_UNKNOWN,
+    // or DT_LNK, which is listed as its target). Without d_type the name
+    // itself is examined first and only followed if it is a symlink
+    int need_type = entry->is_dir < 0;
+    int flags = entry->is_link < 0 ? AT_SYMLINK_NOFOLLOW : 0;
+    mode_t mode = 0;
+    if (stat_entry_at(dir, entry->name, flags, need_type, &mode, &entry->size, &entry->mtime) != 0) {
+        return -1;
+    }
+    if (flags) {
+        entry->is_link = S_ISLNK(mode);
+        if (entry->is_link &&
+            stat_entry_at(dir, entry->name, 0, need_type, &mode, &entry->size, &entry->mtime) != 0) {
+            return -1;
+        }
+    }
+    if (need_type) {
+        entry->is_dir = S_ISDIR(mode);
+    }
+    return 0;
+}
+
+int platform_read_directory_name(platform_dir* dir, platform_dir_entry* entry) {
+    for (;;) {
+        if (dir->position >= dir->length) {
+            long bytes = syscall(SYS_getdents64, dir->fd, dir->buffer, sizeof(dir->buffer));
+            if (bytes < 0) {
+                LOG_ERROR("getdents64 failed: %s\n", strerror(errno));
+                return -1;
+            }
+            if (bytes == 0) {
+                return 0;
+            }
+            dir->position = 0;
+            dir->length = (size_t)bytes;
         }
         
-        // Get full path for the entry
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+        struct linux_dirent64* dirent = (struct linux_dirent64*)(dir->buffer + dir->position);
+        dir->position += dirent->d_reclen;
         
-        // Get file info
-        if (stat(full_path, &stat_buf) != 0) {
-            printf("[WARNING] stat failed for '%s': %s\n", full_path, strerror(errno));
-            continue;  // Skip if can't get info
+        // Skip "." and ".." entries
+        const char* name = dirent->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
         }
         
-        int is_dir = S_ISDIR(stat_buf.st_mode);
+        entry->name = name;
+        if (dirent->d_type == DT_UNKNOWN || dirent->d_type == DT_LNK) {
+            entry->is_dir = -1;
+        } else {
+            entry->is_dir = dirent->d_type == DT_DIR;
+        }
+        entry->is_link = dirent->d_type == DT_UNKNOWN ? -1 : dirent->d_type == DT_LNK;
+        return 1;
+    }
+}
+
+void platform_close_directory(platform_dir* dir) {
+    if (dir) {
+        close(dir->fd);
+        free(dir);
+    }
+}
+
+#else
+
+struct platform_dir {
+    DIR* dir;                        /* Directory stream */
+};
+
+platform_dir* platform_open_directory(const char* path) {
+    platform_dir* dir = malloc(sizeof(platform_dir));
+    if (!dir) {
+        return NULL;
+    }
+    
+    if ((dir->dir = opendir(path)) == NULL) {
+        LOG_ERROR("opendir failed: %s\n", strerror(errno));
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+int platform_read_directory_name(platform_dir* dir, platform_dir_entry* entry) {
+    struct dirent* dirent;
+    
+    for (;;) {
+        errno = 0;
+        if ((dirent = readdir(dir->dir)) == NULL) {
+            if (errno != 0) {
+                LOG_ERROR("readdir failed: %s\n", strerror(errno));
+                return -1;
+            }
+            return 0;
+        }
         
-        printf("[DEBUG] Found: %s (%s, %zu bytes)\n", 
-               entry->d_name, 
-               is_dir ? "directory" : "file", 
-               (size_t)stat_buf.st_size);
+        // Skip "." and ".." entries
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+            continue;
+        }
         
-        // Call the callback
-        if (callback(entry->d_name, is_dir, stat_buf.st_size, stat_buf.st_mtime, user_data) != 0) {
-            printf("[DEBUG] Callback requested to stop directory listing\n");
-            closedir(dir);
-            return 0;  // Callback requested stop
+        entry->name = dirent->d_name;
+        entry->is_dir = -1;
+        entry->is_link = -1;
+        return 1;
+    }
+}
+
+int platform_stat_directory_entry(platform_dir* dir, platform_dir_entry* entry) {
+    struct stat stat_buf;
+    
+    // Get file info relative to the directory, without re-walking its path;
+    // the name itself first, and its target if it is a symlink
+    if (fstatat(dirfd(dir->dir), entry->name, &stat_buf, AT_SYMLINK_NOFOLLOW) != 0) {
+        return -1;
+    }
+    entry->is_link = S_ISLNK(stat_buf.st_mode);
+    if (entry->is_link && fstatat(dirfd(dir->dir), entry->name, &stat_buf, 0) != 0) {
+        return -1;
+    }
+    entry->is_dir = S_ISDIR(stat_buf.st_mode);
+    entry->size = stat_buf.st_size;
+    entry->mtime = stat_buf.st_mtime;
+    return 0;
+}
+
+void platform_close_directory(platform_dir* dir) {
+    if (dir) {
+        closedir(dir->dir);
+        free(dir);
+    }
+}
+
+#endif
+
+int platform_read_directory(platform_dir* dir, platform_dir_entry* entry) {
+    int result;
+    
+    while ((result = platform_read_directory_name(dir, entry)) > 0) {
+        if (platform_stat_directory_entry(dir, entry) == 0) {
+            return 1;
         }
+        LOG_WARNING("stat failed for '%s': %s\n", entry->name, strerror(errno));
+        // Skip if can't get info
     }
+    return result;
+}
+
+int platform_list_directory(const char* path, dir_entry_callback callback, void* user_data) {
+    platform_dir_entry entry;
+    int result;
+    
+    LOG_DEBUG("Unix listing directory: %s\n", path);
     
-    if (errno != 0) {
-        printf("[ERROR] readdir failed: %s\n", strerror(errno));
+    platform_dir* dir = platform_open_directory(path);
+    if (!dir) {
+        return 1;  // Error
     }
     
-    closedir(dir);
-    printf("[DEBUG] Unix directory listing completed\n");
+    // Read directory entries
+    while ((result = platform_read_directory(dir, &entry)) > 0) {
+        LOG_DEBUG("Found: %s (%s, %zu bytes)\n", 
+               entry.name, 
+               entry.is_dir ? "directory" : "file", 
+               entry.size);
+        
+        // Call the callback
+        if (callback(entry.name, entry.is_dir, entry.size, entry.mtime, user_data) != 0) {
+            LOG_DEBUG("Callback requested to stop directory listing\n");
+            break;  // Callback requested stop
+        }
+    }
+    
+    platform_close_directory(dir);
+    LOG_DEBUG("Unix directory listing completed\n");
     return 0;
 }
 
 void platform_set_socket_blocking(int socket, int blocking) {
     int flags = fcntl(socket, F_GETFL, 0);
     if (flags < 0) {
-        printf("[ERROR] fcntl(F_GETFL) failed: %s\n", strerror(errno));
+        LOG_ERROR("fcntl(F_GETFL) failed: %s\n", strerror(errno));
         return;
     }
     
@@ -133,9 +437,21 @@ void platform_set_socket_blocking(int socket, int blocking) {
     }
     
     if (fcntl(socket, F_SETFL, flags) < 0) {
-        printf("[ERROR] fcntl(F_SETFL) failed: %s\n", strerror(errno));
+        LOG_ERROR("fcntl(F_SETFL) failed: %s\n", strerror(errno));
     } else {
-        printf("[DEBUG] Socket %d set to %s mode\n", socket, blocking ? "blocking" : "non-blocking");
+        LOG_DEBUG("Socket %d set to %s mode\n", socket, blocking ? "blocking" : "non-blocking");
+    }
+}
+
+int platform_socket_would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void platform_close_socket(int socket) {
+    // Shut down both directions before closing so pending data is flushed
+    shutdown(socket, SHUT_RDWR);
+    if (close(socket) < 0) {
+        LOG_ERROR("Failed to close socket: %s\n", strerror(errno));
     }
 }
 
@@ -145,14 +461,543 @@ void platform_set_socket_timeouts(int socket, int seconds) {
     timeout.tv_usec = 0;
     
     if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout)) < 0) {
-        printf("[ERROR] setsockopt(SO_RCVTIMEO) failed: %s\n", strerror(errno));
+        LOG_ERROR("setsockopt(SO_RCVTIMEO) failed: %s\n", strerror(errno));
     }
     
     if (setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout)) < 0) {
-        printf("[ERROR] setsockopt(SO_SNDTIMEO) failed: %s\n", strerror(errno));
+        LOG_ERROR("setsockopt(SO_SNDTIMEO) failed: %s\n", strerror(errno));
     }
     
-    printf("[DEBUG] Socket %d timeouts set to %d seconds\n", socket, seconds);
+    LOG_DEBUG("Socket %d timeouts set to %d seconds\n", socket, seconds);
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * io_uring through its system calls, without liburing. The submission and
+ * completion rings are shared with the kernel: we write the submission tail
+ * and the completion head, the kernel the other two, so each side publishes
+ * its index with a release store and reads the other's with an acquire load.
+ * Setting the ring up for a single issuer with deferred task running needs
+ * Linux 6.1, which also covers multishot accept and registered buffer rings,
+ * so a kernel that accepts the setup flags supports everything used here.
+ */
+
+/* Low bits of a completion's user_data that hold the operation */
+#define RING_OP_MASK 7
+
+/* Buffer group of the registered receive buffers */
+#define RING_BUFFER_GROUP 0
+
+struct platform_ring {
+    int fd;                                /**< The io_uring instance */
+    void* rings;                           /**< Mapping of the submission and completion rings */
+    size_t rings_size;                     /**< Its size */
+    struct io_uring_sqe* sqes;             /**< Submission queue entries */
+    size_t sqes_size;                      /**< Their mapping's size */
+    unsigned* sq_head;                     /**< Kernel: next entry it takes */
+    unsigned* sq_tail;                     /**< Us: end of the queued entries */
+    unsigned sq_mask;                      /**< Submission ring index mask */
+    unsigned sq_entries;                   /**< Submission ring size */
+    unsigned* cq_head;                     /**< Us: next completion to read */
+    unsigned* cq_tail;                     /**< Kernel: end of the completions */
+    unsigned cq_mask;                      /**< Completion ring index mask */
+    struct io_uring_cqe* cqes;             /**< Completion entries */
+    struct io_uring_buf_ring* buffer_ring; /**< Free receive buffers, shared with the kernel */
+    size_t buffer_ring_size;               /**< Its mapping's size */
+    char* buffer_memory;                   /**< The receive buffers */
+    unsigned buffer_count;                 /**< Number of receive buffers */
+    size_t buffer_size;                    /**< Size of each */
+    unsigned short buffer_tail;            /**< Us: end of the free buffers */
+};
+
+/**
+ * @brief Hands queued entries to the kernel and optionally waits for completions
+ *
+ * @return The io_uring_enter() result
+ */
+static int ring_enter(platform_ring* ring, unsigned wait, unsigned flags, const void* arg, size_t arg_size) {
+    unsigned queued = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    return (int)syscall(__NR_io_uring_enter, ring->fd, queued, wait, flags, arg, arg_size);
+}
+
+/**
+ * @brief Returns a cleared submission entry, making room in a full queue first
+ *
+ * @return The entry (queued by push_entry()), or NULL if the queue stays full
+ */
+static struct io_uring_sqe* next_entry(platform_ring* ring) {
+    unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        ring_enter(ring, 0, 0, NULL, 0);
+        if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            LOG_ERROR("io_uring submission queue full\n");
+            return NULL;
+        }
+    }
+    struct io_uring_sqe* sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief Queues the entry next_entry() returned
+ */
+static void push_entry(platform_ring* ring, struct io_uring_sqe* sqe, platform_ring_op op, void* tag) {
+    sqe->user_data = (uint64_t)(uintptr_t)tag | (uint64_t)op;
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Puts a receive buffer at the end of the free list (published by publish_buffers())
+ */
+static void add_buffer(platform_ring* ring, int buffer) {
+    struct io_uring_buf* entry = &ring->buffer_ring->bufs[ring->buffer_tail & (ring->buffer_count - 1)];
+    entry->addr = (uint64_t)(uintptr_t)(ring->buffer_memory + (size_t)buffer * ring->buffer_size);
+    entry->len = (unsigned)ring->buffer_size;
+    entry->bid = (unsigned short)buffer;
+    ring->buffer_tail++;
+}
+
+static void publish_buffers(platform_ring* ring) {
+    __atomic_store_n(&ring->buffer_ring->tail, ring->buffer_tail, __ATOMIC_RELEASE);
+}
+
+platform_ring* platform_ring_create(unsigned entries, unsigned buffers, size_t buffer_size) {
+    platform_ring* ring = calloc(1, sizeof(platform_ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->rings = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    ring->buffer_ring = MAP_FAILED;
+
+    // One thread queues and reaps, so the kernel can run completion work
+    // when that thread waits instead of interrupting it. Multishot accepts
+    // complete many times, so the completion ring is the larger one
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN |
+                   IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        LOG_DEBUG("io_uring_setup failed: %s\n", strerror(errno));
+        free(ring);
+        return NULL;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        platform_ring_destroy(ring);
+        return NULL;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        LOG_ERROR("Failed to map the io_uring rings: %s\n", strerror(errno));
+        platform_ring_destroy(ring);
+        return NULL;
+    }
+
+    char* base = ring->rings;
+    ring->sq_head = (unsigned*)(base + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(base + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(base + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned*)(base + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(base + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+
+    // Slot i of the submission ring always holds entry i
+    unsigned* array = (unsigned*)(base + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    // Register the receive buffers as a ring the kernel picks from
+    ring->buffer_count = buffers;
+    ring->buffer_size = buffer_size;
+    ring->buffer_ring_size = buffers * sizeof(struct io_uring_buf);
+    ring->buffer_ring = mmap(NULL, ring->buffer_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->buffer_memory = malloc(buffers * buffer_size);
+    if (ring->buffer_ring == MAP_FAILED || !ring->buffer_memory) {
+        platform_ring_destroy(ring);
+        return NULL;
+    }
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uint64_t)(uintptr_t)ring->buffer_ring;
+    registration.ring_entries = buffers;
+    registration.bgid = RING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        LOG_DEBUG("Failed to register io_uring buffers: %s\n", strerror(errno));
+        platform_ring_destroy(ring);
+        return NULL;
+    }
+    for (unsigned i = 0; i < buffers; i++) {
+        add_buffer(ring, (int)i);
+    }
+    publish_buffers(ring);
+    return ring;
+}
+
+void platform_ring_destroy(platform_ring* ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->rings != MAP_FAILED) {
+        munmap(ring->rings, ring->rings_size);
+    }
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    // Closing the instance drops the buffer registration
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    if (ring->buffer_ring != MAP_FAILED) {
+        munmap(ring->buffer_ring, ring->buffer_ring_size);
+    }
+    free(ring->buffer_memory);
+    free(ring);
+}
+
+int platform_ring_accept(platform_ring* ring, int socket, void* tag) {
+    struct io_uring_sqe* sqe = next_entry(ring);
+    if (!sqe) {
+        return 1;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    push_entry(ring, sqe, PLATFORM_RING_ACCEPT, tag);
+    return 0;
+}
+
+int platform_ring_recv(platform_ring* ring, int socket, size_t max_length, void* tag) {
+    struct io_uring_sqe* sqe = next_entry(ring);
+    if (!sqe) {
+        return 1;
+    }
+    // The kernel picks a buffer and receives at most the smaller of its size and len
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket;
+    sqe->len = (unsigned)max_length;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_BUFFER_GROUP;
+    push_entry(ring, sqe, PLATFORM_RING_RECV, tag);
+    return 0;
+}
+
+int platform_ring_poll(platform_ring* ring, int fd, int writable, void* tag) {
+    struct io_uring_sqe* sqe = next_entry(ring);
+    if (!sqe) {
+        return 1;
+    }
+    uint32_t events = writable ? POLLOUT : POLLIN;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // The kernel reads the mask with its 16-bit halves swapped on big-endian machines
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    push_entry(ring, sqe, PLATFORM_RING_POLL, tag);
+    return 0;
+}
+
+int platform_ring_cancel(platform_ring* ring, int fd) {
+    struct io_uring_sqe* sqe = next_entry(ring);
+    if (!sqe) {
+        return 1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    push_entry(ring, sqe, PLATFORM_RING_CANCEL, NULL);
+    return 0;
+}
+
+int platform_ring_wait(platform_ring* ring, platform_ring_event* events, int max_events, int timeout_ms) {
+    struct __kernel_timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&timeout;
+
+    // Submit and wait in one call; only submit (and run the deferred
+    // completion work) if completions are already waiting
+    unsigned head = *ring->cq_head;
+    int ready = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) != head;
+    if (ring_enter(ring, ready ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0 &&
+        errno != ETIME && errno != EINTR && errno != EBUSY) {
+        LOG_ERROR("io_uring_enter failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    while (head != tail && count < max_events) {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        platform_ring_event* event = &events[count++];
+        event->op = (platform_ring_op)(cqe->user_data & RING_OP_MASK);
+        event->tag = (void*)(uintptr_t)(cqe->user_data & ~(uint64_t)RING_OP_MASK);
+        event->result = cqe->res;
+        event->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            event->buffer = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            event->data = ring->buffer_memory + (size_t)event->buffer * ring->buffer_size;
+        } else {
+            event->buffer = -1;
+            event->data = NULL;
+        }
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+void platform_ring_recycle(platform_ring* ring, int buffer) {
+    add_buffer(ring, buffer);
+    publish_buffers(ring);
+}
+
+#else
+
+/* Without io_uring there is no completion ring: the event loop uses epoll */
+platform_ring* platform_ring_create(unsigned entries, unsigned buffers, size_t buffer_size) {
+    (void)entries;
+    (void)buffers;
+    (void)buffer_size;
+    return NULL;
+}
+
+void platform_ring_destroy(platform_ring* ring) {
+    (void)ring;
+}
+
+int platform_ring_accept(platform_ring* ring, int socket, void* tag) {
+    (void)ring;
+    (void)socket;
+    (void)tag;
+    return 1;
+}
+
+int platform_ring_recv(platform_ring* ring, int socket, size_t max_length, void* tag) {
+    (void)ring;
+    (void)socket;
+    (void)max_length;
+    (void)tag;
+    return 1;
+}
+
+int platform_ring_poll(platform_ring* ring, int fd, int writable, void* tag) {
+    (void)ring;
+    (void)fd;
+    (void)writable;
+    (void)tag;
+    return 1;
+}
+
+int platform_ring_cancel(platform_ring* ring, int fd) {
+    (void)ring;
+    (void)fd;
+    return 1;
+}
+
+int platform_ring_wait(platform_ring* ring, platform_ring_event* events, int max_events, int timeout_ms) {
+    (void)ring;
+    (void)events;
+    (void)max_events;
+    (void)timeout_ms;
+    return -1;
+}
+
+void platform_ring_recycle(platform_ring* ring, int buffer) {
+    (void)ring;
+    (void)buffer;
+}
+
+#endif
+
+// pthread entry points return void*, so wrap the platform thread function
+typedef struct {
+    platform_thread_func func;
+    void* arg;
+} thread_start;
+
+static void* thread_trampoline(void* data) {
+    thread_start start = *(thread_start*)data;
+    free(data);
+    start.func(start.arg);
+    return NULL;
+}
+
+int platform_thread_create(platform_thread_func func, void* arg) {
+    pthread_t thread;
+    thread_start* start = malloc(sizeof(thread_start));
+    if (!start) {
+        return 1;
+    }
+    start->func = func;
+    start->arg = arg;
+
+    int result = pthread_create(&thread, NULL, thread_trampoline, start);
+    if (result != 0) {
+        LOG_ERROR("pthread_create failed: %s\n", strerror(result));
+        free(start);
+        return 1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+struct platform_mutex {
+    pthread_mutex_t mutex;
+};
+
+platform_mutex* platform_mutex_create(void) {
+    platform_mutex* mutex = malloc(sizeof(platform_mutex));
+    if (!mutex) {
+        return NULL;
+    }
+    if (pthread_mutex_init(&mutex->mutex, NULL) != 0) {
+        free(mutex);
+        return NULL;
+    }
+    return mutex;
+}
+
+void platform_mutex_lock(platform_mutex* mutex) {
+    pthread_mutex_lock(&mutex->mutex);
+}
+
+void platform_mutex_unlock(platform_mutex* mutex) {
+    pthread_mutex_unlock(&mutex->mutex);
+}
+
+void platform_mutex_destroy(platform_mutex* mutex) {
+    if (mutex) {
+        pthread_mutex_destroy(&mutex->mutex);
+        free(mutex);
+    }
+}
+
+struct platform_cond {
+    pthread_cond_t cond;
+};
+
+platform_cond* platform_cond_create(void) {
+    platform_cond* cond = malloc(sizeof(platform_cond));
+    if (!cond) {
+        return NULL;
+    }
+    if (pthread_cond_init(&cond->cond, NULL) != 0) {
+        free(cond);
+        return NULL;
+    }
+    return cond;
+}
+
+void platform_cond_wait(platform_cond* cond, platform_mutex* mutex) {
+    pthread_cond_wait(&cond->cond, &mutex->mutex);
+}
+
+void platform_cond_broadcast(platform_cond* cond) {
+    pthread_cond_broadcast(&cond->cond);
+}
+
+void platform_cond_destroy(platform_cond* cond) {
+    if (cond) {
+        pthread_cond_destroy(&cond->cond);
+        free(cond);
+    }
+}
+
+size_t platform_atomic_load(const volatile size_t* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void platform_atomic_store(volatile size_t* value, size_t new_value) {
+    __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+size_t platform_atomic_add(volatile size_t* value, size_t delta) {
+    return __atomic_fetch_add(value, delta, __ATOMIC_SEQ_CST);
+}
+
+long long platform_monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int platform_random_bytes(void* buffer, size_t length) {
+    unsigned char* out = buffer;
+    size_t done = 0;
+#ifdef __linux__
+    // getrandom() needs no descriptor, so it also works without /dev
+    while (done < length) {
+        ssize_t n = getrandom(out + done, length - done, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += (size_t)n;
+    }
+    if (done == length) {
+        return 0;
+    }
+#endif
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 1;
+    }
+    while (done < length) {
+        ssize_t n = read(fd, out + done, length - done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+    return done == length ? 0 : 1;
+}
+
+void platform_format_address(const void* address, char* buffer, size_t size) {
+    const struct sockaddr* generic = address;
+    if (generic->sa_family == AF_INET) {
+        const struct sockaddr_in* ipv4 = address;
+        if (inet_ntop(AF_INET, &ipv4->sin_addr, buffer, (socklen_t)size)) {
+            return;
+        }
+    } else if (generic->sa_family == AF_INET6) {
+        const struct sockaddr_in6* ipv6 = address;
+        if (IN6_IS_ADDR_V4MAPPED(&ipv6->sin6_addr)) {
+            // ::ffff:a.b.c.d from a dual-stack socket
+            if (inet_ntop(AF_INET, &ipv6->sin6_addr.s6_addr[12], buffer, (socklen_t)size)) {
+                return;
+            }
+        } else if (inet_ntop(AF_INET6, &ipv6->sin6_addr, buffer, (socklen_t)size)) {
+            return;
+        }
+    }
+    snprintf(buffer, size, "-");
 }
 
 void platform_sleep_ms(int milliseconds) {
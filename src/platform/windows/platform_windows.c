@@ -12,10 +12,14 @@
  */
 
 #include "platform.h"
+#include "log.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <winsock2.h>  /* Windows Socket API - Windows' implementation of Berkeley sockets */
+#include <ws2tcpip.h>  /* inet_ntop */
 #include <windows.h>   /* Core Windows API functions */
+#include <ntsecapi.h>  /* RtlGenRandom */
 #include <io.h>        /* Low-level I/O functions (_read, _lseek, etc.) */
 #include <fcntl.h>     /* File control options */
 
@@ -34,7 +38,7 @@ int platform_init(void) {
     WSADATA wsaData;  /* Structure to receive details of Winsock implementation */
     int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
     if (result != 0) {
-        printf("[ERROR] WSAStartup failed: %d\n", result);
+        LOG_ERROR("WSAStartup failed: %d\n", result);
     }
     return result;
 }
@@ -49,6 +53,13 @@ void platform_cleanup(void) {
     WSACleanup();  /* Terminates use of the Winsock DLL */
 }
 
+/**
+ * Windows has no kernel sendfile to turn off: platform_sendfile() always copies
+ */
+void platform_set_zero_copy(int enabled) {
+    (void)enabled;
+}
+
 /**
  * Windows implementation of sendfile - transfers data between file descriptor and socket
  * 
@@ -68,13 +79,13 @@ ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
     size_t remaining = count;
     ssize_t to_read, bytes_read, bytes_sent;
     
-    printf("[DEBUG] Windows sendfile: out_fd=%d, in_fd=%d, count=%zu\n", out_fd, in_fd, count);
+    LOG_DEBUG("Windows sendfile: out_fd=%d, in_fd=%d, count=%zu\n", out_fd, in_fd, count);
 
     /* If offset is provided, seek to that position in the file */
     if (offset && *offset) {
         /* Windows uses _lseek instead of lseek for file positioning */
         if (_lseek(in_fd, (long)*offset, SEEK_SET) == -1) {
-            printf("[ERROR] _lseek failed: %lu\n", GetLastError());
+            LOG_ERROR("_lseek failed: %lu\n", GetLastError());
             return -1;
         }
     }
@@ -89,22 +100,22 @@ ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
         
         if (bytes_read <= 0) {
             if (bytes_read < 0) {
-                printf("[ERROR] _read failed: %lu\n", GetLastError());
+                LOG_ERROR("_read failed: %lu\n", GetLastError());
             }
             break;  /* End of file or error */
         }
         
-        printf("[DEBUG] Read %ld bytes from file\n", (long)bytes_read);
+        LOG_DEBUG("Read %ld bytes from file\n", (long)bytes_read);
         
         /* Windows send function takes int instead of size_t for the length */
         bytes_sent = send(out_fd, buffer, (int)bytes_read, 0);
         if (bytes_sent <= 0) {
             /* Windows uses WSAGetLastError() instead of errno for socket errors */
-            printf("[ERROR] send failed: %d\n", WSAGetLastError());
+            LOG_ERROR("send failed: %d\n", WSAGetLastError());
             return -1;  /* Error */
         }
         
-        printf("[DEBUG] Sent %ld bytes to socket\n", (long)bytes_sent);
+        LOG_DEBUG("Sent %ld bytes to socket\n", (long)bytes_sent);
         
         total_sent += bytes_sent;
         remaining -= bytes_sent;
@@ -115,7 +126,7 @@ ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
         }
     }
     
-    printf("[DEBUG] Windows sendfile completed: total sent=%ld\n", (long)total_sent);
+    LOG_DEBUG("Windows sendfile completed: total sent=%ld\n", (long)total_sent);
     return total_sent;
 }
 
@@ -131,39 +142,69 @@ ssize_t platform_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
  * @param user_data User data to pass to the callback
  * @return 0 on success, non-zero on error
  */
-int platform_list_directory(const char* path, dir_entry_callback callback, void* user_data) {
-    WIN32_FIND_DATAA find_data;  /* Structure to receive file info (ANSI version) */
+struct platform_dir {
     HANDLE find_handle;          /* Windows handle for the find operation */
+    WIN32_FIND_DATAA find_data;  /* Current entry (ANSI version) */
+    int pending;                 /* 1 if find_data holds an entry not yet returned */
+};
+
+platform_dir* platform_open_directory(const char* path) {
     char search_path[MAX_PATH];  /* Buffer for the search path with wildcard */
-    
-    printf("[DEBUG] Windows listing directory: %s\n", path);
+    platform_dir* dir = malloc(sizeof(platform_dir));
+    if (!dir) {
+        return NULL;
+    }
     
     /* Create search path with wildcard - Windows requires "\*" pattern to list directory */
     snprintf(search_path, sizeof(search_path), "%s\\*", path);
     
-    /* Start finding files - Windows equivalent of opendir() */
-    find_handle = FindFirstFileA(search_path, &find_data);
-    if (find_handle == INVALID_HANDLE_VALUE) {
-        printf("[ERROR] FindFirstFileA failed: %lu\n", GetLastError());
-        return 1;  /* Error */
+    /* Start finding files - Windows equivalent of opendir(); this already returns the first entry */
+    dir->find_handle = FindFirstFileA(search_path, &dir->find_data);
+    if (dir->find_handle == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("FindFirstFileA failed: %lu\n", GetLastError());
+        free(dir);
+        return NULL;
     }
+    dir->pending = 1;
+    return dir;
+}
+
+/* FindFirstFileA/FindNextFileA return the metadata with the name, so
+ * reading the name already does all the work and there is nothing left
+ * to examine afterwards */
+int platform_read_directory_name(platform_dir* dir, platform_dir_entry* entry) {
+    WIN32_FIND_DATAA* find_data = &dir->find_data;
     
-    do {
+    for (;;) {
+        if (!dir->pending) {
+            /* Get next file, Windows equivalent of readdir() */
+            if (FindNextFileA(dir->find_handle, find_data) == 0) {
+                /* Check if there are no more files or an error occurred */
+                DWORD error = GetLastError();
+                if (error != ERROR_NO_MORE_FILES) {
+                    LOG_ERROR("FindNextFileA failed: %lu\n", error);
+                    return -1;
+                }
+                return 0;
+            }
+        }
+        dir->pending = 0;
+        
         /* Skip "." and ".." entries - these are returned by Windows but often not needed */
-        if (strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0) {
+        if (strcmp(find_data->cFileName, ".") == 0 || strcmp(find_data->cFileName, "..") == 0) {
             continue;
         }
         
-        /* Extract file information from the WIN32_FIND_DATA structure */
-        
         /* Check if entry is a directory using file attributes */
-        int is_dir = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        entry->name = find_data->cFileName;
+        entry->is_dir = (find_data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        entry->is_link = (find_data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
         
         /* Get file size - Windows uses a high/low DWORD pair for 64-bit size */
         ULARGE_INTEGER filesize;
-        filesize.HighPart = find_data.nFileSizeHigh;
-        filesize.LowPart = find_data.nFileSizeLow;
-        size_t size = (size_t)filesize.QuadPart;
+        filesize.HighPart = find_data->nFileSizeHigh;
+        filesize.LowPart = find_data->nFileSizeLow;
+        entry->size = (size_t)filesize.QuadPart;
         
         /* Convert Windows file time to Unix time_t
          * Windows time: 100-nanosecond intervals since January 1, 1601 (UTC)
@@ -174,32 +215,57 @@ int platform_list_directory(const char* path, dir_entry_callback callback, void*
          * 3. Adjust for difference in epochs (subtract 11,644,473,600 seconds)
          */
         ULARGE_INTEGER ull;
-        ull.LowPart = find_data.ftLastWriteTime.dwLowDateTime;
-        ull.HighPart = find_data.ftLastWriteTime.dwHighDateTime;
-        time_t mtime = (time_t)((ull.QuadPart / 10000000ULL) - 11644473600ULL);
-        
-        printf("[DEBUG] Found: %s (%s, %zu bytes)\n", 
-               find_data.cFileName, 
-               is_dir ? "directory" : "file", 
-               size);
+        ull.LowPart = find_data->ftLastWriteTime.dwLowDateTime;
+        ull.HighPart = find_data->ftLastWriteTime.dwHighDateTime;
+        entry->mtime = (time_t)((ull.QuadPart / 10000000ULL) - 11644473600ULL);
+        return 1;
+    }
+}
+
+int platform_stat_directory_entry(platform_dir* dir, platform_dir_entry* entry) {
+    (void)dir;
+    (void)entry;
+    return 0;
+}
+
+int platform_read_directory(platform_dir* dir, platform_dir_entry* entry) {
+    return platform_read_directory_name(dir, entry);
+}
+
+void platform_close_directory(platform_dir* dir) {
+    if (dir) {
+        /* Clean up the find handle - Windows equivalent of closedir() */
+        FindClose(dir->find_handle);
+        free(dir);
+    }
+}
+
+int platform_list_directory(const char* path, dir_entry_callback callback, void* user_data) {
+    platform_dir_entry entry;
+    int result;
+    
+    LOG_DEBUG("Windows listing directory: %s\n", path);
+    
+    platform_dir* dir = platform_open_directory(path);
+    if (!dir) {
+        return 1;  /* Error */
+    }
+    
+    while ((result = platform_read_directory(dir, &entry)) > 0) {
+        LOG_DEBUG("Found: %s (%s, %zu bytes)\n", 
+               entry.name, 
+               entry.is_dir ? "directory" : "file", 
+               entry.size);
         
         /* Call the callback with the file information */
-        if (callback(find_data.cFileName, is_dir, size, mtime, user_data) != 0) {
-            printf("[DEBUG] Callback requested to stop directory listing\n");
-            FindClose(find_handle);
-            return 0;  /* Callback requested stop */
+        if (callback(entry.name, entry.is_dir, entry.size, entry.mtime, user_data) != 0) {
+            LOG_DEBUG("Callback requested to stop directory listing\n");
+            break;  /* Callback requested stop */
         }
-    } while (FindNextFileA(find_handle, &find_data) != 0);  /* Get next file, Windows equivalent of readdir() */
-    
-    /* Check if the loop ended because of an error or because there are no more files */
-    DWORD error = GetLastError();
-    if (error != ERROR_NO_MORE_FILES) {
-        printf("[ERROR] FindNextFileA failed: %lu\n", error);
     }
     
-    /* Clean up the find handle - Windows equivalent of closedir() */
-    FindClose(find_handle);
-    printf("[DEBUG] Windows directory listing completed\n");
+    platform_close_directory(dir);
+    LOG_DEBUG("Windows directory listing completed\n");
     return 0;
 }
 
@@ -217,9 +283,37 @@ void platform_set_socket_blocking(int socket, int blocking) {
     
     /* Windows uses ioctlsocket instead of fcntl for socket options */
     if (ioctlsocket(socket, FIONBIO, &mode) != 0) {
-        printf("[ERROR] ioctlsocket(FIONBIO) failed: %d\n", WSAGetLastError());
+        LOG_ERROR("ioctlsocket(FIONBIO) failed: %d\n", WSAGetLastError());
     } else {
-        printf("[DEBUG] Socket %d set to %s mode\n", socket, blocking ? "blocking" : "non-blocking");
+        LOG_DEBUG("Socket %d set to %s mode\n", socket, blocking ? "blocking" : "non-blocking");
+    }
+}
+
+/**
+ * Check whether the last socket call failed only because a non-blocking
+ * socket was not ready
+ * 
+ * Windows reports this as WSAEWOULDBLOCK through WSAGetLastError() instead
+ * of EAGAIN/EWOULDBLOCK in errno.
+ * 
+ * @return 1 if the operation would have blocked, 0 otherwise
+ */
+int platform_socket_would_block(void) {
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+/**
+ * Shut down and close a socket
+ * 
+ * Windows sockets are not file descriptors, so they must be closed with
+ * closesocket() rather than close().
+ * 
+ * @param socket The socket descriptor
+ */
+void platform_close_socket(int socket) {
+    shutdown(socket, SD_BOTH);
+    if (closesocket(socket) != 0) {
+        LOG_ERROR("Failed to close socket: %d\n", WSAGetLastError());
     }
 }
 
@@ -239,15 +333,223 @@ void platform_set_socket_timeouts(int socket, int seconds) {
     
     /* Set receive timeout */
     if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout)) < 0) {
-        printf("[ERROR] setsockopt(SO_RCVTIMEO) failed: %d\n", WSAGetLastError());
+        LOG_ERROR("setsockopt(SO_RCVTIMEO) failed: %d\n", WSAGetLastError());
     }
     
     /* Set send timeout */
     if (setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout)) < 0) {
-        printf("[ERROR] setsockopt(SO_SNDTIMEO) failed: %d\n", WSAGetLastError());
+        LOG_ERROR("setsockopt(SO_SNDTIMEO) failed: %d\n", WSAGetLastError());
     }
     
-    printf("[DEBUG] Socket %d timeouts set to %d seconds\n", socket, seconds);
+    LOG_DEBUG("Socket %d timeouts set to %d seconds\n", socket, seconds);
+}
+
+/* There is no completion ring here: the event loop serves connections itself */
+platform_ring* platform_ring_create(unsigned entries, unsigned buffers, size_t buffer_size) {
+    (void)entries;
+    (void)buffers;
+    (void)buffer_size;
+    return NULL;
+}
+
+void platform_ring_destroy(platform_ring* ring) {
+    (void)ring;
+}
+
+int platform_ring_accept(platform_ring* ring, int socket, void* tag) {
+    (void)ring;
+    (void)socket;
+    (void)tag;
+    return 1;
+}
+
+int platform_ring_recv(platform_ring* ring, int socket, size_t max_length, void* tag) {
+    (void)ring;
+    (void)socket;
+    (void)max_length;
+    (void)tag;
+    return 1;
+}
+
+int platform_ring_poll(platform_ring* ring, int fd, int writable, void* tag) {
+    (void)ring;
+    (void)fd;
+    (void)writable;
+    (void)tag;
+    return 1;
+}
+
+int platform_ring_cancel(platform_ring* ring, int fd) {
+    (void)ring;
+    (void)fd;
+    return 1;
+}
+
+int platform_ring_wait(platform_ring* ring, platform_ring_event* events, int max_events, int timeout_ms) {
+    (void)ring;
+    (void)events;
+    (void)max_events;
+    (void)timeout_ms;
+    return -1;
+}
+
+void platform_ring_recycle(platform_ring* ring, int buffer) {
+    (void)ring;
+    (void)buffer;
+}
+
+/* CreateThread entry points use a different signature, so we wrap the
+ * platform thread function and its argument in a small heap struct */
+typedef struct {
+    platform_thread_func func;
+    void* arg;
+} thread_start;
+
+static DWORD WINAPI thread_trampoline(LPVOID data) {
+    thread_start start = *(thread_start*)data;
+    free(data);
+    start.func(start.arg);
+    return 0;
+}
+
+/**
+ * Start a detached thread
+ * 
+ * Windows uses CreateThread() instead of pthread_create(). Closing the
+ * returned handle right away is the Windows equivalent of detaching.
+ * 
+ * @param func The function to run on the new thread
+ * @param arg Argument passed to func
+ * @return 0 on success, non-zero on failure
+ */
+int platform_thread_create(platform_thread_func func, void* arg) {
+    thread_start* start = malloc(sizeof(thread_start));
+    if (!start) {
+        return 1;
+    }
+    start->func = func;
+    start->arg = arg;
+
+    HANDLE thread = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (thread == NULL) {
+        LOG_ERROR("CreateThread failed: %lu\n", GetLastError());
+        free(start);
+        return 1;
+    }
+    CloseHandle(thread);
+    return 0;
+}
+
+/**
+ * Mutex implemented with a critical section
+ * 
+ * Critical sections are the lightweight in-process lock on Windows; they spin
+ * briefly before falling back to a kernel wait, much like a pthread mutex.
+ */
+struct platform_mutex {
+    CRITICAL_SECTION section;
+};
+
+platform_mutex* platform_mutex_create(void) {
+    platform_mutex* mutex = malloc(sizeof(platform_mutex));
+    if (!mutex) {
+        return NULL;
+    }
+    InitializeCriticalSection(&mutex->section);
+    return mutex;
+}
+
+void platform_mutex_lock(platform_mutex* mutex) {
+    EnterCriticalSection(&mutex->section);
+}
+
+void platform_mutex_unlock(platform_mutex* mutex) {
+    LeaveCriticalSection(&mutex->section);
+}
+
+void platform_mutex_destroy(platform_mutex* mutex) {
+    if (mutex) {
+        DeleteCriticalSection(&mutex->section);
+        free(mutex);
+    }
+}
+
+/* Condition variables are native since Vista and work with critical sections */
+struct platform_cond {
+    CONDITION_VARIABLE cond;
+};
+
+platform_cond* platform_cond_create(void) {
+    platform_cond* cond = malloc(sizeof(platform_cond));
+    if (!cond) {
+        return NULL;
+    }
+    InitializeConditionVariable(&cond->cond);
+    return cond;
+}
+
+void platform_cond_wait(platform_cond* cond, platform_mutex* mutex) {
+    SleepConditionVariableCS(&cond->cond, &mutex->section, INFINITE);
+}
+
+void platform_cond_broadcast(platform_cond* cond) {
+    WakeAllConditionVariable(&cond->cond);
+}
+
+void platform_cond_destroy(platform_cond* cond) {
+    /* Condition variables need no cleanup on Windows */
+    free(cond);
+}
+
+size_t platform_atomic_load(const volatile size_t* value) {
+    size_t loaded = *value;
+    MemoryBarrier();
+    return loaded;
+}
+
+void platform_atomic_store(volatile size_t* value, size_t new_value) {
+    MemoryBarrier();
+    *value = new_value;
+}
+
+size_t platform_atomic_add(volatile size_t* value, size_t delta) {
+#ifdef _WIN64
+    return (size_t)InterlockedExchangeAdd64((volatile LONG64*)value, (LONG64)delta);
+#else
+    return (size_t)InterlockedExchangeAdd((volatile LONG*)value, (LONG)delta);
+#endif
+}
+
+long long platform_monotonic_us(void) {
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&now);
+    return (long long)(now.QuadPart / frequency.QuadPart * 1000000 +
+                       now.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
+
+int platform_random_bytes(void* buffer, size_t length) {
+    /* RtlGenRandom lives in advapi32, which every program links */
+    return RtlGenRandom(buffer, (ULONG)length) ? 0 : 1;
+}
+
+void platform_format_address(const void* address, char* buffer, size_t size) {
+    const struct sockaddr* generic = address;
+    if (generic->sa_family == AF_INET) {
+        const struct sockaddr_in* ipv4 = address;
+        if (inet_ntop(AF_INET, (void*)&ipv4->sin_addr, buffer, size)) {
+            return;
+        }
+    } else if (generic->sa_family == AF_INET6) {
+        const struct sockaddr_in6* ipv6 = address;
+        if (inet_ntop(AF_INET6, (void*)&ipv6->sin6_addr, buffer, size)) {
+            return;
+        }
+    }
+    snprintf(buffer, size, "-");
 }
 
 /**
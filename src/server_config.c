@@ -0,0 +1,355 @@
+#include "server_config.h"
+#include "http_parser.h"
+#include "log.h"
+#include "access_log.h"
+#include "event_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This file contains the server's runtime options and their parsing.
+ */
+
+static const char* const default_index_files[] = { "index.html", "index.htm" };
+
+static server_config config = {
+    DEFAULT_WORKERS,
+    EVENT_LOOP_EPOLL,
+    1,
+    DEFAULT_KEEPALIVE_TIMEOUT,
+    DEFAULT_MAX_REQUESTS,
+    DEFAULT_MAX_HEADER_SIZE,
+    DEFAULT_MAX_HEADERS,
+    DEFAULT_FILE_CACHE_SIZE,
+    DEFAULT_FILE_CACHE_TTL,
+    DEFAULT_STAT_CACHE_MEMORY,
+    DEFAULT_LISTING_CACHE_MEMORY,
+    DEFAULT_LISTING_STREAM_THRESHOLD,
+    DEFAULT_STAT_THREADS,
+    DEFAULT_FS_THREADS,
+    DEFAULT_FS_QUEUE_DEPTH,
+    DEFAULT_LISTING_PAGE_SIZE,
+    NULL,
+    default_index_files,
+    2,
+    DEFAULT_LOG_LEVEL,
+    NULL,
+    ACCESS_LOG_COMBINED,
+    DEFAULT_METRICS_PATH
+};
+
+const server_config* server_config_get(void) {
+    return &config;
+}
+
+/**
+ * @brief Parses a decimal integer option value within a range
+ *
+ * @param value The string to parse
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param out Receives the parsed value
+ * @return 0 on success, non-zero if the value is not a number or out of range
+ */
+static int parse_int_option(const char* value, long min, long max, int* out) {
+    char* end;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < min || parsed > max) {
+        return 1;
+    }
+    *out = (int)parsed;
+    return 0;
+}
+
+/**
+ * @brief Parses a comma-separated list of index file names
+ *
+ * Names are plain file names: empty entries are skipped, and names with a
+ * path separator or ".." are rejected. An empty list turns index files off.
+ *
+ * @param value The string to parse
+ * @return 0 on success, non-zero if a name is invalid or there are too many
+ */
+static int parse_index_files(const char* value) {
+    // Kept for the life of the process
+    char* copy = malloc(strlen(value) + 1);
+    const char** names = malloc(MAX_INDEX_NAMES * sizeof(const char*));
+    if (!copy || !names) {
+        free(copy);
+        free(names);
+        return 1;
+    }
+    strcpy(copy, value);
+
+    int count = 0;
+    char* name = copy;
+    for (;;) {
+        char* comma = strchr(name, ',');
+        if (comma) {
+            *comma = '\0';
+        }
+        if (*name) {
+            if (count == MAX_INDEX_NAMES || strchr(name, '/') || strchr(name, '\\') || strstr(name, "..")) {
+                free(copy);
+                free(names);
+                return 1;
+            }
+            names[count++] = name;
+        }
+        if (!comma) {
+            break;
+        }
+        name = comma + 1;
+    }
+
+    config.index_files = names;
+    config.index_file_count = count;
+    return 0;
+}
+
+int server_config_set(const char* name, const char* value) {
+    if (name == NULL || value == NULL) {
+        return 1;
+    }
+
+    if (strcmp(name, "workers") == 0) {
+        if (parse_int_option(value, 1, MAX_WORKERS, &config.workers) != 0) {
+            fprintf(stderr, "Invalid value for workers: '%s' (expected 1-%d)\n", value, MAX_WORKERS);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "io-backend") == 0) {
+        if (event_loop_parse_backend(value, &config.io_backend) != 0) {
+            fprintf(stderr, "Invalid value for io-backend: '%s' (expected epoll or io_uring)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "sendfile") == 0) {
+        if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+            fprintf(stderr, "Invalid value for sendfile: '%s' (expected on or off)\n", value);
+            return 1;
+        }
+        config.sendfile = strcmp(value, "on") == 0;
+        return 0;
+    }
+
+    if (strcmp(name, "keepalive-timeout") == 0) {
+        if (parse_int_option(value, 1, 3600, &config.keepalive_timeout) != 0) {
+            fprintf(stderr, "Invalid value for keepalive-timeout: '%s' (expected 1-3600 seconds)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "max-requests") == 0) {
+        if (parse_int_option(value, 1, 1000000, &config.max_requests) != 0) {
+            fprintf(stderr, "Invalid value for max-requests: '%s' (expected 1-1000000)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "max-header-size") == 0) {
+        if (parse_int_option(value, 1024, 1024 * 1024, &config.max_header_size) != 0) {
+            fprintf(stderr, "Invalid value for max-header-size: '%s' (expected 1024-1048576 bytes)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "max-headers") == 0) {
+        if (parse_int_option(value, 1, HTTP_PARSER_MAX_HEADERS, &config.max_headers) != 0) {
+            fprintf(stderr, "Invalid value for max-headers: '%s' (expected 1-%d)\n", value, HTTP_PARSER_MAX_HEADERS);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "file-cache-size") == 0) {
+        if (parse_int_option(value, 0, 65536, &config.file_cache_size) != 0) {
+            fprintf(stderr, "Invalid value for file-cache-size: '%s' (expected 0-65536 files)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "file-cache-ttl") == 0) {
+        if (parse_int_option(value, 0, 3600, &config.file_cache_ttl) != 0) {
+            fprintf(stderr, "Invalid value for file-cache-ttl: '%s' (expected 0-3600 seconds)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "stat-cache-memory") == 0) {
+        if (parse_int_option(value, 0, 4096, &config.stat_cache_memory) != 0) {
+            fprintf(stderr, "Invalid value for stat-cache-memory: '%s' (expected 0-4096 megabytes)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "listing-cache-memory") == 0) {
+        if (parse_int_option(value, 0, 4096, &config.listing_cache_memory) != 0) {
+            fprintf(stderr, "Invalid value for listing-cache-memory: '%s' (expected 0-4096 megabytes)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "listing-stream-threshold") == 0) {
+        if (parse_int_option(value, 0, 10000000, &config.listing_stream_threshold) != 0) {
+            fprintf(stderr, "Invalid value for listing-stream-threshold: '%s' (expected 0-10000000 entries)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "stat-threads") == 0) {
+        if (parse_int_option(value, 0, MAX_STAT_THREADS, &config.stat_threads) != 0) {
+            fprintf(stderr, "Invalid value for stat-threads: '%s' (expected 0-%d)\n", value, MAX_STAT_THREADS);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "fs-threads") == 0) {
+        if (parse_int_option(value, 0, MAX_FS_THREADS, &config.fs_threads) != 0) {
+            fprintf(stderr, "Invalid value for fs-threads: '%s' (expected 0-%d)\n", value, MAX_FS_THREADS);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "fs-queue-depth") == 0) {
+        if (parse_int_option(value, 1, 1000000, &config.fs_queue_depth) != 0) {
+            fprintf(stderr, "Invalid value for fs-queue-depth: '%s' (expected 1-1000000 requests)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "listing-page-size") == 0) {
+        if (parse_int_option(value, 1, 1000000, &config.listing_page_size) != 0) {
+            fprintf(stderr, "Invalid value for listing-page-size: '%s' (expected 1-1000000 entries)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "index-files") == 0) {
+        if (parse_index_files(value) != 0) {
+            fprintf(stderr, "Invalid value for index-files: '%s' (expected up to %d comma-separated file names)\n",
+                    value, MAX_INDEX_NAMES);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "log-level") == 0) {
+        if (log_parse_level(value, &config.log_level) != 0) {
+            fprintf(stderr, "Invalid value for log-level: '%s' (expected debug, info, warning, error or off)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "access-log") == 0) {
+        // Kept for the life of the process
+        char* copy = malloc(strlen(value) + 1);
+        if (!copy) {
+            return 1;
+        }
+        strcpy(copy, value);
+        config.access_log_path = copy;
+        return 0;
+    }
+
+    if (strcmp(name, "access-log-format") == 0) {
+        if (access_log_parse_format(value, &config.access_log_format) != 0) {
+            fprintf(stderr, "Invalid value for access-log-format: '%s' (expected combined or json)\n", value);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(name, "metrics-path") == 0) {
+        if (value[0] == '\0') {
+            config.metrics_path = NULL;
+            return 0;
+        }
+        if (value[0] != '/') {
+            fprintf(stderr, "Invalid value for metrics-path: '%s' (expected a path starting with /, or \"\")\n", value);
+            return 1;
+        }
+        // Kept for the life of the process
+        char* copy = malloc(strlen(value) + 1);
+        if (!copy) {
+            return 1;
+        }
+        strcpy(copy, value);
+        config.metrics_path = copy;
+        return 0;
+    }
+
+    if (strcmp(name, "template") == 0) {
+        // Kept for the life of the process
+        char* copy = malloc(strlen(value) + 1);
+        if (!copy) {
+            return 1;
+        }
+        strcpy(copy, value);
+        config.template_path = copy;
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown server option: '%s'\n", name);
+    return 1;
+}
+
+void server_config_print_usage(void) {
+    printf("Options:\n");
+    printf("  --workers N                  Worker threads, each with its own listener and event loop (default: %d)\n",
+           DEFAULT_WORKERS);
+    printf("  --io-backend BACKEND         Event loop I/O: epoll, or io_uring where the kernel has it (default: epoll)\n");
+    printf("  --sendfile on|off            Send files with the kernel sendfile where available, off copies with read/write (default: on)\n");
+    printf("  --keepalive-timeout SECONDS  Idle time before a keep-alive connection is closed (default: %d)\n",
+           DEFAULT_KEEPALIVE_TIMEOUT);
+    printf("  --max-requests N             Requests served per connection, 1 disables keep-alive (default: %d)\n",
+           DEFAULT_MAX_REQUESTS);
+    printf("  --max-header-size BYTES      Largest accepted request line plus headers (default: %d)\n",
+           DEFAULT_MAX_HEADER_SIZE);
+    printf("  --max-headers N              Largest accepted number of request headers (default: %d)\n",
+           DEFAULT_MAX_HEADERS);
+    printf("  --file-cache-size N          Open files kept for hot content, 0 disables the cache (default: %d)\n",
+           DEFAULT_FILE_CACHE_SIZE);
+    printf("  --file-cache-ttl SECONDS     Time before a cached file is checked for changes (default: %d)\n",
+           DEFAULT_FILE_CACHE_TTL);
+    printf("  --stat-cache-memory MB       Memory for cached file metadata and listings, 0 disables it (default: %d)\n",
+           DEFAULT_STAT_CACHE_MEMORY);
+    printf("  --listing-cache-memory MB    Memory for rendered directory listings, 0 disables it (default: %d)\n",
+           DEFAULT_LISTING_CACHE_MEMORY);
+    printf("  --listing-stream-threshold N Entries above which a listing is streamed, 0 never streams (default: %d)\n",
+           DEFAULT_LISTING_STREAM_THRESHOLD);
+    printf("  --stat-threads N             Threads examining directory entries in parallel, for slow storage (default: %d)\n",
+           DEFAULT_STAT_THREADS);
+    printf("  --fs-threads N               Threads doing filesystem work that may block, off the event loops (default: %d)\n",
+           DEFAULT_FS_THREADS);
+    printf("  --fs-queue-depth N           Requests that may wait for a filesystem thread before 503s are sent (default: %d)\n",
+           DEFAULT_FS_QUEUE_DEPTH);
+    printf("  --listing-page-size N        Entries per page of a sorted listing, and the most a client may ask for (default: %d)\n",
+           DEFAULT_LISTING_PAGE_SIZE);
+    printf("  --index-files NAMES          Files served instead of a directory's listing, \"\" always lists (default: %s)\n",
+           DEFAULT_INDEX_FILES);
+    printf("  --log-level LEVEL            Lowest level logged: debug, info, warning, error or off (default: info)\n");
+    printf("  --access-log FILE            Append a record of every request to FILE, reopened on SIGHUP (default: none)\n");
+    printf("  --access-log-format FORMAT   Access log records: combined or json (default: combined)\n");
+    printf("  --metrics-path PATH          Path serving metrics in the Prometheus format, \"\" turns them off (default: %s)\n",
+           DEFAULT_METRICS_PATH);
+    printf("  --template FILE              Directory listing template to use instead of the built-in one\n");
+}
@@ -0,0 +1,1193 @@
+#include "stat_cache.h"
+#include "file_cache.h"
+#include "listing_cache.h"
+#include "dir_reader.h"
+#include "utils.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+/**
+ * This file contains the metadata cache. See stat_cache.h.
+ *
+ * Items are either the stat() result for a path or the snapshot of a
+ * directory's entries. Each item pins the inotify watches whose events make
+ * it stale; a watch is removed once nothing pins it. Lookups that miss pin
+ * their watches and note the watch generations before going to the
+ * filesystem, and only publish the result if no event arrived in between,
+ * so a change racing with a lookup can never leave a stale item behind.
+ *
+ * Lock order: the stat cache lock is taken before the file and listing
+ * cache locks.
+ */
+
+/**
+ * @brief A directory entry in a listing snapshot
+ */
+typedef struct {
+    const char* name;  /**< Entry name (points into the snapshot) */
+    int is_dir;        /**< 1 for a directory */
+    size_t size;       /**< Size in bytes */
+    time_t mtime;      /**< Last modification time */
+} snapshot_entry;
+
+/**
+ * @brief The entries of a directory, in one allocation with their names
+ */
+typedef struct {
+    int refcount;              /**< Users, including the owning item */
+    size_t count;              /**< Number of entries */
+    size_t memory;             /**< Size of the allocation, plus the sort orders */
+    uint32_t* order[STAT_CACHE_SORT_COUNT]; /**< Entry indices in ascending order per key, built on demand */
+    snapshot_entry entries[];  /**< Entries, followed by their names */
+} snapshot;
+
+/**
+ * @brief Growing collection of entries while a directory is read
+ */
+typedef struct {
+    snapshot_entry* entries;  /**< Entries with names as offsets into names */
+    size_t count;             /**< Entries collected */
+    size_t capacity;          /**< Allocated entries */
+    char* names;              /**< Entry names, each NUL-terminated */
+    size_t names_size;        /**< Bytes used in names */
+    size_t names_capacity;    /**< Allocated bytes for names */
+    size_t max_memory;        /**< Largest snapshot worth caching */
+    int failed;               /**< Set when an allocation failed */
+    int oversized;            /**< Set when the snapshot outgrew max_memory */
+    int linked;               /**< Set when an entry is a symlink */
+} snapshot_builder;
+
+/**
+ * @brief platform_list_directory callback that collects entries into a builder
+ */
+static int collect_entry(const char* name, int is_dir, size_t size, time_t mtime, void* user_data) {
+    snapshot_builder* builder = (snapshot_builder*)user_data;
+    size_t name_size = strlen(name) + 1;
+
+    if (sizeof(snapshot) + (builder->count + 1) * sizeof(snapshot_entry) +
+        builder->names_size + name_size > builder->max_memory) {
+        builder->oversized = 1;
+        return 1;
+    }
+
+    if (builder->count == builder->capacity) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 64;
+        snapshot_entry* entries = realloc(builder->entries, capacity * sizeof(snapshot_entry));
+        if (!entries) {
+            builder->failed = 1;
+            return 1;
+        }
+        builder->entries = entries;
+        builder->capacity = capacity;
+    }
+    if (builder->names_size + name_size > builder->names_capacity) {
+        size_t capacity = builder->names_capacity ? builder->names_capacity * 2 : 1024;
+        while (capacity < builder->names_size + name_size) {
+            capacity *= 2;
+        }
+        char* names = realloc(builder->names, capacity);
+        if (!names) {
+            builder->failed = 1;
+            return 1;
+        }
+        builder->names = names;
+        builder->names_capacity = capacity;
+    }
+
+    snapshot_entry* entry = &builder->entries[builder->count++];
+    entry->name = (const char*)(uintptr_t)builder->names_size;
+    entry->is_dir = is_dir;
+    entry->size = size;
+    entry->mtime = mtime;
+    memcpy(builder->names + builder->names_size, name, name_size);
+    builder->names_size += name_size;
+    return 0;
+}
+
+/**
+ * @brief Packs collected entries into a single snapshot allocation
+ *
+ * @return A snapshot holding one reference, or NULL on allocation failure
+ */
+static snapshot* pack_snapshot(const snapshot_builder* builder) {
+    size_t entries_size = builder->count * sizeof(snapshot_entry);
+    size_t memory = sizeof(snapshot) + entries_size + builder->names_size;
+    snapshot* listing = malloc(memory);
+    if (!listing) {
+        return NULL;
+    }
+
+    char* names = (char*)listing->entries + entries_size;
+    if (builder->names_size > 0) {
+        memcpy(names, builder->names, builder->names_size);
+    }
+    for (size_t i = 0; i < builder->count; i++) {
+        listing->entries[i] = builder->entries[i];
+        listing->entries[i].name = names + (uintptr_t)builder->entries[i].name;
+    }
+    listing->refcount = 1;
+    listing->count = builder->count;
+    listing->memory = memory;
+    memset(listing->order, 0, sizeof(listing->order));
+    return listing;
+}
+
+/**
+ * @brief Frees a snapshot and its sort orders
+ */
+static void free_snapshot(snapshot* listing) {
+    for (int i = 0; i < STAT_CACHE_SORT_COUNT; i++) {
+        free(listing->order[i]);
+    }
+    free(listing);
+}
+
+/**
+ * @brief Reads a directory into a snapshot that is not cached
+ *
+ * @return A snapshot holding one reference, or NULL on failure
+ */
+static snapshot* read_snapshot(const char* path) {
+    snapshot_builder builder;
+    snapshot* listing = NULL;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.max_memory = (size_t)-1;
+    int result = dir_reader_list_directory(path, collect_entry, &builder);
+    if (result == 0 && !builder.failed) {
+        listing = pack_snapshot(&builder);
+    }
+    free(builder.entries);
+    free(builder.names);
+    if (!listing && result == 0) {
+        LOG_ERROR("Failed to allocate memory for the listing of '%s'\n", path);
+    }
+    return listing;
+}
+
+/**
+ * @brief Orders two entries by a sort key, then by name
+ */
+static int compare_entries(const snapshot_entry* a, const snapshot_entry* b, stat_cache_sort sort) {
+    if (sort == STAT_CACHE_SORT_SIZE && a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    if (sort == STAT_CACHE_SORT_MTIME && a->mtime != b->mtime) {
+        return a->mtime < b->mtime ? -1 : 1;
+    }
+    return strcmp(a->name, b->name);
+}
+
+/**
+ * @brief Builds the ascending order of a snapshot's entries for a sort key
+ *
+ * A bottom-up merge sort of 32-bit entry indices: stable, O(n log n) in
+ * the worst case, and without any per-entry allocation.
+ *
+ * @return A malloc'ed array of listing->count indices, or NULL if out of memory
+ */
+static uint32_t* sort_snapshot(const snapshot* listing, stat_cache_sort sort) {
+    size_t count = listing->count;
+    uint32_t* order = malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t* scratch = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!order || !scratch) {
+        free(order);
+        free(scratch);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i] = (uint32_t)i;
+    }
+
+    uint32_t* from = order;
+    uint32_t* to = scratch;
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t left = 0; left < count; left += 2 * width) {
+            size_t middle = left + width < count ? left + width : count;
+            size_t right = left + 2 * width < count ? left + 2 * width : count;
+            size_t i = left, j = middle, k = left;
+            while (i < middle && j < right) {
+                if (compare_entries(&listing->entries[from[j]], &listing->entries[from[i]], sort) < 0) {
+                    to[k++] = from[j++];
+                } else {
+                    to[k++] = from[i++];
+                }
+            }
+            while (i < middle) to[k++] = from[i++];
+            while (j < right) to[k++] = from[j++];
+        }
+        uint32_t* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    // The result may have ended up in the scratch buffer
+    free(to);
+    return from;
+}
+
+/**
+ * @brief Hands out a page of a snapshot's entries in sorted order
+ */
+static void list_page(const snapshot* listing, const uint32_t* order, int descending, size_t offset,
+                      size_t limit, dir_entry_callback callback, void* user_data) {
+    for (size_t n = offset; n < listing->count && (limit == 0 || n - offset < limit); n++) {
+        size_t position = descending ? listing->count - 1 - n : n;
+        const snapshot_entry* entry = &listing->entries[order[position]];
+        if (callback(entry->name, entry->is_dir, entry->size, entry->mtime, user_data) != 0) {
+            break;
+        }
+    }
+}
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+
+// Events that can change what a stat() or a listing of the directory returns
+#define WATCH_MASK (IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                    IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+// Buckets in each of the two watch tables (by descriptor and by path)
+#define WATCH_BUCKETS 1024
+
+// Room for a batch of events read by the watcher thread
+#define EVENT_BUFFER_SIZE 65536
+
+/**
+ * @brief An inotify watch on a directory
+ */
+typedef struct watch {
+    int wd;                    /**< Watch descriptor */
+    char* path;                /**< Directory path, as used in item keys */
+    unsigned long generation;  /**< Bumped by every event under the watch */
+    int refs;                  /**< Items and lookups in progress that pin the watch */
+    int active;                /**< 1 while in the tables and watched by the kernel */
+    struct watch* wd_next;     /**< Next watch in the descriptor bucket */
+    struct watch* path_next;   /**< Next watch in the path bucket */
+} watch;
+
+enum {
+    ITEM_STAT,     /**< stat() result for a path */
+    ITEM_LISTING   /**< Snapshot of a directory's entries */
+};
+
+/**
+ * @brief A cached stat() result or directory snapshot
+ */
+typedef struct item {
+    char* path;               /**< Key, together with kind */
+    int kind;                 /**< ITEM_STAT or ITEM_LISTING */
+    int error;                /**< ITEM_STAT: errno of a failed stat(), 0 on success */
+    struct stat st;           /**< ITEM_STAT: the metadata */
+    snapshot* listing;        /**< ITEM_LISTING: the entries */
+    watch* watches[2];        /**< Pinned watches (the second one can be NULL) */
+    size_t memory;            /**< Bytes accounted to the item */
+    struct item* hash_next;   /**< Next item in the hash bucket */
+    struct item* lru_prev;    /**< More recently used item */
+    struct item* lru_next;    /**< Less recently used item */
+} item;
+
+/**
+ * @brief Global cache state, protected by lock
+ */
+static struct {
+    platform_mutex* lock;             /**< Protects everything below */
+    int inotify_fd;                   /**< inotify instance read by the watcher thread */
+    item** buckets;                   /**< Hash table of items */
+    size_t bucket_count;              /**< Number of buckets (a power of two) */
+    size_t max_memory;                /**< Memory limit (0 when caching is disabled) */
+    item* lru_head;                   /**< Most recently used item */
+    item* lru_tail;                   /**< Least recently used item */
+    watch* watch_by_wd[WATCH_BUCKETS];    /**< Active watches by descriptor */
+    watch* watch_by_path[WATCH_BUCKETS];  /**< Active watches by path */
+    stat_cache_stats stats;           /**< Counters */
+} cache;
+
+/**
+ * @brief FNV-1a hash of an item key
+ */
+static size_t hash_key(int kind, const char* path) {
+    size_t hash = (size_t)2166136261u ^ (size_t)kind;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Builds the key for a path: normalized, without trailing separators
+ *
+ * @param path The path as given by the caller
+ * @param key Receives the key (PATH_MAX bytes)
+ * @param trailing Receives 1 if the path ended in a separator
+ * @return 0 on success, non-zero if the path is too long to cache
+ */
+static int make_key(const char* path, char* key, int* trailing) {
+    size_t length = strlen(path);
+    if (length == 0 || length >= PATH_MAX) {
+        return 1;
+    }
+    memcpy(key, path, length + 1);
+    normalize_path(key);
+
+    length = strlen(key);
+    *trailing = 0;
+    while (length > 1 && key[length - 1] == '/') {
+        key[--length] = '\0';
+        *trailing = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the directory part of a key ("." for a bare name)
+ */
+static void parent_of(const char* key, char* parent) {
+    const char* slash = strrchr(key, '/');
+    if (!slash) {
+        strcpy(parent, ".");
+    } else if (slash == key) {
+        strcpy(parent, "/");
+    } else {
+        memcpy(parent, key, (size_t)(slash - key));
+        parent[slash - key] = '\0';
+    }
+}
+
+/**
+ * @brief Checks whether a path is a prefix directory of another ("/a" of "/a/b")
+ */
+static int is_under(const char* path, const char* dir, size_t dir_length) {
+    if (dir_length == 1 && dir[0] == '/') {
+        return path[0] == '/' && path[1] != '\0';
+    }
+    return strncmp(path, dir, dir_length) == 0 && path[dir_length] == '/';
+}
+
+/**
+ * @brief Removes a watch from the tables and from the kernel (lock held)
+ *
+ * The watch stays allocated while something still pins it; its generation
+ * is bumped so lookups in progress do not publish their results.
+ */
+static void deactivate_watch(watch* w, int remove_from_kernel) {
+    if (!w->active) {
+        return;
+    }
+
+    watch** link = &cache.watch_by_wd[(unsigned)w->wd % WATCH_BUCKETS];
+    while (*link != w) {
+        link = &(*link)->wd_next;
+    }
+    *link = w->wd_next;
+
+    link = &cache.watch_by_path[hash_key(0, w->path) % WATCH_BUCKETS];
+    while (*link != w) {
+        link = &(*link)->path_next;
+    }
+    *link = w->path_next;
+
+    if (remove_from_kernel) {
+        inotify_rm_watch(cache.inotify_fd, w->wd);
+    }
+    w->active = 0;
+    w->generation++;
+    cache.stats.watches--;
+    cache.stats.memory -= sizeof(watch) + strlen(w->path) + 1;
+}
+
+/**
+ * @brief Drops a pin on a watch, removing the watch when it was the last one (lock held)
+ */
+static void unpin_watch(watch* w) {
+    if (!w || --w->refs > 0) {
+        return;
+    }
+    deactivate_watch(w, 1);
+    free(w->path);
+    free(w);
+}
+
+/**
+ * @brief Pins the watch on a directory, adding it if needed (lock held)
+ *
+ * @return The pinned watch, or NULL if the directory cannot be watched
+ */
+static watch* pin_watch(const char* dir) {
+    size_t path_bucket = hash_key(0, dir) % WATCH_BUCKETS;
+    watch* w;
+    for (w = cache.watch_by_path[path_bucket]; w; w = w->path_next) {
+        if (strcmp(w->path, dir) == 0) {
+            w->refs++;
+            return w;
+        }
+    }
+
+    int wd = inotify_add_watch(cache.inotify_fd, dir, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            LOG_WARNING("inotify watch limit reached, not caching metadata under '%s'\n", dir);
+        }
+        return NULL;
+    }
+
+    size_t wd_bucket = (unsigned)wd % WATCH_BUCKETS;
+    for (w = cache.watch_by_wd[wd_bucket]; w; w = w->wd_next) {
+        if (w->wd == wd) {
+            // The same directory under another path (a symlink): events
+            // could only be mapped to one of them, so cache neither
+            return NULL;
+        }
+    }
+
+    w = calloc(1, sizeof(watch));
+    if (w) {
+        w->path = malloc(strlen(dir) + 1);
+    }
+    if (!w || !w->path) {
+        free(w);
+        inotify_rm_watch(cache.inotify_fd, wd);
+        return NULL;
+    }
+    strcpy(w->path, dir);
+    w->wd = wd;
+    w->refs = 1;
+    w->active = 1;
+    w->wd_next = cache.watch_by_wd[wd_bucket];
+    cache.watch_by_wd[wd_bucket] = w;
+    w->path_next = cache.watch_by_path[path_bucket];
+    cache.watch_by_path[path_bucket] = w;
+    cache.stats.watches++;
+    cache.stats.memory += sizeof(watch) + strlen(dir) + 1;
+    return w;
+}
+
+/**
+ * @brief Drops a reference to a snapshot (lock held)
+ */
+static void release_snapshot(snapshot* listing) {
+    if (--listing->refcount == 0) {
+        free_snapshot(listing);
+    }
+}
+
+/**
+ * @brief Finds a cached item (lock held)
+ */
+static item* find_item(int kind, const char* key) {
+    item* it = cache.buckets[hash_key(kind, key) & (cache.bucket_count - 1)];
+    while (it && (it->kind != kind || strcmp(it->path, key) != 0)) {
+        it = it->hash_next;
+    }
+    return it;
+}
+
+/**
+ * @brief Unlinks an item from the LRU list (lock held)
+ */
+static void lru_unlink(item* it) {
+    if (it->lru_prev) {
+        it->lru_prev->lru_next = it->lru_next;
+    } else {
+        cache.lru_head = it->lru_next;
+    }
+    if (it->lru_next) {
+        it->lru_next->lru_prev = it->lru_prev;
+    } else {
+        cache.lru_tail = it->lru_prev;
+    }
+    it->lru_prev = NULL;
+    it->lru_next = NULL;
+}
+
+/**
+ * @brief Puts an item at the front of the LRU list (lock held)
+ */
+static void lru_push_front(item* it) {
+    it->lru_prev = NULL;
+    it->lru_next = cache.lru_head;
+    if (cache.lru_head) {
+        cache.lru_head->lru_prev = it;
+    } else {
+        cache.lru_tail = it;
+    }
+    cache.lru_head = it;
+}
+
+/**
+ * @brief Removes an item from the cache and frees it (lock held)
+ */
+static void remove_item(item* it) {
+    item** link = &cache.buckets[hash_key(it->kind, it->path) & (cache.bucket_count - 1)];
+    while (*link != it) {
+        link = &(*link)->hash_next;
+    }
+    *link = it->hash_next;
+    lru_unlink(it);
+
+    cache.stats.entries--;
+    cache.stats.memory -= it->memory;
+    if (it->listing) {
+        // Rendered listings of the directory are only trusted while its
+        // snapshot is cached (see stat_cache_is_watched())
+        release_snapshot(it->listing);
+        listing_cache_invalidate(it->path);
+    }
+    unpin_watch(it->watches[0]);
+    unpin_watch(it->watches[1]);
+    free(it->path);
+    free(it);
+}
+
+/**
+ * @brief Drops the item for a key, if cached (lock held)
+ */
+static void invalidate_item(int kind, const char* key) {
+    item* it = find_item(kind, key);
+    if (it) {
+        cache.stats.invalidations++;
+        remove_item(it);
+    }
+}
+
+/**
+ * @brief Drops everything at or below a directory: items, watches and open files (lock held)
+ *
+ * Used when a directory is removed or renamed, which changes every path under it.
+ */
+static void invalidate_tree(const char* dir) {
+    size_t length = strlen(dir);
+    item* it = cache.lru_head;
+    while (it) {
+        item* next = it->lru_next;
+        if (strcmp(it->path, dir) == 0 || is_under(it->path, dir, length)) {
+            // Removing an item can free watches, but never other items
+            cache.stats.invalidations++;
+            remove_item(it);
+        }
+        it = next;
+    }
+
+    for (size_t i = 0; i < WATCH_BUCKETS; i++) {
+        watch* w = cache.watch_by_wd[i];
+        while (w) {
+            watch* next = w->wd_next;
+            if (strcmp(w->path, dir) == 0 || is_under(w->path, dir, length)) {
+                deactivate_watch(w, 1);
+            }
+            w = next;
+        }
+    }
+
+    char prefix[PATH_MAX + 1];
+    snprintf(prefix, sizeof(prefix), "%s/", strcmp(dir, "/") == 0 ? "" : dir);
+    file_cache_invalidate_prefix(prefix);
+    listing_cache_invalidate(dir);
+}
+
+/**
+ * @brief Applies one change event (lock held)
+ */
+static void handle_event(const struct inotify_event* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost: nothing cached can be trusted any more
+        LOG_WARNING("inotify queue overflow, dropping the metadata cache\n");
+        while (cache.lru_head) {
+            cache.stats.invalidations++;
+            remove_item(cache.lru_head);
+        }
+        for (size_t i = 0; i < WATCH_BUCKETS; i++) {
+            for (watch* w = cache.watch_by_wd[i]; w; w = w->wd_next) {
+                w->generation++;
+            }
+        }
+        file_cache_invalidate_prefix("");
+        listing_cache_clear();
+        return;
+    }
+
+    watch* w = cache.watch_by_wd[(unsigned)event->wd % WATCH_BUCKETS];
+    while (w && w->wd != event->wd) {
+        w = w->wd_next;
+    }
+    if (!w) {
+        // A watch that was already removed
+        return;
+    }
+    // Dropping the items below can release the last other pin
+    w->refs++;
+    w->generation++;
+
+    if (event->len > 0) {
+        char child[PATH_MAX];
+        int length = snprintf(child, sizeof(child), "%s%s%s", w->path,
+                              strcmp(w->path, "/") == 0 ? "" : "/", event->name);
+        if (length > 0 && (size_t)length < sizeof(child)) {
+            item* it = find_item(ITEM_STAT, child);
+            int was_directory = (event->mask & IN_ISDIR) ||
+                                (it && it->error == 0 && S_ISDIR(it->st.st_mode));
+
+            if (was_directory && (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+                // Everything below the name now refers to something else
+                invalidate_tree(child);
+            } else {
+                invalidate_item(ITEM_STAT, child);
+                file_cache_invalidate(child);
+            }
+        }
+    }
+
+    // The directory's own mtime and its listing change with its entries,
+    // and so does the line for it in its parent's listing
+    invalidate_item(ITEM_STAT, w->path);
+    invalidate_item(ITEM_LISTING, w->path);
+    listing_cache_invalidate(w->path);
+    if (event->len > 0 && (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+        char parent[PATH_MAX];
+        parent_of(w->path, parent);
+        invalidate_item(ITEM_LISTING, parent);
+        listing_cache_invalidate(parent);
+    }
+
+    if (event->mask & IN_IGNORED) {
+        // The kernel removed the watch: nothing under it can be trusted
+        deactivate_watch(w, 0);
+        invalidate_tree(w->path);
+    } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)) {
+        invalidate_tree(w->path);
+    }
+    unpin_watch(w);
+}
+
+/**
+ * @brief Watcher thread: reads change events and applies them
+ */
+static void watch_thread(void* arg) {
+    (void)arg;
+    // Aligned for struct inotify_event
+    static long buffer[EVENT_BUFFER_SIZE / sizeof(long)];
+
+    for (;;) {
+        ssize_t length = read(cache.inotify_fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Reading inotify events failed: %s\n", strerror(errno));
+            return;
+        }
+
+        platform_mutex_lock(cache.lock);
+        const char* p = (const char*)buffer;
+        while (p < (const char*)buffer + length) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            handle_event(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        platform_mutex_unlock(cache.lock);
+    }
+}
+
+int stat_cache_init(size_t max_memory) {
+    cache.max_memory = 0;
+    if (max_memory == 0) {
+        return 0;
+    }
+
+    cache.inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (cache.inotify_fd < 0) {
+        LOG_WARNING("inotify unavailable (%s), metadata cache disabled\n", strerror(errno));
+        return 0;
+    }
+
+    cache.lock = platform_mutex_create();
+    if (!cache.lock) {
+        close(cache.inotify_fd);
+        return 1;
+    }
+
+    // Roughly one bucket per typical small item
+    cache.bucket_count = 1024;
+    while (cache.bucket_count < max_memory / 256 && cache.bucket_count < ((size_t)1 << 20)) {
+        cache.bucket_count *= 2;
+    }
+    cache.buckets = calloc(cache.bucket_count, sizeof(item*));
+    if (!cache.buckets) {
+        platform_mutex_destroy(cache.lock);
+        close(cache.inotify_fd);
+        return 1;
+    }
+
+    if (platform_thread_create(watch_thread, NULL) != 0) {
+        free(cache.buckets);
+        platform_mutex_destroy(cache.lock);
+        close(cache.inotify_fd);
+        return 1;
+    }
+
+    cache.max_memory = max_memory;
+    return 0;
+}
+
+/**
+ * @brief Frees an item that was never published, dropping its pins (lock held)
+ */
+static void discard_item(item* it) {
+    unpin_watch(it->watches[0]);
+    unpin_watch(it->watches[1]);
+    free(it->path);
+    free(it);
+}
+
+/**
+ * @brief Publishes a new item if its watches saw no event since the lookup began (lock held)
+ *
+ * Takes over the item in every case; discards it if it is not published.
+ * A snapshot attached to a discarded item keeps the reference it was given.
+ *
+ * @param generations Watch generations noted before going to the filesystem
+ * @return 1 if the item was published
+ */
+static int publish_item(item* it, const unsigned long* generations) {
+    for (int i = 0; i < 2; i++) {
+        watch* w = it->watches[i];
+        if ((w && (!w->active || w->generation != generations[i])) ||
+            it->memory > cache.max_memory) {
+            discard_item(it);
+            return 0;
+        }
+    }
+
+    // Another thread may have published the same key in the meantime
+    item* existing = find_item(it->kind, it->path);
+    if (existing) {
+        remove_item(existing);
+    }
+
+    while (cache.stats.memory + it->memory > cache.max_memory && cache.lru_tail) {
+        cache.stats.evictions++;
+        remove_item(cache.lru_tail);
+    }
+
+    size_t bucket = hash_key(it->kind, it->path) & (cache.bucket_count - 1);
+    it->hash_next = cache.buckets[bucket];
+    cache.buckets[bucket] = it;
+    lru_push_front(it);
+    cache.stats.entries++;
+    cache.stats.memory += it->memory;
+    return 1;
+}
+
+/**
+ * @brief Allocates an item for a key and pins its watches (lock held)
+ *
+ * @param watch_dir Directory whose watch must be pinned
+ * @param optional_dir Directory whose watch is pinned if it can be (or NULL)
+ * @param generations Receives the generations of the pinned watches
+ * @return The item, or NULL if it cannot be cached
+ */
+static item* begin_item(int kind, const char* key, const char* watch_dir,
+                        const char* optional_dir, unsigned long* generations) {
+    item* it = calloc(1, sizeof(item));
+    if (!it) {
+        return NULL;
+    }
+    it->path = malloc(strlen(key) + 1);
+    it->watches[0] = it->path ? pin_watch(watch_dir) : NULL;
+    if (!it->watches[0]) {
+        free(it->path);
+        free(it);
+        return NULL;
+    }
+    strcpy(it->path, key);
+    it->kind = kind;
+    it->memory = sizeof(item) + strlen(key) + 1;
+    generations[0] = it->watches[0]->generation;
+
+    if (optional_dir) {
+        it->watches[1] = pin_watch(optional_dir);
+        if (it->watches[1]) {
+            generations[1] = it->watches[1]->generation;
+        }
+    }
+    return it;
+}
+
+/**
+ * @brief Reads a cached stat result (called with the lock held)
+ *
+ * @param it The item
+ * @param st Receives the metadata
+ * @return The item's error, 0 if the path exists
+ */
+static int read_stat_item(item* it, struct stat* st) {
+    *st = it->st;
+    lru_unlink(it);
+    lru_push_front(it);
+    cache.stats.hits++;
+    return it->error;
+}
+
+/**
+ * @brief Turns the error of a lookup into stat()'s result
+ *
+ * @param error The error, 0 if the path exists
+ * @param trailing Whether the path had a trailing separator
+ * @param st The metadata (if the path exists)
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int stat_result(int error, int trailing, const struct stat* st) {
+    if (error == 0 && trailing && !S_ISDIR(st->st_mode)) {
+        error = ENOTDIR;
+    }
+    errno = error;
+    return error == 0 ? 0 : -1;
+}
+
+int stat_cache_stat(const char* path, struct stat* st) {
+    char key[PATH_MAX];
+    int trailing;
+
+    if (cache.max_memory == 0 || make_key(path, key, &trailing) != 0) {
+        return stat(path, st) == 0 ? 0 : -1;
+    }
+
+    platform_mutex_lock(cache.lock);
+    item* it = find_item(ITEM_STAT, key);
+    if (it) {
+        int error = read_stat_item(it, st);
+        platform_mutex_unlock(cache.lock);
+        return stat_result(error, trailing, st);
+    }
+
+    // A directory's mtime changes with its entries, which only its own
+    // watch reports, so try to watch the path itself too (this fails
+    // cheaply for anything but a directory)
+    char parent[PATH_MAX];
+    unsigned long generations[2] = {0, 0};
+    parent_of(key, parent);
+    int is_own_parent = strcmp(key, parent) == 0;
+    it = begin_item(ITEM_STAT, key, parent, is_own_parent ? NULL : key, generations);
+    cache.stats.misses++;
+    platform_mutex_unlock(cache.lock);
+
+    // Look at the filesystem without holding the lock. A symlink is
+    // followed, but its target can change without an event under either
+    // watch, so it is not cached
+    int result = lstat(key, st);
+    int is_link = result == 0 && S_ISLNK(st->st_mode);
+    if (is_link) {
+        result = stat(key, st);
+    }
+    int error = result == 0 ? 0 : errno;
+
+    if (it) {
+        it->error = error;
+        if (result == 0) {
+            it->st = *st;
+        }
+
+        int is_dir = result == 0 && S_ISDIR(st->st_mode);
+        platform_mutex_lock(cache.lock);
+        if (is_link || (!is_own_parent && is_dir != (it->watches[1] != NULL))) {
+            // A symlink, a directory that cannot be watched, or the path
+            // changed type
+            discard_item(it);
+        } else {
+            publish_item(it, generations);
+        }
+        platform_mutex_unlock(cache.lock);
+    }
+    return stat_result(error, trailing, st);
+}
+
+int stat_cache_lookup(const char* path, struct stat* st) {
+    char key[PATH_MAX];
+    int trailing;
+
+    if (cache.max_memory == 0 || make_key(path, key, &trailing) != 0) {
+        return 1;
+    }
+
+    platform_mutex_lock(cache.lock);
+    item* it = find_item(ITEM_STAT, key);
+    if (!it) {
+        platform_mutex_unlock(cache.lock);
+        return 1;
+    }
+    int error = read_stat_item(it, st);
+    platform_mutex_unlock(cache.lock);
+    return stat_result(error, trailing, st);
+}
+
+int stat_cache_is_watched(const char* path) {
+    char key[PATH_MAX];
+    int trailing;
+
+    if (cache.max_memory == 0 || make_key(path, key, &trailing) != 0) {
+        return 0;
+    }
+
+    platform_mutex_lock(cache.lock);
+    int watched = find_item(ITEM_LISTING, key) != NULL;
+    platform_mutex_unlock(cache.lock);
+    return watched;
+}
+
+/**
+ * @brief Reads a directory's entries into a builder, noting symlinks
+ *
+ * @return 0 on success, non-zero on failure
+ */
+static int read_entries(const char* path, snapshot_builder* builder) {
+    platform_dir_entry entry;
+    dir_reader* reader = dir_reader_open(path);
+    if (!reader) {
+        return 1;
+    }
+    while (dir_reader_read(reader, &entry) > 0) {
+        if (entry.is_link) {
+            builder->linked = 1;
+        }
+        if (collect_entry(entry.name, entry.is_dir, entry.size, entry.mtime, builder) != 0) {
+            break;
+        }
+    }
+    dir_reader_close(reader);
+    return 0;
+}
+
+/**
+ * @brief Gets the snapshot of a directory, from the cache or read and cached now
+ *
+ * @param key The directory's key
+ * @param oversized Set to 1 if the directory is too large to cache (NULL is returned then)
+ * @return A referenced snapshot (release with the lock held; it may not be
+ *         cached), or NULL on failure
+ */
+static snapshot* acquire_snapshot(const char* key, int* oversized) {
+    *oversized = 0;
+
+    platform_mutex_lock(cache.lock);
+    snapshot* listing = NULL;
+    item* it = find_item(ITEM_LISTING, key);
+    if (it) {
+        listing = it->listing;
+        listing->refcount++;
+        lru_unlink(it);
+        lru_push_front(it);
+        cache.stats.hits++;
+        platform_mutex_unlock(cache.lock);
+        return listing;
+    }
+
+    unsigned long generations[2] = {0, 0};
+    it = begin_item(ITEM_LISTING, key, key, NULL, generations);
+    cache.stats.misses++;
+    platform_mutex_unlock(cache.lock);
+
+    // Read the directory without holding the lock
+    snapshot_builder builder;
+    memset(&builder, 0, sizeof(builder));
+    // One huge directory must not flush the whole cache (nor be held in
+    // memory just to be handed out once)
+    builder.max_memory = cache.max_memory / 8;
+    int result = read_entries(key, &builder);
+    if (result == 0 && !builder.failed && !builder.oversized) {
+        listing = pack_snapshot(&builder);
+    }
+    free(builder.entries);
+    free(builder.names);
+
+    // The size and mtime listed for a symlink are its target's, which can
+    // change without an event on this directory: such a snapshot is only
+    // handed to this caller
+    platform_mutex_lock(cache.lock);
+    if (it && listing && !builder.linked) {
+        it->listing = listing;
+        it->memory += listing->memory;
+        if (publish_item(it, generations)) {
+            listing->refcount++;
+        }
+    } else if (it) {
+        discard_item(it);
+    }
+    platform_mutex_unlock(cache.lock);
+
+    if (builder.linked && listing) {
+        LOG_DEBUG("Listing of '%s' has symlinks, not cached\n", key);
+    } else if (builder.oversized) {
+        LOG_DEBUG("Listing of '%s' is too large to cache\n", key);
+        *oversized = 1;
+    } else if (!listing && result == 0) {
+        LOG_ERROR("Failed to allocate memory for the listing of '%s'\n", key);
+    }
+    return listing;
+}
+
+int stat_cache_list_directory(const char* path, dir_entry_callback callback, void* user_data) {
+    char key[PATH_MAX];
+    int trailing;
+    int oversized;
+
+    if (cache.max_memory == 0 || make_key(path, key, &trailing) != 0) {
+        return dir_reader_list_directory(path, callback, user_data);
+    }
+
+    snapshot* listing = acquire_snapshot(key, &oversized);
+    if (!listing) {
+        // Too big to cache: list it straight from the filesystem
+        return oversized ? dir_reader_list_directory(key, callback, user_data) : 1;
+    }
+
+    // Hand out the entries without holding the lock; the reference keeps
+    // the snapshot alive even if it is invalidated meanwhile
+    for (size_t i = 0; i < listing->count; i++) {
+        const snapshot_entry* entry = &listing->entries[i];
+        if (callback(entry->name, entry->is_dir, entry->size, entry->mtime, user_data) != 0) {
+            break;
+        }
+    }
+
+    platform_mutex_lock(cache.lock);
+    release_snapshot(listing);
+    platform_mutex_unlock(cache.lock);
+    return 0;
+}
+
+int stat_cache_list_sorted(const char* path, stat_cache_sort sort, int descending, size_t offset,
+                           size_t limit, dir_entry_callback callback, void* user_data, size_t* total) {
+    char key[PATH_MAX];
+    int trailing;
+    int oversized = 1;
+    snapshot* listing = NULL;
+
+    if (cache.max_memory > 0 && make_key(path, key, &trailing) == 0) {
+        listing = acquire_snapshot(key, &oversized);
+    }
+    if (!listing) {
+        if (!oversized) {
+            return 1;
+        }
+        // Not cached: sort a snapshot of our own, freed when done
+        listing = read_snapshot(path);
+        if (!listing) {
+            return 1;
+        }
+        listing->order[sort] = sort_snapshot(listing, sort);
+        if (listing->order[sort]) {
+            *total = listing->count;
+            list_page(listing, listing->order[sort], descending, offset, limit, callback, user_data);
+        }
+        int failed = listing->order[sort] == NULL;
+        free_snapshot(listing);
+        return failed;
+    }
+
+    platform_mutex_lock(cache.lock);
+    uint32_t* order = listing->order[sort];
+    platform_mutex_unlock(cache.lock);
+
+    if (!order) {
+        // Sort without holding the lock; another thread may be sorting too,
+        // and the first order attached wins
+        order = sort_snapshot(listing, sort);
+        platform_mutex_lock(cache.lock);
+        if (listing->order[sort]) {
+            free(order);
+            order = listing->order[sort];
+        } else if (order) {
+            size_t memory = listing->count * sizeof(uint32_t);
+            listing->order[sort] = order;
+            listing->memory += memory;
+            item* it = find_item(ITEM_LISTING, key);
+            if (it && it->listing == listing) {
+                it->memory += memory;
+                cache.stats.memory += memory;
+            }
+        }
+        platform_mutex_unlock(cache.lock);
+    }
+
+    if (order) {
+        *total = listing->count;
+        list_page(listing, order, descending, offset, limit, callback, user_data);
+    }
+
+    platform_mutex_lock(cache.lock);
+    release_snapshot(listing);
+    platform_mutex_unlock(cache.lock);
+    return order ? 0 : 1;
+}
+
+void stat_cache_get_stats(stat_cache_stats* stats) {
+    if (cache.max_memory == 0) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    platform_mutex_lock(cache.lock);
+    *stats = cache.stats;
+    platform_mutex_unlock(cache.lock);
+}
+
+#else /* !__linux__ */
+
+// Without inotify the cache could not notice changes, so it stays disabled
+// and every lookup goes to the filesystem
+
+int stat_cache_init(size_t max_memory) {
+    if (max_memory > 0) {
+        LOG_DEBUG("Metadata cache needs inotify, disabled on this platform\n");
+    }
+    return 0;
+}
+
+int stat_cache_stat(const char* path, struct stat* st) {
+    return stat(path, st) == 0 ? 0 : -1;
+}
+
+int stat_cache_lookup(const char* path, struct stat* st) {
+    (void)path;
+    (void)st;
+    return 1;
+}
+
+int stat_cache_is_watched(const char* path) {
+    (void)path;
+    return 0;
+}
+
+int stat_cache_list_directory(const char* path, dir_entry_callback callback, void* user_data) {
+    return dir_reader_list_directory(path, callback, user_data);
+}
+
+int stat_cache_list_sorted(const char* path, stat_cache_sort sort, int descending, size_t offset,
+                           size_t limit, dir_entry_callback callback, void* user_data, size_t* total) {
+    snapshot* listing = read_snapshot(path);
+    if (!listing) {
+        return 1;
+    }
+    uint32_t* order = sort_snapshot(listing, sort);
+    if (order) {
+        *total = listing->count;
+        list_page(listing, order, descending, offset, limit, callback, user_data);
+    }
+    int failed = order == NULL;
+    free(order);
+    free_snapshot(listing);
+    return failed;
+}
+
+void stat_cache_get_stats(stat_cache_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif /* __linux__ */
@@ -1,4 +1,5 @@
 #include "httpfileserv.h"
+#include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,7 +16,7 @@
 char* load_template(const char* template_path) {
     FILE* file = fopen(template_path, "rb");
     if (!file) {
-        printf("[ERROR] Failed to open template file: %s\n", template_path);
+        LOG_ERROR("Failed to open template file: %s\n", template_path);
         return NULL;
     }
     
@@ -25,7 +26,7 @@ char* load_template(const char* template_path) {
     fseek(file, 0, SEEK_SET);
     
     if (file_size <= 0) {
-        printf("[ERROR] Empty or invalid template file: %s\n", template_path);
+        LOG_ERROR("Empty or invalid template file: %s\n", template_path);
         fclose(file);
         return NULL;
     }
@@ -33,7 +34,7 @@ char* load_template(const char* template_path) {
     // Allocate buffer for the entire file content plus null terminator
     char* buffer = (char*)malloc(file_size + 1);
     if (!buffer) {
-        printf("[ERROR] Failed to allocate memory for template\n");
+        LOG_ERROR("Failed to allocate memory for template\n");
         fclose(file);
         return NULL;
     }
@@ -43,7 +44,7 @@ char* load_template(const char* template_path) {
     fclose(file);
     
     if (bytes_read != (size_t)file_size) {
-        printf("[ERROR] Failed to read template file: %s\n", template_path);
+        LOG_ERROR("Failed to read template file: %s\n", template_path);
         free(buffer);
         return NULL;
     }
@@ -54,96 +55,206 @@ char* load_template(const char* template_path) {
     return buffer;
 }
 
+/* The default template, embedded at build time by tools/bin2c */
+extern const char directory_template_html[];
+
+/* Link to the parent directory, for every listing but the root's */
+static const char parent_directory_link[] =
+    "<div class=\"parent\"><a href=\"..\"><span class=\"icon\">⬆️</span> Parent Directory</a></div>";
+
+/* Placeholder names, indexed by template_slot */
+static const char* const slot_names[TEMPLATE_SLOT_COUNT] = {
+    "{{DIRECTORY_PATH}}",
+    "{{DIRECTORY_ENTRIES}}",
+    "{{PARENT_DIRECTORY_LINK}}"
+};
+
+/**
+ * @brief A piece of the compiled template: literal text or a placeholder slot
+ */
+typedef struct {
+    const char* text;  /**< Literal text (points into the template source) */
+    size_t length;     /**< Length of the literal text */
+    int slot;          /**< template_slot to substitute, or -1 for literal text */
+} template_segment;
+
+/**
+ * @brief The compiled template, built once at startup and read-only afterwards
+ */
+static struct {
+    char* source;                            /**< Template text (owned for an override file) */
+    template_segment* segments;              /**< Literal and placeholder segments in order */
+    size_t count;                            /**< Number of segments */
+    size_t literal_length;                   /**< Total length of the literal segments */
+    size_t slot_uses[TEMPLATE_SLOT_COUNT];   /**< Occurrences of each placeholder */
+} compiled;
+
 /**
- * @brief Replace all occurrences of a placeholder in a string with replacement text
+ * @brief Finds the placeholder at a position, if any
  *
- * @param str The string containing the placeholder
- * @param placeholder The placeholder to replace
- * @param replacement The text to replace the placeholder with
- * @return A new dynamically allocated string with all replacements made
+ * @return The slot, or -1 if no known placeholder starts here
  */
-static char* replace_placeholder(const char* str, const char* placeholder, const char* replacement) {
-    // Find first occurrence to check if placeholder exists
-    const char* pos = strstr(str, placeholder);
-    if (!pos) {
-        return strdup(str); // No placeholder found, duplicate the original string
+static int match_slot(const char* text) {
+    for (int slot = 0; slot < TEMPLATE_SLOT_COUNT; slot++) {
+        size_t length = strlen(slot_names[slot]);
+        if (strncmp(text, slot_names[slot], length) == 0) {
+            return slot;
+        }
     }
-    
-    size_t placeholder_len = strlen(placeholder);
-    size_t replacement_len = strlen(replacement);
-    size_t str_len = strlen(str);
-    
-    // Count occurrences to calculate new size
-    int count = 0;
-    const char* temp = str;
-    while ((temp = strstr(temp, placeholder)) != NULL) {
+    return -1;
+}
+
+/**
+ * @brief Splits a template into literal segments and placeholder slots
+ *
+ * Unknown "{{...}}" sequences stay part of the literal text.
+ *
+ * @param source The template text (must stay valid while the template is used)
+ * @return 0 on success, non-zero if out of memory
+ */
+static int compile_template(const char* source) {
+    // Every placeholder adds at most two segments
+    size_t capacity = 1;
+    for (const char* p = strstr(source, "{{"); p; p = strstr(p + 2, "{{")) {
+        capacity += 2;
+    }
+    template_segment* segments = malloc(capacity * sizeof(template_segment));
+    if (!segments) {
+        return 1;
+    }
+
+    size_t count = 0;
+    size_t literal_length = 0;
+    size_t slot_uses[TEMPLATE_SLOT_COUNT] = {0};
+    const char* literal = source;
+    const char* p = source;
+    while ((p = strstr(p, "{{")) != NULL) {
+        int slot = match_slot(p);
+        if (slot < 0) {
+            p += 2;
+            continue;
+        }
+        if (p > literal) {
+            segments[count].text = literal;
+            segments[count].length = (size_t)(p - literal);
+            segments[count].slot = -1;
+            literal_length += segments[count].length;
+            count++;
+        }
+        segments[count].text = NULL;
+        segments[count].length = 0;
+        segments[count].slot = slot;
         count++;
-        temp += placeholder_len;
+        slot_uses[slot]++;
+        p += strlen(slot_names[slot]);
+        literal = p;
     }
-    
-    // Calculate the size of the new string
-    size_t new_len = str_len + count * (replacement_len - placeholder_len);
-    char* result = (char*)malloc(new_len + 1); // +1 for null terminator
-    if (!result) {
-        return NULL;
+    if (*literal) {
+        segments[count].text = literal;
+        segments[count].length = strlen(literal);
+        segments[count].slot = -1;
+        literal_length += segments[count].length;
+        count++;
     }
-    
-    // Copy with replacements
-    const char* src = str;
-    char* dest = result;
-    
-    while ((pos = strstr(src, placeholder)) != NULL) {
-        // Copy part before placeholder
-        size_t prefix_len = pos - src;
-        memcpy(dest, src, prefix_len);
-        dest += prefix_len;
-        
-        // Copy replacement
-        memcpy(dest, replacement, replacement_len);
-        dest += replacement_len;
-        
-        // Move source pointer past placeholder
-        src = pos + placeholder_len;
+
+    free(compiled.segments);
+    compiled.segments = segments;
+    compiled.count = count;
+    compiled.literal_length = literal_length;
+    memcpy(compiled.slot_uses, slot_uses, sizeof(slot_uses));
+    return 0;
+}
+
+int template_init(const char* template_path) {
+    const char* source = directory_template_html;
+    char* loaded = NULL;
+
+    if (template_path) {
+        loaded = load_template(template_path);
+        if (!loaded) {
+            return 1;
+        }
+        source = loaded;
     }
-    
-    // Copy remaining part after last placeholder
-    strcpy(dest, src);
-    
-    return result;
+
+    if (compile_template(source) != 0) {
+        LOG_ERROR("Failed to allocate memory for template\n");
+        free(loaded);
+        return 1;
+    }
+
+    free(compiled.source);
+    compiled.source = loaded;
+    LOG_DEBUG("Compiled %s template into %zu segments\n",
+           template_path ? template_path : "embedded", compiled.count);
+    return 0;
 }
 
 /**
- * @brief Process a template by replacing placeholders with actual content
+ * @brief Renders the compiled template with the given entries
  *
- * @param template_content The template content with placeholders
- * @param url_path The URL path to display
- * @param entries The HTML for directory entries
- * @param has_parent Whether to include a parent directory link
- * @return A new dynamically allocated string with the processed template
+ * @param entries_offset If not NULL, receives the offset of the (first)
+ *                       entries placeholder in the page
  */
-char* process_template(const char* template_content, const char* url_path, const char* entries, int has_parent) {
-    char* result = strdup(template_content);
-    if (!result) return NULL;
-    
-    // Replace directory path placeholder
-    char* temp = replace_placeholder(result, "{{DIRECTORY_PATH}}", url_path);
-    free(result);
-    result = temp;
-    
-    // Replace directory entries placeholder
-    temp = replace_placeholder(result, "{{DIRECTORY_ENTRIES}}", entries);
-    free(result);
-    result = temp;
-    
-    // Replace parent directory link placeholder
-    const char* parent_link = "";
-    if (has_parent) {
-        parent_link = "<div class=\"parent\"><a href=\"..\"><span class=\"icon\">⬆️</span> Parent Directory</a></div>";
+static char* render_page(const char* url_path, const char* entries, size_t entries_length,
+                         int has_parent, size_t* length, size_t* entries_offset) {
+    if (!compiled.segments && template_init(NULL) != 0) {
+        return NULL;
     }
-    
-    temp = replace_placeholder(result, "{{PARENT_DIRECTORY_LINK}}", parent_link);
-    free(result);
-    result = temp;
-    
+
+    const char* values[TEMPLATE_SLOT_COUNT];
+    size_t value_lengths[TEMPLATE_SLOT_COUNT];
+    values[TEMPLATE_DIRECTORY_PATH] = url_path;
+    value_lengths[TEMPLATE_DIRECTORY_PATH] = strlen(url_path);
+    values[TEMPLATE_DIRECTORY_ENTRIES] = entries;
+    value_lengths[TEMPLATE_DIRECTORY_ENTRIES] = entries_length;
+    values[TEMPLATE_PARENT_DIRECTORY_LINK] = has_parent ? parent_directory_link : "";
+    value_lengths[TEMPLATE_PARENT_DIRECTORY_LINK] = has_parent ? sizeof(parent_directory_link) - 1 : 0;
+
+    // The exact size is known up front, so the page is built in one pass
+    size_t total = compiled.literal_length;
+    for (int slot = 0; slot < TEMPLATE_SLOT_COUNT; slot++) {
+        total += compiled.slot_uses[slot] * value_lengths[slot];
+    }
+
+    char* result = malloc(total + 1);
+    if (!result) {
+        return NULL;
+    }
+
+    char* dest = result;
+    for (size_t i = 0; i < compiled.count; i++) {
+        const template_segment* segment = &compiled.segments[i];
+        if (segment->slot < 0) {
+            memcpy(dest, segment->text, segment->length);
+            dest += segment->length;
+        } else {
+            if (segment->slot == TEMPLATE_DIRECTORY_ENTRIES && entries_offset) {
+                *entries_offset = (size_t)(dest - result);
+                entries_offset = NULL;
+            }
+            memcpy(dest, values[segment->slot], value_lengths[segment->slot]);
+            dest += value_lengths[segment->slot];
+        }
+    }
+    *dest = '\0';
+
+    *length = total;
     return result;
+}
+
+char* render_template(const char* url_path, const char* entries, size_t entries_length,
+                      int has_parent, size_t* length) {
+    return render_page(url_path, entries, entries_length, has_parent, length, NULL);
+}
+
+char* render_template_frame(const char* url_path, int has_parent, size_t* length, size_t* entries_offset) {
+    if (!compiled.segments && template_init(NULL) != 0) {
+        return NULL;
+    }
+    // The rows can only be streamed into a single place
+    if (compiled.slot_uses[TEMPLATE_DIRECTORY_ENTRIES] != 1) {
+        return NULL;
+    }
+    return render_page(url_path, "", 0, has_parent, length, entries_offset);
 } 
\ No newline at end of file
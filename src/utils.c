@@ -58,4 +58,66 @@ const char* get_mime_type(const char* path) {
     } else {
         return "application/octet-stream";
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Checks for a path separator ('/' is accepted on every platform)
+ */
+static int is_separator(char c) {
+    return c == '/' || c == PATH_SEPARATOR;
+}
+
+void normalize_path(char* path) {
+    char* out = path;
+    const char* in = path;
+
+    while (*in) {
+        if (is_separator(*in) && out > path && is_separator(out[-1])) {
+            // Repeated separator
+            in++;
+        } else if (*in == '.' && out > path && is_separator(out[-1]) &&
+                   (in[1] == '\0' || is_separator(in[1]))) {
+            // "." segment after a separator
+            in++;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+}
+
+int utf8_sequence_length(const char* text, size_t length) {
+    const unsigned char* c = (const unsigned char*)text;
+    size_t needed;
+    unsigned char low = 0x80, high = 0xbf;
+    if (length == 0) {
+        return 0;
+    } else if (c[0] < 0x80) {
+        return 1;
+    } else if (c[0] >= 0xc2 && c[0] <= 0xdf) {
+        needed = 2;
+    } else if (c[0] >= 0xe0 && c[0] <= 0xef) {
+        needed = 3;
+        if (c[0] == 0xe0) low = 0xa0;
+        if (c[0] == 0xed) high = 0x9f;
+    } else if (c[0] >= 0xf0 && c[0] <= 0xf4) {
+        needed = 4;
+        if (c[0] == 0xf0) low = 0x90;
+        if (c[0] == 0xf4) high = 0x8f;
+    } else {
+        return 0;
+    }
+    if (length < needed) {
+        return 0;
+    }
+    // Only the second byte has a narrower range
+    if (c[1] < low || c[1] > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < needed; i++) {
+        if (c[i] < 0x80 || c[i] > 0xbf) {
+            return 0;
+        }
+    }
+    return (int)needed;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Build-time tool that embeds a file into the binary as a C array.
+ *
+ * Usage: bin2c <input> <output.c> <symbol>
+ *
+ * Writes a C source file defining
+ *
+ *     const char <symbol>[];          the file's bytes plus a NUL terminator
+ *     const size_t <symbol>_size;     the number of bytes, without the NUL
+ *
+ * The Makefile and build.bat use it to compile src/directory_template.html
+ * into the server.
+ */
+
+int main(int argc, char* argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <input> <output.c> <symbol>\n", argv[0]);
+        return 1;
+    }
+
+    FILE* input = fopen(argv[1], "rb");
+    if (!input) {
+        fprintf(stderr, "bin2c: cannot open '%s'\n", argv[1]);
+        return 1;
+    }
+
+    FILE* output = fopen(argv[2], "w");
+    if (!output) {
+        fprintf(stderr, "bin2c: cannot create '%s'\n", argv[2]);
+        fclose(input);
+        return 1;
+    }
+
+    fprintf(output, "/* Generated by tools/bin2c from %s. Do not edit. */\n\n", argv[1]);
+    fprintf(output, "#include <stddef.h>\n\n");
+    fprintf(output, "const char %s[] = {", argv[3]);
+
+    // A byte array rather than a string literal: compilers limit the length
+    // of string literals (MSVC to 64 KB)
+    unsigned long size = 0;
+    int c;
+    while ((c = fgetc(input)) != EOF) {
+        fprintf(output, "%s0x%02x,", size % 16 == 0 ? "\n    " : " ", (unsigned)c);
+        size++;
+    }
+    fprintf(output, "%s0x00\n};\n\n", size % 16 == 0 ? "\n    " : " ");
+    fprintf(output, "const size_t %s_size = %lu;\n", argv[3], size);
+
+    int failed = ferror(input) || ferror(output);
+    fclose(input);
+    if (fclose(output) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        fprintf(stderr, "bin2c: failed to convert '%s'\n", argv[1]);
+        remove(argv[2]);
+        return 1;
+    }
+    return 0;
+}